@@ -37,10 +37,46 @@
 /** system logging is disabled */
 #define SYSLOG_DISABLED 3
 
+/** Deferred logging options */
+#define SYSLOG_DEFERRED_DISABLED 0 // Log calls format and write immediately
+#define SYSLOG_DEFERRED_ENABLED 1  // Log calls queue records for a log task
+
+/** Tokenized logging options */
+#define SYSLOG_TOKENIZED_DISABLED 0 // Log calls write formatted text
+#define SYSLOG_TOKENIZED_ENABLED 1  // Log calls write binary token records
+
 /** System preemption options */
 #define PREEMPTION_DISABLED 0 // Tasks cannot be preempted
 #define PREEMPTION_ENABLED 1  // Higher priority tasks will preempt
 
+/** Task statistics options */
+#define TASK_STATS_DISABLED 0 // No scheduler instrumentation
+#define TASK_STATS_ENABLED 1  // Scheduler records cycle counts per task
+
+/** Kernel port options */
+#define PORT_CORTEX_M4 0 // Kernel runs on the STM32L433 Cortex-M4 core
+#define PORT_HOST 1      // Kernel runs natively as a host process
+
+/** Kernel trace options */
+#define TRACE_DISABLED 0 // No kernel event trace
+#define TRACE_ENABLED 1  // Kernel events are recorded and sent over SWO
+
+/** System tickless idle options */
+#define TICKLESS_DISABLED 0 // System tick fires every tick period
+#define TICKLESS_ENABLED 1  // Idle task suppresses ticks until next deadline
+
+/** Low power idle options */
+#define LOW_POWER_DISABLED 0 // Idle task only sleeps the core
+#define LOW_POWER_ENABLED 1  // Idle task may enter Stop 1 or Stop 2 mode
+
+/** Stack MPU guard options */
+#define STACK_MPU_GUARD_DISABLED 0 // Overflows detected at context switch
+#define STACK_MPU_GUARD_ENABLED 1  // MPU traps accesses to the stack padding
+
+/** Task reentrancy options */
+#define TASK_REENT_DISABLED 0 // Tasks share the global newlib state
+#define TASK_REENT_ENABLED 1  // Each task has its own newlib state
+
 /** Default system stack protection size. Can be changed */
 #define SYS_STACK_PROTECTION_SIZE_DEFAULT 16 /* 16 bytes, or 4 registers */
 
@@ -60,13 +96,49 @@
 #endif
 
 /**
- * System heap size in bytes. Set to 0 to disable memory allocation
- * Set by passing -DSYSHEAPSIZE=val
+ * System heap size in bytes. Set to 0 to disable memory allocation. The kernel
+ * and drivers do not require the heap, but tasks, semaphores, and mutexes
+ * must then be created with their _static variants.
+ * Set by passing -DSYS_HEAP_SIZE=val
  */
 #ifndef SYS_HEAP_SIZE
 #define SYS_HEAP_SIZE SYS_HEAPSIZE_DEFAULT
 #endif
 
+/**
+ * Kernel object pool sizes. Task control blocks, task stacks, semaphores, and
+ * message buffers are allocated from fixed block pools of these sizes, and
+ * fall back to the heap once a pool is exhausted. Set a count to 0 to disable
+ * that pool. Stack sizes are in bytes, and a stack is served from the smallest
+ * stack pool that can hold it. Message buffer blocks hold a default UART
+ * buffer (UART_DEFAULT_BUFSIZE), and larger requests use the heap.
+ * Set by passing -DSYS_POOL_TASKS=val (or the respective setting name)
+ */
+#ifndef SYS_POOL_TASKS
+#define SYS_POOL_TASKS 8
+#endif
+#ifndef SYS_POOL_SEMAPHORES
+#define SYS_POOL_SEMAPHORES 16
+#endif
+#ifndef SYS_POOL_SMALL_STACKS
+#define SYS_POOL_SMALL_STACKS 2
+#endif
+#ifndef SYS_POOL_SMALL_STACK_SIZE
+#define SYS_POOL_SMALL_STACK_SIZE 1024
+#endif
+#ifndef SYS_POOL_STACKS
+#define SYS_POOL_STACKS 2
+#endif
+#ifndef SYS_POOL_STACK_SIZE
+#define SYS_POOL_STACK_SIZE 2048
+#endif
+#ifndef SYS_POOL_MSGBUFS
+#define SYS_POOL_MSGBUFS 8
+#endif
+#ifndef SYS_POOL_MSGBUF_SIZE
+#define SYS_POOL_MSGBUF_SIZE 128
+#endif
+
 /**
  * System log subsystem. Can use a uart device, or disable system logging.
  * Set by passing -DSYSLOG=val
@@ -86,18 +158,69 @@
 /**
  * System log buffer size. The system will log to the buffer, and periodically
  * flush it to the output. If output flushing is desired, call
- * fsync(STDOUT_FILENO). This is only used for semihosting.
+ * fsync(STDOUT_FILENO). This is only used for semihosting and SWO. The idle
+ * task flushes the buffer, so log output is sent when the system is idle.
+ * Semihosting output is only flushed by the idle task once the buffer is half
+ * full, or after SYSLOG_FLUSH_MS.
  * Set by passing -DSYSLOG_BUFSIZE=val
  */
 #ifndef SYSLOG_BUFSIZE
 #define SYSLOG_BUFSIZE 512
 #endif
 
+/**
+ * Maximum time buffered semihosting output waits before the idle task flushes
+ * it, in milliseconds. Set by passing -DSYSLOG_FLUSH_MS=val
+ */
+#ifndef SYSLOG_FLUSH_MS
+#define SYSLOG_FLUSH_MS 100
+#endif
+
+/**
+ * Deferred logging setting. If enabled, log calls made while the RTOS is
+ * running only store a compact record (level, tag, format string, arguments
+ * and tick count). A low priority log task formats and writes the records
+ * later, so logging does not run printf or block on output in the caller.
+ * Records are dropped if the record buffer is full, and the drop count is
+ * reported by the log task.
+ * Set by passing -DSYSLOG_DEFERRED=val
+ */
+#ifndef SYSLOG_DEFERRED
+#define SYSLOG_DEFERRED SYSLOG_DEFERRED_DISABLED
+#endif
+
+/**
+ * Tokenized logging setting. If enabled, log format strings are kept in the
+ * ELF file but not flashed, and log calls write a compact binary record of the
+ * format string token and its arguments. Decode the output on the host with
+ * "make decode-log LOG=<captured output>".
+ * Set by passing -DSYSLOG_TOKENIZED=val
+ */
+#ifndef SYSLOG_TOKENIZED
+#define SYSLOG_TOKENIZED SYSLOG_TOKENIZED_DISABLED
+#endif
+
+/**
+ * Number of records the deferred log buffer holds. Must be a power of two.
+ * Set by passing -DSYSLOG_DEFERRED_RECORDS=val
+ */
+#ifndef SYSLOG_DEFERRED_RECORDS
+#define SYSLOG_DEFERRED_RECORDS 16
+#endif
+
+/**
+ * Stack size of the deferred log task. The stack must fit printf.
+ * Set by passing -DSYSLOG_DEFERRED_STACKSIZE=val
+ */
+#ifndef SYSLOG_DEFERRED_STACKSIZE
+#define SYSLOG_DEFERRED_STACKSIZE 1024
+#endif
+
 /**
  * System preemption setting. If enabled, higher priority tasks will preempt
  * lower priority ones. In effect the highest priority task that is ready to run
  * will always be running. Note that equal priority tasks will NOT preempt each
- * other.
+ * other, unless time slicing is enabled (see SYS_TIMESLICE_TICKS).
  *
  * Note if preemption is disabled, low priority tasks can easily use the cpu
  * without yielding and cause priority inversion. Without preemption, the
@@ -109,6 +232,135 @@
 #define SYS_USE_PREEMPTION PREEMPTION_ENABLED
 #endif
 
+/**
+ * Default task time slice, in system ticks. If nonzero and preemption is
+ * enabled, a task that runs for this many ticks while another task of equal
+ * priority is ready will be moved to the back of its ready list, so equal
+ * priority tasks share the cpu round robin. No context switch occurs if no
+ * other task of equal priority is ready. Tasks may override this with the
+ * task_timeslice field of their configuration. 0 disables time slicing.
+ * Set by passing -DSYS_TIMESLICE_TICKS=val
+ */
+#ifndef SYS_TIMESLICE_TICKS
+#define SYS_TIMESLICE_TICKS 0
+#endif
+
+/**
+ * Maximum interrupt priority that may call RTOS functions, from 1 (highest) to
+ * 15 (lowest). Kernel critical sections set BASEPRI to this priority, so only
+ * interrupts at this priority or lower are masked by the kernel. Interrupts
+ * with a higher priority (lower value) are never delayed by the RTOS, but MUST
+ * NOT call any RTOS function. Peripheral interrupts start at this priority,
+ * see set_irq_priority. PendSV and SysTick always run at the lowest priority.
+ * Set by passing -DSYS_MAX_SYSCALL_PRIORITY=val
+ */
+#ifndef SYS_MAX_SYSCALL_PRIORITY
+#define SYS_MAX_SYSCALL_PRIORITY 5
+#endif
+
+/**
+ * Task statistics setting. If enabled, the scheduler uses the DWT cycle
+ * counter to record run time, context switch counts, and worst case wake
+ * latency for each task, as well as idle time. Read them with task_get_stats
+ * and task_get_system_stats. Adds a few cycles to each context switch and
+ * system tick.
+ * Set by passing -DSYS_TASK_STATS=val
+ */
+#ifndef SYS_TASK_STATS
+#define SYS_TASK_STATS TASK_STATS_DISABLED
+#endif
+
+/**
+ * Kernel port setting. The host port swaps task contexts with ucontext, and
+ * simulates interrupt masking and the system tick, so the scheduler,
+ * semaphores and utilities can be built and run natively. Only host/host.mk
+ * should set this.
+ * Set by passing -DSYS_PORT=val
+ */
+#ifndef SYS_PORT
+#define SYS_PORT PORT_CORTEX_M4
+#endif
+
+/**
+ * Kernel trace setting. If enabled, task switches, task creation and
+ * destruction, semaphore pends, posts and timeouts, and peripheral interrupt
+ * entry and exit are recorded with DWT cycle count timestamps. The idle task
+ * sends records on SWO stimulus port SWO_PORT_TRACE. Decode captured trace
+ * data with "make decode-trace".
+ * Set by passing -DSYS_TRACE=val
+ */
+#ifndef SYS_TRACE
+#define SYS_TRACE TRACE_DISABLED
+#endif
+
+/**
+ * Number of trace records buffered until the idle task sends them. Must be a
+ * power of two. Events recorded while the buffer is full are dropped, and
+ * reported by a TRACE_DROPPED record. Each record uses 12 bytes.
+ * Set by passing -DSYS_TRACE_RECORDS=val
+ */
+#ifndef SYS_TRACE_RECORDS
+#define SYS_TRACE_RECORDS 256
+#endif
+
+/**
+ * System tickless idle setting. If enabled, the idle task will stop the
+ * periodic system tick when no task is ready to run, and program SysTick to
+ * fire at the next task delay deadline instead. The core then sleeps until the
+ * deadline passes or another interrupt fires, rather than waking every tick.
+ * Set by passing -DSYS_USE_TICKLESS=val
+ */
+#ifndef SYS_USE_TICKLESS
+#define SYS_USE_TICKLESS TICKLESS_DISABLED
+#endif
+
+/**
+ * Low power idle setting. If enabled, the tickless idle task enters Stop 1 or
+ * Stop 2 mode instead of sleeping when the next deadline is far enough away,
+ * using LPTIM1 to wake at the deadline. Drivers that stop working in Stop mode
+ * prevent it while open, see power_limit. Requires SYS_USE_TICKLESS.
+ * Set by passing -DSYS_LOW_POWER=val
+ */
+#ifndef SYS_LOW_POWER
+#define SYS_LOW_POWER LOW_POWER_DISABLED
+#endif
+
+/**
+ * Stack MPU guard setting. If enabled, the scheduler programs an MPU region
+ * over the stack protection padding of the running task on every context
+ * switch. Any access to the padding, including exception stacking, triggers a
+ * memory management fault that reports the overflowing task and halts. The
+ * region is 32 bytes and must be 32 byte aligned, so SYS_STACK_PROTECTION_SIZE
+ * must be at least 64 bytes.
+ * Set by passing -DSYS_STACK_MPU_GUARD=val
+ */
+#ifndef SYS_STACK_MPU_GUARD
+#define SYS_STACK_MPU_GUARD STACK_MPU_GUARD_DISABLED
+#endif
+
+/**
+ * Task reentrancy setting. If enabled, each task control block holds its own
+ * newlib reentrancy structure, which the scheduler switches to on every
+ * context switch. Each task then has its own errno, strtok and rand state, and
+ * its own stdout stream, so output from separate tasks is never mixed within
+ * a line.
+ * Set by passing -DSYS_TASK_REENT=val
+ */
+#ifndef SYS_TASK_REENT
+#define SYS_TASK_REENT TASK_REENT_ENABLED
+#endif
+
+/**
+ * Size of each stdout line buffer, in bytes. stdout is line buffered, so
+ * printf output is only written to the system log once a line is complete,
+ * the buffer fills, or stdout is flushed. With SYS_TASK_REENT enabled, each
+ * task that prints allocates its own buffer from the heap.
+ * Set by passing -DSYS_STDOUT_BUFSIZE=val
+ */
+#ifndef SYS_STDOUT_BUFSIZE
+#define SYS_STDOUT_BUFSIZE 128
+#endif
+
 /**
  * System stack protection size. If nonzero, statically allocated stacks will
  * effectively be this many bytes smaller than their set size. Dynamically
@@ -116,8 +368,11 @@
  *
  * The task scheduler will fill the this many bytes at the end of the task
  * stack with padding, and will kill a task if its stack pointer enters
- * or exceededs the start of this padding, to limit the impact of a stack
- * overflow
+ * or exceededs the start of this padding, or the padding is overwritten, to
+ * limit the impact of a stack overflow. The check runs each time a task is
+ * switched out, and the idle task reports and reaps the task. Blocked and
+ * delayed tasks may be referenced by other tasks waiting on them, so if one of
+ * those overflows the system halts instead.
  * Set by passing -DSYS_STACK_PROTECTION_SIZE=val
  */
 #ifndef SYS_STACK_PROTECTION_SIZE
@@ -1,11 +1,13 @@
 /**
  * @file clock.c
  * Implements system clock support, including setting the system clock
- * source and delaying by a defined number of milliseconds
+ * source, and delays and timestamps counted by the DWT cycle counter
  */
 #include <stdlib.h>
+#include <string.h>
 
 #include <drivers/device/device.h>
+#include <sys/isr/isr.h>
 #include <util/bitmask.h>
 
 #include "clock.h"
@@ -17,6 +19,33 @@
 #define REG_VERIFY_TIMEOUT                                                     \
     500 // How many times to check register before timeout
 
+/** Longest wait delay_us spins for at once, in cycles */
+#define DELAY_MAX_CYCLES 0x80000000UL
+
+/**
+ * System clock settings of a clock profile
+ */
+typedef struct {
+    MSI_Freq_t MSI_freq;       /*!< MSI frequency */
+    bool PLL_en;               /*!< Is the PLL enabled */
+    uint16_t PLLN_mul;         /*!< PLL multiplication factor */
+    PLLR_div_t PLLR_div;       /*!< PLL division factor */
+    sysclock_src_t sysclk_src; /*!< System clock source */
+} clock_profile_cfg_t;
+
+/** Settings of each clock profile, indexed by clock_profile_t */
+static const clock_profile_cfg_t CLOCK_PROFILES[] = {
+    [CLOCK_PROFILE_4MHz] = {.MSI_freq = MSI_freq_4MHz, .PLL_en = false,
+                            .PLLN_mul = 0, .PLLR_div = PLLR_2,
+                            .sysclk_src = CLK_MSI},
+    [CLOCK_PROFILE_16MHz] = {.MSI_freq = MSI_freq_16MHz, .PLL_en = false,
+                             .PLLN_mul = 0, .PLLR_div = PLLR_2,
+                             .sysclk_src = CLK_MSI},
+    [CLOCK_PROFILE_80MHz] = {.MSI_freq = MSI_freq_4MHz, .PLL_en = true,
+                             .PLLN_mul = 40, .PLLR_div = PLLR_2,
+                             .sysclk_src = CLK_PLL},
+};
+
 // Static variables to record current clock frequencies and states
 static sysclock_src_t system_clk_src = CLK_MSI; // Default clock is MSI
 static uint64_t sysclk_freq = MSI_freq_4MHz;    // Default frequency is 4 MHz
@@ -30,12 +59,31 @@ static LSI_Freq_t lsi32_freq = LSI_freq_disabled; // LSI is disabled at boot
 static uint64_t apb_freq = MSI_freq_4MHz;  // src is sysclock divided by 1
 static uint64_t apb1_freq = MSI_freq_4MHz; // src is sysclock divided by 1
 static uint64_t apb2_freq = MSI_freq_4MHz; // src is sysclock divided by 1
+// Last configuration applied by clock_init. Starts at the reset configuration
+static clock_cfg_t current_cfg = {
+    .HSI16_freq = HSI16_freq_disabled, .MSI_freq = MSI_freq_4MHz,
+    .LSI_freq = LSI_freq_disabled, .PLL_en = false, .PLLR_div = PLLR_2,
+    .PLLN_mul = 0, .APB1_scale = APB_scale_div1,
+    .APB2_scale = APB_scale_div1, .sysclk_src = CLK_MSI,
+    .flash_prefetch = false, .flash_icache = true, .flash_dcache = true};
+/**
+ * Timestamp state. Cycles are counted at the current system clock frequency,
+ * and converted to microseconds each time the frequency changes.
+ */
+static uint64_t timestamp_base_us = 0;    // us counted at previous frequencies
+static uint64_t timestamp_cycles = 0;     // cycles counted at this frequency
+static uint32_t timestamp_last_cycle = 0; // cycle count at the last update
+// Registered clock change notifiers
+static clock_notifier_t *clock_notifiers = NULL;
 
 // Local functions
 static syserr_t update_flash_ws(uint64_t new_freq);
 static syserr_t msiclk_init(clock_cfg_t *cfg);
 static syserr_t pllclk_init(clock_cfg_t *cfg);
 static inline syserr_t verify_reg(uint32_t reg, uint32_t msk, uint32_t expect);
+static void timestamp_rebase();
+static void flash_accel_init(clock_cfg_t *cfg);
+static void clock_notify(clock_change_t event);
 
 /**
  * Initializes device clocks. This function should be called at boot
@@ -50,6 +98,8 @@ syserr_t clock_init(clock_cfg_t *cfg) {
     if (cfg == NULL) {
         return ERR_BADPARAM;
     }
+    // Count the cycles run so far at the current frequency
+    timestamp_rebase();
     /* ------- Configure the MSI clock --------- */
     /**
      * If the PLL is the system clock and is sourced from MSI, or MSI is the
@@ -257,14 +307,149 @@ syserr_t clock_init(clock_cfg_t *cfg) {
         break;
     }
     MODIFY_REG(RCC->CFGR, RCC_CFGR_PPRE2, apb_scale);
+    /* ------------ Flash prefetch and ART accelerator caches ----------- */
+    flash_accel_init(cfg);
+    // Record configuration, so it can be restored after Stop mode
+    if (cfg != &current_cfg) {
+        memcpy(&current_cfg, cfg, sizeof(clock_cfg_t));
+    }
     return SYS_OK;
 }
 
+/**
+ * Gets the clock configuration last applied by clock_init. To change one
+ * clock, modify the returned configuration and pass it to clock_init.
+ * @param cfg: filled with the current clock configuration
+ */
+void clock_get_config(clock_cfg_t *cfg) {
+    memcpy(cfg, &current_cfg, sizeof(clock_cfg_t));
+}
+
+/**
+ * Switches the system clock to a profile at runtime, adjusting the flash wait
+ * states to match. Registered notifiers are called with CLOCK_CHANGE_PRE
+ * before the switch, and CLOCK_CHANGE_POST after it, so drivers can recompute
+ * clock derived settings. Notifiers may block, so MUST NOT be called from
+ * interrupt context, or by more than one task at once.
+ * @param profile: clock profile to switch to
+ * @return SYS_OK on success, ERR_BADPARAM for an invalid profile, or
+ * ERR_DEVICE if the clock hardware did not respond
+ */
+syserr_t clock_set_profile(clock_profile_t profile) {
+    const clock_profile_cfg_t *prof;
+    clock_cfg_t cfg;
+    syserr_t ret = SYS_OK;
+    uint32_t state;
+    if (profile > CLOCK_PROFILE_80MHz) {
+        return ERR_BADPARAM;
+    }
+    prof = &CLOCK_PROFILES[profile];
+    if (current_cfg.sysclk_src == prof->sysclk_src &&
+        current_cfg.MSI_freq == prof->MSI_freq &&
+        current_cfg.PLL_en == prof->PLL_en &&
+        (!prof->PLL_en || (current_cfg.PLLN_mul == prof->PLLN_mul &&
+                           current_cfg.PLLR_div == prof->PLLR_div))) {
+        // Already running this profile
+        return SYS_OK;
+    }
+    clock_notify(CLOCK_CHANGE_PRE);
+    // Interrupt handlers may read the clock state while it is inconsistent
+    state = mask_irq_save();
+    if (system_clk_src == CLK_PLL) {
+        /**
+         * The PLL and its MSI source cannot be changed while the PLL is the
+         * system clock, so switch to MSI before applying the profile
+         */
+        memcpy(&cfg, &current_cfg, sizeof(clock_cfg_t));
+        cfg.sysclk_src = CLK_MSI;
+        ret = clock_init(&cfg);
+    }
+    if (ret == SYS_OK) {
+        memcpy(&cfg, &current_cfg, sizeof(clock_cfg_t));
+        cfg.MSI_freq = prof->MSI_freq;
+        cfg.PLL_en = prof->PLL_en;
+        cfg.PLLN_mul = prof->PLLN_mul;
+        cfg.PLLR_div = prof->PLLR_div;
+        cfg.sysclk_src = prof->sysclk_src;
+        ret = clock_init(&cfg);
+    }
+    restore_irq_mask(state);
+    // Notify even on failure, since the clocks may have been changed
+    clock_notify(CLOCK_CHANGE_POST);
+    return ret;
+}
+
+/**
+ * Registers a notifier, called on each clock_set_profile
+ * @param notifier: notifier to register, with callback set
+ * @return SYS_OK on success, ERR_BADPARAM if notifier is invalid, or
+ * ERR_INUSE if the notifier is already registered
+ */
+syserr_t clock_register_notifier(clock_notifier_t *notifier) {
+    clock_notifier_t *pos;
+    uint32_t state;
+    if (notifier == NULL || notifier->callback == NULL) {
+        return ERR_BADPARAM;
+    }
+    state = mask_irq_save();
+    // Linking a notifier twice would make the list circular
+    for (pos = clock_notifiers; pos != NULL; pos = pos->_next) {
+        if (pos == notifier) {
+            restore_irq_mask(state);
+            return ERR_INUSE;
+        }
+    }
+    notifier->_next = clock_notifiers;
+    clock_notifiers = notifier;
+    restore_irq_mask(state);
+    return SYS_OK;
+}
+
+/**
+ * Unregisters a clock change notifier
+ * @param notifier: notifier to unregister
+ * @return SYS_OK on success, or ERR_BADPARAM if notifier is not registered
+ */
+syserr_t clock_unregister_notifier(clock_notifier_t *notifier) {
+    clock_notifier_t **link;
+    uint32_t state = mask_irq_save();
+    for (link = &clock_notifiers; *link != NULL; link = &(*link)->_next) {
+        if (*link == notifier) {
+            *link = notifier->_next;
+            restore_irq_mask(state);
+            return SYS_OK;
+        }
+    }
+    restore_irq_mask(state);
+    return ERR_BADPARAM;
+}
+
+/**
+ * Restores the clock configuration after the core wakes from Stop mode.
+ * Stop mode switches off the PLL and HSI16, and the core wakes running from
+ * MSI at its configured range. The flash wait state is retained, so it is
+ * still valid for the lower MSI frequency. MUST be called with interrupts
+ * masked, before any code that depends on the system clock frequency.
+ * @return SYS_OK on success, or error value otherwise
+ */
+syserr_t clock_resume() {
+    // Cycles before Stop mode ran at the old frequency
+    timestamp_rebase();
+    // Record the clock state the hardware woke with
+    system_clk_src = CLK_MSI;
+    sysclk_freq = msi_freq;
+    apb_freq = msi_freq;
+    pll_freq = PLL_freq_disabled;
+    hsi16_freq = HSI16_freq_disabled;
+    // Restart the PLL and switch back to it, via the same path as at boot
+    return clock_init(&current_cfg);
+}
+
 /**
  * Resets all system clocks to known good values.
  * This function should be called before main.
  * After calling this function, the device will be using the MSI clock at
- * 4MHZ as the system clock
+ * 4MHZ as the system clock, and the DWT cycle counter will be running
  */
 void reset_clocks() {
     // RCC register reset values are taken from p.243 of the reference manual
@@ -275,6 +460,10 @@ void reset_clocks() {
     RCC->CIER = 0x00U;
     // Additionally, reset the flash access control register
     FLASH->ACR = 0x600U;
+    // Start the DWT cycle counter, used for delays and timestamps
+    SETBITS(CoreDebug->DEMCR, CoreDebug_DEMCR_TRCENA_Msk);
+    SETBITS(DWT->CTRL, DWT_CTRL_CYCCNTENA_Msk);
+    timestamp_last_cycle = DWT->CYCCNT;
 }
 
 /*
@@ -321,6 +510,51 @@ uint64_t hsi_freq() { return hsi16_freq; }
  */
 uint64_t hclk_freq() { return apb_freq; }
 
+/**
+ * Resets the flash instruction and data caches. MUST be called after writing
+ * or erasing flash, so stale cache lines are not used. Caches that are
+ * enabled are disabled while they are reset.
+ */
+void flash_cache_reset() {
+    uint32_t state = mask_irq_save();
+    uint32_t caches = READBITS(FLASH->ACR, FLASH_ACR_ICEN | FLASH_ACR_DCEN);
+    // The caches may only be reset while disabled
+    CLEARBITS(FLASH->ACR, caches);
+    SETBITS(FLASH->ACR, FLASH_ACR_ICRST | FLASH_ACR_DCRST);
+    CLEARBITS(FLASH->ACR, FLASH_ACR_ICRST | FLASH_ACR_DCRST);
+    SETBITS(FLASH->ACR, caches);
+    restore_irq_mask(state);
+}
+
+/**
+ * Reads the DWT cycle counter. The counter runs at the system clock frequency
+ * and wraps on overflow, so compare cycle counts by subtraction. It does not
+ * run in Stop mode.
+ * @return current cycle count
+ */
+uint32_t clock_cycles() { return DWT->CYCCNT; }
+
+/**
+ * Delays the system by a given number of microseconds, counted by the DWT
+ * cycle counter. This function simply spins the processor during this delay.
+ * Interrupts that run during the delay are included in it.
+ * If possible, use task_delay() instead of this function
+ * @param delay: length to delay in us
+ */
+void delay_us(uint32_t delay) {
+    uint64_t cycles = (delay * sysclk_freq) / 1000000UL;
+    uint32_t start = DWT->CYCCNT;
+    uint32_t wait;
+    // Spin in steps the 32 bit counter can measure without wrapping
+    while (cycles) {
+        wait = cycles > DELAY_MAX_CYCLES ? DELAY_MAX_CYCLES : cycles;
+        while ((DWT->CYCCNT - start) < wait)
+            ;
+        start += wait;
+        cycles -= wait;
+    }
+}
+
 /**
  * Delays the system by a given number of milliseconds.
  * This function simply spins the processor during this delay
@@ -328,31 +562,93 @@ uint64_t hclk_freq() { return apb_freq; }
  * @param delay: length to delay in ms
  */
 void blocking_delay_ms(uint32_t delay) {
-    /**
-     * Approximate the delay by simply subtractring from a counter.
-     * All instructions here should take 1 clock cycle
-     * one iteration (from the loop label back up to it) takes:
-     * 1 cycle for sub
-     * 1 cycle for mov
-     * innerloop takes 2 * 4096 = 8192 cycles
-     * 1 cycle for cmp
-     * 1 cycle for bne
-     * total of 8196 cycles
-     * divide by 8,196,000, because we want a target in milliseconds
-     */
-    uint32_t target = (sysclk_freq / 8196000UL) * delay;
-    // use assembly here to ensure known number of instructions
-    asm volatile("loop:\n"
-                 "sub %0, #1\n"
-                 "mov r1, #4095\n"
-                 "innerloop:\n"
-                 "subs r1 , #1\n"  // Runs 4096 times
-                 "bne innerloop\n" // Runs 4096 times
-                 "cmp %0, #0\n"
-                 "bge loop\n"
-                 :
-                 : "r"(target)
-                 : "r1");
+    while (delay--) {
+        delay_us(1000);
+    }
+}
+
+/**
+ * Extends the 32 bit cycle counter used by timestamp_us. MUST be called at
+ * least once every 2^32 cycles (53 seconds at 80 MHz). The system tick calls
+ * it while the RTOS runs. Safe to call from interrupt context.
+ */
+void timestamp_update() {
+    uint32_t state = mask_irq_save();
+    uint32_t now = DWT->CYCCNT;
+    timestamp_cycles += now - timestamp_last_cycle;
+    timestamp_last_cycle = now;
+    restore_irq_mask(state);
+}
+
+/**
+ * Gets the time since boot in microseconds, counted by the DWT cycle counter.
+ * Accurate across system clock changes, but does not count time spent in
+ * Stop mode. Use task_get_time_us for a time base that includes Stop mode.
+ * Safe to call from interrupt context, and before the RTOS starts.
+ * @return microseconds elapsed since boot
+ */
+uint64_t timestamp_us() {
+    uint64_t us;
+    uint32_t state = mask_irq_save();
+    timestamp_update();
+    // Split the conversion so the multiplication cannot overflow
+    us = timestamp_base_us + (timestamp_cycles / sysclk_freq) * 1000000UL +
+         ((timestamp_cycles % sysclk_freq) * 1000000UL) / sysclk_freq;
+    restore_irq_mask(state);
+    return us;
+}
+
+/**
+ * Configures flash prefetch and the ART accelerator caches. A cache is reset
+ * before it is enabled, since it may hold lines from before flash was
+ * written.
+ * @param cfg: clock configuration structure
+ */
+static void flash_accel_init(clock_cfg_t *cfg) {
+    uint32_t acr = 0;
+    if (cfg->flash_prefetch) {
+        acr |= FLASH_ACR_PRFTEN;
+    }
+    if (cfg->flash_icache) {
+        acr |= FLASH_ACR_ICEN;
+    }
+    if (cfg->flash_dcache) {
+        acr |= FLASH_ACR_DCEN;
+    }
+    if (READBITS(FLASH->ACR, FLASH_ACR_ICEN) == 0 && cfg->flash_icache) {
+        SETBITS(FLASH->ACR, FLASH_ACR_ICRST);
+        CLEARBITS(FLASH->ACR, FLASH_ACR_ICRST);
+    }
+    if (READBITS(FLASH->ACR, FLASH_ACR_DCEN) == 0 && cfg->flash_dcache) {
+        SETBITS(FLASH->ACR, FLASH_ACR_DCRST);
+        CLEARBITS(FLASH->ACR, FLASH_ACR_DCRST);
+    }
+    MODIFY_REG(FLASH->ACR, FLASH_ACR_PRFTEN | FLASH_ACR_ICEN | FLASH_ACR_DCEN,
+               acr);
+}
+
+/**
+ * Calls each registered clock change notifier. Notifiers MUST NOT register
+ * or unregister notifiers from their callback.
+ * @param event: clock change event
+ */
+static void clock_notify(clock_change_t event) {
+    clock_notifier_t *notifier;
+    for (notifier = clock_notifiers; notifier != NULL;
+         notifier = notifier->_next) {
+        notifier->callback(event, notifier->arg);
+    }
+}
+
+/**
+ * Converts the cycles counted at the current system clock frequency to
+ * microseconds. Called before the system clock frequency changes.
+ */
+static void timestamp_rebase() {
+    uint32_t state = mask_irq_save();
+    timestamp_base_us = timestamp_us();
+    timestamp_cycles = 0;
+    restore_irq_mask(state);
 }
 
 /**
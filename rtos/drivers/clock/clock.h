@@ -86,20 +86,54 @@ typedef struct clock_cfg {
     APB_scale_t APB1_scale;    /*!< APB1 prescaler (divides system clock) */
     APB_scale_t APB2_scale;    /*!< APB2 prescaler (divides system clock) */
     sysclock_src_t sysclk_src; /*!< System clock source */
+    bool flash_prefetch;       /*!< Enable the flash prefetch buffer */
+    bool flash_icache;         /*!< Enable the flash instruction cache */
+    bool flash_dcache;         /*!< Enable the flash data cache */
 } clock_cfg_t;
 
 /**
  * Default clock config. No division on APB clocks,
- * PLL is system clock at 80 MHz
+ * PLL is system clock at 80 MHz. Flash prefetch and caches are enabled, to
+ * hide the flash wait states needed at 80 MHz.
  */
 #define CLOCK_DEFAULT_CONFIG                                                   \
     {                                                                          \
         .HSI16_freq = HSI16_freq_disabled, .MSI_freq = MSI_freq_4MHz,          \
         .LSI_freq = LSI_freq_disabled, .PLL_en = true, .PLLR_div = PLLR_2,     \
         .PLLN_mul = 40, .APB1_scale = APB_scale_div1,                          \
-        .APB2_scale = APB_scale_div1, .sysclk_src = CLK_PLL                    \
+        .APB2_scale = APB_scale_div1, .sysclk_src = CLK_PLL,                   \
+        .flash_prefetch = true, .flash_icache = true, .flash_dcache = true     \
     }
 
+/**
+ * System clock profiles, selected at runtime with clock_set_profile. Other
+ * clock settings, such as the APB prescalers and HSI16, are kept.
+ */
+typedef enum {
+    CLOCK_PROFILE_4MHz,  /*!< MSI at 4 MHz. PLL is off */
+    CLOCK_PROFILE_16MHz, /*!< MSI at 16 MHz. PLL is off */
+    CLOCK_PROFILE_80MHz, /*!< PLL at 80 MHz, sourced from MSI at 4 MHz */
+} clock_profile_t;
+
+/**
+ * Clock change events, passed to clock change notifiers
+ */
+typedef enum {
+    CLOCK_CHANGE_PRE,  /*!< System clock is about to change */
+    CLOCK_CHANGE_POST, /*!< System clock changed. Clock getters are updated */
+} clock_change_t;
+
+/**
+ * Clock change notifier. Storage is provided by the caller, and must remain
+ * valid while the notifier is registered.
+ */
+typedef struct clock_notifier {
+    /*! Called before and after each profile change, with interrupts enabled */
+    void (*callback)(clock_change_t event, void *arg);
+    void *arg;                    /*!< Argument passed to callback */
+    struct clock_notifier *_next; /*!< Next notifier. Do NOT modify */
+} clock_notifier_t;
+
 /**
  * Initializes device clocks. This function should be called at boot
  * @return SYS_OK on successful configuration, or ERR_BADPARAM if a clock
@@ -107,6 +141,49 @@ typedef struct clock_cfg {
  */
 syserr_t clock_init(clock_cfg_t *cfg);
 
+/**
+ * Gets the clock configuration last applied by clock_init. To change one
+ * clock, modify the returned configuration and pass it to clock_init.
+ * @param cfg: filled with the current clock configuration
+ */
+void clock_get_config(clock_cfg_t *cfg);
+
+/**
+ * Switches the system clock to a profile at runtime, adjusting the flash wait
+ * states to match. Registered notifiers are called with CLOCK_CHANGE_PRE
+ * before the switch, and CLOCK_CHANGE_POST after it, so drivers can recompute
+ * clock derived settings. Notifiers may block, so MUST NOT be called from
+ * interrupt context, or by more than one task at once.
+ * @param profile: clock profile to switch to
+ * @return SYS_OK on success, ERR_BADPARAM for an invalid profile, or
+ * ERR_DEVICE if the clock hardware did not respond
+ */
+syserr_t clock_set_profile(clock_profile_t profile);
+
+/**
+ * Registers a notifier, called on each clock_set_profile
+ * @param notifier: notifier to register, with callback set
+ * @return SYS_OK on success, ERR_BADPARAM if notifier is invalid, or
+ * ERR_INUSE if the notifier is already registered
+ */
+syserr_t clock_register_notifier(clock_notifier_t *notifier);
+
+/**
+ * Unregisters a clock change notifier
+ * @param notifier: notifier to unregister
+ * @return SYS_OK on success, or ERR_BADPARAM if notifier is not registered
+ */
+syserr_t clock_unregister_notifier(clock_notifier_t *notifier);
+
+/**
+ * Restores the clock configuration after the core wakes from Stop mode.
+ * Stop mode switches off the PLL and HSI16, and the core wakes running from
+ * MSI at its configured range. MUST be called with interrupts masked, before
+ * any code that depends on the system clock frequency.
+ * @return SYS_OK on success, or error value otherwise
+ */
+syserr_t clock_resume();
+
 /**
  * Returns the system clock, in Hz
  */
@@ -151,6 +228,30 @@ uint64_t lsi_freq();
  */
 uint64_t hsi_freq();
 
+/**
+ * Resets the flash instruction and data caches. MUST be called after writing
+ * or erasing flash, so stale cache lines are not used. Caches that are
+ * enabled are disabled while they are reset.
+ */
+void flash_cache_reset();
+
+/**
+ * Reads the DWT cycle counter. The counter runs at the system clock frequency
+ * and wraps on overflow, so compare cycle counts by subtraction. It does not
+ * run in Stop mode.
+ * @return current cycle count
+ */
+uint32_t clock_cycles();
+
+/**
+ * Delays the system by a given number of microseconds, counted by the DWT
+ * cycle counter. This function simply spins the processor during this delay.
+ * Interrupts that run during the delay are included in it.
+ * If possible, use task_delay() instead of this function
+ * @param delay: length to delay in us
+ */
+void delay_us(uint32_t delay);
+
 /**
  * Delays the system by a given number of milliseconds.
  * This function simply spins the processor during this delay
@@ -159,11 +260,27 @@ uint64_t hsi_freq();
  */
 void blocking_delay_ms(uint32_t delay);
 
+/**
+ * Extends the 32 bit cycle counter used by timestamp_us. MUST be called at
+ * least once every 2^32 cycles (53 seconds at 80 MHz). The system tick calls
+ * it while the RTOS runs. Safe to call from interrupt context.
+ */
+void timestamp_update();
+
+/**
+ * Gets the time since boot in microseconds, counted by the DWT cycle counter.
+ * Accurate across system clock changes, but does not count time spent in
+ * Stop mode. Use task_get_time_us for a time base that includes Stop mode.
+ * Safe to call from interrupt context, and before the RTOS starts.
+ * @return microseconds elapsed since boot
+ */
+uint64_t timestamp_us();
+
 /**
  * Resets all system clocks to known good values.
  * This function should be called before main.
  * After calling this function, the device will be using the MSI clock at
- * 4MHZ as the system clock
+ * 4MHZ as the system clock, and the DWT cycle counter will be running
  */
 void reset_clocks();
 
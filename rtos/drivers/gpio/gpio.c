@@ -1,15 +1,39 @@
 #include <stdint.h>
+#include <stdlib.h>
 
 #include "gpio.h"
 #include <drivers/device/device.h>
 #include <sys/isr/isr.h>
+#include <sys/sections.h>
 #include <util/bitmask.h>
 
-/** GPIO interrupt handler array */
-static void (*gpio_interrupt_handlers[16])(void) = {0};
+/** EXTI lines sharing the EXTI9_5 and EXTI15_10 vectors */
+#define EXTI9_5_LINES 0x03E0U
+#define EXTI15_10_LINES 0xFC00U
+
+/** Interrupt binding of one EXTI line */
+typedef struct GPIO_line {
+    GPIO_callback_t callback; /*!< Callback to run, or NULL */
+    void *arg;                /*!< Callback argument */
+    task_handle_t task;       /*!< Task to notify instead, or NULL */
+    uint32_t bits;            /*!< Notification bits to set on task */
+    work_t *work;             /*!< Work item to submit instead, or NULL */
+} GPIO_line_t;
+
+/** GPIO interrupt bindings, indexed by EXTI line (pin number) */
+static GPIO_line_t gpio_lines[16] = {0};
 
 // Static functions
-static void GPIO_isr(void);
+static syserr_t GPIO_exti_enable(GPIO_pin_t pin, GPIO_trigger_t trigger);
+static inline void GPIO_dispatch(uint32_t line);
+static inline void GPIO_lines_isr(uint32_t lines);
+static void GPIO_exti0_isr(void);
+static void GPIO_exti1_isr(void);
+static void GPIO_exti2_isr(void);
+static void GPIO_exti3_isr(void);
+static void GPIO_exti4_isr(void);
+static void GPIO_exti9_5_isr(void);
+static void GPIO_exti15_10_isr(void);
 
 /**
  * Configure a GPIO port for use with driver
@@ -195,98 +219,88 @@ syserr_t GPIO_config(GPIO_pin_t pin, GPIO_config_t *config) {
 }
 
 /**
- * Write a voltage level (high or low) to a GPIO pin
- * @param pin: pin to set
- * @param lvl: GPIO level to set
+ * Enable interrupts on a GPIO pin
+ * @param pin: pin to enable interrupts on
+ * @param trigger: either GPIO_trig_rising, GPIO_trig_falling, or GPIO_trig_both
+ * @param callback: callback to run. This function will be called from an
+ * interrupt context.
+ * @param arg: argument passed to callback. May be NULL
+ * @return SYS_OK on success, ERR_BADPARAM if callback is NULL, or ERR_INUSE
+ * if another GPIO pin is using the interrupt line (GPIO pins are multipled
+ * accross 16 lines)
  */
-syserr_t GPIO_write(GPIO_pin_t pin, GPIO_level_t lvl) {
-    // Begin by converting port into base register
-    GPIO_TypeDef *periph;
-    uint32_t port = pin & PORTMASK;
-    pin &= PINMASK; // Mask out port definition from pin
-    uint32_t shift = pin;
-    switch (port) {
-    case PORT_A:
-        periph = GPIOA;
-        break;
-    case PORT_B:
-        periph = GPIOB;
-        break;
-    case PORT_C:
-        periph = GPIOC;
-        break;
-    case PORT_D:
-        periph = GPIOD;
-        break;
-    case PORT_E:
-        periph = GPIOE;
-        break;
-    case PORT_H:
-        periph = GPIOH;
-        break;
-    default:
+syserr_t GPIO_interrupt_enable(GPIO_pin_t pin, GPIO_trigger_t trigger,
+                               GPIO_callback_t callback, void *arg) {
+    GPIO_line_t *line = &gpio_lines[pin & PINMASK];
+    if (callback == NULL) {
         return ERR_BADPARAM;
     }
-    if (lvl == GPIO_HIGH) {
-        SETFIELD(periph->ODR, 1UL, shift);
-    } else if (lvl == GPIO_LOW) {
-        CLEARFIELD(periph->ODR, 1UL, shift);
-    } else {
+    if (line->callback != NULL || line->task != NULL || line->work != NULL) {
+        return ERR_INUSE;
+    }
+    // Bind the line before its interrupt is unmasked
+    line->callback = callback;
+    line->arg = arg;
+    return GPIO_exti_enable(pin, trigger);
+}
+
+/**
+ * Enable interrupts on a GPIO pin, and notify a task when they fire. The
+ * interrupt only sets notification bits, so the task handles the edge
+ * instead of user code running in the interrupt.
+ * @param pin: pin to enable interrupts on
+ * @param trigger: either GPIO_trig_rising, GPIO_trig_falling, or GPIO_trig_both
+ * @param task: task to notify
+ * @param bits: notification bits to set, see task_notify
+ * @return SYS_OK on success, ERR_BADPARAM if task is NULL, or ERR_INUSE if
+ * another GPIO pin is using the interrupt line
+ */
+syserr_t GPIO_interrupt_notify(GPIO_pin_t pin, GPIO_trigger_t trigger,
+                               task_handle_t task, uint32_t bits) {
+    GPIO_line_t *line = &gpio_lines[pin & PINMASK];
+    if (task == NULL) {
         return ERR_BADPARAM;
     }
-    return SYS_OK;
+    if (line->callback != NULL || line->task != NULL || line->work != NULL) {
+        return ERR_INUSE;
+    }
+    line->task = task;
+    line->bits = bits;
+    return GPIO_exti_enable(pin, trigger);
 }
 
 /**
- * Read the digital voltage level from a pin
- * @param pin : pin to set
- * @ return GPIO pin level
+ * Enable interrupts on a GPIO pin, and submit a work item when they fire. The
+ * interrupt only queues the work item, so its function runs in a work queue
+ * task instead of the interrupt. Edges that fire while the item is still
+ * queued run it only once.
+ * @param pin: pin to enable interrupts on
+ * @param trigger: either GPIO_trig_rising, GPIO_trig_falling, or GPIO_trig_both
+ * @param work: work item to submit, initialized with work_init. Must remain
+ * valid while the interrupt is enabled
+ * @return SYS_OK on success, ERR_BADPARAM if work is NULL, or ERR_INUSE if
+ * another GPIO pin is using the interrupt line
  */
-GPIO_level_t GPIO_read(GPIO_pin_t pin) {
-    // Begin by converting port into base register
-    uint32_t port = pin & PORTMASK;
-    pin &= PINMASK; // Mask out port from pin
-    GPIO_TypeDef *periph;
-    switch (port) {
-    case PORT_A:
-        periph = GPIOA;
-        break;
-    case PORT_B:
-        periph = GPIOB;
-        break;
-    case PORT_C:
-        periph = GPIOC;
-        break;
-    case PORT_D:
-        periph = GPIOD;
-        break;
-    case PORT_E:
-        periph = GPIOE;
-        break;
-    case PORT_H:
-        periph = GPIOH;
-        break;
-    default:
-        return 0;
+syserr_t GPIO_interrupt_defer(GPIO_pin_t pin, GPIO_trigger_t trigger,
+                              work_t *work) {
+    GPIO_line_t *line = &gpio_lines[pin & PINMASK];
+    if (work == NULL) {
+        return ERR_BADPARAM;
     }
-    if (READFIELD(periph->IDR, 1UL, pin)) {
-        return GPIO_HIGH;
-    } else {
-        return GPIO_LOW;
+    if (line->callback != NULL || line->task != NULL || line->work != NULL) {
+        return ERR_INUSE;
     }
+    line->work = work;
+    return GPIO_exti_enable(pin, trigger);
 }
 
 /**
- * Enable interrupts on a GPIO pin
+ * Routes a GPIO pin to its EXTI line, and enables the line's interrupt
  * @param pin: pin to enable interrupts on
  * @param trigger: either GPIO_trig_rising, GPIO_trig_falling, or GPIO_trig_both
- * @param callback: callback to run. This function will be called from an
- * interrupt context.
- * @return SYS_OK on success, or ERR_INUSE if another GPIO pin is using the
- * interrupt line (GPIO pins are multipled accross 16 lines)
+ * @return SYS_OK on success
  */
-syserr_t GPIO_interrupt_enable(GPIO_pin_t pin, GPIO_trigger_t trigger,
-                               void (*callback)(void)) {
+static syserr_t GPIO_exti_enable(GPIO_pin_t pin, GPIO_trigger_t trigger) {
     /**
      * The pin number is all that really matters for the EXTI controller,
      * as gpio pins are multiplexed by pin number (PA1, PB1, PC1, PD1, and PE1
@@ -296,10 +310,12 @@ syserr_t GPIO_interrupt_enable(GPIO_pin_t pin, GPIO_trigger_t trigger,
     uint32_t pin_value = pin & PINMASK;
     uint32_t interrupt_vect;
     uint32_t mask, regidx, value;
+    void (*handler)(void);
     switch (pin_value) {
     case PIN_0:
         mask = SYSCFG_EXTICR1_EXTI0_Msk;
         interrupt_vect = EXTI0_IRQn;
+        handler = GPIO_exti0_isr;
         regidx = 0;
         switch (port) {
         case PORT_A:
@@ -325,6 +341,7 @@ syserr_t GPIO_interrupt_enable(GPIO_pin_t pin, GPIO_trigger_t trigger,
     case PIN_1:
         mask = SYSCFG_EXTICR1_EXTI1_Msk;
         interrupt_vect = EXTI1_IRQn;
+        handler = GPIO_exti1_isr;
         regidx = 0;
         switch (port) {
         case PORT_A:
@@ -350,6 +367,7 @@ syserr_t GPIO_interrupt_enable(GPIO_pin_t pin, GPIO_trigger_t trigger,
     case PIN_2:
         mask = SYSCFG_EXTICR1_EXTI2_Msk;
         interrupt_vect = EXTI2_IRQn;
+        handler = GPIO_exti2_isr;
         regidx = 0;
         switch (port) {
         case PORT_A:
@@ -372,6 +390,7 @@ syserr_t GPIO_interrupt_enable(GPIO_pin_t pin, GPIO_trigger_t trigger,
     case PIN_3:
         mask = SYSCFG_EXTICR1_EXTI3_Msk;
         interrupt_vect = EXTI3_IRQn;
+        handler = GPIO_exti3_isr;
         regidx = 0;
         switch (port) {
         case PORT_A:
@@ -394,6 +413,7 @@ syserr_t GPIO_interrupt_enable(GPIO_pin_t pin, GPIO_trigger_t trigger,
     case PIN_4:
         mask = SYSCFG_EXTICR2_EXTI4_Msk;
         interrupt_vect = EXTI4_IRQn;
+        handler = GPIO_exti4_isr;
         regidx = 1;
         switch (port) {
         case PORT_A:
@@ -416,6 +436,7 @@ syserr_t GPIO_interrupt_enable(GPIO_pin_t pin, GPIO_trigger_t trigger,
     case PIN_5:
         mask = SYSCFG_EXTICR2_EXTI5_Msk;
         interrupt_vect = EXTI9_5_IRQn;
+        handler = GPIO_exti9_5_isr;
         regidx = 1;
         switch (port) {
         case PORT_A:
@@ -438,6 +459,7 @@ syserr_t GPIO_interrupt_enable(GPIO_pin_t pin, GPIO_trigger_t trigger,
     case PIN_6:
         mask = SYSCFG_EXTICR2_EXTI6_Msk;
         interrupt_vect = EXTI9_5_IRQn;
+        handler = GPIO_exti9_5_isr;
         regidx = 1;
         switch (port) {
         case PORT_A:
@@ -460,6 +482,7 @@ syserr_t GPIO_interrupt_enable(GPIO_pin_t pin, GPIO_trigger_t trigger,
     case PIN_7:
         mask = SYSCFG_EXTICR2_EXTI7_Msk;
         interrupt_vect = EXTI9_5_IRQn;
+        handler = GPIO_exti9_5_isr;
         regidx = 1;
         switch (port) {
         case PORT_A:
@@ -482,6 +505,7 @@ syserr_t GPIO_interrupt_enable(GPIO_pin_t pin, GPIO_trigger_t trigger,
     case PIN_8:
         mask = SYSCFG_EXTICR3_EXTI8_Msk;
         interrupt_vect = EXTI9_5_IRQn;
+        handler = GPIO_exti9_5_isr;
         regidx = 2;
         switch (port) {
         case PORT_A:
@@ -504,6 +528,7 @@ syserr_t GPIO_interrupt_enable(GPIO_pin_t pin, GPIO_trigger_t trigger,
     case PIN_9:
         mask = SYSCFG_EXTICR3_EXTI9_Msk;
         interrupt_vect = EXTI9_5_IRQn;
+        handler = GPIO_exti9_5_isr;
         regidx = 2;
         switch (port) {
         case PORT_A:
@@ -526,6 +551,7 @@ syserr_t GPIO_interrupt_enable(GPIO_pin_t pin, GPIO_trigger_t trigger,
     case PIN_10:
         mask = SYSCFG_EXTICR3_EXTI10_Msk;
         interrupt_vect = EXTI15_10_IRQn;
+        handler = GPIO_exti15_10_isr;
         regidx = 2;
         switch (port) {
         case PORT_A:
@@ -548,6 +574,7 @@ syserr_t GPIO_interrupt_enable(GPIO_pin_t pin, GPIO_trigger_t trigger,
     case PIN_11:
         mask = SYSCFG_EXTICR3_EXTI11_Msk;
         interrupt_vect = EXTI15_10_IRQn;
+        handler = GPIO_exti15_10_isr;
         regidx = 2;
         switch (port) {
         case PORT_A:
@@ -570,6 +597,7 @@ syserr_t GPIO_interrupt_enable(GPIO_pin_t pin, GPIO_trigger_t trigger,
     case PIN_12:
         mask = SYSCFG_EXTICR4_EXTI12_Msk;
         interrupt_vect = EXTI15_10_IRQn;
+        handler = GPIO_exti15_10_isr;
         regidx = 3;
         switch (port) {
         case PORT_A:
@@ -592,6 +620,7 @@ syserr_t GPIO_interrupt_enable(GPIO_pin_t pin, GPIO_trigger_t trigger,
     case PIN_13:
         mask = SYSCFG_EXTICR4_EXTI13_Msk;
         interrupt_vect = EXTI15_10_IRQn;
+        handler = GPIO_exti15_10_isr;
         regidx = 3;
         switch (port) {
         case PORT_A:
@@ -614,6 +643,7 @@ syserr_t GPIO_interrupt_enable(GPIO_pin_t pin, GPIO_trigger_t trigger,
     case PIN_14:
         mask = SYSCFG_EXTICR4_EXTI14_Msk;
         interrupt_vect = EXTI15_10_IRQn;
+        handler = GPIO_exti15_10_isr;
         regidx = 3;
         switch (port) {
         case PORT_A:
@@ -636,6 +666,7 @@ syserr_t GPIO_interrupt_enable(GPIO_pin_t pin, GPIO_trigger_t trigger,
     case PIN_15:
         mask = SYSCFG_EXTICR4_EXTI15_Msk;
         interrupt_vect = EXTI15_10_IRQn;
+        handler = GPIO_exti15_10_isr;
         regidx = 3;
         switch (port) {
         case PORT_A:
@@ -656,48 +687,96 @@ syserr_t GPIO_interrupt_enable(GPIO_pin_t pin, GPIO_trigger_t trigger,
         }
         break;
     }
-    if (READBITS(SYSCFG->EXTICR[regidx], mask) != 0) {
-        // EXTI in use
-        return ERR_INUSE;
-    } else {
-        // Enable SYSCFG clock
-        SETBITS(RCC->APB2ENR, RCC_APB2ENR_SYSCFGEN);
-        // Enable EXTI
-        MODIFY_REG(SYSCFG->EXTICR[regidx], mask, value);
-        // Power down SYSCFG
-        CLEARBITS(RCC->APB2ENR, RCC_APB2ENR_SYSCFGEN);
-        // EXTI line number is same as pin. Unmask line interrupt.
-        SETBITS(EXTI->IMR1, (0x1 << pin_value));
-        if (trigger == GPIO_trig_both) {
-            // Enable both rising and falling registers
-            SETBITS(EXTI->RTSR1, (0x1 << pin_value));
-            SETBITS(EXTI->FTSR1, (0x1 << pin_value));
-        } else if (trigger == GPIO_trig_falling) {
-            SETBITS(EXTI->FTSR1, (0x1 << pin_value));
-        } else if (trigger == GPIO_trig_rising) {
-            SETBITS(EXTI->RTSR1, (0x1 << pin_value));
-        }
-        // Save pointer to callback
-        gpio_interrupt_handlers[pin_value] = callback;
-        // Enable interrupt
-        enable_irq(interrupt_vect, GPIO_isr);
+    // Enable SYSCFG clock
+    SETBITS(RCC->APB2ENR, RCC_APB2ENR_SYSCFGEN);
+    // Route the port to the EXTI line
+    MODIFY_REG(SYSCFG->EXTICR[regidx], mask, value);
+    // Power down SYSCFG
+    CLEARBITS(RCC->APB2ENR, RCC_APB2ENR_SYSCFGEN);
+    // EXTI line number is same as pin. Unmask line interrupt.
+    SETBITS(EXTI->IMR1, (0x1 << pin_value));
+    if (trigger == GPIO_trig_both) {
+        // Enable both rising and falling registers
+        SETBITS(EXTI->RTSR1, (0x1 << pin_value));
+        SETBITS(EXTI->FTSR1, (0x1 << pin_value));
+    } else if (trigger == GPIO_trig_falling) {
+        SETBITS(EXTI->FTSR1, (0x1 << pin_value));
+    } else if (trigger == GPIO_trig_rising) {
+        SETBITS(EXTI->RTSR1, (0x1 << pin_value));
     }
+    // Enable interrupt
+    enable_irq(interrupt_vect, handler, NULL);
     return SYS_OK;
 }
 
 /**
- * GPIO ISR. Handles EXTI interrupts for lines 0-15
+ * Runs the interrupt binding of an EXTI line
+ * @param line: EXTI line that fired
  */
-static void GPIO_isr(void) {
-    // Check the EXTI pending register to dermine which line(s) have interrupts
-    uint32_t pending = READBITS(EXTI->PR1, 0xFFFF); // Only need lower 16 bits
-    int i;
-    for (i = 0; i < 16; i++) {
-        if (pending & (0x1 << i)) {
-            // Call interrupt handler
-            gpio_interrupt_handlers[i]();
-        }
+static inline void GPIO_dispatch(uint32_t line) {
+    GPIO_line_t *binding = &gpio_lines[line];
+    if (binding->task != NULL) {
+        task_notify(binding->task, binding->bits);
+    } else if (binding->work != NULL) {
+        work_submit(binding->work);
+    } else if (binding->callback != NULL) {
+        binding->callback(binding->arg);
     }
-    // A write of 1 to an EXTI_PR bit clears it. Just write the 'pending' mask
-    SETBITS(EXTI->PR1, pending);
-}
\ No newline at end of file
+}
+
+/**
+ * Handles the pending lines of a shared EXTI vector. Pending bits are
+ * cleared before dispatch, so an edge during a callback is not lost. Only
+ * lines that are pending are visited.
+ * @param lines: EXTI lines sharing the vector
+ */
+static inline void GPIO_lines_isr(uint32_t lines) {
+    uint32_t pending = READBITS(EXTI->PR1, lines);
+    // A write of 1 to an EXTI_PR bit clears it, and 0 bits have no effect
+    EXTI->PR1 = pending;
+    while (pending) {
+        GPIO_dispatch(__builtin_ctz(pending));
+        pending &= pending - 1; // Clear the lowest set bit
+    }
+}
+
+/**
+ * EXTI line 0-4 ISRs. Each line has its own vector, so no pending bits are
+ * scanned. These run from SRAM, to reduce edge to handler latency.
+ */
+static __ramfunc void GPIO_exti0_isr(void) {
+    EXTI->PR1 = EXTI_PR1_PIF0;
+    GPIO_dispatch(0);
+}
+
+static __ramfunc void GPIO_exti1_isr(void) {
+    EXTI->PR1 = EXTI_PR1_PIF1;
+    GPIO_dispatch(1);
+}
+
+static __ramfunc void GPIO_exti2_isr(void) {
+    EXTI->PR1 = EXTI_PR1_PIF2;
+    GPIO_dispatch(2);
+}
+
+static __ramfunc void GPIO_exti3_isr(void) {
+    EXTI->PR1 = EXTI_PR1_PIF3;
+    GPIO_dispatch(3);
+}
+
+static __ramfunc void GPIO_exti4_isr(void) {
+    EXTI->PR1 = EXTI_PR1_PIF4;
+    GPIO_dispatch(4);
+}
+
+/**
+ * EXTI lines 5-9 ISR
+ */
+static __ramfunc void GPIO_exti9_5_isr(void) { GPIO_lines_isr(EXTI9_5_LINES); }
+
+/**
+ * EXTI lines 10-15 ISR
+ */
+static __ramfunc void GPIO_exti15_10_isr(void) {
+    GPIO_lines_isr(EXTI15_10_LINES);
+}
@@ -6,7 +6,13 @@
  * Driver for STM32L4xxxx GPIO
  */
 
+#include <stdint.h>
+
+#include <drivers/device/device.h>
 #include <sys/err.h>
+#include <sys/task/task.h>
+#include <sys/workqueue/workqueue.h>
+#include <util/bitmask.h>
 
 /**
  * GPIO pin number and port defs. Masked together to form pin definitions
@@ -22,6 +28,9 @@
 
 #define PINMASK 0xFU
 
+/** Register blocks of consecutive GPIO ports are this far apart */
+#define GPIO_PORT_STRIDE 0x400U
+
 #define PIN_0 0U
 #define PIN_1 1U
 #define PIN_2 2U
@@ -172,6 +181,12 @@ typedef enum GPIO_level {
     GPIO_HIGH = 1,
 } GPIO_level_t;
 
+/**
+ * GPIO interrupt callback. Called from interrupt context
+ * @param arg: argument passed to GPIO_interrupt_enable
+ */
+typedef void (*GPIO_callback_t)(void *arg);
+
 typedef struct {
     GPIO_mode_t mode;
     GPIO_otype_t output_type;
@@ -203,18 +218,97 @@ typedef struct {
 syserr_t GPIO_config(GPIO_pin_t pin, GPIO_config_t *config);
 
 /**
- * Write a voltage level (high or low) to a GPIO pin
+ * Gets the registers of a GPIO port. Ports are spaced evenly from GPIOA, so
+ * this folds to a constant when the port is known at compile time.
+ * @param port: GPIO port (PORT_A-PORT_H)
+ * @return port register block
+ */
+static inline GPIO_TypeDef *GPIO_port_regs(uint32_t port) {
+    uint32_t idx = (port >> PORTSHIFT) - 1;
+    if (port == PORT_H) {
+        // Port H follows the unimplemented ports F and G
+        idx = (GPIOH_BASE - GPIOA_BASE) / GPIO_PORT_STRIDE;
+    }
+    return (GPIO_TypeDef *)(GPIOA_BASE + idx * GPIO_PORT_STRIDE);
+}
+
+/**
+ * Write a voltage level (high or low) to a GPIO pin. The pin is set or
+ * cleared with one write to BSRR or BRR, so this is atomic against ISRs
+ * writing other pins on the port. When the pin and level are compile time
+ * constants, this compiles to a single store.
  * @param pin: pin to set
  * @param lvl: GPIO level to set
+ * @return SYS_OK on success, or ERR_BADPARAM for an invalid pin or level
+ */
+static inline syserr_t GPIO_write(GPIO_pin_t pin, GPIO_level_t lvl) {
+    uint32_t port = pin & PORTMASK;
+    if (port < PORT_A || port > PORT_H) {
+        return ERR_BADPARAM;
+    }
+    if (lvl == GPIO_HIGH) {
+        GPIO_port_regs(port)->BSRR = 1UL << (pin & PINMASK);
+    } else if (lvl == GPIO_LOW) {
+        GPIO_port_regs(port)->BRR = 1UL << (pin & PINMASK);
+    } else {
+        return ERR_BADPARAM;
+    }
+    return SYS_OK;
+}
+
+/**
+ * Writes several pins of one GPIO port at once. Pins in "mask" are set to
+ * their bit in "value", with a single write to BSRR, so all pins change
+ * together and other pins on the port are unaffected.
+ * @param port: GPIO port (PORT_A-PORT_H)
+ * @param mask: pins to write, bit n selects pin n
+ * @param value: levels to write, bit n is the level of pin n
+ */
+static inline void GPIO_write_port_mask(uint32_t port, uint16_t mask,
+                                        uint16_t value) {
+    // Set bits are in the low half of BSRR, reset bits in the high half
+    GPIO_port_regs(port)->BSRR =
+        ((uint32_t)(~value & mask) << 16) | (value & mask);
+}
+
+/**
+ * Toggles the output level of a GPIO pin. The new level is written with one
+ * write to BSRR, so other pins on the port are unaffected.
+ * @param pin: pin to toggle
  */
-syserr_t GPIO_write(GPIO_pin_t pin, GPIO_level_t lvl);
+static inline void GPIO_toggle(GPIO_pin_t pin) {
+    GPIO_TypeDef *periph = GPIO_port_regs(pin & PORTMASK);
+    uint32_t bit = 1UL << (pin & PINMASK);
+    uint32_t odr = periph->ODR;
+    // Reset the pin if it is high, or set it if it is low
+    periph->BSRR = ((odr & bit) << 16) | (~odr & bit);
+}
 
 /**
  * Read the digital voltage level from a pin
- * @param pin: pin to set
+ * @param pin: pin to read
  * @return GPIO pin level
  */
-GPIO_level_t GPIO_read(GPIO_pin_t pin);
+static inline GPIO_level_t GPIO_read(GPIO_pin_t pin) {
+    uint32_t port = pin & PORTMASK;
+    if (port < PORT_A || port > PORT_H) {
+        return GPIO_LOW;
+    }
+    if (READFIELD(GPIO_port_regs(port)->IDR, 1UL, pin & PINMASK)) {
+        return GPIO_HIGH;
+    } else {
+        return GPIO_LOW;
+    }
+}
+
+/**
+ * Reads the input levels of all pins on a GPIO port
+ * @param port: GPIO port (PORT_A-PORT_H)
+ * @return pin levels, bit n is the level of pin n
+ */
+static inline uint16_t GPIO_read_port(uint32_t port) {
+    return (uint16_t)GPIO_port_regs(port)->IDR;
+}
 
 /**
  * Enable interrupts on a GPIO pin
@@ -222,10 +316,41 @@ GPIO_level_t GPIO_read(GPIO_pin_t pin);
  * @param trigger: either GPIO_trig_rising, GPIO_trig_falling, or GPIO_trig_both
  * @param callback: callback to run. This function will be called from an
  * interrupt context.
- * @return SYS_OK on success, or ERR_INUSE if another GPIO pin is using the
- * interrupt line (GPIO pins are multipled accross 16 lines)
+ * @param arg: argument passed to callback. May be NULL
+ * @return SYS_OK on success, ERR_BADPARAM if callback is NULL, or ERR_INUSE
+ * if another GPIO pin is using the interrupt line (GPIO pins are multipled
+ * accross 16 lines)
  */
 syserr_t GPIO_interrupt_enable(GPIO_pin_t pin, GPIO_trigger_t trigger,
-                               void(*callback)(void));
+                               GPIO_callback_t callback, void *arg);
+
+/**
+ * Enable interrupts on a GPIO pin, and notify a task when they fire. The
+ * interrupt only sets notification bits, so the task handles the edge
+ * instead of user code running in the interrupt.
+ * @param pin: pin to enable interrupts on
+ * @param trigger: either GPIO_trig_rising, GPIO_trig_falling, or GPIO_trig_both
+ * @param task: task to notify
+ * @param bits: notification bits to set, see task_notify
+ * @return SYS_OK on success, ERR_BADPARAM if task is NULL, or ERR_INUSE if
+ * another GPIO pin is using the interrupt line
+ */
+syserr_t GPIO_interrupt_notify(GPIO_pin_t pin, GPIO_trigger_t trigger,
+                               task_handle_t task, uint32_t bits);
+
+/**
+ * Enable interrupts on a GPIO pin, and submit a work item when they fire. The
+ * interrupt only queues the work item, so its function runs in a work queue
+ * task instead of the interrupt. Edges that fire while the item is still
+ * queued run it only once.
+ * @param pin: pin to enable interrupts on
+ * @param trigger: either GPIO_trig_rising, GPIO_trig_falling, or GPIO_trig_both
+ * @param work: work item to submit, initialized with work_init. Must remain
+ * valid while the interrupt is enabled
+ * @return SYS_OK on success, ERR_BADPARAM if work is NULL, or ERR_INUSE if
+ * another GPIO pin is using the interrupt line
+ */
+syserr_t GPIO_interrupt_defer(GPIO_pin_t pin, GPIO_trigger_t trigger,
+                              work_t *work);
 
 #endif
\ No newline at end of file
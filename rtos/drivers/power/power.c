@@ -0,0 +1,189 @@
+/**
+ * @file power.c
+ * Implements low power idle modes, and limits drivers place on them
+ *
+ * SysTick stops in Stop mode, so LPTIM1 clocked at 1 kHz from the LSI
+ * oscillator times Stop mode periods instead. The core wakes running from
+ * MSI, and clock_resume restarts the PLL.
+ */
+#include <stdlib.h>
+
+#include <drivers/clock/clock.h>
+#include <drivers/device/device.h>
+#include <sys/isr/isr.h>
+#include <util/bitmask.h>
+
+#include "power.h"
+
+// Number of limits placed on each power mode, see power_limit
+static volatile uint32_t mode_limits[POWER_STOP2 + 1] = {0};
+
+#if SYS_LOW_POWER == LOW_POWER_ENABLED
+
+// Static functions
+static void LPTIM1_interrupt(void);
+static inline uint32_t lptim_count();
+
+/**
+ * Initializes low power support. Clocks LPTIM1 from the LSI oscillator, so it
+ * can wake the core from Stop mode. Called by the system when the RTOS starts.
+ * Has no effect unless SYS_LOW_POWER is enabled.
+ */
+void power_init() {
+    clock_cfg_t cfg;
+    // Start the LSI oscillator through clock_init, so it is restored on wake
+    clock_get_config(&cfg);
+    cfg.LSI_freq = LSI_freq_32MHz;
+    clock_init(&cfg);
+    SETBITS(RCC->APB1ENR1, RCC_APB1ENR1_PWREN | RCC_APB1ENR1_LPTIM1EN);
+    MODIFY_REG(RCC->CCIPR, RCC_CCIPR_LPTIM1SEL, RCC_CCIPR_LPTIM1SEL_0);
+    // Wake from Stop mode using MSI as the system clock
+    CLEARBITS(RCC->CFGR, RCC_CFGR_STOPWUCK);
+    /**
+     * Divide the 32 kHz LSI clock by 32, for a 1 ms count. The configuration
+     * and interrupt enable registers may only be written while disabled.
+     */
+    CLEARBITS(LPTIM1->CR, LPTIM_CR_ENABLE);
+    LPTIM1->CFGR = LPTIM_CFGR_PRESC_2 | LPTIM_CFGR_PRESC_0;
+    LPTIM1->IER = LPTIM_IER_ARRMIE;
+    enable_irq(LPTIM1_IRQn, LPTIM1_interrupt, NULL);
+}
+
+/**
+ * Enters a Stop mode until LPTIM1 expires after "idle_ms", or another
+ * interrupt wakes the core. Restores the system clocks before returning.
+ * MUST be called by the idle task, with interrupts disabled by PRIMASK and
+ * SysTick stopped.
+ * @param mode: POWER_STOP1 or POWER_STOP2
+ * @param idle_ms: maximum time to stop for, in ms. Clamped to
+ * POWER_STOP_MAX_MS
+ * @return time spent stopped, in ms
+ */
+uint32_t power_stop(power_mode_t mode, uint32_t idle_ms) {
+    uint32_t elapsed;
+    if (idle_ms > POWER_STOP_MAX_MS) {
+        idle_ms = POWER_STOP_MAX_MS;
+    }
+    // The autoreload register may only be written while enabled
+    SETBITS(LPTIM1->CR, LPTIM_CR_ENABLE);
+    LPTIM1->ICR = LPTIM_ICR_ARRMCF | LPTIM_ICR_ARROKCF;
+    LPTIM1->ARR = idle_ms;
+    while (READBITS(LPTIM1->ISR, LPTIM_ISR_ARROK) == 0)
+        ; // Wait for the write to reach the LSI clock domain
+    LPTIM1->ICR = LPTIM_ICR_ARROKCF;
+    SETBITS(LPTIM1->CR, LPTIM_CR_CNTSTRT);
+    if (mode == POWER_STOP2) {
+        MODIFY_REG(PWR->CR1, PWR_CR1_LPMS, PWR_CR1_LPMS_STOP2);
+    } else {
+        MODIFY_REG(PWR->CR1, PWR_CR1_LPMS, PWR_CR1_LPMS_STOP1);
+    }
+    SETBITS(SCB->SCR, SCB_SCR_SLEEPDEEP_Msk);
+    /**
+     * Interrupts are disabled, but wfi will still wake the core when one is
+     * pending. The interrupt runs once the caller enables interrupts.
+     */
+    asm volatile("dsb\n"
+                 "wfi\n"
+                 "isb\n");
+    CLEARBITS(SCB->SCR, SCB_SCR_SLEEPDEEP_Msk);
+    clock_resume();
+    if (READBITS(LPTIM1->ISR, LPTIM_ISR_ARRM)) {
+        elapsed = idle_ms;
+    } else {
+        // Another interrupt woke the core
+        elapsed = lptim_count();
+    }
+    // Stop the timer, and drop its pending wakeup interrupt
+    LPTIM1->ICR = LPTIM_ICR_ARRMCF;
+    CLEARBITS(LPTIM1->CR, LPTIM_CR_ENABLE);
+    NVIC->ICPR[LPTIM1_IRQn >> 5] = 1UL << (LPTIM1_IRQn & 0x1F);
+    return elapsed;
+}
+
+/**
+ * LPTIM1 interrupt. Only wakes the core from Stop mode, and power_stop clears
+ * the interrupt before interrupts are enabled, so this should rarely run.
+ */
+static void LPTIM1_interrupt(void) {
+    LPTIM1->ICR = LPTIM_ICR_ARRMCF | LPTIM_ICR_ARROKCF;
+}
+
+/**
+ * Reads the LPTIM1 counter. The counter runs from the LSI clock, so it is
+ * read until two consecutive reads match.
+ * @return LPTIM1 count
+ */
+static inline uint32_t lptim_count() {
+    uint32_t count;
+    do {
+        count = LPTIM1->CNT;
+    } while (count != LPTIM1->CNT);
+    return count;
+}
+
+#else
+
+/**
+ * Initializes low power support. Has no effect unless SYS_LOW_POWER is
+ * enabled.
+ */
+void power_init() {}
+
+/**
+ * Enters a Stop mode. Not supported unless SYS_LOW_POWER is enabled.
+ * @param mode: unused
+ * @param idle_ms: unused
+ * @return 0, no time is spent stopped
+ */
+uint32_t power_stop(power_mode_t mode, uint32_t idle_ms) { return 0; }
+
+#endif
+
+/**
+ * Prevents the idle task from entering power modes deeper than "mode". Used by
+ * drivers that stop working in deeper modes. Each call must be paired with a
+ * call to power_unlimit. Safe to call from interrupt context.
+ * @param mode: deepest power mode that may be entered
+ */
+void power_limit(power_mode_t mode) {
+    uint32_t state = mask_irq_save();
+    mode_limits[mode]++;
+    restore_irq_mask(state);
+}
+
+/**
+ * Releases a limit placed with power_limit. Safe to call from interrupt
+ * context.
+ * @param mode: power mode passed to power_limit
+ */
+void power_unlimit(power_mode_t mode) {
+    uint32_t state = mask_irq_save();
+    mode_limits[mode]--;
+    restore_irq_mask(state);
+}
+
+/**
+ * Selects the deepest power mode that is allowed by driver limits and worth
+ * entering for the expected idle time.
+ * @param idle_ms: time until the next deadline, in ms
+ * @return power mode to enter
+ */
+power_mode_t power_select_mode(uint32_t idle_ms) {
+    power_mode_t mode;
+    // The shallowest limited mode is the deepest one allowed
+    if (mode_limits[POWER_SLEEP]) {
+        mode = POWER_SLEEP;
+    } else if (mode_limits[POWER_STOP1]) {
+        mode = POWER_STOP1;
+    } else {
+        mode = POWER_STOP2;
+    }
+    // Deeper modes take longer to wake from, so are only worth longer idles
+    if (mode == POWER_STOP2 && idle_ms < POWER_STOP2_MIN_MS) {
+        mode = POWER_STOP1;
+    }
+    if (mode == POWER_STOP1 && idle_ms < POWER_STOP1_MIN_MS) {
+        mode = POWER_SLEEP;
+    }
+    return mode;
+}
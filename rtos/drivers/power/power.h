@@ -0,0 +1,85 @@
+/**
+ * @file power.h
+ * Implements low power idle modes, and limits drivers place on them
+ */
+#ifndef POWER_H
+#define POWER_H
+
+#include <stdint.h>
+
+#include <config.h>
+#include <sys/err.h>
+
+#if SYS_LOW_POWER == LOW_POWER_ENABLED && SYS_USE_TICKLESS != TICKLESS_ENABLED
+#error "SYS_LOW_POWER requires SYS_USE_TICKLESS to be enabled"
+#endif
+
+/**
+ * Minimum idle time (in ms) before the idle task enters Stop 1 mode.
+ * Set by passing -DPOWER_STOP1_MIN_MS=val
+ */
+#ifndef POWER_STOP1_MIN_MS
+#define POWER_STOP1_MIN_MS 4
+#endif
+/**
+ * Minimum idle time (in ms) before the idle task enters Stop 2 mode.
+ * Set by passing -DPOWER_STOP2_MIN_MS=val
+ */
+#ifndef POWER_STOP2_MIN_MS
+#define POWER_STOP2_MIN_MS 10
+#endif
+/** Longest Stop mode period LPTIM1 can time, in ms */
+#define POWER_STOP_MAX_MS 0xFFFF
+
+/**
+ * Idle power modes, from shallowest to deepest
+ */
+typedef enum {
+    POWER_SLEEP, /*!< Core clock stopped, peripherals and SysTick run */
+    POWER_STOP1, /*!< All high speed clocks stopped, main regulator off */
+    POWER_STOP2, /*!< As Stop 1, with most peripherals powered down */
+} power_mode_t;
+
+/**
+ * Initializes low power support. Clocks LPTIM1 from the LSI oscillator, so it
+ * can wake the core from Stop mode. Called by the system when the RTOS starts.
+ * Has no effect unless SYS_LOW_POWER is enabled.
+ */
+void power_init();
+
+/**
+ * Prevents the idle task from entering power modes deeper than "mode". Used by
+ * drivers that stop working in deeper modes. Each call must be paired with a
+ * call to power_unlimit. Safe to call from interrupt context.
+ * @param mode: deepest power mode that may be entered
+ */
+void power_limit(power_mode_t mode);
+
+/**
+ * Releases a limit placed with power_limit. Safe to call from interrupt
+ * context.
+ * @param mode: power mode passed to power_limit
+ */
+void power_unlimit(power_mode_t mode);
+
+/**
+ * Selects the deepest power mode that is allowed by driver limits and worth
+ * entering for the expected idle time.
+ * @param idle_ms: time until the next deadline, in ms
+ * @return power mode to enter
+ */
+power_mode_t power_select_mode(uint32_t idle_ms);
+
+/**
+ * Enters a Stop mode until LPTIM1 expires after "idle_ms", or another
+ * interrupt wakes the core. Restores the system clocks before returning.
+ * MUST be called by the idle task, with interrupts disabled by PRIMASK and
+ * SysTick stopped.
+ * @param mode: POWER_STOP1 or POWER_STOP2
+ * @param idle_ms: maximum time to stop for, in ms. Clamped to
+ * POWER_STOP_MAX_MS
+ * @return time spent stopped, in ms
+ */
+uint32_t power_stop(power_mode_t mode, uint32_t idle_ms);
+
+#endif
@@ -3,12 +3,28 @@
  * Implements support for semihosting functionality
  */
 
+#include <stdint.h>
+#include <string.h>
+
 #include <config.h>
+#include <sys/isr/isr.h>
+#include <sys/task/task.h>
 
 #include "semihost.h"
 
+/** Semihosting operation numbers */
+#define SYS_OPEN 0x01
+#define SYS_WRITE 0x05
+
+/** SYS_OPEN mode for writing ("w") */
+#define SYS_OPEN_MODE_W 4
+
 static char semihost_buf[SYSLOG_BUFSIZE];
-static char *write_offset = semihost_buf;
+static uint32_t buf_len = 0;
+static uint32_t buf_first_tick; // Tick count when buffer became nonempty
+static int console_handle = -1;
+
+static int semihost_call(int op, void *args);
 
 /**
  * Writes a single :character to the semihost output.
@@ -51,36 +67,85 @@ void semihost_writestr(char *str) {
 /**
  * Writes a buffer to the semihost output. This buffer will be sent
  * asynchronously, and does not have to be null terminated.
- * Null characters in this buffer will be skipped.
  * @param buf: buffer to write
  * @param len: length to write
  */
 void semihost_writebuf(char *buf, int len) {
-    int remaining = len;
-    char *buf_max = (SYSLOG_BUFSIZE - 1) + semihost_buf;
-    while (remaining--) {
-        if (*buf == '\0') {
-            // We do not support writing null characters to stream
-            continue;
+    uint32_t state, space;
+    state = mask_irq_save();
+    while (len > 0) {
+        if (buf_len == 0) {
+            buf_first_tick = task_get_ticks();
+        }
+        space = SYSLOG_BUFSIZE - buf_len;
+        if (space > (uint32_t)len) {
+            space = len;
         }
-        // Write data while there is data to write
-        *write_offset++ = *buf++;
+        memcpy(&semihost_buf[buf_len], buf, space);
+        buf_len += space;
+        buf += space;
+        len -= space;
         // If buffer is full, flush it
-        if (write_offset == buf_max) {
+        if (buf_len == SYSLOG_BUFSIZE) {
             semihost_flush();
         }
     }
+    restore_irq_mask(state);
 }
 
 /**
  * Forces the semihost output to flush to the debugger
  */
 void semihost_flush() {
-    // Null terminate the semihost buffer
-    *write_offset = '\0';
-    write_offset++;
-    // Write the buffer
-    semihost_writestr(semihost_buf);
+    uint32_t state;
+    uint32_t args[3];
+    state = mask_irq_save();
+    if (buf_len == 0) {
+        restore_irq_mask(state);
+        return;
+    }
+    if (console_handle < 0) {
+        // Open the debugger console. ":tt" is the semihosting console name
+        args[0] = (uint32_t)":tt";
+        args[1] = SYS_OPEN_MODE_W;
+        args[2] = 3; // Length of ":tt"
+        console_handle = semihost_call(SYS_OPEN, args);
+    }
+    if (console_handle >= 0) {
+        // Write the whole buffer with one debugger halt
+        args[0] = console_handle;
+        args[1] = (uint32_t)semihost_buf;
+        args[2] = buf_len;
+        semihost_call(SYS_WRITE, args);
+    }
     // Reset buffer write index
-    write_offset = semihost_buf;
-}
\ No newline at end of file
+    buf_len = 0;
+    restore_irq_mask(state);
+}
+
+/**
+ * Flushes the semihost output if the buffer is over half full, or if data
+ * has been buffered for SYSLOG_FLUSH_MS. Called from the idle task, so that
+ * the debugger halts the core as rarely as possible.
+ */
+void semihost_poll() {
+    if (buf_len >= SYSLOG_BUFSIZE / 2 ||
+        (buf_len != 0 &&
+         task_get_ticks() - buf_first_tick >=
+             SYSLOG_FLUSH_MS * SYSTICK_FREQ / 1000)) {
+        semihost_flush();
+    }
+}
+
+/**
+ * Runs a semihosting operation
+ * @param op: semihosting operation number
+ * @param args: operation argument block
+ * @return value returned by the debugger
+ */
+static int semihost_call(int op, void *args) {
+    register int r0 asm("r0") = op;
+    register void *r1 asm("r1") = args;
+    asm volatile("bkpt 0xAB\n" : "+r"(r0) : "r"(r1) : "memory");
+    return r0;
+}
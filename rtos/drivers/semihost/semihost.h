@@ -23,7 +23,6 @@ void semihost_writestr(char* str);
 /**
  * Writes a buffer to the semihost output. This buffer will be sent
  * asynchronously, and does not have to be null terminated.
- * Null characters in this buffer will be skipped.
  * @param buf: buffer to write
  * @param len: length to write
  */
@@ -34,4 +33,11 @@ void semihost_writebuf(char *buf, int len);
  */
 void semihost_flush();
 
+/**
+ * Flushes the semihost output if the buffer is over half full, or if data
+ * has been buffered for SYSLOG_FLUSH_MS. Called from the idle task, so that
+ * the debugger halts the core as rarely as possible.
+ */
+void semihost_poll();
+
 #endif
\ No newline at end of file
@@ -7,7 +7,12 @@
 #include <drivers/gpio/gpio.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
+
+#include <config.h>
+#include <sys/isr/isr.h>
 #include <util/bitmask.h>
+#include <util/ringbuf/ringbuf.h>
 
 #include "swo.h"
 
@@ -15,6 +20,21 @@
 #define TPI_SPPR_TXMODE_MANCHESTER 1UL
 #define TPI_SPPR_TXMODE_NRZ 2UL
 
+static inline bool SWO_port_enabled(uint32_t port);
+static inline void SWO_wait(uint32_t port);
+
+#if SYSLOG == SYSLOG_SWO
+/**
+ * Log output buffer. Writers fill it with interrupts masked, only for the
+ * time taken to copy data. It is drained with interrupts enabled, by one
+ * context at a time.
+ */
+static uint8_t swo_store[SYSLOG_BUFSIZE];
+static RingBuf_t swo_buf;
+static bool swo_buf_ready = false;
+static volatile bool swo_draining = false;
+#endif
+
 /**
  * Writes a single character to the SWO output.
  * This character will be sent immediately.
@@ -22,33 +42,136 @@
  * @return SYS_OK on success, or SYS_ERR on error
  */
 syserr_t SWO_writechar(char c) {
-    if ((READBITS(ITM->TCR, ITM_TCR_ITMENA_Msk) != 0UL) && /* ITM enabled */
-        (READBITS(ITM->TER, 1UL) != 0UL)) /* ITM Port #0 enabled */
-    {
-        // Wait for SWO port to be available
-        while (ITM->PORT[0].u32 == 0) {
-            // Spin
-        }
-        ITM->PORT[0U].u8 = c;
+    if (SWO_port_enabled(SWO_PORT_LOG)) {
+        SWO_wait(SWO_PORT_LOG);
+        ITM->PORT[SWO_PORT_LOG].u8 = c;
     }
     return SYS_OK;
 }
 
 /**
- * Writes a buffer to the SWO output.
+ * Writes a buffer to the SWO log port. When SWO is the system log, data is
+ * stored in the log buffer and sent by SWO_flush, or when the buffer fills.
+ * Otherwise it is sent immediately.
  * @param buf: buffer to write
  * @param len: length to write
  * @return SYS_OK on success, or SYS_ERR on error
  */
 syserr_t SWO_writebuf(char *buf, int len) {
-    syserr_t ret;
-    while (len--) {
-        ret = SWO_writechar(*buf);
-        if (ret != SYS_OK) {
-            return ret;
+#if SYSLOG == SYSLOG_SWO
+    uint32_t state, written;
+    if (!SWO_port_enabled(SWO_PORT_LOG)) {
+        // No debugger is listening, discard output
+        return SYS_OK;
+    }
+    while (len > 0) {
+        state = mask_irq_save();
+        if (!swo_buf_ready) {
+            buf_init(&swo_buf, swo_store, SYSLOG_BUFSIZE);
+            swo_buf_ready = true;
         }
-        // Advance buffer
-        buf++;
+        written = buf_writeblock(&swo_buf, (uint8_t *)buf, len);
+        restore_irq_mask(state);
+        buf += written;
+        len -= written;
+        if (len > 0) {
+            // Buffer is full. Drain it to make space
+            SWO_flush();
+            if (swo_draining) {
+                /**
+                 * Another context is draining the buffer, but may not run
+                 * until this one finishes. Send the rest directly.
+                 */
+                return SWO_writeport(SWO_PORT_LOG, buf, len);
+            }
+        }
+    }
+    return SYS_OK;
+#else
+    return SWO_writeport(SWO_PORT_LOG, buf, len);
+#endif
+}
+
+/**
+ * Writes a buffer to an ITM stimulus port immediately. Data is sent in 32 bit
+ * words where possible, so each wait on the ITM FIFO moves four bytes.
+ * @param port: stimulus port to write to
+ * @param buf: buffer to write
+ * @param len: length to write
+ * @return SYS_OK on success, or ERR_BADPARAM for an invalid port
+ */
+syserr_t SWO_writeport(uint32_t port, const void *buf, uint32_t len) {
+    const uint8_t *data = buf;
+    uint32_t word;
+    uint16_t half;
+    if (port >= SWO_NUM_PORTS) {
+        return ERR_BADPARAM;
+    }
+    if (!SWO_port_enabled(port)) {
+        return SYS_OK;
+    }
+    while (len >= 4) {
+        // Copy, since data may not be word aligned
+        memcpy(&word, data, sizeof(word));
+        SWO_wait(port);
+        ITM->PORT[port].u32 = word;
+        data += 4;
+        len -= 4;
+    }
+    if (len >= 2) {
+        memcpy(&half, data, sizeof(half));
+        SWO_wait(port);
+        ITM->PORT[port].u16 = half;
+        data += 2;
+        len -= 2;
+    }
+    if (len) {
+        SWO_wait(port);
+        ITM->PORT[port].u8 = *data;
     }
     return SYS_OK;
-}
\ No newline at end of file
+}
+
+/**
+ * Sends all data stored in the SWO log buffer. Called by the idle task, so
+ * log output is sent when no other task needs to run.
+ */
+void SWO_flush() {
+#if SYSLOG == SYSLOG_SWO
+    uint32_t state, len;
+    uint8_t *region;
+    state = mask_irq_save();
+    if (swo_draining || !swo_buf_ready) {
+        restore_irq_mask(state);
+        return;
+    }
+    swo_draining = true;
+    restore_irq_mask(state);
+    // This context is now the only reader, so the buffer is read unmasked
+    while ((len = buf_read_region(&swo_buf, &region)) != 0) {
+        SWO_writeport(SWO_PORT_LOG, region, len);
+        buf_read_commit(&swo_buf, len);
+    }
+    swo_draining = false;
+#endif
+}
+
+/**
+ * Checks if the ITM and a stimulus port are enabled
+ * @param port: stimulus port to check
+ * @return true if writes to the port will be sent
+ */
+static inline bool SWO_port_enabled(uint32_t port) {
+    return (READBITS(ITM->TCR, ITM_TCR_ITMENA_Msk) != 0UL) && /* ITM enabled */
+           (READBITS(ITM->TER, 1UL << port) != 0UL);         /* Port enabled */
+}
+
+/**
+ * Waits for a stimulus port to be ready for a write
+ * @param port: stimulus port to wait on
+ */
+static inline void SWO_wait(uint32_t port) {
+    while (ITM->PORT[port].u32 == 0) {
+        // Spin
+    }
+}
@@ -5,8 +5,18 @@
 #ifndef SWO_H
 #define SWO_H
 
+#include <stdint.h>
+
 #include <sys/err.h>
 
+/**
+ * ITM stimulus ports. Text logs and trace data use separate ports, so a
+ * debugger can route them to separate outputs.
+ */
+#define SWO_PORT_LOG 0   /*!< System log and printf output */
+#define SWO_PORT_TRACE 1 /*!< Binary trace data */
+#define SWO_NUM_PORTS 32
+
 /**
  * Writes a single character to the SWO output.
  * This character will be sent immediately.
@@ -16,13 +26,30 @@
 syserr_t SWO_writechar(char c);
 
 /**
- * Writes a buffer to the SWO output. This buffer will be sent
- * asynchronously, and does not have to be null terminated.
- * Null characters in this buffer will be skipped.
+ * Writes a buffer to the SWO log port. When SWO is the system log, data is
+ * stored in the log buffer and sent by SWO_flush, or when the buffer fills.
+ * Otherwise it is sent immediately. Buffer does not have to be null
+ * terminated.
  * @param buf: buffer to write
  * @param len: length to write
  * @return SYS_OK on success, or SYS_ERR on error
  */
 syserr_t SWO_writebuf(char *buf, int len);
 
-#endif
\ No newline at end of file
+/**
+ * Writes a buffer to an ITM stimulus port immediately. Data is sent in 32 bit
+ * words where possible, so each wait on the ITM FIFO moves four bytes.
+ * @param port: stimulus port to write to
+ * @param buf: buffer to write
+ * @param len: length to write
+ * @return SYS_OK on success, or ERR_BADPARAM for an invalid port
+ */
+syserr_t SWO_writeport(uint32_t port, const void *buf, uint32_t len);
+
+/**
+ * Sends all data stored in the SWO log buffer. Called by the idle task, so
+ * log output is sent when no other task needs to run.
+ */
+void SWO_flush();
+
+#endif
@@ -10,7 +10,8 @@
  * fast cycle of 5 blinks.
  *
  * After the LED cycles 5 times, the led will be blinked 5 times with a 1000ms
- * delay. This tests the delay() function within the clock code
+ * delay. This tests the delay() function within the clock code. A 1 ms
+ * delay_us() is then checked against the DWT cycle counter and timestamp_us()
  *
  * After the LED cycles 5 times with the delay, clock speed will be set to 16MHz
  * using the HSI16 oscillator. The LED will then be blinked with the same preset
@@ -30,6 +31,8 @@
 
 #define DELAY 100000
 #define CYCLES 5
+#define DELAY_US 1000
+#define CORE_FREQ_MHZ 80
 
 /**
  * Blinks the user LED using the preset delay
@@ -52,6 +55,8 @@ int main() {
     GPIO_config_t led_cfg = GPIO_DEFAULT_CONFIG;
     clock_cfg_t clk_cfg = CLOCK_DEFAULT_CONFIG;
     int cycles = CYCLES;
+    uint32_t start_cycle;
+    uint64_t start_us;
     // Set clock config to use MSI at 4MHz
     clk_cfg.PLL_en = false;
     clk_cfg.sysclk_src = CLK_MSI;
@@ -96,6 +101,15 @@ int main() {
         GPIO_write(GPIO_PB13, GPIO_LOW);
         blocking_delay_ms(1000);
     }
+    // Verify the microsecond delay against the cycle counter and timestamp
+    start_us = timestamp_us();
+    start_cycle = clock_cycles();
+    delay_us(DELAY_US);
+    if ((clock_cycles() - start_cycle) < DELAY_US * CORE_FREQ_MHZ ||
+        (timestamp_us() - start_us) < DELAY_US) {
+        while (1) // spin
+            ;
+    }
     /**
      * Verify function failures
      */
@@ -0,0 +1,142 @@
+/**
+ * @file clock_profile_test.c
+ * Tests runtime clock profile changes. The test task steps through each clock
+ * profile while the RTOS runs, with LPUART1 open. At each profile the system
+ * clock must match the profile, a task delay must still last the requested
+ * time, and a message is written to LPUART1. Each message should be readable
+ * on the ST-Link virtual COM port at 115200 baud, showing the UART baud rate
+ * was updated for the new clock.
+ *
+ * SWO output is timed from the system clock, so the system log is only
+ * written while the clock runs at 80 MHz.
+ *
+ * Here is the expected output from LPUART1:
+ * Running at 4 MHz
+ * Running at 16 MHz
+ * Running at 80 MHz
+ * Running at 16 MHz
+ * Running at 4 MHz
+ * Running at 80 MHz
+ *
+ * Here is the expected output from the system log:
+ * Clock profile test passed
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <drivers/clock/clock.h>
+#include <drivers/uart/uart.h>
+#include <sys/task/task.h>
+#include <util/logging/logging.h>
+
+#define DELAY_MS 100
+#define DELAY_TOLERANCE_US 2000
+
+static void test_task(void *arg);
+
+/** Profiles to step through, and the system clock each should run at */
+static const struct {
+    clock_profile_t profile;
+    uint64_t freq;
+} steps[] = {
+    {CLOCK_PROFILE_4MHz, 4000000UL},   {CLOCK_PROFILE_16MHz, 16000000UL},
+    {CLOCK_PROFILE_80MHz, 80000000UL}, {CLOCK_PROFILE_16MHz, 16000000UL},
+    {CLOCK_PROFILE_4MHz, 4000000UL},   {CLOCK_PROFILE_80MHz, 80000000UL},
+};
+
+static const char *TAG = "Clock Profile Test";
+static int notifications = 0;
+
+/**
+ * Initializes system
+ */
+static void system_init() {
+    clock_cfg_t clk_cfg = CLOCK_DEFAULT_CONFIG;
+    clock_init(&clk_cfg);
+}
+
+/**
+ * Clock change notifier. Counts each change event
+ * @param event: clock change event
+ * @param arg: unused.
+ */
+static void count_change(clock_change_t event, void *arg) {
+    notifications++;
+}
+
+/**
+ * Test task entry point. Steps through each clock profile
+ * @param arg: unused.
+ */
+static void test_task(void *arg) {
+    UART_config_t uart_cfg = UART_DEFAULT_CONFIG;
+    clock_notifier_t notifier = {.callback = count_change};
+    UART_handle_t lpuart;
+    syserr_t err;
+    uint64_t start, elapsed;
+    char msg[32];
+    int i, len;
+    lpuart = UART_open(LPUART_1, &uart_cfg, &err);
+    if (lpuart == NULL) {
+        LOG_E(TAG, "Clock profile test failed, could not open LPUART1");
+        exit(ERR_FAIL);
+    }
+    clock_register_notifier(&notifier);
+    for (i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+        err = clock_set_profile(steps[i].profile);
+        if (err != SYS_OK || sysclock_freq() != steps[i].freq) {
+            break;
+        }
+        // Task delays are counted by SysTick, and must not change length
+        start = timestamp_us();
+        task_delay(DELAY_MS);
+        elapsed = timestamp_us() - start;
+        if (elapsed < DELAY_MS * 1000UL - DELAY_TOLERANCE_US ||
+            elapsed > DELAY_MS * 1000UL + DELAY_TOLERANCE_US) {
+            break;
+        }
+        len = snprintf(msg, sizeof(msg), "Running at %lu MHz\r\n",
+                       (unsigned long)(steps[i].freq / 1000000UL));
+        UART_write(lpuart, (uint8_t *)msg, len, &err);
+    }
+    // Back at 80 MHz, so the system log can be written again
+    clock_set_profile(CLOCK_PROFILE_80MHz);
+    clock_unregister_notifier(&notifier);
+    UART_close(lpuart);
+    if (i != sizeof(steps) / sizeof(steps[0])) {
+        LOG_E(TAG, "Clock profile test failed at step %d, %lu MHz", i,
+              (unsigned long)(sysclock_freq() / 1000000UL));
+        exit(ERR_FAIL);
+    }
+    // Each change calls the notifier before and after
+    if (notifications != 2 * i) {
+        LOG_E(TAG, "Clock profile test failed, %d notifications for %d "
+                   "changes", notifications, i);
+        exit(ERR_FAIL);
+    }
+    // Switching to the running profile does nothing
+    if (clock_set_profile(CLOCK_PROFILE_80MHz) != SYS_OK ||
+        notifications != 2 * i) {
+        LOG_E(TAG, "Clock profile test failed, repeated profile changed clock");
+        exit(ERR_FAIL);
+    }
+    LOG_I(TAG, "Clock profile test passed");
+}
+
+/**
+ * Testing entry point. Tests runtime clock profile changes
+ */
+int main() {
+    task_config_t cfg = DEFAULT_TASK_CONFIG;
+    /* Init system */
+    system_init();
+    cfg.task_name = "Test Task";
+    if (task_create(test_task, NULL, &cfg) == NULL) {
+        LOG_E(TAG, "Failed to create rtos task");
+        return ERR_FAIL;
+    }
+    rtos_start();
+    return SYS_OK;
+}
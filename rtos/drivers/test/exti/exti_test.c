@@ -0,0 +1,114 @@
+/**
+ * @file exti_test.c
+ * Tests GPIO interrupt dispatch. EXTI interrupts are raised in software with
+ * the software interrupt event register, so no wiring is needed.
+ *
+ * A callback is bound to PA0, which has its own EXTI vector, and should run
+ * with its argument. The test task is then bound to PC13 and PC10, which
+ * share the EXTI15_10 vector. Raising both lines at once should notify the
+ * task with both notification bits.
+ *
+ * Here is the expected output from the system log:
+ * Callback ran with its argument
+ * Task notified by shared vector lines
+ * EXTI test passed
+ */
+
+#include <stdlib.h>
+
+#include <drivers/clock/clock.h>
+#include <drivers/device/device.h>
+#include <drivers/gpio/gpio.h>
+#include <sys/semaphore/semaphore.h>
+#include <sys/task/task.h>
+#include <util/logging/logging.h>
+
+#define NOTIFY_PC13 0x1
+#define NOTIFY_PC10 0x2
+#define NOTIFY_TIMEOUT 100
+
+static void test_task(void *arg);
+static void count_callback(void *arg);
+
+static volatile int callback_count = 0;
+
+/**
+ * Initializes system
+ */
+static void system_init() {
+    clock_cfg_t clk_cfg = CLOCK_DEFAULT_CONFIG;
+    GPIO_config_t in_cfg = GPIO_DEFAULT_CONFIG;
+    clock_init(&clk_cfg);
+    in_cfg.mode = GPIO_mode_input;
+    GPIO_config(GPIO_PA0, &in_cfg);
+    GPIO_config(GPIO_PC10, &in_cfg);
+    GPIO_config(GPIO_PC13, &in_cfg);
+}
+
+/**
+ * GPIO callback. Increments the counter passed as its argument
+ * @param arg: counter to increment
+ */
+static void count_callback(void *arg) { (*(volatile int *)arg)++; }
+
+/**
+ * Test task entry point. Raises EXTI lines by software, and checks their
+ * bindings ran
+ * @param arg: unused.
+ */
+static void test_task(void *arg) {
+    const char *TAG = "Test Task";
+    uint32_t bits;
+    if (GPIO_interrupt_enable(GPIO_PA0, GPIO_trig_rising, count_callback,
+                              (void *)&callback_count) != SYS_OK) {
+        LOG_E(TAG, "EXTI test failed, could not bind callback");
+        exit(ERR_FAIL);
+    }
+    EXTI->SWIER1 = EXTI_SWIER1_SWI0;
+    task_delay(1);
+    if (callback_count != 1) {
+        LOG_E(TAG, "EXTI test failed, callback ran %d times", callback_count);
+        exit(ERR_FAIL);
+    }
+    LOG_I(TAG, "Callback ran with its argument");
+    if (GPIO_interrupt_notify(GPIO_PC13, GPIO_trig_falling,
+                              get_active_task(), NOTIFY_PC13) != SYS_OK ||
+        GPIO_interrupt_notify(GPIO_PC10, GPIO_trig_falling,
+                              get_active_task(), NOTIFY_PC10) != SYS_OK) {
+        LOG_E(TAG, "EXTI test failed, could not bind task");
+        exit(ERR_FAIL);
+    }
+    // A second binding on a line in use must fail
+    if (GPIO_interrupt_enable(GPIO_PB13, GPIO_trig_rising, count_callback,
+                              NULL) != ERR_INUSE) {
+        LOG_E(TAG, "EXTI test failed, bound a line in use");
+        exit(ERR_FAIL);
+    }
+    EXTI->SWIER1 = EXTI_SWIER1_SWI13 | EXTI_SWIER1_SWI10;
+    if (task_notify_wait(NOTIFY_PC13 | NOTIFY_PC10,
+                         NOTIFY_WAIT_ALL | NOTIFY_CLEAR, &bits,
+                         NOTIFY_TIMEOUT) != SYS_OK) {
+        LOG_E(TAG, "EXTI test failed, task not notified");
+        exit(ERR_FAIL);
+    }
+    LOG_I(TAG, "Task notified by shared vector lines");
+    LOG_I(TAG, "EXTI test passed");
+}
+
+/**
+ * Testing entry point. Tests GPIO interrupt dispatch
+ */
+int main() {
+    const char *TAG = "main";
+    task_config_t cfg = DEFAULT_TASK_CONFIG;
+    /* Init system */
+    system_init();
+    cfg.task_name = "Test Task";
+    if (task_create(test_task, NULL, &cfg) == NULL) {
+        LOG_E(TAG, "Failed to create rtos task");
+        return ERR_FAIL;
+    }
+    LOG_I(TAG, "Starting RTOS");
+    rtos_start();
+    return SYS_OK;
+}
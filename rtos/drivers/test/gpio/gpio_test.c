@@ -3,6 +3,8 @@
  * Tests system GPIO
  *
  * This code, when executing correctly, should do the following:
+ * - Check that port writes and toggles read back on the user LED pin, and
+ * spin with the LED off if they do not
  * - Blink the user LED at boot (D4 on development board)
  * - Pressing B1 (user button) should switch the user LED between a fast and
  * slow blink cycle
@@ -17,12 +19,14 @@ volatile int delay = DELAY_SHORT;
 
 /**
  * Handles interrupts on press of user button B1
+ * @param arg: blink delay to switch
  */
-void gpio_inthandler(void) {
-    if (delay == DELAY_SHORT) {
-        delay = DELAY_LONG;
+void gpio_inthandler(void *arg) {
+    volatile int *blink_delay = (volatile int *)arg;
+    if (*blink_delay == DELAY_SHORT) {
+        *blink_delay = DELAY_LONG;
     } else {
-        delay = DELAY_SHORT;
+        *blink_delay = DELAY_SHORT;
     }
 }
 
@@ -50,30 +54,45 @@ syserr_t gpio_init() {
         return ret;
     }
     // Enable rising edge interrupts for user button
-    ret = GPIO_interrupt_enable(GPIO_PC13, GPIO_trig_falling, gpio_inthandler);
+    ret = GPIO_interrupt_enable(GPIO_PC13, GPIO_trig_falling, gpio_inthandler,
+                                (void *)&delay);
     if (ret != SYS_OK) {
         return ret;
     }
     return SYS_OK;
 }
 
+/**
+ * Checks port writes and toggles by reading back the user LED pin
+ * @return SYS_OK on success, or ERR_FAIL if a pin read back incorrectly
+ */
+syserr_t gpio_check_readback() {
+    GPIO_write_port_mask(PORT_B, 1U << PIN_13, 1U << PIN_13);
+    if (GPIO_read(GPIO_PB13) != GPIO_HIGH ||
+        (GPIO_read_port(PORT_B) & (1U << PIN_13)) == 0) {
+        return ERR_FAIL;
+    }
+    GPIO_toggle(GPIO_PB13);
+    if (GPIO_read(GPIO_PB13) != GPIO_LOW) {
+        return ERR_FAIL;
+    }
+    return SYS_OK;
+}
+
 int main() {
     volatile int i;
-    if (gpio_init() != SYS_OK) {
+    if (gpio_init() != SYS_OK || gpio_check_readback() != SYS_OK) {
         // Spin
         while (1)
             ;
     }
+    // Illuminate Led D4
+    GPIO_write(GPIO_PB13, GPIO_HIGH);
     while (1) {
-        // Illuminate Led D4
-        GPIO_write(GPIO_PB13, GPIO_HIGH);
-        // Delay
-        for (i = 0; i < delay; i++)
-            ;
-        // Turn the LED off
-        GPIO_write(GPIO_PB13, GPIO_LOW);
+        // Delay, then toggle the LED
         for (i = 0; i < delay; i++)
             ;
+        GPIO_toggle(GPIO_PB13);
     }
     return SYS_OK;
 }
\ No newline at end of file
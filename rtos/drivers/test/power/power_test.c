@@ -0,0 +1,119 @@
+/**
+ * @file power_test.c
+ * Tests low power idle. The test task blinks the LED (User LED D4) with long
+ * task delays, so the idle task enters Stop 2 mode between blinks. The LED
+ * should blink once a second, showing LPTIM1 wakes the core at each deadline.
+ * After each wakeup the system clock must be restored to the PLL at 80 MHz.
+ *
+ * An open LPUART1 still allows Stop 2 mode, since it can receive in Stop mode.
+ * USART2 is then opened, which limits idle to Sleep mode, and the LED blinks
+ * again at the same rate.
+ *
+ * Here is the expected output from the system log:
+ * Blinking LED with LPUART1 open
+ * Blinking LED with USART2 open
+ * Power test passed
+ */
+
+#include <stdlib.h>
+
+#include <drivers/clock/clock.h>
+#include <drivers/device/device.h>
+#include <drivers/gpio/gpio.h>
+#include <drivers/power/power.h>
+#include <drivers/uart/uart.h>
+#include <sys/task/task.h>
+#include <util/bitmask.h>
+#include <util/logging/logging.h>
+
+#define BLINK_MS 500
+#define CYCLES 5
+#define CORE_FREQ 80000000UL
+
+static void test_task(void *arg);
+
+/**
+ * Initializes system
+ */
+static void system_init() {
+    clock_cfg_t clk_cfg = CLOCK_DEFAULT_CONFIG;
+    GPIO_config_t led_cfg = GPIO_DEFAULT_CONFIG;
+    clock_init(&clk_cfg);
+    GPIO_config(GPIO_PB13, &led_cfg);
+}
+
+/**
+ * Blinks the LED with task delays, and checks the clock is restored after
+ * each delay
+ * @return SYS_OK on success, or ERR_FAIL if the clock was not restored
+ */
+static syserr_t blink_led() {
+    int cycles = CYCLES;
+    while (cycles--) {
+        GPIO_write(GPIO_PB13, GPIO_HIGH);
+        task_delay(BLINK_MS);
+        GPIO_write(GPIO_PB13, GPIO_LOW);
+        task_delay(BLINK_MS);
+        if (sysclock_freq() != CORE_FREQ ||
+            READBITS(RCC->CFGR, RCC_CFGR_SWS) != RCC_CFGR_SWS_PLL) {
+            return ERR_FAIL;
+        }
+    }
+    return SYS_OK;
+}
+
+/**
+ * Test task entry point. Blinks the LED with UARTs open
+ * @param arg: unused.
+ */
+static void test_task(void *arg) {
+    const char *TAG = "Test Task";
+    UART_config_t uart_cfg = UART_DEFAULT_CONFIG;
+    UART_handle_t lpuart, usart;
+    syserr_t err;
+    lpuart = UART_open(LPUART_1, &uart_cfg, &err);
+    if (lpuart == NULL || power_select_mode(BLINK_MS) != POWER_STOP2) {
+        LOG_E(TAG, "Power test failed, LPUART1 prevented Stop 2 mode");
+        exit(ERR_FAIL);
+    }
+    LOG_I(TAG, "Blinking LED with LPUART1 open");
+    if (blink_led() != SYS_OK) {
+        LOG_E(TAG, "Power test failed, clock not restored after Stop mode");
+        exit(ERR_FAIL);
+    }
+    usart = UART_open(USART_2, &uart_cfg, &err);
+    if (usart == NULL || power_select_mode(BLINK_MS) != POWER_SLEEP) {
+        LOG_E(TAG, "Power test failed, USART2 did not limit idle mode");
+        exit(ERR_FAIL);
+    }
+    LOG_I(TAG, "Blinking LED with USART2 open");
+    if (blink_led() != SYS_OK) {
+        LOG_E(TAG, "Power test failed, clock changed in Sleep mode");
+        exit(ERR_FAIL);
+    }
+    UART_close(usart);
+    UART_close(lpuart);
+    if (power_select_mode(BLINK_MS) != POWER_STOP2) {
+        LOG_E(TAG, "Power test failed, closed UART still limits idle mode");
+        exit(ERR_FAIL);
+    }
+    LOG_I(TAG, "Power test passed");
+}
+
+/**
+ * Testing entry point. Tests low power idle
+ */
+int main() {
+    const char *TAG = "main";
+    task_config_t cfg = DEFAULT_TASK_CONFIG;
+    /* Init system */
+    system_init();
+    cfg.task_name = "Test Task";
+    if (task_create(test_task, NULL, &cfg) == NULL) {
+        LOG_E(TAG, "Failed to create rtos task");
+        return ERR_FAIL;
+    }
+    LOG_I(TAG, "Starting RTOS");
+    rtos_start();
+    return SYS_OK;
+}
@@ -0,0 +1,187 @@
+/**
+ * @file uart_async_test.c
+ * Tests asynchronous UART writes on LPUART1. Each message is sent as a
+ * header, payload and trailer from three separate buffers, without copying
+ * them. The first request notifies the test task, and several requests are
+ * then queued back to back, each counting its completion in a callback. The
+ * requests must complete in the order they were queued. The test runs with
+ * interrupt driven transmission, then again in DMA mode.
+ *
+ * The test requires a serial terminal at 115200 baud on the ST-Link virtual
+ * COM port. Here is the expected output from LPUART1:
+ * [async] notified write 0 [end]
+ * [async] queued write 1 [end]
+ * [async] queued write 2 [end]
+ * [async] queued write 3 [end]
+ * [async] notified write 0 [end]
+ * [async] queued write 1 [end]
+ * [async] queued write 2 [end]
+ * [async] queued write 3 [end]
+ *
+ * Here is the expected output from the system log:
+ * Async writes passed with interrupt transmission
+ * Async writes passed with DMA transmission
+ * UART async test passed
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <drivers/clock/clock.h>
+#include <drivers/gpio/gpio.h>
+#include <drivers/uart/uart.h>
+#include <sys/task/task.h>
+#include <util/logging/logging.h>
+
+#define QUEUED_WRITES 3
+#define NOTIFY_DONE 0x1
+#define WRITE_TIMEOUT 100
+
+static void test_task(void *arg);
+static void count_callback(void *arg);
+
+static const char *TAG = "UART Async Test";
+static const char header[] = "[async] ";
+static const char trailer[] = " [end]\r\n";
+static volatile int completions = 0;
+
+/**
+ * Initializes system, and the LPUART1 pins
+ */
+static void system_init() {
+    clock_cfg_t clk_cfg = CLOCK_DEFAULT_CONFIG;
+    GPIO_config_t uart_gpio = GPIO_DEFAULT_CONFIG;
+    clock_init(&clk_cfg);
+    uart_gpio.alternate_func = GPIO_af8;
+    uart_gpio.mode = GPIO_mode_afunc;
+    uart_gpio.pullup_pulldown = GPIO_pullup; // UART is idle high
+    uart_gpio.output_speed = GPIO_speed_vhigh;
+    GPIO_config(GPIO_PA2, &uart_gpio);
+    GPIO_config(GPIO_PA3, &uart_gpio);
+}
+
+/**
+ * Write completion callback. Checks requests complete in order
+ * @param arg: index of the completed request, counting from 1
+ */
+static void count_callback(void *arg) {
+    if ((int)(uintptr_t)arg == completions + 1) {
+        completions++;
+    }
+}
+
+/**
+ * Sets up a three buffer write request for a message
+ * @param req: request to set up
+ * @param iov: iovec list for the request, with three entries
+ * @param payload: message payload
+ */
+static void setup_request(UART_write_req_t *req, UART_iovec_t *iov,
+                          const char *payload) {
+    iov[0].base = (const uint8_t *)header;
+    iov[0].len = strlen(header);
+    iov[1].base = (const uint8_t *)payload;
+    iov[1].len = strlen(payload);
+    iov[2].base = (const uint8_t *)trailer;
+    iov[2].len = strlen(trailer);
+    memset(req, 0, sizeof(*req));
+    req->iov = iov;
+    req->iovcnt = 3;
+}
+
+/**
+ * Runs the asynchronous write tests on LPUART1
+ * @param dmamode: UART DMA mode to test with
+ * @return true if the tests passed
+ */
+static bool run_async_writes(UART_dmamode_t dmamode) {
+    UART_config_t uart_cfg = UART_DEFAULT_CONFIG;
+    UART_write_req_t reqs[QUEUED_WRITES + 1], empty_req = {0};
+    UART_iovec_t iovs[QUEUED_WRITES + 1][3];
+    char payloads[QUEUED_WRITES + 1][20];
+    UART_iovec_t empty = {.base = (const uint8_t *)header, .len = 0};
+    UART_handle_t lpuart;
+    syserr_t err;
+    int i;
+    bool passed = true;
+    uart_cfg.UART_dmamode = dmamode;
+    lpuart = UART_open(LPUART_1, &uart_cfg, &err);
+    if (lpuart == NULL) {
+        LOG_E(TAG, "Could not open LPUART1");
+        return false;
+    }
+    // First request notifies the test task
+    snprintf(payloads[0], sizeof(payloads[0]), "notified write 0");
+    setup_request(&reqs[0], iovs[0], payloads[0]);
+    reqs[0].task = get_active_task();
+    reqs[0].bits = NOTIFY_DONE;
+    if (UART_write_async(lpuart, &reqs[0]) != SYS_OK ||
+        task_notify_wait(NOTIFY_DONE, NOTIFY_CLEAR, NULL, WRITE_TIMEOUT) !=
+            SYS_OK ||
+        UART_write_pending(&reqs[0])) {
+        LOG_E(TAG, "Notified write did not complete");
+        passed = false;
+    }
+    // Queue the remaining requests while earlier ones are still sending
+    completions = 0;
+    for (i = 1; i <= QUEUED_WRITES && passed; i++) {
+        snprintf(payloads[i], sizeof(payloads[i]), "queued write %d", i);
+        setup_request(&reqs[i], iovs[i], payloads[i]);
+        reqs[i].callback = count_callback;
+        reqs[i].arg = (void *)(uintptr_t)i;
+        if (UART_write_async(lpuart, &reqs[i]) != SYS_OK) {
+            LOG_E(TAG, "Could not queue write %d", i);
+            passed = false;
+        }
+    }
+    // A request with no data is rejected
+    empty_req.iov = &empty;
+    empty_req.iovcnt = 1;
+    if (UART_write_async(lpuart, &empty_req) != ERR_BADPARAM) {
+        LOG_E(TAG, "Empty write was queued");
+        passed = false;
+    }
+    // Closing the UART waits for all queued writes to be sent
+    UART_close(lpuart);
+    if (passed && completions != QUEUED_WRITES) {
+        LOG_E(TAG, "%d of %d queued writes completed in order", completions,
+              QUEUED_WRITES);
+        passed = false;
+    }
+    return passed;
+}
+
+/**
+ * Test task entry point. Runs the tests with and without DMA
+ * @param arg: unused.
+ */
+static void test_task(void *arg) {
+    if (!run_async_writes(UART_dma_dis)) {
+        LOG_E(TAG, "UART async test failed with interrupt transmission");
+        exit(ERR_FAIL);
+    }
+    LOG_I(TAG, "Async writes passed with interrupt transmission");
+    if (!run_async_writes(UART_dma_en)) {
+        LOG_E(TAG, "UART async test failed with DMA transmission");
+        exit(ERR_FAIL);
+    }
+    LOG_I(TAG, "Async writes passed with DMA transmission");
+    LOG_I(TAG, "UART async test passed");
+}
+
+/**
+ * Testing entry point. Tests asynchronous UART writes
+ */
+int main() {
+    task_config_t cfg = DEFAULT_TASK_CONFIG;
+    /* Init system */
+    system_init();
+    cfg.task_name = "Test Task";
+    if (task_create(test_task, NULL, &cfg) == NULL) {
+        LOG_E(TAG, "Failed to create rtos task");
+        return ERR_FAIL;
+    }
+    rtos_start();
+    return SYS_OK;
+}
@@ -9,16 +9,25 @@
 #include <config.h>
 #include <drivers/clock/clock.h>
 #include <drivers/device/device.h>
+#include <drivers/power/power.h>
 #include <sys/err.h>
 #include <sys/isr/isr.h>
+#include <sys/kmem/kmem.h>
 #include <sys/semaphore/semaphore.h>
 #include <sys/task/task.h>
+#include <sys/workqueue/workqueue.h>
 #include <util/bitmask.h>
 #include <util/logging/logging.h>
 #include <util/ringbuf/ringbuf.h>
 
 #include "uart.h"
 
+/** UART events, signalled from interrupts to tasks. See UART_signal */
+#define UART_EVENT_READ 0x1    /*!< Data is available in the read buffer */
+#define UART_EVENT_WRITE 0x2   /*!< Space is available in the write buffer */
+#define UART_EVENT_TX_DONE 0x4 /*!< Transmission has completed */
+#define UART_EVENT_DROPPED 0x8 /*!< Received data was dropped */
+
 /**
  * UART device state
  */
@@ -37,20 +46,85 @@ typedef struct {
     volatile bool tx_active; /*!< Is UART transmission active */
     RingBuf_t write_buf;     /*!< UART write ring buffer (outgoing data)*/
     RingBuf_t read_buf;      /*!< UART read ring buffer (incoming data)*/
+    uint8_t *rx_alloc;       /*!< Read buffer, if allocated by the driver */
+    uint8_t *tx_alloc;       /*!< Write buffer, if allocated by the driver */
     UART_periph_t periph_id; /*!< Identifies the peripheral handle references */
     char echo_char;          /*!< Next echo character to send on TX line */
     semaphore_t write_sem;   /*!< Posted to when space exists in write buffer */
     semaphore_t read_sem;    /*!< Posted to when data exists in read buffer */
     semaphore_t tx_sem;      /*!< Posted to when transmission completes */
+    semaphore_static_t write_sem_storage; /*!< Storage for write_sem */
+    semaphore_static_t read_sem_storage;  /*!< Storage for read_sem */
+    semaphore_static_t tx_sem_storage;    /*!< Storage for tx_sem */
+    mutex_t write_lock;      /*!< Serializes tasks writing to the UART */
+    mutex_t read_lock;       /*!< Serializes tasks reading from the UART */
+    mutex_static_t write_lock_storage; /*!< Storage for write_lock */
+    mutex_static_t read_lock_storage;  /*!< Storage for read_lock */
+    uint32_t dma_rx_pos; /*!< Read buffer index DMA has been processed up to */
+    volatile bool dma_rx_overrun; /*!< Set when DMA overwrote unread data */
+    uint32_t dma_tx_len; /*!< Length of DMA transmission in progress */
+    power_mode_t power_mode; /*!< Deepest idle power mode the UART works in */
+    bool power_limited;      /*!< Is the idle power mode limited by the UART */
+    clock_notifier_t clock_notifier; /*!< Updates baud rate on clock changes */
+    work_t work;              /*!< Handles deferred events in task context */
+    uint32_t deferred_events; /*!< Events waiting for the work item */
+    UART_write_req_t *tx_queue;      /*!< Queued asynchronous writes */
+    UART_write_req_t *tx_queue_tail; /*!< Last queued asynchronous write */
+    bool dma_tx_req; /*!< Is DMA sending from the head asynchronous write? */
 } UART_status_t;
 
-#define UART_RINGBUF_SIZE 80
+/**
+ * DMA channel assignment for a UART
+ */
+typedef struct {
+    DMA_TypeDef *dma;              /*!< DMA controller */
+    DMA_Request_TypeDef *cselr;    /*!< DMA controller request selection */
+    uint32_t dma_en;               /*!< RCC AHB1ENR bit for DMA controller */
+    DMA_Channel_TypeDef *tx_chan;  /*!< DMA TX channel */
+    DMA_Channel_TypeDef *rx_chan;  /*!< DMA RX channel */
+    uint32_t tx_num;               /*!< DMA TX channel number */
+    uint32_t rx_num;               /*!< DMA RX channel number */
+    IRQn_Type tx_irq;              /*!< DMA TX channel interrupt */
+    IRQn_Type rx_irq;              /*!< DMA RX channel interrupt */
+    uint32_t request;              /*!< DMA request number for this UART */
+} UART_dma_map_t;
 
 static UART_status_t UARTS[NUM_UARTS] = {0};
-static uint8_t UART_RBUFFS[NUM_UARTS][UART_RINGBUF_SIZE];
-static uint8_t UART_WBUFFS[NUM_UARTS][UART_RINGBUF_SIZE];
+
+/**
+ * DMA channels used by each UART. See the DMA request mapping tables in the
+ * reference manual.
+ */
+static const UART_dma_map_t UART_DMA_MAP[NUM_UARTS] = {
+    [LPUART_1] = {DMA2, DMA2_CSELR, RCC_AHB1ENR_DMA2EN, DMA2_Channel6,
+                  DMA2_Channel7, 6, 7, DMA2_Channel6_IRQn, DMA2_Channel7_IRQn,
+                  4},
+    [USART_1] = {DMA1, DMA1_CSELR, RCC_AHB1ENR_DMA1EN, DMA1_Channel4,
+                 DMA1_Channel5, 4, 5, DMA1_Channel4_IRQn, DMA1_Channel5_IRQn,
+                 2},
+    [USART_2] = {DMA1, DMA1_CSELR, RCC_AHB1ENR_DMA1EN, DMA1_Channel7,
+                 DMA1_Channel6, 7, 6, DMA1_Channel7_IRQn, DMA1_Channel6_IRQn,
+                 2},
+    [USART_3] = {DMA1, DMA1_CSELR, RCC_AHB1ENR_DMA1EN, DMA1_Channel2,
+                 DMA1_Channel3, 2, 3, DMA1_Channel2_IRQn, DMA1_Channel3_IRQn,
+                 2},
+};
+
+/** Offset of a DMA channel's flags within the DMA ISR and IFCR registers */
+#define DMA_FLAG_SHIFT(chan_num) (((chan_num)-1) * 4)
 
 static void UART_interrupt(void);
+static inline void UART_signal(UART_status_t *handle, uint32_t events);
+static void UART_handle_events(UART_status_t *handle, uint32_t events);
+static void UART_work(void *arg);
+static void UART_dma_tx_interrupt(void);
+static void UART_dma_rx_interrupt(void);
+static void UART_dma_enable(UART_status_t *handle);
+static void UART_dma_disable(UART_status_t *handle);
+static void UART_dma_start_tx(UART_status_t *handle);
+static void UART_dma_rx_update(UART_status_t *handle);
+static void UART_dma_rx_resync(UART_status_t *handle);
+static syserr_t UART_setup_buffers(UART_status_t *handle);
 static void UART_transmit(UART_status_t *handle);
 static int UART_bufwrite(UART_status_t *uart, uint8_t *buf, int len);
 static syserr_t UART_set_wordlen(UART_status_t *handle, UART_wordlen_t wlen);
@@ -61,7 +135,13 @@ static syserr_t UART_set_pinswap(UART_status_t *handle, UART_pinswap_t swap);
 static syserr_t UART_set_msb(UART_status_t *handle, UART_bitorder_t bitorder);
 static syserr_t UART_set_flowcontrol(UART_status_t *dev, UART_flow_control_t f);
 static syserr_t UART_set_baudrate(UART_status_t *handle, UART_baud_rate_t baud);
+static syserr_t UART_set_lowpower(UART_status_t *handle);
 static syserr_t UART_start_tx(UART_status_t *handle);
+static void UART_kick_tx(UART_status_t *handle);
+static inline bool UART_req_skip(UART_write_req_t *req);
+static void UART_req_consume(UART_status_t *handle, uint32_t len);
+static inline bool UART_poll_expired(uint64_t start, int timeout);
+static void UART_clock_change(clock_change_t event, void *arg);
 
 /**
  * Opens a UART or LPUART device for read/write access
@@ -90,32 +170,32 @@ UART_handle_t UART_open(UART_periph_t periph, UART_config_t *config,
     handle->state = UART_dev_open;
     handle->tx_active = false;
     handle->echo_char = '\0';
+    handle->dma_rx_pos = 0;
+    handle->dma_rx_overrun = false;
+    handle->dma_tx_len = 0;
+    handle->dma_tx_req = false;
+    handle->tx_queue = NULL;
+    handle->tx_queue_tail = NULL;
+    handle->rx_alloc = NULL;
+    handle->tx_alloc = NULL;
+    handle->power_limited = false;
     memcpy(&handle->cfg, config, sizeof(UART_config_t));
     // Setup read and write buffers
-    buf_init(&handle->read_buf, UART_RBUFFS[periph], UART_RINGBUF_SIZE);
-    buf_init(&handle->write_buf, UART_WBUFFS[periph], UART_RINGBUF_SIZE);
-    // Setup semaphores
-    if (rtos_started()) {
-        handle->write_sem = handle->tx_sem = handle->read_sem = NULL;
-        handle->write_sem = semaphore_create_binary();
-        if (handle->write_sem == NULL) {
-            *err = ERR_NOMEM;
-            UART_close(handle);
-            return NULL;
-        }
-        handle->read_sem = semaphore_create_binary();
-        if (handle->read_sem == NULL) {
-            *err = ERR_NOMEM;
-            UART_close(handle);
-            return NULL;
-        }
-        handle->tx_sem = semaphore_create_binary();
-        if (handle->tx_sem == NULL) {
-            *err = ERR_NOMEM;
-            UART_close(handle);
-            return NULL;
-        }
+    *err = UART_setup_buffers(handle);
+    if (*err != SYS_OK) {
+        handle->state = UART_dev_closed;
+        return NULL;
     }
+    /**
+     * Setup semaphores. These use storage within the UART handle, so they
+     * cannot fail and are ready if the UART is opened before the RTOS starts.
+     */
+    handle->write_sem =
+        semaphore_create_binary_static(&handle->write_sem_storage);
+    handle->read_sem = semaphore_create_binary_static(&handle->read_sem_storage);
+    handle->tx_sem = semaphore_create_binary_static(&handle->tx_sem_storage);
+    handle->write_lock = mutex_create_static(&handle->write_lock_storage);
+    handle->read_lock = mutex_create_static(&handle->read_lock_storage);
     /**
      * Record the UART peripheral address into the config structure
      * Here we also enable the clock for the relevant UART device,
@@ -126,6 +206,21 @@ UART_handle_t UART_open(UART_periph_t periph, UART_config_t *config,
         UART_close(handle);
         return NULL;
     }
+    /* Configure operation in low power idle modes */
+    *err = UART_set_lowpower(handle);
+    if (*err != SYS_OK) {
+        UART_close(handle);
+        return NULL;
+    }
+    /* Set up the work item that handles deferred interrupt events */
+    if (handle->cfg.UART_defermode == UART_defer_en) {
+        handle->deferred_events = 0;
+        *err = work_init(&handle->work, UART_work, handle);
+        if (*err != SYS_OK) {
+            UART_close(handle);
+            return NULL;
+        }
+    }
     /**
      * Configure the UART module according to the UART config provided
      * Register description can be found at p.1238 of datasheet
@@ -179,11 +274,33 @@ UART_handle_t UART_open(UART_periph_t periph, UART_config_t *config,
     if (handle->cfg.UART_baud_rate == UART_baud_auto) {
         SETBITS(handle->regs->CR2, USART_CR2_ABREN);
     }
-    // Enable the transmitter and receiver
-    SETBITS(handle->regs->CR1, USART_CR1_RE);
-    // Enable transmit complete and receive interrupts
-    SETBITS(handle->regs->CR1, USART_CR1_RXNEIE);
-    SETBITS(handle->regs->CR1, USART_CR1_TCIE);
+    if (handle->cfg.UART_dmamode == UART_dma_en) {
+        if (handle->cfg.UART_echomode == UART_echo_en) {
+            // Echo requires handling each character as it arrives
+            *err = ERR_NOSUPPORT;
+            UART_close(handle);
+            return NULL;
+        }
+        /**
+         * Start circular DMA reception, and enable the idle line interrupt so
+         * data is processed when the line goes quiet. The transmit complete
+         * interrupt is only enabled once the last DMA transmission finishes
+         */
+        UART_dma_enable(handle);
+        SETBITS(handle->regs->CR1, USART_CR1_IDLEIE);
+        // Enable the receiver
+        SETBITS(handle->regs->CR1, USART_CR1_RE);
+    } else {
+        // Enable the transmitter and receiver
+        SETBITS(handle->regs->CR1, USART_CR1_RE);
+        // Enable transmit complete and receive interrupts
+        SETBITS(handle->regs->CR1, USART_CR1_RXNEIE);
+        SETBITS(handle->regs->CR1, USART_CR1_TCIE);
+    }
+    // Recompute the baud rate when the system clock profile changes
+    handle->clock_notifier.callback = UART_clock_change;
+    handle->clock_notifier.arg = handle;
+    clock_register_notifier(&handle->clock_notifier);
     return handle;
 }
 
@@ -197,6 +314,8 @@ UART_handle_t UART_open(UART_periph_t periph, UART_config_t *config,
  */
 int UART_read(UART_handle_t handle, uint8_t *buf, uint32_t len, syserr_t *err) {
     int num_read, timeout;
+    uint64_t start;
+    bool locked;
     UART_status_t *uart = (UART_status_t *)handle;
     // Verify inputs
     if (handle == NULL || buf == NULL) {
@@ -204,19 +323,27 @@ int UART_read(UART_handle_t handle, uint8_t *buf, uint32_t len, syserr_t *err) {
         return -1;
     }
     /**
-     * First, we must disable interrupts. If we don't do so, then we may get
-     * inconsistent data from the ring buffer
+     * The UART interrupt is the only producer for the read buffer, so it is
+     * safe to read without masking interrupts as long as only one task
+     * reads at a time.
      */
-    mask_irq();
+    locked = rtos_started() && !in_isr();
+    if (locked &&
+        mutex_lock(uart->read_lock, uart->cfg.UART_read_timeout) != SYS_OK) {
+        *err = ERR_INUSE;
+        return -1;
+    }
+    if (uart->dma_rx_overrun) {
+        UART_dma_rx_resync(uart);
+    }
     // Now, attempt to read data from the input ring buffer
     num_read = buf_readblock(&(uart->read_buf), buf, len);
-    // reenable interrupts
-    unmask_irq();
     if (rtos_started()) {
         // Pend on the read semaphore with no timeout to ensure it is 0
         semaphore_pend(uart->read_sem, 0);
     }
     timeout = (int)uart->cfg.UART_read_timeout;
+    start = timestamp_us();
     while (num_read < len && timeout != UART_TIMEOUT_NONE) {
         /**
          * Wait for data to be available. For now, we will simply poll the
@@ -237,32 +364,28 @@ int UART_read(UART_handle_t handle, uint8_t *buf, uint32_t len, syserr_t *err) {
                 }
             } else {
                 /**
-                 * If the timeout is infinite, spin here until there is data to
-                 * read
+                 * Poll until there is data to read. If the timeout is
+                 * infinite, this spins until data arrives.
                  */
-                if (timeout != UART_TIMEOUT_INF) {
-                    // Decrement timeout
-                    blocking_delay_ms(200);
-                    timeout -= 200;
-                    if (timeout - 200 < UART_TIMEOUT_NONE) {
-                        // Just set timeout to NONE (defined to be zero)
-                        timeout = UART_TIMEOUT_NONE;
-                    } else {
-                        timeout -= 200;
-                    }
+                if (UART_poll_expired(start, timeout)) {
+                    timeout = UART_TIMEOUT_NONE;
                 }
             }
         }
-        mask_irq();
+        if (uart->dma_rx_overrun) {
+            UART_dma_rx_resync(uart);
+        }
         // Now, there is data available in the buffer. Read it.
         num_read +=
             buf_readblock(&(uart->read_buf), buf + num_read, len - num_read);
-        unmask_irq();
     }
     if (timeout == UART_TIMEOUT_NONE &&
         uart->cfg.UART_read_timeout != UART_TIMEOUT_NONE) {
         *err = ERR_TIMEOUT;
     }
+    if (locked) {
+        mutex_unlock(uart->read_lock);
+    }
     return num_read;
 }
 
@@ -277,6 +400,8 @@ int UART_read(UART_handle_t handle, uint8_t *buf, uint32_t len, syserr_t *err) {
 int UART_write(UART_handle_t handle, uint8_t *buf, uint32_t len,
                syserr_t *err) {
     int num_written, write_len, timeout, remaining_writes;
+    uint64_t start;
+    bool locked;
     UART_status_t *uart = (UART_status_t *)handle;
     // Verify inputs
     if (handle == NULL || buf == NULL) {
@@ -289,13 +414,18 @@ int UART_write(UART_handle_t handle, uint8_t *buf, uint32_t len,
     *err = SYS_OK;
     remaining_writes = len;
     /**
-     * First, disable interrupts so we do not place bad data into the output
-     * ring buffer
+     * The UART interrupt is the only consumer for the write buffer, so it is
+     * safe to write without masking interrupts as long as only one task
+     * writes at a time.
      */
-    mask_irq();
+    locked = rtos_started() && !in_isr();
+    if (locked &&
+        mutex_lock(uart->write_lock, uart->cfg.UART_write_timeout) != SYS_OK) {
+        *err = ERR_INUSE;
+        return -1;
+    }
     // Now write data to the ring buffer
     num_written = UART_bufwrite(uart, buf, remaining_writes);
-    unmask_irq();
     // Advance the offset of buffer, and decrease len
     buf += num_written;
     remaining_writes -= num_written;
@@ -303,16 +433,20 @@ int UART_write(UART_handle_t handle, uint8_t *buf, uint32_t len,
     *err = UART_start_tx(uart);
     if (*err != SYS_OK) {
         // UART is likely already in use for transmission
+        if (locked) {
+            mutex_unlock(uart->write_lock);
+        }
         return -1;
     }
     timeout = uart->cfg.UART_write_timeout;
+    start = timestamp_us();
     if (rtos_started()) {
         // Pend on the write semaphore with no delay, to make sure it is 0
         semaphore_pend(uart->write_sem, 0);
     }
     while (num_written < len && timeout != UART_TIMEOUT_NONE) {
         // Wait for there to be space in the ringbuffer
-        while (buf_getsize(&(uart->write_buf)) == UART_RINGBUF_SIZE &&
+        while (buf_getspace(&(uart->write_buf)) == 0 &&
                timeout != UART_TIMEOUT_NONE) {
             if (rtos_started()) {
                 // Pend on the write semaphore until space is available
@@ -327,17 +461,13 @@ int UART_write(UART_handle_t handle, uint8_t *buf, uint32_t len,
                 }
             } else {
                 // If the timeout is set to infinity, we should just spin here
-                if (timeout != UART_TIMEOUT_INF) {
-                    // Decrement the timeout
-                    blocking_delay_ms(1);
-                    timeout--;
+                if (UART_poll_expired(start, timeout)) {
+                    timeout = UART_TIMEOUT_NONE;
                 }
             }
         }
         // There is space to write data. Write it.
-        mask_irq();
         write_len = UART_bufwrite(uart, buf, remaining_writes);
-        unmask_irq();
         num_written += write_len;
         buf += write_len;
         remaining_writes -= write_len;
@@ -357,14 +487,8 @@ int UART_write(UART_handle_t handle, uint8_t *buf, uint32_t len,
                 }
             }
         } else {
-            if (timeout != UART_TIMEOUT_INF) {
-                blocking_delay_ms(200);
-                if (timeout - 200 < UART_TIMEOUT_NONE) {
-                    // Just set timeout to NONE (defined to be zero)
-                    timeout = UART_TIMEOUT_NONE;
-                } else {
-                    timeout -= 200;
-                }
+            if (UART_poll_expired(start, timeout)) {
+                timeout = UART_TIMEOUT_NONE;
             }
         }
     }
@@ -372,9 +496,52 @@ int UART_write(UART_handle_t handle, uint8_t *buf, uint32_t len,
         // A timeout occurred
         *err = ERR_TIMEOUT;
     }
+    if (locked) {
+        mutex_unlock(uart->write_lock);
+    }
     return num_written;
 }
 
+/**
+ * Queues an asynchronous write to a UART or LPUART device, and returns
+ * without waiting. The buffers of the request are sent in order, in place,
+ * so no data is copied. In DMA mode, each buffer is sent by DMA. Requests
+ * are sent in the order they are queued, after any data already buffered by
+ * UART_write. Text mode replacement is not applied to asynchronous writes.
+ * Safe to call from interrupt context.
+ * @param handle: UART handle to access
+ * @param req: write request. MUST NOT already be queued
+ * @return SYS_OK if the request was queued, or ERR_BADPARAM if the request has
+ * no data to send or the UART is not open
+ */
+syserr_t UART_write_async(UART_handle_t handle, UART_write_req_t *req) {
+    UART_status_t *uart = (UART_status_t *)handle;
+    uint32_t state;
+    if (uart == NULL || req == NULL || (req->iov == NULL && req->iovcnt != 0) ||
+        uart->state != UART_dev_open) {
+        return ERR_BADPARAM;
+    }
+    req->_idx = 0;
+    req->_pos = 0;
+    req->_next = NULL;
+    if (UART_req_skip(req)) {
+        // Every buffer is empty
+        return ERR_BADPARAM;
+    }
+    req->_pending = true;
+    // The UART interrupts remove requests, so the queue is updated masked
+    state = mask_irq_save();
+    if (uart->tx_queue_tail != NULL) {
+        uart->tx_queue_tail->_next = req;
+    } else {
+        uart->tx_queue = req;
+    }
+    uart->tx_queue_tail = req;
+    UART_kick_tx(uart);
+    restore_irq_mask(state);
+    return SYS_OK;
+}
+
 /**
  * Closes a UART or LPUART device
  * @param handle: Handle to open uart device
@@ -393,25 +560,40 @@ syserr_t UART_close(UART_handle_t handle) {
             semaphore_pend(uart->tx_sem, SYS_TIMEOUT_INF);
         }
     }
-    // Free uart semaphores
-    if (rtos_started()) {
-        if (uart->write_sem) {
-            err = semaphore_destroy(uart->write_sem);
-            if (err != SYS_OK) {
-                return err;
-            }
+    // Fails if UART_open did not get far enough to register the notifier
+    clock_unregister_notifier(&uart->clock_notifier);
+    if (uart->cfg.UART_dmamode == UART_dma_en) {
+        UART_dma_disable(uart);
+    }
+    // Destroy uart semaphores
+    if (uart->write_sem) {
+        err = semaphore_destroy(uart->write_sem);
+        if (err != SYS_OK) {
+            return err;
         }
-        if (uart->read_sem) {
-            err = semaphore_destroy(uart->read_sem);
-            if (err != SYS_OK) {
-                return err;
-            }
+    }
+    if (uart->read_sem) {
+        err = semaphore_destroy(uart->read_sem);
+        if (err != SYS_OK) {
+            return err;
         }
-        if (uart->tx_sem) {
-            err = semaphore_destroy(uart->tx_sem);
-            if (err != SYS_OK) {
-                return err;
-            }
+    }
+    if (uart->tx_sem) {
+        err = semaphore_destroy(uart->tx_sem);
+        if (err != SYS_OK) {
+            return err;
+        }
+    }
+    if (uart->write_lock) {
+        err = mutex_destroy(uart->write_lock);
+        if (err != SYS_OK) {
+            return err;
+        }
+    }
+    if (uart->read_lock) {
+        err = mutex_destroy(uart->read_lock);
+        if (err != SYS_OK) {
+            return err;
         }
     }
     switch (uart->periph_id) {
@@ -447,46 +629,158 @@ syserr_t UART_close(UART_handle_t handle) {
         return ERR_BADPARAM;
         break;
     }
+    if (uart->cfg.UART_defermode == UART_defer_en) {
+        // Interrupts are disabled, so the work item cannot be queued again
+        work_cancel(&uart->work);
+    }
+    // Release any buffers the driver allocated
+    kmem_free(uart->rx_alloc);
+    kmem_free(uart->tx_alloc);
+    uart->rx_alloc = NULL;
+    uart->tx_alloc = NULL;
+    // Allow deeper idle power modes again
+    if (uart->power_limited) {
+        power_unlimit(uart->power_mode);
+        uart->power_limited = false;
+    }
     // Close UART device
     uart->state = UART_dev_closed;
     return SYS_OK;
 }
 
+/**
+ * Clock change notifier. Lets the transmission in progress finish at the old
+ * baud rate, then recomputes the baud rate divider for the new clock. The
+ * divider may only be written while the UART is disabled.
+ * @param event: clock change event
+ * @param arg: UART handle
+ */
+static void UART_clock_change(clock_change_t event, void *arg) {
+    UART_status_t *handle = (UART_status_t *)arg;
+    if (event == CLOCK_CHANGE_PRE) {
+        while (handle->tx_active) {
+            if (rtos_started()) {
+                semaphore_pend(handle->tx_sem, SYS_TIMEOUT_INF);
+            }
+        }
+        return;
+    }
+    CLEARBITS(handle->regs->CR1, USART_CR1_UE);
+    UART_set_baudrate(handle, handle->cfg.UART_baud_rate);
+    SETBITS(handle->regs->CR1, USART_CR1_UE);
+    if (handle->cfg.UART_baud_rate == UART_baud_auto) {
+        // Detect the baud rate again, against the new clock
+        SETBITS(handle->regs->RQR, USART_RQR_ABRRQ);
+    }
+}
+
 /**
  * Starts UART transmission. This function should only be called once data
  * is stored in the UART write buffer, to avoid constantly getting a TX
  * interrupt. The TC interrupt handler will disable TX interrupts once the
- * write buffer is drained.
+ * write buffer is drained. If the UART is already transmitting, the new data
+ * is sent once the data ahead of it has been sent.
  *
  * @param handle: UART handle to enable tx on
  * @return SYS_OK on success, or error on failure
  */
 static syserr_t UART_start_tx(UART_status_t *handle) {
-    if (handle->tx_active &&
-        handle->cfg.UART_write_timeout != UART_TIMEOUT_INF) {
-        // Device is already transmitting. Block this attempt to transmit
-        return ERR_INUSE;
-    } else {
-        // wait for the uart to be available for transmission
-        while (handle->tx_active) {
-            if (rtos_started()) {
-                semaphore_pend(handle->tx_sem, SYS_TIMEOUT_INF);
-            }
+    uint32_t state = mask_irq_save();
+    UART_kick_tx(handle);
+    restore_irq_mask(state);
+    return SYS_OK;
+}
+
+/**
+ * Makes sure the UART is transmitting, so newly buffered or queued data is
+ * sent. MUST be called with interrupts masked, so the TC interrupt cannot
+ * end the transmission in between.
+ * @param handle: UART handle to transmit for
+ */
+static void UART_kick_tx(UART_status_t *handle) {
+    if (!handle->tx_active) {
+        // Enable interrupts for this UART device, and set TX as active
+        handle->tx_active = true;
+        SETBITS(handle->regs->CR1, USART_CR1_TE);
+        if (handle->cfg.UART_dmamode == UART_dma_en) {
+            // Send the write buffer by DMA
+            UART_dma_start_tx(handle);
+        } else {
+            SETBITS(handle->regs->CR1, USART_CR1_TXEIE);
         }
+    } else if (handle->cfg.UART_dmamode == UART_dma_en) {
+        /**
+         * DMA may have finished, and be waiting for the last character to be
+         * sent. Starting the next DMA transfer has no effect otherwise
+         */
+        UART_dma_start_tx(handle);
+    }
+    // Otherwise the TXE interrupt is still enabled, and sends the new data
+}
+
+/**
+ * Skips the buffers of a write request that have been fully sent
+ * @param req: write request to skip sent buffers of
+ * @return true if every buffer of the request has been sent
+ */
+static inline bool UART_req_skip(UART_write_req_t *req) {
+    while (req->_idx < req->iovcnt && req->_pos == req->iov[req->_idx].len) {
+        req->_idx++;
+        req->_pos = 0;
+    }
+    return req->_idx == req->iovcnt;
+}
+
+/**
+ * Marks data of the asynchronous write at the head of the transmit queue as
+ * sent. Once all of its data is sent, the request is removed from the queue
+ * and completed. MUST be called from the UART interrupts, or with interrupts
+ * masked.
+ * @param handle: UART handle to consume data for
+ * @param len: number of bytes sent. MUST NOT pass the end of the current
+ * buffer of the request
+ */
+static void UART_req_consume(UART_status_t *handle, uint32_t len) {
+    UART_write_req_t *req = handle->tx_queue;
+    req->_pos += len;
+    if (!UART_req_skip(req)) {
+        return;
+    }
+    // The request is complete, and its buffers are no longer used
+    handle->tx_queue = req->_next;
+    if (handle->tx_queue == NULL) {
+        handle->tx_queue_tail = NULL;
+    }
+    req->_pending = false;
+    if (req->task != NULL) {
+        task_notify(req->task, req->bits);
+    }
+    if (req->callback != NULL) {
+        req->callback(req->arg);
     }
-    // Enable interrupts for this UART device, and set TX as active
-    handle->tx_active = true;
-    SETBITS(handle->regs->CR1, USART_CR1_TE);
-    SETBITS(handle->regs->CR1, USART_CR1_TXEIE);
-    return SYS_OK;
+}
+
+/**
+ * Checks if a timeout has expired while polling before the RTOS starts.
+ * Elapsed time is measured with timestamp_us, so polling is not delayed.
+ * @param start: timestamp_us value when the wait began
+ * @param timeout: timeout in ms. UART_TIMEOUT_INF never expires
+ * @return true if the timeout has expired
+ */
+static inline bool UART_poll_expired(uint64_t start, int timeout) {
+    if (timeout == UART_TIMEOUT_INF) {
+        return false;
+    }
+    return (timestamp_us() - start) >= (uint64_t)timeout * 1000UL;
 }
 
 /**
  * Transmits data on the UART device provided. Reads data from the device's
- * ring buffer
+ * ring buffer, then from queued asynchronous writes
  * @param handle: UART device to send data from ringbuffer on
  */
 static void UART_transmit(UART_status_t *handle) {
+    UART_write_req_t *req;
     char data;
     if (handle->cfg.UART_echomode == UART_echo_en &&
         handle->echo_char != '\0') {
@@ -505,10 +799,13 @@ static void UART_transmit(UART_status_t *handle) {
         if (buf_read(&(handle->write_buf), &data) == SYS_OK) {
             // Send by writing to the TDR register
             handle->regs->TDR = USART_TDR_TDR & data;
-            if (rtos_started()) {
-                // Post to the write semaphore
-                semaphore_post(handle->write_sem);
-            }
+            UART_signal(handle, UART_EVENT_WRITE);
+        } else if (handle->tx_queue != NULL) {
+            // Send the next byte of the head asynchronous write in place
+            req = handle->tx_queue;
+            data = req->iov[req->_idx].base[req->_pos];
+            handle->regs->TDR = USART_TDR_TDR & data;
+            UART_req_consume(handle, 1);
         }
     }
 }
@@ -518,34 +815,8 @@ static void UART_transmit(UART_status_t *handle) {
  */
 static void UART_interrupt(void) {
     char data;
-    UART_status_t *handle;
-    /**
-     * Use the exception number to determine which UART caused the interrupt
-     */
-    switch (READBITS(SCB->ICSR, SCB_ICSR_VECTACTIVE_Msk) - 16) {
-    /* Call the uart_handler function with the relevant UART device */
-    case USART1_IRQn:
-        handle = &UARTS[USART_1];
-        break;
-    case USART2_IRQn:
-        handle = &UARTS[USART_2];
-        break;
-    case USART3_IRQn:
-        handle = &UARTS[USART_3];
-        break;
-    case LPUART1_IRQn:
-        handle = &UARTS[LPUART_1];
-        break;
-    default:
-        /**
-         * Spin here. We want to stop processor as we
-         * should not be handling this exception.
-         */
-        while (1) {
-            // Spin
-        }
-        break;
-    }
+    // The UART that caused the interrupt is its context pointer
+    UART_status_t *handle = irq_context();
     /**
      * Now determine what flag caused the interrupt. We need to check for
      * the TXE and RXNE bits
@@ -567,18 +838,18 @@ static void UART_interrupt(void) {
         }
         // Store the data
         if (buf_write(&(handle->read_buf), data) != SYS_OK) {
-            LOG_MIN(SYSLOG_LEVEL_DEBUG, __FILE__,
-                    "Dropping character from UART");
             // Write 1 to RXFRQ to drop the data
             SETBITS(handle->regs->RQR, USART_RQR_RXFRQ);
-        } else if (rtos_started()) {
-            // post to read semaphore
-            semaphore_post(handle->read_sem);
+            UART_signal(handle, UART_EVENT_DROPPED);
+        } else {
+            UART_signal(handle, UART_EVENT_READ);
         }
     }
-    if (READBITS(handle->regs->ISR, USART_ISR_TC)) {
-        // Transmission is complete. Check if write buffer is empty.
-        if (buf_getsize(&(handle->write_buf)) == 0) {
+    if (READBITS(handle->regs->ISR, USART_ISR_TC) &&
+        READBITS(handle->regs->CR1, USART_CR1_TCIE)) {
+        // Transmission is complete. Check if there is more data to send.
+        if (buf_getsize(&(handle->write_buf)) == 0 &&
+            handle->tx_queue == NULL) {
             /**
              * Tranmission is no longer active. Wait for the TC bit to be set,
              * then clear it By waiting here, we ensure the UART is done
@@ -589,16 +860,24 @@ static void UART_interrupt(void) {
             handle->tx_active = false;
             // Disable the transmitter
             CLEARBITS(handle->regs->CR1, USART_CR1_TXEIE);
+            if (handle->cfg.UART_dmamode == UART_dma_en) {
+                // Re-enabled when the next DMA transmission finishes
+                CLEARBITS(handle->regs->CR1, USART_CR1_TCIE);
+            }
             CLEARBITS(handle->regs->CR1, USART_CR1_TE);
             // Clear the TC interrupt
             SETBITS(handle->regs->ICR, USART_ICR_TCCF);
-            if (rtos_started()) {
-                // Post to the transmission complete semaphore
-                semaphore_post(handle->tx_sem);
-            }
+            UART_signal(handle, UART_EVENT_TX_DONE);
         }
     }
-    if (READBITS(handle->regs->ISR, USART_ISR_TXE) && handle->tx_active) {
+    if (READBITS(handle->regs->ISR, USART_ISR_IDLE) &&
+        READBITS(handle->regs->CR1, USART_CR1_IDLEIE)) {
+        // The RX line went idle. Process data the DMA received.
+        SETBITS(handle->regs->ICR, USART_ICR_IDLECF);
+        UART_dma_rx_update(handle);
+    }
+    if (READBITS(handle->regs->ISR, USART_ISR_TXE) &&
+        READBITS(handle->regs->CR1, USART_CR1_TXEIE) && handle->tx_active) {
         /**
          * Transmit data register is empty and ready for a new char.
          */
@@ -606,6 +885,298 @@ static void UART_interrupt(void) {
     }
 }
 
+/**
+ * Signals UART events to waiting tasks. In deferred mode, the events are
+ * recorded and the UART work item is queued, so the interrupt does not wake
+ * tasks or log itself.
+ * @param handle: UART handle to signal events for
+ * @param events: UART_EVENT flags to signal
+ */
+static inline void UART_signal(UART_status_t *handle, uint32_t events) {
+    if (handle->cfg.UART_defermode == UART_defer_en && rtos_started()) {
+        __atomic_fetch_or(&handle->deferred_events, events, __ATOMIC_RELAXED);
+        work_submit(&handle->work);
+    } else {
+        UART_handle_events(handle, events);
+    }
+}
+
+/**
+ * Handles UART events, waking tasks waiting on the UART semaphores
+ * @param handle: UART handle to handle events for
+ * @param events: UART_EVENT flags to handle
+ */
+static void UART_handle_events(UART_status_t *handle, uint32_t events) {
+    if (events & UART_EVENT_DROPPED) {
+        LOG_MIN(SYSLOG_LEVEL_DEBUG, __FILE__, "Dropping characters from UART");
+    }
+    if (!rtos_started()) {
+        // No task can be waiting on the semaphores
+        return;
+    }
+    if (events & UART_EVENT_READ) {
+        semaphore_post(handle->read_sem);
+    }
+    if (events & UART_EVENT_WRITE) {
+        semaphore_post(handle->write_sem);
+    }
+    if (events & UART_EVENT_TX_DONE) {
+        semaphore_post(handle->tx_sem);
+    }
+}
+
+/**
+ * UART work item function. Handles the events interrupts deferred
+ * @param arg: UART handle the work item belongs to
+ */
+static void UART_work(void *arg) {
+    UART_status_t *handle = (UART_status_t *)arg;
+    uint32_t events;
+    // Events signalled from here on queue the work item again
+    events = __atomic_exchange_n(&handle->deferred_events, 0, __ATOMIC_RELAXED);
+    if (handle->state == UART_dev_open) {
+        UART_handle_events(handle, events);
+    }
+}
+
+/**
+ * Handles DMA transmit channel interrupts for UART devices
+ */
+static void UART_dma_tx_interrupt(void) {
+    uint32_t flags;
+    // The UART this DMA channel belongs to is its context pointer
+    UART_status_t *handle = irq_context();
+    const UART_dma_map_t *map = &UART_DMA_MAP[handle->periph_id];
+    flags = map->dma->ISR >> DMA_FLAG_SHIFT(map->tx_num);
+    // Clear all flags for this channel
+    map->dma->IFCR = DMA_IFCR_CGIF1 << DMA_FLAG_SHIFT(map->tx_num);
+    if (flags & (DMA_ISR_TCIF1 | DMA_ISR_TEIF1)) {
+        // Transmission finished. Release the data it sent.
+        CLEARBITS(map->tx_chan->CCR, DMA_CCR_EN);
+        if (handle->dma_tx_req) {
+            UART_req_consume(handle, handle->dma_tx_len);
+        } else {
+            buf_read_commit(&handle->write_buf, handle->dma_tx_len);
+            // Space is available in the write buffer
+            UART_signal(handle, UART_EVENT_WRITE);
+        }
+        handle->dma_tx_len = 0;
+        UART_dma_start_tx(handle);
+    }
+}
+
+/**
+ * Handles DMA receive channel interrupts for UART devices
+ */
+static void UART_dma_rx_interrupt(void) {
+    UART_status_t *handle = irq_context();
+    const UART_dma_map_t *map = &UART_DMA_MAP[handle->periph_id];
+    // Clear all flags for this channel
+    map->dma->IFCR = DMA_IFCR_CGIF1 << DMA_FLAG_SHIFT(map->rx_num);
+    // Half or full buffer was received
+    UART_dma_rx_update(handle);
+}
+
+/**
+ * Enables DMA for a UART, and starts circular reception into the read buffer
+ * @param handle: UART handle to enable DMA for
+ */
+static void UART_dma_enable(UART_status_t *handle) {
+    const UART_dma_map_t *map = &UART_DMA_MAP[handle->periph_id];
+    SETBITS(RCC->AHB1ENR, map->dma_en);
+    // Route the UART requests to its DMA channels
+    MODIFY_REG(map->cselr->CSELR, DMA_CSELR_C1S << ((map->tx_num - 1) * 4),
+               map->request << ((map->tx_num - 1) * 4));
+    MODIFY_REG(map->cselr->CSELR, DMA_CSELR_C1S << ((map->rx_num - 1) * 4),
+               map->request << ((map->rx_num - 1) * 4));
+    /**
+     * RX channel writes into the read buffer's full backing store, wrapping
+     * around. Half and full transfer interrupts make sure data is processed
+     * before the DMA can lap it.
+     */
+    map->rx_chan->CCR = 0;
+    map->rx_chan->CPAR = (uint32_t)&handle->regs->RDR;
+    map->rx_chan->CMAR = (uint32_t)handle->read_buf.buff;
+    map->rx_chan->CNDTR = handle->read_buf.len;
+    map->rx_chan->CCR =
+        DMA_CCR_MINC | DMA_CCR_CIRC | DMA_CCR_HTIE | DMA_CCR_TCIE;
+    // TX channel reads from memory into the transmit data register
+    map->tx_chan->CCR = 0;
+    map->tx_chan->CPAR = (uint32_t)&handle->regs->TDR;
+    map->tx_chan->CCR = DMA_CCR_MINC | DMA_CCR_DIR | DMA_CCR_TCIE |
+                        DMA_CCR_TEIE;
+    enable_irq(map->rx_irq, UART_dma_rx_interrupt, handle);
+    enable_irq(map->tx_irq, UART_dma_tx_interrupt, handle);
+    // Enable UART DMA requests, then start reception
+    SETBITS(handle->regs->CR3, USART_CR3_DMAR | USART_CR3_DMAT);
+    SETBITS(map->rx_chan->CCR, DMA_CCR_EN);
+}
+
+/**
+ * Disables DMA for a UART
+ * @param handle: UART handle to disable DMA for
+ */
+static void UART_dma_disable(UART_status_t *handle) {
+    const UART_dma_map_t *map = &UART_DMA_MAP[handle->periph_id];
+    CLEARBITS(handle->regs->CR3, USART_CR3_DMAR | USART_CR3_DMAT);
+    CLEARBITS(map->rx_chan->CCR, DMA_CCR_EN);
+    CLEARBITS(map->tx_chan->CCR, DMA_CCR_EN);
+    disable_irq(map->rx_irq);
+    disable_irq(map->tx_irq);
+}
+
+/**
+ * Starts a DMA transmission of the contiguous data at the read position of
+ * the write buffer. Data is sent in place, and released once the DMA
+ * completes. Once the write buffer is empty, the current buffer of the head
+ * asynchronous write is sent in place instead. If there is no data to send,
+ * enables the transmit complete interrupt to finish transmission. MUST be
+ * called with interrupts masked.
+ * @param handle: UART handle to transmit for
+ */
+static void UART_dma_start_tx(UART_status_t *handle) {
+    const UART_dma_map_t *map = &UART_DMA_MAP[handle->periph_id];
+    UART_write_req_t *req = handle->tx_queue;
+    uint8_t *region;
+    if (handle->dma_tx_len != 0) {
+        // Transmission already in progress
+        return;
+    }
+    handle->dma_tx_len = buf_read_region(&handle->write_buf, &region);
+    handle->dma_tx_req = false;
+    if (handle->dma_tx_len == 0 && req != NULL) {
+        region = (uint8_t *)req->iov[req->_idx].base + req->_pos;
+        handle->dma_tx_len = req->iov[req->_idx].len - req->_pos;
+        if (handle->dma_tx_len > 0xFFFF) {
+            // DMA transfer count register is 16 bits
+            handle->dma_tx_len = 0xFFFF;
+        }
+        handle->dma_tx_req = true;
+    }
+    if (handle->dma_tx_len == 0) {
+        // All data has been sent. Wait for the final character to finish.
+        SETBITS(handle->regs->CR1, USART_CR1_TCIE);
+        return;
+    }
+    // Clear transmission complete, so it only sets after this transfer
+    SETBITS(handle->regs->ICR, USART_ICR_TCCF);
+    map->tx_chan->CMAR = (uint32_t)region;
+    map->tx_chan->CNDTR = handle->dma_tx_len;
+    SETBITS(map->tx_chan->CCR, DMA_CCR_EN);
+}
+
+/**
+ * Adds data received by DMA to the read buffer. Finds the DMA write position,
+ * and commits all data written since the last update.
+ * @param handle: UART handle to process received data for
+ */
+static void UART_dma_rx_update(UART_status_t *handle) {
+    const UART_dma_map_t *map = &UART_DMA_MAP[handle->periph_id];
+    uint8_t *store = handle->read_buf.buff;
+    uint32_t size = handle->read_buf.len;
+    uint32_t pos, received, i;
+    if (handle->dma_rx_overrun) {
+        // Waiting for the reader to resynchronize the buffer
+        return;
+    }
+    pos = size - map->rx_chan->CNDTR;
+    if (pos == size) {
+        pos = 0;
+    }
+    received = (pos + size - handle->dma_rx_pos) % size;
+    if (received == 0) {
+        return;
+    }
+    if (handle->cfg.UART_textmode == UART_txtmode_en) {
+        // Transparently replace \r with \n in the new data
+        for (i = handle->dma_rx_pos; i != pos; i = (i + 1) % size) {
+            if (store[i] == '\r') {
+                store[i] = '\n';
+            }
+        }
+    }
+    if (received > buf_getspace(&handle->read_buf)) {
+        /**
+         * DMA has overwritten data that was not read yet. Only the reader
+         * may move the read index, so flag the overrun for it to handle.
+         */
+        handle->dma_rx_overrun = true;
+        UART_signal(handle, UART_EVENT_DROPPED | UART_EVENT_READ);
+    } else {
+        buf_write_commit(&handle->read_buf, received);
+        handle->dma_rx_pos = pos;
+        UART_signal(handle, UART_EVENT_READ);
+    }
+}
+
+/**
+ * Sets up the read and write buffers for a UART. Buffers provided in the UART
+ * configuration are used directly, and others are allocated.
+ * @param handle: UART handle to set up buffers for
+ * @return SYS_OK on success, ERR_BADPARAM for an invalid buffer size, or
+ * ERR_NOMEM if a buffer could not be allocated
+ */
+static syserr_t UART_setup_buffers(UART_status_t *handle) {
+    uint8_t *rx = handle->cfg.UART_rx_buf;
+    uint8_t *tx = handle->cfg.UART_tx_buf;
+    uint32_t rx_size = handle->cfg.UART_rx_bufsize;
+    uint32_t tx_size = handle->cfg.UART_tx_bufsize;
+    if (rx_size == 0 || tx_size == 0) {
+        return ERR_BADPARAM;
+    }
+    if (handle->cfg.UART_dmamode == UART_dma_en && rx_size > 0xFFFF) {
+        // DMA transfer count register is 16 bits
+        return ERR_BADPARAM;
+    }
+    if (rx == NULL) {
+        rx = handle->rx_alloc = kmem_alloc(KMEM_MSGBUF, rx_size);
+    }
+    if (tx == NULL) {
+        tx = handle->tx_alloc = kmem_alloc(KMEM_MSGBUF, tx_size);
+    }
+    if (rx == NULL || tx == NULL) {
+        kmem_free(handle->rx_alloc);
+        kmem_free(handle->tx_alloc);
+        handle->rx_alloc = NULL;
+        handle->tx_alloc = NULL;
+        return ERR_NOMEM;
+    }
+    buf_init(&handle->read_buf, rx, rx_size);
+    buf_init(&handle->write_buf, tx, tx_size);
+    return SYS_OK;
+}
+
+/**
+ * Recovers from a DMA receive overrun. Discards all buffered data, and
+ * restarts the read buffer at the current DMA position. Called by the reader,
+ * since the read index belongs to it.
+ * @param handle: UART handle to resynchronize
+ */
+static void UART_dma_rx_resync(UART_status_t *handle) {
+    const UART_dma_map_t *map = &UART_DMA_MAP[handle->periph_id];
+    uint32_t size = handle->read_buf.len;
+    uint32_t pos, skip, state;
+    uint8_t *region;
+    /**
+     * Overruns are rare, and the DMA interrupt must not run while both
+     * buffer indices are moved, so interrupts are masked here.
+     */
+    state = mask_irq_save();
+    buf_read_commit(&handle->read_buf, buf_getsize(&handle->read_buf));
+    pos = size - map->rx_chan->CNDTR;
+    if (pos == size) {
+        pos = 0;
+    }
+    // Move the now empty buffer forwards to the DMA position
+    buf_write_region(&handle->read_buf, &region);
+    skip = (pos + size - (region - handle->read_buf.buff)) % size;
+    buf_write_commit(&handle->read_buf, skip);
+    buf_read_commit(&handle->read_buf, skip);
+    handle->dma_rx_pos = pos;
+    handle->dma_rx_overrun = false;
+    restore_irq_mask(state);
+}
+
 /**
  * Writes data to a UART's output buffer, until the buffer is full or the
  * provided buffer is entirely written. returns the number of bytes written.
@@ -664,7 +1235,8 @@ static syserr_t UART_enable_periph(UART_status_t *handle,
         // Reset peripheral by toggling reset bit
         SETBITS(RCC->APB1RSTR2, RCC_APB1RSTR2_LPUART1RST);
         CLEARBITS(RCC->APB1RSTR2, RCC_APB1RSTR2_LPUART1RST);
-        enable_irq(LPUART1_IRQn, UART_interrupt); // Enable interrupts for this device
+        // Enable interrupts for this device
+        enable_irq(LPUART1_IRQn, UART_interrupt, handle);
         handle->regs = LPUART1;
         break;
     case USART_1:
@@ -672,7 +1244,8 @@ static syserr_t UART_enable_periph(UART_status_t *handle,
         // Reset peripheral by toggling reset bit
         SETBITS(RCC->APB2RSTR, RCC_APB2RSTR_USART1RST);
         CLEARBITS(RCC->APB2RSTR, RCC_APB2RSTR_USART1RST);
-        enable_irq(USART1_IRQn, UART_interrupt); // Enable interrupts for this device
+        // Enable interrupts for this device
+        enable_irq(USART1_IRQn, UART_interrupt, handle);
         handle->regs = USART1;
         break;
     case USART_2:
@@ -680,7 +1253,8 @@ static syserr_t UART_enable_periph(UART_status_t *handle,
         // Reset peripheral by toggling reset bit
         SETBITS(RCC->APB1RSTR1, RCC_APB1RSTR1_USART2RST);
         CLEARBITS(RCC->APB1RSTR1, RCC_APB1RSTR1_USART2RST);
-        enable_irq(USART2_IRQn, UART_interrupt); // Enable interrupts for this device
+        // Enable interrupts for this device
+        enable_irq(USART2_IRQn, UART_interrupt, handle);
         handle->regs = USART2;
         break;
     case USART_3:
@@ -688,7 +1262,8 @@ static syserr_t UART_enable_periph(UART_status_t *handle,
         // Reset peripheral by toggling reset bit
         SETBITS(RCC->APB1RSTR1, RCC_APB1RSTR1_USART3RST);
         CLEARBITS(RCC->APB1RSTR1, RCC_APB1RSTR1_USART2RST);
-        enable_irq(USART3_IRQn, UART_interrupt); // Enable interrupts for this device
+        // Enable interrupts for this device
+        enable_irq(USART3_IRQn, UART_interrupt, handle);
         handle->regs = USART3;
         break;
     default:
@@ -700,6 +1275,44 @@ static syserr_t UART_enable_periph(UART_status_t *handle,
     return SYS_OK;
 }
 
+/**
+ * Configures UART operation in low power idle modes, and limits the idle
+ * power mode to one the UART keeps working in. Without DMA, LPUART1 is clocked
+ * from HSI16 when low power idle is enabled, so it keeps receiving in Stop
+ * mode and wakes the core when data arrives. Other UARTs, and DMA transfers,
+ * stop in Stop mode.
+ * @param handle: UART device handle to configure
+ * @return SYS_OK on success, or error value on failure
+ */
+static syserr_t UART_set_lowpower(UART_status_t *handle) {
+#if SYS_LOW_POWER == LOW_POWER_ENABLED
+    clock_cfg_t cfg;
+    syserr_t ret;
+    if (handle->periph_id == LPUART_1 &&
+        handle->cfg.UART_dmamode != UART_dma_en) {
+        // HSI16 must run for LPUART1 in Run mode, and is restored on wake
+        clock_get_config(&cfg);
+        cfg.HSI16_freq = HSI16_freq_16MHz;
+        ret = clock_init(&cfg);
+        if (ret != SYS_OK) {
+            return ret;
+        }
+        MODIFY_REG(RCC->CCIPR, RCC_CCIPR_LPUART1SEL, RCC_CCIPR_LPUART1SEL_1);
+        // Keep LPUART1 enabled in Stop mode, and wake when data is received
+        SETBITS(handle->regs->CR1, USART_CR1_UESM);
+        SETBITS(handle->regs->CR3, USART_CR3_WUS);
+        handle->power_mode = POWER_STOP2;
+    } else {
+        handle->power_mode = POWER_SLEEP;
+    }
+#else
+    handle->power_mode = POWER_SLEEP;
+#endif
+    power_limit(handle->power_mode);
+    handle->power_limited = true;
+    return SYS_OK;
+}
+
 /**
  * Configures UART world length
  * @param handle: UART device handle to configure
@@ -860,7 +1473,13 @@ static syserr_t UART_set_baudrate(UART_status_t *handle,
      * Values used below are taken from datasheet pg.1274
      */
     if (handle->periph_id == LPUART_1) {
-        clk_freq = pclk1_freq();
+        // LPUART1 is clocked from HSI16 when it receives in Stop mode
+        if (READBITS(RCC->CCIPR, RCC_CCIPR_LPUART1SEL) ==
+            RCC_CCIPR_LPUART1SEL_1) {
+            clk_freq = hsi_freq();
+        } else {
+            clk_freq = pclk1_freq();
+        }
         switch (baud) {
         case UART_baud_1200:
             brr_val = (256UL * clk_freq) / 1200;
@@ -6,9 +6,11 @@
 #ifndef UART_H
 #define UART_H
 
+#include <stdbool.h>
 #include <stdint.h>
 
 #include <sys/err.h>
+#include <sys/task/task.h>
 
 /**
  * UART word lengths
@@ -95,6 +97,28 @@ typedef enum {
     UART_echo_en,  /*!< UART echo enabled */
 } UART_echomode_t;
 
+/**
+ * UART DMA setting. If enabled, received data is written into the read buffer
+ * by a circular DMA transfer, and transmitted data is sent from the write
+ * buffer by DMA. This avoids an interrupt per character. UART echo is not
+ * supported in DMA mode.
+ */
+typedef enum {
+    UART_dma_dis, /*!< Characters are moved by the UART interrupt */
+    UART_dma_en,  /*!< Characters are moved by DMA */
+} UART_dmamode_t;
+
+/**
+ * UART deferred interrupt setting. If enabled, the UART interrupts only move
+ * data. Waking tasks waiting to read or write, and logging dropped data, is
+ * deferred to a work queue task (see sys/workqueue/workqueue.h), so the
+ * interrupts stay short. Work is only deferred once the RTOS has started.
+ */
+typedef enum {
+    UART_defer_dis, /*!< Interrupts wake waiting tasks directly */
+    UART_defer_en,  /*!< Interrupts defer waking tasks to a work queue */
+} UART_defermode_t;
+
 /**
  * UART peripheral list. See datasheet for pin connections.
  */
@@ -112,6 +136,14 @@ typedef int UART_timeout_t;
 #define UART_TIMEOUT_NONE 0 // No timeout
 #define UART_TIMEOUT_INF -1 // Infinite timeout
 
+/**
+ * Default size of UART read and write buffers, used when no buffer is
+ * provided in the UART configuration. A power of two keeps buffer index
+ * wrapping cheap. Buffers that are not provided come from the message buffer
+ * pool when they fit in SYS_POOL_MSGBUF_SIZE, and from the heap otherwise.
+ */
+#define UART_DEFAULT_BUFSIZE 128
+
 /**
  * UART configuration structure
  */
@@ -127,6 +159,15 @@ typedef struct UART_config {
     UART_timeout_t UART_write_timeout;    /*!< UART write timeout */
     UART_txtmode_t UART_textmode;         /*!< UART replaces LF with CRLF */
     UART_echomode_t UART_echomode; /*!< UART echo mode (echo data on tx line) */
+    UART_dmamode_t UART_dmamode;   /*!< UART DMA mode */
+    UART_defermode_t UART_defermode; /*!< UART deferred interrupt mode */
+    uint8_t *UART_rx_buf;   /*!< Optional read buffer storage. If NULL, a
+                               buffer is allocated when the UART is opened */
+    uint32_t UART_rx_bufsize; /*!< Size of read buffer. In DMA mode, must be
+                                 at most 65535 */
+    uint8_t *UART_tx_buf;     /*!< Optional write buffer storage. If NULL, a
+                                 buffer is allocated when the UART is opened */
+    uint32_t UART_tx_bufsize; /*!< Size of write buffer */
 } UART_config_t;
 
 #define UART_DEFAULT_CONFIG                                                    \
@@ -137,13 +178,48 @@ typedef struct UART_config {
         .UART_baud_rate = UART_baud_115200,                                    \
         .UART_read_timeout = UART_TIMEOUT_INF,                                 \
         .UART_write_timeout = UART_TIMEOUT_INF,                                \
-        .UART_textmode = UART_txtmode_dis, .UART_echomode = UART_echo_dis     \
+        .UART_textmode = UART_txtmode_dis, .UART_echomode = UART_echo_dis,     \
+        .UART_dmamode = UART_dma_dis, .UART_defermode = UART_defer_dis,       \
+        .UART_rx_buf = NULL,                                                   \
+        .UART_rx_bufsize = UART_DEFAULT_BUFSIZE, .UART_tx_buf = NULL,          \
+        .UART_tx_bufsize = UART_DEFAULT_BUFSIZE                                \
     }
 
 typedef void *UART_handle_t;
 
 /**
- * Opens a UART or LPUART device for read/write access
+ * Buffer of an asynchronous write, see UART_write_async
+ */
+typedef struct UART_iovec {
+    const uint8_t *base; /*!< Start of buffer */
+    uint32_t len;        /*!< Length of buffer in bytes. May be 0 */
+} UART_iovec_t;
+
+/**
+ * Asynchronous write request, see UART_write_async. Owned by the caller. The
+ * request, its iovec list, and every buffer in the list MUST remain valid
+ * and unchanged until the request completes. On completion the callback is
+ * run and the task is notified, if they are set. Both happen from interrupt
+ * context, so the callback MUST NOT block. Fields starting with an
+ * underscore are private.
+ */
+typedef struct UART_write_req {
+    const UART_iovec_t *iov;      /*!< Buffers to send, in order */
+    uint32_t iovcnt;              /*!< Number of buffers in iov */
+    void (*callback)(void *arg);  /*!< Run on completion, or NULL */
+    void *arg;                    /*!< Callback argument */
+    task_handle_t task;           /*!< Task to notify on completion, or NULL */
+    uint32_t bits;                /*!< Notification bits to set on task */
+    volatile bool _pending;       /*!< Is the request queued? */
+    uint32_t _idx;                /*!< Index of the buffer being sent */
+    uint32_t _pos;                /*!< Bytes of that buffer already sent */
+    struct UART_write_req *_next; /*!< Next queued request */
+} UART_write_req_t;
+
+/**
+ * Opens a UART or LPUART device for read/write access. Read and write buffers
+ * are taken from the configuration if provided, and otherwise allocated. Any
+ * provided buffer must remain valid until the UART is closed.
  * @param periph: Identifier of UART to open
  * @param config: UART configuration structure
  * @param err: Set on function error
@@ -172,6 +248,29 @@ int UART_read(UART_handle_t handle, uint8_t *buf, uint32_t len, syserr_t *err);
  */
 int UART_write(UART_handle_t handle, uint8_t *buf, uint32_t len, syserr_t *err);
 
+/**
+ * Queues an asynchronous write to a UART or LPUART device, and returns
+ * without waiting. The buffers of the request are sent in order, in place,
+ * so no data is copied. In DMA mode, each buffer is sent by DMA. Requests
+ * are sent in the order they are queued, after any data already buffered by
+ * UART_write. Text mode replacement is not applied to asynchronous writes.
+ * Safe to call from interrupt context.
+ * @param handle: UART handle to access
+ * @param req: write request. MUST NOT already be queued
+ * @return SYS_OK if the request was queued, or ERR_BADPARAM if the request has
+ * no data to send or the UART is not open
+ */
+syserr_t UART_write_async(UART_handle_t handle, UART_write_req_t *req);
+
+/**
+ * Checks if an asynchronous write request is still queued
+ * @param req: write request to check
+ * @return true if the request has not completed
+ */
+static inline bool UART_write_pending(UART_write_req_t *req) {
+    return req->_pending;
+}
+
 /**
  * Closes a UART or LPUART device
  * @param handle: Handle to open uart device
@@ -0,0 +1,27 @@
+/**
+ * @file drivers.c
+ * Implements host stand-ins for the clock driver functions the kernel calls
+ */
+#include <stdint.h>
+#include <time.h>
+
+#include <drivers/clock/clock.h>
+
+#include "port.h"
+
+/**
+ * Reads a monotonic nanosecond count, in place of the DWT cycle counter.
+ * Wraps on overflow, so compare counts by subtraction.
+ * @return current count, in ns
+ */
+uint32_t clock_cycles() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)((uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec);
+}
+
+/**
+ * Extends the cycle counter used by timestamp_us. The host port has no cycle
+ * counter to extend, so has no effect.
+ */
+void timestamp_update() {}
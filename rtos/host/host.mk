@@ -0,0 +1,73 @@
+## PROG=example # Must be set by user
+
+# RTOS directory
+##  RTOS=rtos # Must be set by user
+
+# Host toolchain
+CC=gcc
+
+# Sanitizers to build with, such as SANITIZE=address,undefined
+SANITIZE=
+
+# Host stacks also hold the ucontext and host library frames, so default
+# stack sizes are raised. The host C library is not newlib, so tasks share its
+# reentrancy state
+local_CFLAGS += -DSYS_PORT=1 \
+	-DSYS_TASK_REENT=0 \
+	-DDEFAULT_STACKSIZE=65536 \
+	-DIDLE_TASK_STACK_SIZE=65536 \
+	-Wall \
+	-Werror \
+	-g \
+	-O2 \
+	-isystem $(RTOS) \
+	$(CFLAGS)
+ifneq ($(SANITIZE),)
+local_CFLAGS += -fsanitize=$(SANITIZE) -fno-omit-frame-pointer
+endif
+local_LDFLAGS += $(LDFLAGS)
+
+# Build output directory
+BUILDDIR=build
+
+## Kernel and utility sources that build for the host. Drivers and interrupt
+## handling are replaced by the host port.
+HOST_SRCS=$(RTOS)/drivers/power/power.c \
+	$(RTOS)/sys/kmem/kmem.c \
+	$(RTOS)/sys/semaphore/semaphore.c \
+	$(RTOS)/sys/task/task.c \
+	$(RTOS)/util/list/list.c \
+	$(RTOS)/util/logging/logging.c \
+	$(RTOS)/util/pool/pool.c \
+	$(RTOS)/util/ringbuf/ringbuf.c \
+	$(wildcard $(RTOS)/host/*.c)
+
+# Add all .c files in current directory to compilation
+SRCS=$(wildcard *.c)
+SRCS+=$(HOST_SRCS)
+
+# Object files (autogenerated from sources)
+OBJ=$(SRCS:%.c=%.o)
+OBJDIR=$(BUILDDIR)/obj
+_OBJ=$(patsubst %,$(OBJDIR)/%,$(OBJ))
+
+all: $(BUILDDIR)/$(PROG)
+
+# Output compiled object files into BUILDDIR
+$(OBJDIR)/%.o: %.c
+	@ [ -d $(dir $@) ] || mkdir -p $(dir $@)
+	@ echo "[CC] $<"
+	@ $(CC) $(local_CFLAGS) -c -o $@ $<
+
+$(BUILDDIR)/$(PROG): $(_OBJ)
+	@ echo "Linking $@"
+	@ $(CC) -o $@ $^ $(local_CFLAGS) $(local_LDFLAGS)
+
+## Build and run the program
+run: $(BUILDDIR)/$(PROG)
+	./$(BUILDDIR)/$(PROG)
+
+clean:
+	rm -rf $(BUILDDIR)
+
+.PHONY: all run clean
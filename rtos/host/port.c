@@ -0,0 +1,188 @@
+/**
+ * @file port.c
+ * Implements the host port, which runs the kernel as a Linux process
+ *
+ * Stands in for the Cortex-M4 context switch and interrupt masking. Each
+ * task context is a ucontext, stored at the top of the task stack as the
+ * Cortex-M4 port stores its register frame. The PendSV and SVCall handlers
+ * become ordinary calls, made whenever a switch is requested and no mask or
+ * simulated interrupt holds it off.
+ */
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <ucontext.h>
+
+#include <sys/isr/isr.h>
+
+#include "port.h"
+
+/** Task context, stored at the top of each task stack */
+typedef struct host_frame {
+    ucontext_t context;          /*!< Saved task context */
+    void (*entry)(void *);       /*!< Task entry point */
+    void *arg;                   /*!< Task entry argument */
+    void (*exit_handler)(void);  /*!< Run if the entry point returns */
+} host_frame_t;
+
+// Simulated interrupt state. The port is single threaded, so no locking
+static uint32_t host_mask = 0;       // Nonzero while interrupts are masked
+static uint32_t host_exception = 0;  // Active simulated exception number
+static bool host_pendsv_pending = false;
+
+// Static functions
+static void host_task_start(unsigned int high, unsigned int low);
+static void host_pendsv();
+
+/**
+ * Initializes a task context, stored at the top of the task stack. The task
+ * starts in "entry", and runs "exit_handler" if entry returns.
+ * @param stack_end: lowest address of the task stack
+ * @param stack_start: highest address of the task stack
+ * @param entry: task entry point
+ * @param arg: argument for entry
+ * @param exit_handler: function to run when entry returns. Must not return
+ * @return saved context, stored as the task stack pointer
+ */
+uint32_t *host_init_stack(char *stack_end, char *stack_start,
+                          void (*entry)(void *), void *arg,
+                          void (*exit_handler)(void)) {
+    host_frame_t *frame;
+    uint64_t addr;
+    // ucontext_t holds the FPU state, which must be 16 byte aligned
+    frame = (host_frame_t *)(((uintptr_t)stack_start + 1 -
+                              sizeof(host_frame_t)) & ~(uintptr_t)0xF);
+    frame->entry = entry;
+    frame->arg = arg;
+    frame->exit_handler = exit_handler;
+    getcontext(&frame->context);
+    frame->context.uc_stack.ss_sp = stack_end;
+    frame->context.uc_stack.ss_size = (char *)frame - stack_end;
+    frame->context.uc_link = NULL;
+    // makecontext only passes int arguments, so the frame is split in two
+    addr = (uintptr_t)frame;
+    makecontext(&frame->context, (void (*)(void))host_task_start, 2,
+                (unsigned int)(addr >> 32), (unsigned int)addr);
+    return (uint32_t *)frame;
+}
+
+/**
+ * Requests a context switch. Stands in for setting PendSV pending, so the
+ * switch runs at once unless interrupts are masked or the simulated system
+ * tick is running, in which case it runs once they are not.
+ */
+void host_set_pendsv() {
+    host_pendsv_pending = true;
+    host_pendsv();
+}
+
+/**
+ * Selects a task to run, and switches to it without saving the current
+ * context. Stands in for the SVCall handler, used to start the scheduler and
+ * to leave a destroyed task. Does not return.
+ */
+void host_svcall() {
+    host_frame_t *next;
+    host_mask = 1;
+    select_active_task();
+    host_mask = 0;
+    next = host_active_context();
+    setcontext(&next->context);
+    // setcontext only returns on failure
+    abort();
+}
+
+/**
+ * Runs the system tick handler once, as if the tick interrupt fired. Any
+ * context switch it requests runs before returning. MUST be called from a
+ * task, with interrupts unmasked.
+ */
+void host_tick() {
+    host_exception = HOST_SYSTICK_EXCEPTION;
+    SysTickHandler();
+    host_exception = 0;
+    host_pendsv();
+}
+
+/**
+ * Called in place of sleeping by the idle task. Advances simulated time by
+ * one tick.
+ */
+void host_idle() { host_tick(); }
+
+/**
+ * Masks simulated interrupts. Does not nest, see mask_irq_save.
+ */
+void mask_irq() { host_mask = 1; }
+
+/**
+ * Unmasks simulated interrupts, and runs any context switch requested while
+ * they were masked.
+ */
+void unmask_irq() {
+    host_mask = 0;
+    host_pendsv();
+}
+
+/**
+ * Masks simulated interrupts, and returns the previous mask state. Calls may
+ * be nested as long as each is paired with a call to restore_irq_mask.
+ * @return previous interrupt mask state, to pass to restore_irq_mask
+ */
+uint32_t mask_irq_save() {
+    uint32_t state = host_mask;
+    host_mask = 1;
+    return state;
+}
+
+/**
+ * Restores the interrupt mask state saved by mask_irq_save.
+ * @param state: interrupt mask state returned by mask_irq_save
+ */
+void restore_irq_mask(uint32_t state) {
+    host_mask = state;
+    host_pendsv();
+}
+
+/**
+ * Checks if a simulated exception handler is running.
+ * @return nonzero if called from the simulated system tick
+ */
+uint32_t in_isr() { return host_exception; }
+
+/**
+ * Entry point of every task context. Runs the task entry point, then its
+ * exit handler.
+ * @param high: upper 32 bits of the task frame address
+ * @param low: lower 32 bits of the task frame address
+ */
+static void host_task_start(unsigned int high, unsigned int low) {
+    host_frame_t *frame =
+        (host_frame_t *)(uintptr_t)(((uint64_t)high << 32) | low);
+    frame->entry(frame->arg);
+    frame->exit_handler();
+}
+
+/**
+ * Stands in for the PendSV handler. If a switch is pending and nothing holds
+ * it off, selects the next task and swaps to its context. Returns once this
+ * task is selected to run again.
+ */
+static void host_pendsv() {
+    host_frame_t *prev, *next;
+    // No task runs before the scheduler starts, so there is nothing to save
+    while (host_pendsv_pending && host_mask == 0 && host_exception == 0 &&
+           host_active_context() != NULL) {
+        host_pendsv_pending = false;
+        prev = host_active_context();
+        // The PendSV handler selects the next task with interrupts masked
+        host_mask = 1;
+        select_active_task();
+        host_mask = 0;
+        next = host_active_context();
+        if (next != prev) {
+            swapcontext(&prev->context, &next->context);
+        }
+    }
+}
@@ -0,0 +1,84 @@
+/**
+ * @file port.h
+ * Implements the host port, which runs the kernel as a Linux process
+ *
+ * Task contexts are switched with ucontext. Interrupts are simulated: masking
+ * sets a flag, and a requested context switch runs once the mask is dropped,
+ * as PendSV would. There is no timer interrupt. The system tick only advances
+ * when the idle task runs, or when host_tick is called, so task delays
+ * complete as soon as every task is idle.
+ */
+#ifndef HOST_PORT_H
+#define HOST_PORT_H
+
+#include <stdint.h>
+
+#include <config.h>
+
+#if SYS_PORT != PORT_HOST
+#error "host/port.h is only used by the host port"
+#endif
+#if SYS_TASK_STATS == TASK_STATS_ENABLED || SYS_TRACE == TRACE_ENABLED ||      \
+    SYS_USE_TICKLESS == TICKLESS_ENABLED ||                                    \
+    SYS_STACK_MPU_GUARD == STACK_MPU_GUARD_ENABLED
+#error "The host port does not support options that use core peripherals"
+#endif
+#if SYS_TASK_REENT == TASK_REENT_ENABLED
+#error "The host port does not support per task newlib reentrancy"
+#endif
+
+/** Exception number in_isr reports while the simulated system tick runs */
+#define HOST_SYSTICK_EXCEPTION 15
+
+/**
+ * Initializes a task context, stored at the top of the task stack. The task
+ * starts in "entry", and runs "exit_handler" if entry returns.
+ * @param stack_end: lowest address of the task stack
+ * @param stack_start: highest address of the task stack
+ * @param entry: task entry point
+ * @param arg: argument for entry
+ * @param exit_handler: function to run when entry returns. Must not return
+ * @return saved context, stored as the task stack pointer
+ */
+uint32_t *host_init_stack(char *stack_end, char *stack_start,
+                          void (*entry)(void *), void *arg,
+                          void (*exit_handler)(void));
+
+/**
+ * Requests a context switch. Stands in for setting PendSV pending, so the
+ * switch runs at once unless interrupts are masked or the simulated system
+ * tick is running, in which case it runs once they are not.
+ */
+void host_set_pendsv();
+
+/**
+ * Selects a task to run, and switches to it without saving the current
+ * context. Stands in for the SVCall handler, used to start the scheduler and
+ * to leave a destroyed task. Does not return.
+ */
+void host_svcall();
+
+/**
+ * Runs the system tick handler once, as if the tick interrupt fired. Any
+ * context switch it requests runs before returning. MUST be called from a
+ * task, with interrupts unmasked.
+ */
+void host_tick();
+
+/**
+ * Called in place of sleeping by the idle task. Advances simulated time by
+ * one tick.
+ */
+void host_idle();
+
+/**
+ * Gets the saved context of the active task. Provided by task.c.
+ * @return context set by host_init_stack, or NULL if no task is active
+ */
+void *host_active_context();
+
+/** Scheduler entry points, provided by task.c */
+void select_active_task();
+void SysTickHandler();
+
+#endif
@@ -0,0 +1,322 @@
+/**
+ * @file sched_test.c
+ * Host scheduler test and benchmark. Runs the scheduler natively through the
+ * host port, with far more tasks than fit on the board, and reports the wall
+ * clock time of each operation. Build and run with "make run", and add
+ * SANITIZE=address,undefined to check for memory errors.
+ *
+ * Tasks of every priority are created, and must run in priority order. A
+ * raised mutex owner then yields and unlocks with the context switch held
+ * off, which must restore its priority without corrupting the ready lists. A
+ * ring of tasks then yields to each other, and another passes a token around
+ * a ring of semaphores. Finally every task delays for a different number of
+ * ticks, and each must wake exactly at its deadline. Kernel logging is limited
+ * to warnings, so results are printed directly.
+ *
+ * Here is the expected output (times vary):
+ * Tasks ran in priority order
+ * Mutex handed off with context switch held off
+ * task_yield: ... ns per switch with 1000 tasks
+ * Semaphore ring: ... ns per handoff with 1000 tasks
+ * task_delay: ... ns per wakeup with 1000 tasks
+ * Host scheduler test passed
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <sys/isr/isr.h>
+#include <sys/semaphore/semaphore.h>
+#include <sys/task/task.h>
+#include <util/logging/logging.h>
+
+/**
+ * Number of tasks in each benchmark.
+ * Set by passing -DHOST_TASKS=val
+ */
+#ifndef HOST_TASKS
+#define HOST_TASKS 1000
+#endif
+#define ROUNDS 100
+#define MAX_DELAY 97
+#define WORKER_STACKSIZE 16384
+#define WORKER_PRIORITY DEFAULT_PRIORITY
+#define CONTROL_PRIORITY (RTOS_PRIORITY_COUNT - 1)
+
+static void control_task(void *arg);
+
+static const char *TAG = "Sched Test";
+static semaphore_t done_sem;
+static semaphore_t ring_sems[HOST_TASKS];
+static mutex_t handoff_mutex;
+static volatile int handoff_errors = 0;
+static volatile int run_order[RTOS_PRIORITY_COUNT];
+static volatile int run_count = 0;
+static volatile int late_wakeups, early_wakeups;
+
+/**
+ * Reads a monotonic wall clock time
+ * @return time in ns
+ */
+static uint64_t now_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+/**
+ * Creates a worker task, exiting on failure
+ * @param entry: task entry point
+ * @param arg: task argument
+ * @param priority: task priority
+ */
+static void start_worker(void (*entry)(void *), void *arg, uint32_t priority) {
+    task_config_t cfg = DEFAULT_TASK_CONFIG;
+    cfg.task_name = "Worker";
+    cfg.task_priority = priority;
+    cfg.task_stacksize = WORKER_STACKSIZE;
+    if (task_create(entry, arg, &cfg) == NULL) {
+        LOG_E(TAG, "Host scheduler test failed, could not create task");
+        exit(ERR_FAIL);
+    }
+}
+
+/**
+ * Waits for "count" workers to post the done semaphore
+ * @param count: number of workers to wait for
+ */
+static void wait_workers(int count) {
+    while (count--) {
+        semaphore_pend(done_sem, SYS_TIMEOUT_INF);
+    }
+}
+
+/**
+ * Priority order worker. Records the order workers ran in
+ * @param arg: worker priority
+ */
+static void priority_worker(void *arg) {
+    run_order[run_count++] = (int)(intptr_t)arg;
+    semaphore_post(done_sem);
+}
+
+/**
+ * Mutex handoff worker. Holds the mutex until the control task waits on it,
+ * then yields and unlocks it inside a critical section, so the context
+ * switch only runs once the section ends.
+ * @param arg: unused.
+ */
+static void handoff_worker(void *arg) {
+    uint32_t state;
+    if (mutex_lock(handoff_mutex, SYS_TIMEOUT_INF) != SYS_OK) {
+        handoff_errors++;
+    }
+    // Control task runs, and raises this task by waiting on the mutex
+    semaphore_post(done_sem);
+    state = mask_irq_save();
+    task_yield();
+    mutex_unlock(handoff_mutex);
+    restore_irq_mask(state);
+    if (task_get_priority(get_active_task()) != WORKER_PRIORITY) {
+        handoff_errors++;
+    }
+    semaphore_post(done_sem);
+}
+
+/**
+ * Yield worker. Yields to the other workers of its priority
+ * @param arg: unused.
+ */
+static void yield_worker(void *arg) {
+    int i;
+    for (i = 0; i < ROUNDS; i++) {
+        task_yield();
+    }
+    semaphore_post(done_sem);
+}
+
+/**
+ * Semaphore ring worker. Waits for the token on its semaphore, then passes it
+ * to the next worker in the ring
+ * @param arg: index of the worker in the ring
+ */
+static void ring_worker(void *arg) {
+    int idx = (int)(intptr_t)arg;
+    int i;
+    for (i = 0; i < ROUNDS; i++) {
+        semaphore_pend(ring_sems[idx], SYS_TIMEOUT_INF);
+        semaphore_post(ring_sems[(idx + 1) % HOST_TASKS]);
+    }
+    semaphore_post(done_sem);
+}
+
+/**
+ * Delay worker. Checks that a delay wakes the task at its deadline
+ * @param arg: delay, in ticks
+ */
+static void delay_worker(void *arg) {
+    uint32_t delay = (uint32_t)(intptr_t)arg;
+    uint32_t start = task_get_ticks();
+    uint32_t elapsed;
+    task_delay(delay);
+    elapsed = task_get_ticks() - start;
+    if (elapsed < delay) {
+        early_wakeups++;
+    } else if (elapsed > delay) {
+        late_wakeups++;
+    }
+    semaphore_post(done_sem);
+}
+
+/**
+ * Checks that ready tasks run in priority order. Workers are created below
+ * the control task, and only run once it waits for them.
+ */
+static void test_priority_order() {
+    int i;
+    for (i = IDLE_TASK_PRIORITY + 1; i < CONTROL_PRIORITY; i++) {
+        start_worker(priority_worker, (void *)(intptr_t)i, i);
+    }
+    wait_workers(CONTROL_PRIORITY - IDLE_TASK_PRIORITY - 1);
+    for (i = 0; i < run_count; i++) {
+        if (run_order[i] != CONTROL_PRIORITY - 1 - i) {
+            LOG_E(TAG, "Host scheduler test failed, priority %d ran %dth",
+                  run_order[i], i + 1);
+            exit(ERR_FAIL);
+        }
+    }
+    printf("Tasks ran in priority order\n");
+}
+
+/**
+ * Checks that a raised mutex owner can unlock the mutex after yielding inside
+ * a critical section. The owner is then marked ready but in no ready list, so
+ * dropping its inherited priority must leave the ready lists alone.
+ */
+static void test_mutex_handoff() {
+    handoff_mutex = mutex_create();
+    if (handoff_mutex == NULL) {
+        LOG_E(TAG, "Host scheduler test failed, could not create mutex");
+        exit(ERR_FAIL);
+    }
+    start_worker(handoff_worker, NULL, WORKER_PRIORITY);
+    // Worker holds the mutex once it posts
+    wait_workers(1);
+    if (mutex_lock(handoff_mutex, SYS_TIMEOUT_INF) != SYS_OK) {
+        handoff_errors++;
+    }
+    mutex_unlock(handoff_mutex);
+    wait_workers(1);
+    // Every ready list must still be intact for the worker to have exited
+    task_delay(1);
+    if (handoff_errors != 0 ||
+        task_get_priority(get_active_task()) != CONTROL_PRIORITY) {
+        LOG_E(TAG, "Host scheduler test failed, mutex handoff failed");
+        exit(ERR_FAIL);
+    }
+    mutex_destroy(handoff_mutex);
+    printf("Mutex handed off with context switch held off\n");
+}
+
+/**
+ * Measures task_yield between many tasks of equal priority
+ */
+static void bench_yield() {
+    uint64_t start, elapsed;
+    int i;
+    for (i = 0; i < HOST_TASKS; i++) {
+        start_worker(yield_worker, NULL, WORKER_PRIORITY);
+    }
+    start = now_ns();
+    wait_workers(HOST_TASKS);
+    elapsed = now_ns() - start;
+    printf("task_yield: %lu ns per switch with %d tasks\n",
+           (unsigned long)(elapsed / ((uint64_t)HOST_TASKS * ROUNDS)),
+           HOST_TASKS);
+}
+
+/**
+ * Measures semaphore handoffs around a ring of tasks
+ */
+static void bench_semaphore_ring() {
+    uint64_t start, elapsed;
+    int i;
+    for (i = 0; i < HOST_TASKS; i++) {
+        ring_sems[i] = semaphore_create_binary();
+        if (ring_sems[i] == NULL) {
+            LOG_E(TAG, "Host scheduler test failed, could not create "
+                       "semaphore");
+            exit(ERR_FAIL);
+        }
+        start_worker(ring_worker, (void *)(intptr_t)i, WORKER_PRIORITY);
+    }
+    start = now_ns();
+    semaphore_post(ring_sems[0]);
+    wait_workers(HOST_TASKS);
+    elapsed = now_ns() - start;
+    printf("Semaphore ring: %lu ns per handoff with %d tasks\n",
+           (unsigned long)(elapsed / ((uint64_t)HOST_TASKS * ROUNDS)),
+           HOST_TASKS);
+    for (i = 0; i < HOST_TASKS; i++) {
+        semaphore_destroy(ring_sems[i]);
+    }
+}
+
+/**
+ * Measures delayed task wakeups, and checks each wakes at its deadline.
+ * Simulated time only advances while every task is idle, so no wakeup may be
+ * late.
+ */
+static void bench_delay() {
+    uint64_t start, elapsed;
+    int i;
+    for (i = 0; i < HOST_TASKS; i++) {
+        start_worker(delay_worker, (void *)(intptr_t)(1 + i % MAX_DELAY),
+                     WORKER_PRIORITY);
+    }
+    start = now_ns();
+    wait_workers(HOST_TASKS);
+    elapsed = now_ns() - start;
+    if (early_wakeups != 0 || late_wakeups != 0) {
+        LOG_E(TAG, "Host scheduler test failed, %d early and %d late wakeups",
+              early_wakeups, late_wakeups);
+        exit(ERR_FAIL);
+    }
+    printf("task_delay: %lu ns per wakeup with %d tasks\n",
+           (unsigned long)(elapsed / HOST_TASKS), HOST_TASKS);
+}
+
+/**
+ * Control task entry point. Runs each test in turn
+ * @param arg: unused.
+ */
+static void control_task(void *arg) {
+    done_sem = semaphore_create_counting(0);
+    if (done_sem == NULL) {
+        LOG_E(TAG, "Host scheduler test failed, could not create semaphore");
+        exit(ERR_FAIL);
+    }
+    test_priority_order();
+    test_mutex_handoff();
+    bench_yield();
+    bench_semaphore_ring();
+    bench_delay();
+    printf("Host scheduler test passed\n");
+    exit(SYS_OK);
+}
+
+/**
+ * Testing entry point. Tests the scheduler on the host
+ */
+int main() {
+    task_config_t cfg = DEFAULT_TASK_CONFIG;
+    cfg.task_name = "Control Task";
+    cfg.task_priority = CONTROL_PRIORITY;
+    if (task_create(control_task, NULL, &cfg) == NULL) {
+        LOG_E(TAG, "Failed to create rtos task");
+        return ERR_FAIL;
+    }
+    rtos_start();
+    return SYS_OK;
+}
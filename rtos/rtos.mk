@@ -27,6 +27,11 @@ local_CFLAGS += -mcpu=cortex-m4 \
 	-nostartfiles\
 	--specs=nano.specs \
 	$(CFLAGS)
+# Hardware floating point. Set FPU=hard to use the Cortex-M4F FPU. All
+# objects must be rebuilt (make clean) when changing this.
+ifeq ($(FPU),hard)
+local_CFLAGS += -mfpu=fpv4-sp-d16 -mfloat-abi=hard
+endif
 local_LDFLAGS += -Wl,-T $(RTOS)/linker_script.ld \
 	-Wl,-Map=$(BUILDDIR)/$(PROG).map \
 	$(LDFLAGS)
@@ -36,7 +41,8 @@ BUILDDIR=build
 
 # Excluded build paths. Should not have a trailing slash.
 # Any files in these directories will not be built
-EXCLUDED_DIRS=$(RTOS)/drivers/test $(RTOS)/util/test $(RTOS)/sys/test
+EXCLUDED_DIRS=$(RTOS)/drivers/test $(RTOS)/util/test $(RTOS)/sys/test \
+	$(RTOS)/host
 
 ###### recursive wildcard function #######
 rwildcard=$(wildcard $1$2) $(foreach d, \
@@ -83,6 +89,17 @@ $(BUILDDIR)/$(PROG).elf: $(_OBJ)
 	@ echo "Code sizes for $@:"
 	@ $(SIZE) -G $@
 
+##### Decode tokenized log output (built with -DSYSLOG_TOKENIZED=1) #####
+## LOG is a file of captured log output. Reads stdin if unset.
+decode-log: $(BUILDDIR)/$(PROG).elf
+	python3 $(RTOS)/tools/logdecode.py $^ $(LOG)
+
+##### Decode kernel trace output (built with -DSYS_TRACE=1) #####
+## TRACE is a file of data captured from SWO stimulus port 1. Reads stdin if
+## unset.
+decode-trace: $(BUILDDIR)/$(PROG).elf
+	python3 $(RTOS)/tools/tracedecode.py $^ $(TRACE)
+
 ##### Flash code to board using OpenOCD (0x08000000 is start of flash bank)
 flash: $(BUILDDIR)/$(PROG).bin
 	$(OPENOCD) -c "program $^ 0x08000000 reset exit"
@@ -98,7 +115,7 @@ debug: all
 	$(BUILDDIR)/$(PROG).elf
 
 
-.PHONY: clean erase
+.PHONY: clean erase decode-log decode-trace
 
 clean:
 	@ if [ -d $(BUILDDIR) ]; then \
@@ -0,0 +1,281 @@
+/**
+ * @file event.c
+ * Implements event flag groups
+ *
+ * Waiting tasks place a waiter entry on their stack in the event group's
+ * waiting list. Setting bits walks the list once, and hands each satisfied
+ * waiter the bits that satisfied it before waking the task. To signal a
+ * single task from an interrupt, task_notify is cheaper.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <sys/err.h>
+#include <sys/isr/isr.h>
+#include <sys/kmem/kmem.h>
+#include <sys/task/task.h>
+#include <util/bitmask.h>
+#include <util/list/ilist.h>
+#include <util/logging/logging.h>
+
+#include "event.h"
+
+/** Internal definition of event group structure */
+typedef struct event_group_state {
+    uint32_t bits;   /*!< Event bits */
+    ilist_t waiters; /*!< Tasks waiting on the event group */
+    bool allocated;  /*!< Was this event group allocated? */
+} event_group_state_t;
+
+_Static_assert(sizeof(event_group_state_t) <= sizeof(event_group_static_t),
+               "event_group_static_t is too small to hold an event group");
+
+/**
+ * Waiting task structure. Lives on the stack of the waiting task, which
+ * cannot return while the entry is in the waiting list
+ */
+typedef struct event_waiter {
+    task_handle_t task;      /*!< Task handle */
+    int delay;               /*!< Delay task requested */
+    uint32_t bits;           /*!< Bits task waits for */
+    uint32_t flags;          /*!< Wait flags */
+    uint32_t value;          /*!< Bits that satisfied the wait */
+    volatile bool done;      /*!< Set when the wait is satisfied */
+    ilist_node_t list_node;  /*!< Wait list node */
+} event_waiter_t;
+
+/** Gets the waiter entry holding a wait list node */
+#define WAITER_OF(node) ilist_entry(node, event_waiter_t, list_node)
+
+static const char *TAG = "event.c";
+
+// Static functions
+static void init_event_group(event_group_state_t *group, bool allocated);
+static inline bool wait_satisfied(uint32_t value, uint32_t bits,
+                                  uint32_t flags);
+static inline void wake_waiter(event_waiter_t *waiter, uint32_t value);
+
+/**
+ * Creates a new event group, with all bits clear
+ * @return handle to created event group, or NULL on error
+ */
+event_group_t event_group_create() {
+    event_group_state_t *group;
+    group = kmem_alloc(KMEM_SEMAPHORE, sizeof(event_group_state_t));
+    if (group == NULL) {
+        return NULL;
+    }
+    init_event_group(group, true);
+    return (event_group_t)group;
+}
+
+/**
+ * Creates a new event group without allocating memory
+ * @param storage: storage for event group. Must remain valid until the event
+ * group is destroyed
+ * @return handle to created event group, or NULL on error
+ */
+event_group_t event_group_create_static(event_group_static_t *storage) {
+    if (storage == NULL) {
+        return NULL;
+    }
+    init_event_group((event_group_state_t *)storage, false);
+    return (event_group_t)storage;
+}
+
+/**
+ * Sets bits in an event group, and wakes every waiting task whose wait is now
+ * satisfied. Safe to call from interrupt context.
+ * @param group: event group to set bits in
+ * @param bits: bits to set
+ * @return event group bits after setting, and after clearing any bits taken
+ * by woken tasks with EVENT_CLEAR
+ */
+uint32_t event_group_set(event_group_t group, uint32_t bits) {
+    event_group_state_t *grp = (event_group_state_t *)group;
+    event_waiter_t *waiter;
+    ilist_node_t *node, *next;
+    uint32_t clear_bits = 0;
+    uint32_t ret, state;
+    state = mask_irq_save();
+    SETBITS(grp->bits, bits);
+    /**
+     * Every waiter sees the bits as they were set, so bits taken with
+     * EVENT_CLEAR are only cleared once all waiters are checked.
+     */
+    ilist_for_each_safe(node, next, &grp->waiters) {
+        waiter = WAITER_OF(node);
+        if (!wait_satisfied(grp->bits, waiter->bits, waiter->flags)) {
+            continue;
+        }
+        ilist_remove(node);
+        if (waiter->flags & EVENT_CLEAR) {
+            SETBITS(clear_bits, waiter->bits);
+        }
+        wake_waiter(waiter, grp->bits);
+    }
+    CLEARBITS(grp->bits, clear_bits);
+    ret = grp->bits;
+    restore_irq_mask(state);
+    return ret;
+}
+
+/**
+ * Clears bits in an event group. Safe to call from interrupt context.
+ * @param group: event group to clear bits in
+ * @param bits: bits to clear
+ * @return event group bits before clearing
+ */
+uint32_t event_group_clear(event_group_t group, uint32_t bits) {
+    event_group_state_t *grp = (event_group_state_t *)group;
+    uint32_t old, state;
+    state = mask_irq_save();
+    old = grp->bits;
+    CLEARBITS(grp->bits, bits);
+    restore_irq_mask(state);
+    return old;
+}
+
+/**
+ * Gets the bits of an event group
+ * @param group: event group to read
+ * @return event group bits
+ */
+uint32_t event_group_get(event_group_t group) {
+    return ((event_group_state_t *)group)->bits;
+}
+
+/**
+ * Waits for bits to be set in an event group.
+ * @param group: event group to wait on
+ * @param bits: bits to wait for
+ * @param flags: EVENT_WAIT_ANY to wait for any of the bits, or
+ * EVENT_WAIT_ALL to wait for all of them. OR with EVENT_CLEAR to clear the
+ * waited for bits when the wait completes
+ * @param value: set to the event group bits that satisfied the wait, or the
+ * current bits on timeout. May be NULL
+ * @param delay: max amount of time to wait (in ms). Use SYS_TIMEOUT_INF for
+ * infinite timeout, or SYS_TIMEOUT_NONE to poll
+ * @return SYS_OK when the bits were set, or ERR_TIMEOUT on timeout
+ */
+syserr_t event_group_wait(event_group_t group, uint32_t bits, uint32_t flags,
+                          uint32_t *value, int delay) {
+    event_group_state_t *grp = (event_group_state_t *)group;
+    event_waiter_t waiter;
+    syserr_t ret;
+    uint32_t state;
+    if (bits == 0) {
+        return ERR_BADPARAM;
+    }
+    state = mask_irq_save();
+    if (wait_satisfied(grp->bits, bits, flags)) {
+        if (value != NULL) {
+            *value = grp->bits;
+        }
+        if (flags & EVENT_CLEAR) {
+            CLEARBITS(grp->bits, bits);
+        }
+        restore_irq_mask(state);
+        return SYS_OK;
+    }
+    if (delay == SYS_TIMEOUT_NONE || in_isr() || !rtos_started()) {
+        if (value != NULL) {
+            *value = grp->bits;
+        }
+        restore_irq_mask(state);
+        return ERR_TIMEOUT;
+    }
+    // Place this task into the waiting list. Entry is stored on our stack.
+    waiter.task = get_active_task();
+    waiter.delay = delay;
+    waiter.bits = bits;
+    waiter.flags = flags;
+    waiter.done = false;
+    ilist_append(&grp->waiters, &waiter.list_node);
+    /**
+     * Interrupts stay masked until the task is blocked, so the wake cannot be
+     * missed. The context switch occurs once they are unmasked.
+     */
+    if (delay == SYS_TIMEOUT_INF) {
+        while (!waiter.done) {
+            block_active_task(BLOCK_EVENT);
+            restore_irq_mask(state);
+            state = mask_irq_save();
+        }
+    } else {
+        task_delay((uint32_t)delay);
+        restore_irq_mask(state);
+        // Woken by event_group_set, or the delay expired
+        state = mask_irq_save();
+        if (!waiter.done) {
+            ilist_remove(&waiter.list_node);
+            waiter.value = grp->bits;
+        }
+    }
+    ret = waiter.done ? SYS_OK : ERR_TIMEOUT;
+    if (value != NULL) {
+        *value = waiter.value;
+    }
+    restore_irq_mask(state);
+    return ret;
+}
+
+/**
+ * Destroys an event group. Will fail if any tasks are waiting on it
+ * @param group: event group to destroy
+ * @return SYS_OK on success, or ERR_BADPARAM when tasks are waiting
+ */
+syserr_t event_group_destroy(event_group_t group) {
+    event_group_state_t *grp = (event_group_state_t *)group;
+    if (!ilist_empty(&grp->waiters)) {
+        LOG_D(TAG, "Cannot destroy event group, tasks are waiting");
+        return ERR_BADPARAM;
+    }
+    if (grp->allocated) {
+        kmem_free(grp);
+    }
+    return SYS_OK;
+}
+
+/**
+ * Initializes event group state
+ * @param group: event group to initialize
+ * @param allocated: was the event group allocated with kmem_alloc?
+ */
+static void init_event_group(event_group_state_t *group, bool allocated) {
+    group->bits = 0;
+    ilist_init(&group->waiters);
+    group->allocated = allocated;
+}
+
+/**
+ * Checks if event bits satisfy a wait
+ * @param value: event group bits
+ * @param bits: bits being waited for
+ * @param flags: wait flags
+ * @return true if the wait is satisfied
+ */
+static inline bool wait_satisfied(uint32_t value, uint32_t bits,
+                                  uint32_t flags) {
+    if (flags & EVENT_WAIT_ALL) {
+        return (value & bits) == bits;
+    }
+    return (value & bits) != 0;
+}
+
+/**
+ * Hands a satisfied waiter the event bits, then wakes its task. MUST be called
+ * with interrupts masked.
+ * @param waiter: waiter entry, already removed from the waiting list
+ * @param value: event group bits that satisfied the wait
+ */
+static inline void wake_waiter(event_waiter_t *waiter, uint32_t value) {
+    waiter->value = value;
+    waiter->done = true;
+    // Waiter task cannot run until interrupts are restored
+    if (waiter->delay == SYS_TIMEOUT_INF) {
+        unblock_task(waiter->task, BLOCK_EVENT);
+    } else {
+        unblock_delayed_task(waiter->task);
+    }
+}
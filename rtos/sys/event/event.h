@@ -0,0 +1,91 @@
+/**
+ * @file event.h
+ * Implements event flag groups
+ */
+#ifndef EVENT_H
+#define EVENT_H
+
+#include <stdint.h>
+
+#include <sys/err.h>
+#include <sys/semaphore/semaphore.h>
+
+// typedef to obscure internal definition of event group
+typedef void *event_group_t;
+
+/**
+ * Storage for a statically allocated event group. Contents are private, this
+ * type only reserves memory of the correct size.
+ */
+typedef struct event_group_static {
+    void *_reserved[4];
+} event_group_static_t;
+
+/* Event group wait flags, see event_group_wait */
+#define EVENT_WAIT_ANY 0x0 /*!< Wait for any of the requested bits */
+#define EVENT_WAIT_ALL 0x1 /*!< Wait for all of the requested bits */
+#define EVENT_CLEAR 0x2    /*!< Clear the requested bits on return */
+
+/**
+ * Creates a new event group, with all bits clear
+ * @return handle to created event group, or NULL on error
+ */
+event_group_t event_group_create();
+
+/**
+ * Creates a new event group without allocating memory
+ * @param storage: storage for event group. Must remain valid until the event
+ * group is destroyed
+ * @return handle to created event group, or NULL on error
+ */
+event_group_t event_group_create_static(event_group_static_t *storage);
+
+/**
+ * Sets bits in an event group, and wakes every waiting task whose wait is now
+ * satisfied. Safe to call from interrupt context.
+ * @param group: event group to set bits in
+ * @param bits: bits to set
+ * @return event group bits after setting, and after clearing any bits taken
+ * by woken tasks with EVENT_CLEAR
+ */
+uint32_t event_group_set(event_group_t group, uint32_t bits);
+
+/**
+ * Clears bits in an event group. Safe to call from interrupt context.
+ * @param group: event group to clear bits in
+ * @param bits: bits to clear
+ * @return event group bits before clearing
+ */
+uint32_t event_group_clear(event_group_t group, uint32_t bits);
+
+/**
+ * Gets the bits of an event group
+ * @param group: event group to read
+ * @return event group bits
+ */
+uint32_t event_group_get(event_group_t group);
+
+/**
+ * Waits for bits to be set in an event group.
+ * @param group: event group to wait on
+ * @param bits: bits to wait for
+ * @param flags: EVENT_WAIT_ANY to wait for any of the bits, or
+ * EVENT_WAIT_ALL to wait for all of them. OR with EVENT_CLEAR to clear the
+ * waited for bits when the wait completes
+ * @param value: set to the event group bits that satisfied the wait, or the
+ * current bits on timeout. May be NULL
+ * @param delay: max amount of time to wait (in ms). Use SYS_TIMEOUT_INF for
+ * infinite timeout, or SYS_TIMEOUT_NONE to poll
+ * @return SYS_OK when the bits were set, or ERR_TIMEOUT on timeout
+ */
+syserr_t event_group_wait(event_group_t group, uint32_t bits, uint32_t flags,
+                          uint32_t *value, int delay);
+
+/**
+ * Destroys an event group. Will fail if any tasks are waiting on it
+ * @param group: event group to destroy
+ * @return SYS_OK on success, or ERR_BADPARAM when tasks are waiting
+ */
+syserr_t event_group_destroy(event_group_t group);
+
+#endif
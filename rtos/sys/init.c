@@ -6,17 +6,35 @@
 #include <stdlib.h>
 
 #include <drivers/clock/clock.h>
+#include <drivers/device/device.h>
+#include <sys/isr/isr.h>
+#include <sys/kmem/kmem.h>
+#include <util/bitmask.h>
 
 // Variables declared in linker script
 extern unsigned char _srcdata;
 extern unsigned char _sdata;
 extern unsigned char _edata;
+extern unsigned char _srcramfunc;
+extern unsigned char _sramfunc;
+extern unsigned char _eramfunc;
 extern unsigned char _sbss;
 extern unsigned char _ebss;
+extern unsigned char _srcfastdata;
+extern unsigned char _sfastdata;
+extern unsigned char _efastdata;
+extern unsigned char _sfastbss;
+extern unsigned char _efastbss;
+extern unsigned char _sretained;
+extern unsigned char _eretained;
+extern unsigned char _snoinit;
+extern unsigned char _enoinit;
 extern unsigned char _stack_ptr;
 
 // Function prototypes
 static void init_data_bss(void);
+static void init_sram2(void);
+static void init_fpu(void);
 
 // External functions
 extern void __libc_init_array(void); // Provided by newlib
@@ -31,12 +49,19 @@ void system_init(void);
  */
 void system_init(void) {
     int ret;
+    // Enable the FPU before any code can use it
+    init_fpu();
     // First initialize global variables
     init_data_bss();
+    init_sram2();
+    // Move the vector table to RAM, so handlers can be installed directly
+    isr_init();
     // Now that data and BSS segments are populated, initialize clocks
     reset_clocks();
     // Init libs
     __libc_init_array();
+    // Init kernel object pools
+    kmem_init();
     // init is done. Call the main entry point.
     ret = main();
     // exit with the return value of main
@@ -45,7 +70,7 @@ void system_init(void) {
 
 /**
  * Core init function for MCU. Sets up global variables by copying data from
- * flash to ram, and zeroing BSS
+ * flash to ram, and zeroing BSS. Also copies functions placed in SRAM
  *
  * Reference: http://eleceng.dit.ie/frank/arm/BareMetalTILM4F/index.html
  */
@@ -61,10 +86,83 @@ static void init_data_bss(void) {
     while (len--) {
         *dst++ = *src++;
     }
+    // Copy functions that run from SRAM
+    src = &_srcramfunc;
+    dst = &_sramfunc;
+    len = &_eramfunc - &_sramfunc;
+    while (len--) {
+        *dst++ = *src++;
+    }
     // Zero out all bss values.
     dst = &_sbss;
     len = &_ebss - &_sbss;
     while (len--) {
         *dst++ = 0;
     }
-}
\ No newline at end of file
+}
+
+/**
+ * Sets up data placed in SRAM2. Fast data is copied and zeroed like .data
+ * and .bss. Retained data is only kept when waking from Standby mode, and
+ * no-init data when the reset was not a power on or brownout.
+ */
+static void init_sram2(void) {
+    unsigned char *src;
+    unsigned char *dst;
+    unsigned int len;
+    uint32_t pwren;
+    src = &_srcfastdata;
+    dst = &_sfastdata;
+    len = &_efastdata - &_sfastdata;
+    while (len--) {
+        *dst++ = *src++;
+    }
+    dst = &_sfastbss;
+    len = &_efastbss - &_sfastbss;
+    while (len--) {
+        *dst++ = 0;
+    }
+    // The PWR peripheral must be clocked to read the Standby flag
+    pwren = READBITS(RCC->APB1ENR1, RCC_APB1ENR1_PWREN);
+    SETBITS(RCC->APB1ENR1, RCC_APB1ENR1_PWREN);
+    if (READBITS(PWR->SR1, PWR_SR1_SBF) == 0) {
+        dst = &_sretained;
+        len = &_eretained - &_sretained;
+        while (len--) {
+            *dst++ = 0;
+        }
+    }
+    SETBITS(PWR->SCR, PWR_SCR_CSBF);
+    if (&_eretained != &_sretained) {
+        // Keep SRAM2 powered in Standby mode, for the retained data
+        SETBITS(PWR->CR3, PWR_CR3_RRS);
+    }
+    if (!pwren) {
+        CLEARBITS(RCC->APB1ENR1, RCC_APB1ENR1_PWREN);
+    }
+    if (READBITS(RCC->CSR, RCC_CSR_BORRSTF)) {
+        // SRAM2 held no data at power on, and its parity must be initialized
+        dst = &_snoinit;
+        len = &_enoinit - &_snoinit;
+        while (len--) {
+            *dst++ = 0;
+        }
+    }
+    // Clear reset flags, so the next reset can be told apart from power on
+    SETBITS(RCC->CSR, RCC_CSR_RMVF);
+}
+
+/**
+ * Enables the FPU when building for hardware floating point. Automatic and
+ * lazy state preservation are enabled, so exception entry only saves FPU
+ * registers for contexts that used the FPU, and only once the handler does.
+ */
+static void init_fpu(void) {
+#ifdef __ARM_FP
+    // Grant full access to coprocessors 10 and 11 (the FPU)
+    SETBITS(SCB->CPACR, (0x3UL << 20) | (0x3UL << 22));
+    SETBITS(FPU->FPCCR, FPU_FPCCR_ASPEN_Msk | FPU_FPCCR_LSPEN_Msk);
+    asm volatile("dsb\n"
+                 "isb\n");
+#endif
+}
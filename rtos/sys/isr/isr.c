@@ -1,14 +1,15 @@
 /**
  * @file isr.c
  * Implements peripheral and system interrupt handlers.
- * All peripheral interrupt handlers provide a means to register a
- * handler function, and simply serve as a wrapper around it
+ * The vector table is copied to RAM at startup, so enable_irq can install
+ * peripheral handlers directly into the hardware vector table.
  */
 
 #include <stdlib.h>
 
 #include <drivers/device/device.h>
 #include <sys/task/task.h>
+#include <sys/trace/trace.h>
 #include <util/bitmask.h>
 
 #include "isr.h"
@@ -18,8 +19,18 @@ extern void system_init(void);
 /** Provided by linker */
 extern unsigned char _stack_ptr;
 
-// Dynamic array of exception handlers
-static void (*exception_handlers[84])(void) = { 0 };
+/**
+ * RAM copy of the vector table, used by the core once isr_init runs. VTOR
+ * requires the table to be aligned to its size rounded up to a power of two.
+ */
+static uint32_t ram_vectors[NUM_VECTORS] __attribute__((aligned(512)));
+// Context pointer for each peripheral interrupt, see irq_context
+static void *irq_contexts[NUM_IRQS] = {0};
+#if SYS_TRACE == TRACE_ENABLED
+// Installed handler for each peripheral interrupt, run by trace_irq_dispatch
+static void (*irq_handlers[NUM_IRQS])(void) = {0};
+static void trace_irq_dispatch(void);
+#endif
 
 /**
  * System interrupt handler definitions. These should not be called, they
@@ -27,17 +38,23 @@ static void (*exception_handlers[84])(void) = { 0 };
  */
 
 /**
- * Default Handler for an ISR.
+ * Default Handler for an ISR. Installed for interrupts without a handler.
  */
-static void DefaultISRHandler(void) {
-    /** Read ICSR to determine exception number */
-    uint8_t vecactive = (READBITS(SCB->ICSR, SCB_ICSR_VECTACTIVE_Msk) - 16);
-    // Check if a handler is installed for this function
-    if (exception_handlers[vecactive] != NULL) {
-        exception_handlers[vecactive]();
-    }
+static void DefaultISRHandler(void) {}
 
+#if SYS_TRACE == TRACE_ENABLED
+/**
+ * Runs the handler installed for the active peripheral interrupt, recording
+ * interrupt entry and exit in the kernel trace. Installed in place of every
+ * handler passed to enable_irq when SYS_TRACE is enabled.
+ */
+static void trace_irq_dispatch(void) {
+    uint32_t num = in_isr() - 16;
+    trace_event(TRACE_ISR_ENTER, num, 0);
+    irq_handlers[num]();
+    trace_event(TRACE_ISR_EXIT, num, 0);
 }
+#endif
 
 /**
  * Non maskable interrupt handler
@@ -59,6 +76,8 @@ void HardFault_irq() {
  * Memory management fault interrupt handler
  */
 void MMFault_irq() {
+    // Reports task stack overflows caught by the MPU guard
+    stack_guard_fault();
     while (1)
         ;
 }
@@ -219,21 +238,65 @@ __attribute__((section(".vectors"))) const uint32_t exception_vectors[] = {
     (uint32_t)
         DefaultISRHandler, /*!< 77 Touch Sense Controller global interrupt */
     (uint32_t)DefaultISRHandler, /*!< 78 LCD global interrupt */
+    0,                           /*!< 79 Not supported on STM32L433 */
     (uint32_t)DefaultISRHandler, /*!< 80 RNG global interrupt */
     (uint32_t)DefaultISRHandler, /*!< 81 FPU global interrupt */
     (uint32_t)DefaultISRHandler  /*!< 82 CRS global interrupt  */
 };
 
+_Static_assert(sizeof(exception_vectors) == NUM_VECTORS * sizeof(uint32_t),
+               "Exception vector table has the wrong number of entries");
+
+/**
+ * Copies the vector table to RAM, and points the core at the copy. Sets all
+ * peripheral interrupts to SYS_MAX_SYSCALL_PRIORITY, and PendSV and SysTick to
+ * the lowest priority. Called by the system at startup, before any interrupt
+ * is enabled.
+ */
+void isr_init() {
+    int i;
+    for (i = 0; i < NUM_VECTORS; i++) {
+        ram_vectors[i] = exception_vectors[i];
+    }
+    SCB->VTOR = (uint32_t)ram_vectors;
+    // Peripheral interrupts may call the RTOS unless raised above this level
+    for (i = 0; i < NUM_IRQS; i++) {
+        set_irq_priority(i, SYS_MAX_SYSCALL_PRIORITY);
+    }
+    /**
+     * Run the scheduler below every interrupt, so context switches never delay
+     * one. SVCall stays at the highest priority, since an svc instruction
+     * executed while SVCall is masked would escalate to a hard fault.
+     */
+    SCB->SHP[IRQN_TO_EXCEPTION(PendSV_IRQn) - 4] =
+        IRQ_PRIORITY_LOWEST << (8 - __NVIC_PRIO_BITS);
+    SCB->SHP[IRQN_TO_EXCEPTION(SysTick_IRQn) - 4] =
+        IRQ_PRIORITY_LOWEST << (8 - __NVIC_PRIO_BITS);
+    // Make sure the new table is used for the next exception
+    asm volatile("dsb\n"
+                 "isb\n");
+}
+
 /**
  * Enable interrupt number "num" (in Nested vector interrupt controller),
  * and install a handler function for it.
  * @param num: Interrupt number to enable
- * @param handler: Handler function. Will be called from interrupt context.
+ * @param handler: Handler function. Installed directly in the vector table,
+ * and called from interrupt context.
+ * @param ctx: Context pointer for the interrupt, read with irq_context. May
+ * be NULL
  */
-void enable_irq(uint32_t num, void (*handler)(void)) {
+void enable_irq(uint32_t num, void (*handler)(void), void *ctx) {
     uint32_t reg_sel;
-    // Install exception handler
-    exception_handlers[num] = handler;
+    // Install exception handler. Context is set first, the handler may run
+    irq_contexts[num] = ctx;
+#if SYS_TRACE == TRACE_ENABLED
+    irq_handlers[num] = handler;
+    ram_vectors[IRQN_TO_EXCEPTION(num)] = (uint32_t)trace_irq_dispatch;
+#else
+    ram_vectors[IRQN_TO_EXCEPTION(num)] = (uint32_t)handler;
+#endif
+    asm volatile("dsb\n");
     // divide "num" by 32 to get interrupt set/enable register # to use
     reg_sel = num >> 5;
     // Subtract "reg_sel" times 32 to get the offset within the set/enable reg
@@ -249,7 +312,7 @@ void enable_irq(uint32_t num, void (*handler)(void)) {
 void disable_irq(uint32_t num) {
     uint32_t reg_sel;
     // Reset exception handler
-    exception_handlers[num] = DefaultISRHandler;
+    ram_vectors[IRQN_TO_EXCEPTION(num)] = (uint32_t)DefaultISRHandler;
     // divide "num" by 32 to get interrupt set/enable register # to use
     reg_sel = num >> 5;
     // Subtract "reg_sel" times 32 to get the offset within the set/enable reg
@@ -257,15 +320,82 @@ void disable_irq(uint32_t num) {
     CLEARFIELD(NVIC->ISER[reg_sel], 1UL, num);
 }
 
+/**
+ * Sets the priority of interrupt number "num". Lower values are higher
+ * priority, and preempt interrupts with higher values. Interrupts start at
+ * SYS_MAX_SYSCALL_PRIORITY. Handlers set to a higher priority (lower value)
+ * are never masked by the kernel, and MUST NOT call RTOS functions.
+ * @param num: Interrupt number to set priority of
+ * @param priority: Priority, from 0 (highest) to IRQ_PRIORITY_LOWEST
+ */
+void set_irq_priority(uint32_t num, uint32_t priority) {
+    // Only the top __NVIC_PRIO_BITS bits of each priority field are used
+    NVIC->IP[num] = (uint8_t)(priority << (8 - __NVIC_PRIO_BITS));
+}
+
+/**
+ * Gets the context pointer passed to enable_irq for the active interrupt.
+ * MUST be called from a handler installed with enable_irq.
+ * @return context pointer for the active interrupt
+ */
+void *irq_context() { return irq_contexts[in_isr() - 16]; }
+
 /**
  *
  * Simple function to disable interrupts.
- * This sets PRIMASK to 1, effectively disabling preemption
+ * This sets BASEPRI to SYS_MAX_SYSCALL_PRIORITY, masking every interrupt that
+ * may call the RTOS, and so preemption. Does not nest, see mask_irq_save.
  */
-void mask_irq() { asm volatile("CPSID i"); }
+void mask_irq() {
+    asm volatile("msr BASEPRI, %0\n"
+                 "isb\n"
+                 :
+                 : "r"(IRQ_MASK_BASEPRI)
+                 : "memory");
+}
 
 /**
  * Simple function to reenable interrupts.
- * This sets PRIMASK to 0, effectively allowing preemption
+ * This sets BASEPRI to 0, effectively allowing preemption
+ */
+void unmask_irq() { asm volatile("msr BASEPRI, %0\n" : : "r"(0) : "memory"); }
+
+/**
+ * Disables interrupts, and returns the previous interrupt mask state. Unlike
+ * mask_irq, calls may be nested as long as each is paired with a call to
+ * restore_irq_mask. Like mask_irq, only interrupts at or below
+ * SYS_MAX_SYSCALL_PRIORITY are masked.
+ * @return previous interrupt mask state, to pass to restore_irq_mask
+ */
+uint32_t mask_irq_save() {
+    uint32_t state;
+    /**
+     * BASEPRI_MAX only raises the mask, so a caller already running with a
+     * stricter mask keeps it.
+     */
+    asm volatile("mrs %0, BASEPRI\n"
+                 "msr BASEPRI_MAX, %1\n"
+                 "isb\n"
+                 : "=&r"(state)
+                 : "r"(IRQ_MASK_BASEPRI)
+                 : "memory");
+    return state;
+}
+
+/**
+ * Restores the interrupt mask state saved by mask_irq_save.
+ * @param state: interrupt mask state returned by mask_irq_save
+ */
+void restore_irq_mask(uint32_t state) {
+    asm volatile("msr BASEPRI, %0\n" : : "r"(state) : "memory");
+}
+
+/**
+ * Checks if the processor is executing an exception handler.
+ * @return nonzero if called from interrupt context
  */
-void unmask_irq() { asm volatile("CPSIE i"); }
+uint32_t in_isr() {
+    uint32_t ipsr;
+    asm volatile("mrs %0, IPSR\n" : "=r"(ipsr));
+    return ipsr;
+}
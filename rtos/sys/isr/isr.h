@@ -1,21 +1,66 @@
 #ifndef ISR_H
 #define ISR_H
 
+#include <stdint.h>
+
+#include <config.h>
+
 /** Macro to convert IRQ number to exception number */
-#define IRQN_TO_EXCEPTION(irq) (irq) + 16
+#define IRQN_TO_EXCEPTION(irq) ((irq) + 16)
+/** Number of peripheral interrupts, and of vector table entries */
+#define NUM_IRQS 83
+#define NUM_VECTORS IRQN_TO_EXCEPTION(NUM_IRQS)
+/** Lowest interrupt priority. The STM32L433 implements 4 priority bits */
+#define IRQ_PRIORITY_LOWEST 15
+/** BASEPRI value used by kernel critical sections, see mask_irq */
+#define IRQ_MASK_BASEPRI (SYS_MAX_SYSCALL_PRIORITY << 4)
+
+#if SYS_MAX_SYSCALL_PRIORITY < 1 || SYS_MAX_SYSCALL_PRIORITY > IRQ_PRIORITY_LOWEST
+#error "SYS_MAX_SYSCALL_PRIORITY must be between 1 and 15"
+#endif
+
+/**
+ * Copies the vector table to RAM, and points the core at the copy. Sets all
+ * peripheral interrupts to SYS_MAX_SYSCALL_PRIORITY, and PendSV and SysTick to
+ * the lowest priority. Called by the system at startup, before any interrupt
+ * is enabled.
+ */
+void isr_init();
 
 /**
  * Simple function to disable interrupts.
- * This sets PRIMASK to 1, effectively disabling preemption
+ * This sets BASEPRI to SYS_MAX_SYSCALL_PRIORITY, masking every interrupt that
+ * may call the RTOS, and so preemption. Does not nest, see mask_irq_save.
  */
 void mask_irq();
 
 /**
  * Simple function to reenable interrupts.
- * This sets PRIMASK to 0, effectively allowing preemption
+ * This sets BASEPRI to 0, effectively allowing preemption
  */
 void unmask_irq();
 
+/**
+ * Disables interrupts, and returns the previous interrupt mask state. Unlike
+ * mask_irq, calls may be nested as long as each is paired with a call to
+ * restore_irq_mask. Like mask_irq, only interrupts at or below
+ * SYS_MAX_SYSCALL_PRIORITY are masked.
+ * @return previous interrupt mask state, to pass to restore_irq_mask
+ */
+uint32_t mask_irq_save();
+
+/**
+ * Restores the interrupt mask state saved by mask_irq_save.
+ * @param state: interrupt mask state returned by mask_irq_save
+ */
+void restore_irq_mask(uint32_t state);
+
+/**
+ * Checks if the processor is executing an exception handler.
+ * @return nonzero if called from interrupt context
+ */
+uint32_t in_isr();
+
 /**
  * Disable interrupt number "num" (in Nested vector interrupt controller).
  * Resets handler function.
@@ -27,8 +72,28 @@ void disable_irq(uint32_t num);
  * Enable interrupt number "num" (in Nested vector interrupt controller),
  * and install a handler function for it.
  * @param num: Interrupt number to enable
- * @param handler: Handler function. Will be called from interrupt context.
+ * @param handler: Handler function. Installed directly in the vector table,
+ * and called from interrupt context.
+ * @param ctx: Context pointer for the interrupt, read with irq_context. May
+ * be NULL
+ */
+void enable_irq(uint32_t num, void (*handler)(void), void *ctx);
+
+/**
+ * Sets the priority of interrupt number "num". Lower values are higher
+ * priority, and preempt interrupts with higher values. Interrupts start at
+ * SYS_MAX_SYSCALL_PRIORITY. Handlers set to a higher priority (lower value)
+ * are never masked by the kernel, and MUST NOT call RTOS functions.
+ * @param num: Interrupt number to set priority of
+ * @param priority: Priority, from 0 (highest) to IRQ_PRIORITY_LOWEST
+ */
+void set_irq_priority(uint32_t num, uint32_t priority);
+
+/**
+ * Gets the context pointer passed to enable_irq for the active interrupt.
+ * MUST be called from a handler installed with enable_irq.
+ * @return context pointer for the active interrupt
  */
-void enable_irq(uint32_t num, void (*handler)(void));
+void *irq_context();
 
 #endif
\ No newline at end of file
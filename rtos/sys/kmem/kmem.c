@@ -0,0 +1,109 @@
+/**
+ * @file kmem.c
+ * Implements kernel object allocation from fixed block pools
+ *
+ * Kernel objects are allocated and freed repeatedly as tasks are created and
+ * destroyed. Serving them from fixed block pools avoids fragmenting the heap
+ * over long uptimes. The heap is only used once a pool is exhausted.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <config.h>
+#include <sys/sections.h>
+#include <sys/semaphore/semaphore.h>
+#include <sys/task/task.h>
+#include <util/pool/pool.h>
+
+#include "kmem.h"
+
+/** Pool descriptor */
+typedef struct kmem_pool {
+    kmem_class_t cls;  /*!< Class of allocations this pool serves */
+    pool_t pool;       /*!< Pool state */
+    uint64_t *mem;     /*!< Pool memory */
+    size_t block_size; /*!< Size of pool blocks */
+    size_t count;      /*!< Number of pool blocks */
+} kmem_pool_t;
+
+// Pool storage. Task control blocks are kept in SRAM2 with the scheduler
+static uint64_t task_mem[POOL_STORAGE_WORDS(sizeof(task_static_t),
+                                            SYS_POOL_TASKS)] __fast_bss;
+static uint64_t small_stack_mem[POOL_STORAGE_WORDS(SYS_POOL_SMALL_STACK_SIZE,
+                                                   SYS_POOL_SMALL_STACKS)];
+static uint64_t stack_mem[POOL_STORAGE_WORDS(SYS_POOL_STACK_SIZE,
+                                             SYS_POOL_STACKS)];
+static uint64_t semaphore_mem[POOL_STORAGE_WORDS(sizeof(mutex_static_t),
+                                                 SYS_POOL_SEMAPHORES)];
+static uint64_t msgbuf_mem[POOL_STORAGE_WORDS(SYS_POOL_MSGBUF_SIZE,
+                                              SYS_POOL_MSGBUFS)];
+
+/**
+ * Kernel pools. Pools of the same class must be ordered from smallest to
+ * largest block size. Semaphore blocks are sized to hold a mutex.
+ */
+static kmem_pool_t kmem_pools[] = {
+    {KMEM_TASK, {0}, task_mem, sizeof(task_static_t), SYS_POOL_TASKS},
+    {KMEM_STACK, {0}, small_stack_mem, SYS_POOL_SMALL_STACK_SIZE,
+     SYS_POOL_SMALL_STACKS},
+    {KMEM_STACK, {0}, stack_mem, SYS_POOL_STACK_SIZE, SYS_POOL_STACKS},
+    {KMEM_SEMAPHORE, {0}, semaphore_mem, sizeof(mutex_static_t),
+     SYS_POOL_SEMAPHORES},
+    {KMEM_MSGBUF, {0}, msgbuf_mem, SYS_POOL_MSGBUF_SIZE, SYS_POOL_MSGBUFS},
+};
+
+#define NUM_KMEM_POOLS (sizeof(kmem_pools) / sizeof(kmem_pools[0]))
+
+/**
+ * Initializes kernel object pools. Called by the system before main.
+ */
+void kmem_init() {
+    size_t i;
+    for (i = 0; i < NUM_KMEM_POOLS; i++) {
+        pool_init(&kmem_pools[i].pool, kmem_pools[i].mem,
+                  kmem_pools[i].block_size, kmem_pools[i].count);
+    }
+}
+
+/**
+ * Allocates kernel memory. The smallest pool of the given class that can
+ * hold the request is used. If no pool block is free, memory is allocated
+ * from the heap instead.
+ * @param cls: class of object to allocate
+ * @param size: size of allocation, in bytes
+ * @return allocated memory, or NULL if no memory is available
+ */
+void *kmem_alloc(kmem_class_t cls, size_t size) {
+    size_t i;
+    void *ptr;
+    for (i = 0; i < NUM_KMEM_POOLS; i++) {
+        if (kmem_pools[i].cls == cls && kmem_pools[i].block_size >= size) {
+            ptr = pool_alloc(&kmem_pools[i].pool);
+            if (ptr != NULL) {
+                return ptr;
+            }
+        }
+    }
+    // No pool could serve this request. Fall back to the heap.
+    return malloc(size);
+}
+
+/**
+ * Frees kernel memory allocated with kmem_alloc.
+ * @param ptr: memory to free. May be NULL.
+ */
+void kmem_free(void *ptr) {
+    size_t i;
+    if (ptr == NULL) {
+        return;
+    }
+    for (i = 0; i < NUM_KMEM_POOLS; i++) {
+        if (pool_contains(&kmem_pools[i].pool, ptr)) {
+            pool_free(&kmem_pools[i].pool, ptr);
+            return;
+        }
+    }
+    // Memory did not come from a pool
+    free(ptr);
+}
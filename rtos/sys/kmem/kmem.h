@@ -0,0 +1,43 @@
+/**
+ * @file kmem.h
+ * Implements kernel object allocation from fixed block pools
+ */
+
+#ifndef KMEM_H
+#define KMEM_H
+
+#include <stddef.h>
+
+/**
+ * Kernel allocation classes. Each class is backed by one or more fixed block
+ * pools, sized in config.h.
+ */
+typedef enum kmem_class {
+    KMEM_TASK,      /*!< Task control blocks */
+    KMEM_STACK,     /*!< Task stacks */
+    KMEM_SEMAPHORE, /*!< Semaphores and mutexes */
+    KMEM_MSGBUF,    /*!< Message and driver buffers */
+} kmem_class_t;
+
+/**
+ * Initializes kernel object pools. Called by the system before main.
+ */
+void kmem_init();
+
+/**
+ * Allocates kernel memory. The smallest pool of the given class that can
+ * hold the request is used. If no pool block is free, memory is allocated
+ * from the heap instead.
+ * @param cls: class of object to allocate
+ * @param size: size of allocation, in bytes
+ * @return allocated memory, or NULL if no memory is available
+ */
+void *kmem_alloc(kmem_class_t cls, size_t size);
+
+/**
+ * Frees kernel memory allocated with kmem_alloc.
+ * @param ptr: memory to free. May be NULL.
+ */
+void kmem_free(void *ptr);
+
+#endif
@@ -0,0 +1,391 @@
+/**
+ * @file queue.c
+ * Implements fixed size item message queues
+ *
+ * Queues block and wake tasks directly, rather than using semaphores. A task
+ * that cannot send or receive places a waiter entry on its stack in the
+ * queue's sender or receiver list. The task on the other side of the transfer
+ * then copies the item directly to or from the waiter, and wakes it.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <sys/err.h>
+#include <sys/isr/isr.h>
+#include <sys/kmem/kmem.h>
+#include <sys/task/task.h>
+#include <util/list/ilist.h>
+#include <util/logging/logging.h>
+
+#include "queue.h"
+
+/** Internal definition of queue structure */
+typedef struct queue_state {
+    uint8_t *buffer;    /*!< Item storage */
+    uint32_t item_size; /*!< Size of each item */
+    uint32_t length;    /*!< Number of items queue can hold */
+    uint32_t count;     /*!< Number of items in queue */
+    uint32_t read_idx;  /*!< Index of item at front of queue */
+    uint32_t write_idx; /*!< Index to store next item at */
+    ilist_t senders;    /*!< Tasks waiting for space, by priority */
+    ilist_t receivers;  /*!< Tasks waiting for an item, by priority */
+    bool allocated;     /*!< Was this queue allocated? */
+} queue_state_t;
+
+_Static_assert(sizeof(queue_state_t) <= sizeof(queue_static_t),
+               "queue_static_t is too small to hold a queue");
+
+/**
+ * Waiting task structure. Lives on the stack of the waiting task, which
+ * cannot return while the entry is in a waiting list
+ */
+typedef struct queue_waiter {
+    task_handle_t task;      /*!< Task handle */
+    int delay;               /*!< Delay task requested */
+    uint32_t priority;       /*!< Priority of task when it started waiting */
+    void *item;              /*!< Item to send, or buffer to receive into */
+    volatile bool done;      /*!< Set when the item has been transferred */
+    ilist_node_t list_node;  /*!< Wait list node */
+} queue_waiter_t;
+
+/** Gets the waiter entry holding a wait list node */
+#define WAITER_OF(node) ilist_entry(node, queue_waiter_t, list_node)
+
+static const char *TAG = "queue.c";
+
+// Static functions
+static void init_queue(queue_state_t *queue, uint32_t item_size,
+                       uint32_t length, void *buffer, bool allocated);
+static void queue_push(queue_state_t *queue, const void *item);
+static void queue_pop(queue_state_t *queue, void *item);
+static syserr_t queue_wait(ilist_t *waiters, void *item, int delay,
+                           uint32_t state);
+static queue_waiter_t *queue_take_waiter(ilist_t *waiters);
+static void queue_wake(task_handle_t task, int delay);
+static int compare_priority(ilist_node_t *a, ilist_node_t *b);
+
+/**
+ * Creates a new queue. Items are copied into and out of the queue. To move
+ * large buffers without copying them, create a queue with item size
+ * QUEUE_PTR_ITEM_SIZE and pass pointers with queue_send_ptr and
+ * queue_receive_ptr. Item storage is allocated with the queue from the message
+ * buffer pool when it fits in SYS_POOL_MSGBUF_SIZE along with the queue state,
+ * and from the heap otherwise. Use queue_create_static to avoid the heap.
+ * @param item_size: size of each queue item, in bytes
+ * @param length: maximum number of items the queue holds
+ * @return handle to created queue, or NULL on error
+ */
+queue_t queue_create(uint32_t item_size, uint32_t length) {
+    queue_state_t *queue;
+    if (item_size == 0 || length == 0) {
+        return NULL;
+    }
+    // Allocate queue state and item storage together
+    queue = kmem_alloc(KMEM_MSGBUF, sizeof(queue_state_t) + item_size * length);
+    if (queue == NULL) {
+        return NULL;
+    }
+    init_queue(queue, item_size, length, queue + 1, true);
+    return (queue_t)queue;
+}
+
+/**
+ * Creates a new queue without allocating memory.
+ * @param item_size: size of each queue item, in bytes
+ * @param length: maximum number of items the queue holds
+ * @param buffer: item storage, at least item_size * length bytes
+ * @param storage: storage for queue. Must remain valid until the queue is
+ * destroyed, as must buffer
+ * @return handle to created queue, or NULL on error
+ */
+queue_t queue_create_static(uint32_t item_size, uint32_t length, void *buffer,
+                            queue_static_t *storage) {
+    if (item_size == 0 || length == 0 || buffer == NULL || storage == NULL) {
+        return NULL;
+    }
+    init_queue((queue_state_t *)storage, item_size, length, buffer, false);
+    return (queue_t)storage;
+}
+
+/**
+ * Sends an item to the back of a queue. If a task is waiting to receive, the
+ * item is copied directly to it. May be called from interrupt context with a
+ * delay of SYS_TIMEOUT_NONE.
+ * @param queue: queue to send to
+ * @param item: item to send. item_size bytes are copied from it
+ * @param delay: max amount of time to wait for space in the queue (in ms).
+ * Use value SYS_TIMEOUT_INF for infinite timeout
+ * @return SYS_OK on success, or ERR_TIMEOUT if the queue stayed full
+ */
+syserr_t queue_send(queue_t queue, const void *item, int delay) {
+    queue_state_t *q = (queue_state_t *)queue;
+    queue_waiter_t *waiter;
+    uint32_t state = mask_irq_save();
+    waiter = queue_take_waiter(&q->receivers);
+    if (waiter != NULL) {
+        // A task is waiting for an item, so the queue is empty. Hand it over.
+        memcpy(waiter->item, item, q->item_size);
+        waiter->done = true;
+        // Waiter task cannot run until interrupts are restored
+        queue_wake(waiter->task, waiter->delay);
+        restore_irq_mask(state);
+        return SYS_OK;
+    }
+    if (q->count < q->length) {
+        queue_push(q, item);
+        restore_irq_mask(state);
+        return SYS_OK;
+    }
+    // Queue is full. A receiver will take the item from this task directly.
+    return queue_wait(&q->senders, (void *)item, delay, state);
+}
+
+/**
+ * Sends an item to a queue from interrupt context. Never blocks.
+ * @param queue: queue to send to
+ * @param item: item to send. item_size bytes are copied from it
+ * @return SYS_OK on success, or ERR_TIMEOUT if the queue is full
+ */
+syserr_t queue_send_from_isr(queue_t queue, const void *item) {
+    return queue_send(queue, item, SYS_TIMEOUT_NONE);
+}
+
+/**
+ * Receives the item at the front of a queue. If a task is waiting to send,
+ * its item is moved into the queue. May be called from interrupt context with
+ * a delay of SYS_TIMEOUT_NONE.
+ * @param queue: queue to receive from
+ * @param item: buffer to receive item into. item_size bytes are copied to it
+ * @param delay: max amount of time to wait for an item (in ms). Use value
+ * SYS_TIMEOUT_INF for infinite timeout
+ * @return SYS_OK on success, or ERR_TIMEOUT if the queue stayed empty
+ */
+syserr_t queue_receive(queue_t queue, void *item, int delay) {
+    queue_state_t *q = (queue_state_t *)queue;
+    queue_waiter_t *waiter;
+    uint32_t state = mask_irq_save();
+    if (q->count == 0) {
+        // Queue is empty. A sender will copy its item to this task directly.
+        return queue_wait(&q->receivers, item, delay, state);
+    }
+    queue_pop(q, item);
+    waiter = queue_take_waiter(&q->senders);
+    if (waiter == NULL) {
+        restore_irq_mask(state);
+        return SYS_OK;
+    }
+    // A task is waiting for space. Move its item into the queue.
+    queue_push(q, waiter->item);
+    waiter->done = true;
+    // Waiter task cannot run until interrupts are restored
+    queue_wake(waiter->task, waiter->delay);
+    restore_irq_mask(state);
+    return SYS_OK;
+}
+
+/**
+ * Sends a pointer to a queue created with item size QUEUE_PTR_ITEM_SIZE. The
+ * data pointed to is not copied, so the sender must not modify it after
+ * sending.
+ * @param queue: queue to send to
+ * @param ptr: pointer to send
+ * @param delay: max amount of time to wait for space in the queue (in ms)
+ * @return SYS_OK on success, or ERR_TIMEOUT if the queue stayed full
+ */
+syserr_t queue_send_ptr(queue_t queue, void *ptr, int delay) {
+    return queue_send(queue, &ptr, delay);
+}
+
+/**
+ * Receives a pointer from a queue created with item size QUEUE_PTR_ITEM_SIZE.
+ * @param queue: queue to receive from
+ * @param ptr: set to the received pointer
+ * @param delay: max amount of time to wait for an item (in ms)
+ * @return SYS_OK on success, or ERR_TIMEOUT if the queue stayed empty
+ */
+syserr_t queue_receive_ptr(queue_t queue, void **ptr, int delay) {
+    return queue_receive(queue, ptr, delay);
+}
+
+/**
+ * Gets the number of items stored in a queue
+ * @param queue: queue to check
+ * @return number of items in queue
+ */
+uint32_t queue_count(queue_t queue) { return ((queue_state_t *)queue)->count; }
+
+/**
+ * Destroys a queue. Will fail if any tasks are waiting on the queue
+ * @param queue: queue to destroy
+ * @return SYS_OK on success, or ERR_BADPARAM when tasks are waiting
+ */
+syserr_t queue_destroy(queue_t queue) {
+    queue_state_t *q = (queue_state_t *)queue;
+    uint32_t state = mask_irq_save();
+    if (!ilist_empty(&q->senders) || !ilist_empty(&q->receivers)) {
+        restore_irq_mask(state);
+        LOG_D(TAG, "Cannot destroy queue, tasks are waiting");
+        return ERR_BADPARAM;
+    }
+    restore_irq_mask(state);
+    if (q->allocated) {
+        kmem_free(q);
+    }
+    return SYS_OK;
+}
+
+/**
+ * Initializes queue state
+ * @param queue: queue to initialize
+ * @param item_size: size of each item
+ * @param length: number of items queue holds
+ * @param buffer: item storage
+ * @param allocated: was the queue allocated with kmem_alloc?
+ */
+static void init_queue(queue_state_t *queue, uint32_t item_size,
+                       uint32_t length, void *buffer, bool allocated) {
+    queue->buffer = buffer;
+    queue->item_size = item_size;
+    queue->length = length;
+    queue->count = 0;
+    queue->read_idx = 0;
+    queue->write_idx = 0;
+    ilist_init(&queue->senders);
+    ilist_init(&queue->receivers);
+    queue->allocated = allocated;
+}
+
+/**
+ * Copies an item to the back of a queue. Queue must have space. MUST be
+ * called with interrupts masked.
+ * @param queue: queue to add item to
+ * @param item: item to copy
+ */
+static void queue_push(queue_state_t *queue, const void *item) {
+    memcpy(queue->buffer + queue->write_idx * queue->item_size, item,
+           queue->item_size);
+    queue->write_idx++;
+    if (queue->write_idx == queue->length) {
+        queue->write_idx = 0;
+    }
+    queue->count++;
+}
+
+/**
+ * Copies the item at the front of a queue out, and removes it. Queue must not
+ * be empty. MUST be called with interrupts masked.
+ * @param queue: queue to take item from
+ * @param item: buffer to copy item to
+ */
+static void queue_pop(queue_state_t *queue, void *item) {
+    memcpy(item, queue->buffer + queue->read_idx * queue->item_size,
+           queue->item_size);
+    queue->read_idx++;
+    if (queue->read_idx == queue->length) {
+        queue->read_idx = 0;
+    }
+    queue->count--;
+}
+
+/**
+ * Places the active task in a waiting list, and blocks it until another task
+ * transfers its item or the delay expires. MUST be called with interrupts
+ * masked by mask_irq_save. Restores the interrupt mask.
+ * @param waiters: waiting list to join
+ * @param item: item to send, or buffer to receive into
+ * @param delay: max time to wait in ms, or SYS_TIMEOUT_INF
+ * @param state: interrupt mask state from mask_irq_save
+ * @return SYS_OK if the item was transferred, or ERR_TIMEOUT on timeout
+ */
+static syserr_t queue_wait(ilist_t *waiters, void *item, int delay,
+                           uint32_t state) {
+    queue_waiter_t waiter;
+    syserr_t ret;
+    if (delay == SYS_TIMEOUT_NONE || in_isr() || !rtos_started()) {
+        restore_irq_mask(state);
+        return ERR_TIMEOUT;
+    }
+    /**
+     * Place this task into the waiting list, ordered by priority. The entry
+     * is stored on this task's stack, so blocking never needs to allocate
+     * memory.
+     */
+    waiter.task = get_active_task();
+    waiter.delay = delay;
+    waiter.priority = task_get_priority(waiter.task);
+    waiter.item = item;
+    waiter.done = false;
+    ilist_insert_sorted(waiters, &waiter.list_node, compare_priority);
+    /**
+     * Interrupts stay masked until the task is blocked, so the transfer
+     * cannot be missed. The context switch occurs once they are unmasked.
+     */
+    if (delay == SYS_TIMEOUT_INF) {
+        while (!waiter.done) {
+            block_active_task(BLOCK_QUEUE);
+            restore_irq_mask(state);
+            state = mask_irq_save();
+        }
+        restore_irq_mask(state);
+        // Other task removed our entry when transferring the item
+        return SYS_OK;
+    }
+    if (!waiter.done) {
+        task_delay((uint32_t)delay);
+    }
+    restore_irq_mask(state);
+    // Woken by a transfer, or the delay expired
+    state = mask_irq_save();
+    if (waiter.done) {
+        ret = SYS_OK;
+    } else {
+        ilist_remove(&waiter.list_node);
+        ret = ERR_TIMEOUT;
+    }
+    restore_irq_mask(state);
+    return ret;
+}
+
+/**
+ * Removes the highest priority task from a waiting list. MUST be called with
+ * interrupts masked.
+ * @param waiters: waiting list
+ * @return removed waiter, or NULL if no tasks are waiting
+ */
+static queue_waiter_t *queue_take_waiter(ilist_t *waiters) {
+    ilist_node_t *node = ilist_head(waiters);
+    if (node == NULL) {
+        return NULL;
+    }
+    ilist_remove(node);
+    return WAITER_OF(node);
+}
+
+/**
+ * Wakes a task whose item was transferred
+ * @param task: task to wake
+ * @param delay: delay the task requested when it started waiting
+ */
+static void queue_wake(task_handle_t task, int delay) {
+    if (delay == SYS_TIMEOUT_INF) {
+        // Unblock the task normally.
+        unblock_task(task, BLOCK_QUEUE);
+    } else {
+        // The task is in a delay block, clear the delay.
+        unblock_delayed_task(task);
+    }
+}
+
+/**
+ * Compares the priorities of two waiter entries. Used to keep wait lists
+ * sorted with the highest priority task first.
+ * @param a: first waiter entry
+ * @param b: second waiter entry
+ * @return negative value if entry a has higher priority than entry b
+ */
+static int compare_priority(ilist_node_t *a, ilist_node_t *b) {
+    queue_waiter_t *entry_a = WAITER_OF(a);
+    queue_waiter_t *entry_b = WAITER_OF(b);
+    return (int)entry_b->priority - (int)entry_a->priority;
+}
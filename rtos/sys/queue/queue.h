@@ -0,0 +1,118 @@
+/**
+ * @file queue.h
+ * Implements fixed size item message queues
+ */
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <stdint.h>
+
+#include <sys/err.h>
+#include <sys/semaphore/semaphore.h>
+
+// typedef to obscure internal definition of queue
+typedef void *queue_t;
+
+/**
+ * Storage for a statically allocated queue. Contents are private, this type
+ * only reserves memory of the correct size.
+ */
+typedef struct queue_static {
+    void *_reserved[11];
+} queue_static_t;
+
+/** Item size of a queue that passes pointers, see queue_send_ptr */
+#define QUEUE_PTR_ITEM_SIZE sizeof(void *)
+
+/**
+ * Creates a new queue. Items are copied into and out of the queue. To move
+ * large buffers without copying them, create a queue with item size
+ * QUEUE_PTR_ITEM_SIZE and pass pointers with queue_send_ptr and
+ * queue_receive_ptr. Item storage is allocated with the queue from the message
+ * buffer pool when it fits in SYS_POOL_MSGBUF_SIZE along with the queue state,
+ * and from the heap otherwise. Use queue_create_static to avoid the heap.
+ * @param item_size: size of each queue item, in bytes
+ * @param length: maximum number of items the queue holds
+ * @return handle to created queue, or NULL on error
+ */
+queue_t queue_create(uint32_t item_size, uint32_t length);
+
+/**
+ * Creates a new queue without allocating memory.
+ * @param item_size: size of each queue item, in bytes
+ * @param length: maximum number of items the queue holds
+ * @param buffer: item storage, at least item_size * length bytes
+ * @param storage: storage for queue. Must remain valid until the queue is
+ * destroyed, as must buffer
+ * @return handle to created queue, or NULL on error
+ */
+queue_t queue_create_static(uint32_t item_size, uint32_t length, void *buffer,
+                            queue_static_t *storage);
+
+/**
+ * Sends an item to the back of a queue. If a task is waiting to receive, the
+ * item is copied directly to it. May be called from interrupt context with a
+ * delay of SYS_TIMEOUT_NONE.
+ * @param queue: queue to send to
+ * @param item: item to send. item_size bytes are copied from it
+ * @param delay: max amount of time to wait for space in the queue (in ms).
+ * Use value SYS_TIMEOUT_INF for infinite timeout
+ * @return SYS_OK on success, or ERR_TIMEOUT if the queue stayed full
+ */
+syserr_t queue_send(queue_t queue, const void *item, int delay);
+
+/**
+ * Sends an item to a queue from interrupt context. Never blocks.
+ * @param queue: queue to send to
+ * @param item: item to send. item_size bytes are copied from it
+ * @return SYS_OK on success, or ERR_TIMEOUT if the queue is full
+ */
+syserr_t queue_send_from_isr(queue_t queue, const void *item);
+
+/**
+ * Receives the item at the front of a queue. If a task is waiting to send,
+ * its item is moved into the queue. May be called from interrupt context with
+ * a delay of SYS_TIMEOUT_NONE.
+ * @param queue: queue to receive from
+ * @param item: buffer to receive item into. item_size bytes are copied to it
+ * @param delay: max amount of time to wait for an item (in ms). Use value
+ * SYS_TIMEOUT_INF for infinite timeout
+ * @return SYS_OK on success, or ERR_TIMEOUT if the queue stayed empty
+ */
+syserr_t queue_receive(queue_t queue, void *item, int delay);
+
+/**
+ * Sends a pointer to a queue created with item size QUEUE_PTR_ITEM_SIZE. The
+ * data pointed to is not copied, so the sender must not modify it after
+ * sending.
+ * @param queue: queue to send to
+ * @param ptr: pointer to send
+ * @param delay: max amount of time to wait for space in the queue (in ms)
+ * @return SYS_OK on success, or ERR_TIMEOUT if the queue stayed full
+ */
+syserr_t queue_send_ptr(queue_t queue, void *ptr, int delay);
+
+/**
+ * Receives a pointer from a queue created with item size QUEUE_PTR_ITEM_SIZE.
+ * @param queue: queue to receive from
+ * @param ptr: set to the received pointer
+ * @param delay: max amount of time to wait for an item (in ms)
+ * @return SYS_OK on success, or ERR_TIMEOUT if the queue stayed empty
+ */
+syserr_t queue_receive_ptr(queue_t queue, void **ptr, int delay);
+
+/**
+ * Gets the number of items stored in a queue
+ * @param queue: queue to check
+ * @return number of items in queue
+ */
+uint32_t queue_count(queue_t queue);
+
+/**
+ * Destroys a queue. Will fail if any tasks are waiting on the queue
+ * @param queue: queue to destroy
+ * @return SYS_OK on success, or ERR_BADPARAM when tasks are waiting
+ */
+syserr_t queue_destroy(queue_t queue);
+
+#endif
@@ -0,0 +1,57 @@
+/**
+ * @file sections.h
+ * Attributes to place code and data in linker script sections
+ */
+#ifndef SECTIONS_H
+#define SECTIONS_H
+
+#include <config.h>
+
+#if SYS_PORT == PORT_HOST
+/** The host port has no linker script, so placement attributes are empty */
+#define __ramfunc
+#define __fast_data
+#define __fast_bss
+#define __retained
+#define __noinit
+#else
+
+/**
+ * Places a function in SRAM. Flash needs up to 4 wait states at 80 MHz, but
+ * SRAM runs with none, so hot interrupt handlers run faster from it. The
+ * .ramfunc section is copied from flash to SRAM at boot, with .data.
+ * Calls into SRAM are beyond the range of a branch from flash, so callers
+ * load the function address instead.
+ */
+#define __ramfunc __attribute__((section(".ramfunc"), noinline, long_call))
+
+/**
+ * Places initialized data in SRAM2. SRAM2 is a separate bus slave from SRAM1,
+ * so the core can access it while DMA transfers use SRAM1. Copied from flash
+ * at boot, with .data.
+ */
+#define __fast_data __attribute__((section(".fast_data")))
+
+/**
+ * Places zero initialized data in SRAM2, as with __fast_data. Zeroed at boot,
+ * with .bss. Variables MUST NOT have a nonzero initializer.
+ */
+#define __fast_bss __attribute__((section(".fast_bss")))
+
+/**
+ * Places data in SRAM2, and keeps it when the core wakes from Standby mode.
+ * Zeroed on any other reset. Variables MUST NOT have an initializer.
+ */
+#define __retained __attribute__((section(".retained")))
+
+/**
+ * Places data in SRAM2, and keeps it through any reset but power on, such as
+ * for crash logs. The contents are undefined after power on or brownout
+ * (SRAM2 is zeroed then, so parity is valid), so validate them before use.
+ * Variables MUST NOT have an initializer.
+ */
+#define __noinit __attribute__((section(".noinit")))
+
+#endif
+
+#endif
@@ -2,17 +2,20 @@
  * @file semaphore.c
  * implements binary and counting semaphores
  */
+#include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 
 #include <sys/err.h>
+#include <sys/isr/isr.h>
+#include <sys/kmem/kmem.h>
 #include <sys/task/task.h>
-#include <util/list/list.h>
+#include <sys/trace/trace.h>
+#include <util/list/ilist.h>
 #include <util/logging/logging.h>
 
 #include "semaphore.h"
 
-#define SEMAPHORE_UNLOCKED 0x00
-#define SEMAPHORE_LOCKED 0xFF
 #define SEMAPHORE_TIMED_OUT -2
 
 /** Semaphore type */
@@ -23,24 +26,52 @@ typedef enum {
 
 /** Internal defintion of semaphore structure */
 typedef struct semaphore_state {
-    char lock; /*!< Semaphore lock. 0 when open, 0xFF when locked*/
+    uint32_t irq_state; /*!< Interrupt mask state saved by semaphore lock */
     volatile unsigned int value; /*!< Semaphore value */
     semaphore_type_t type;       /*!< Semaphore type */
-    list_t waiting_tasks;        /*!< List of tasks waiting on the semaphore */
+    ilist_t waiting_tasks; /*!< Tasks waiting on the semaphore, by priority */
+    bool allocated;       /*!< Was this semaphore allocated? */
 } semaphore_state_t;
 
-/** Waiting task structure */
+/** Internal definition of mutex structure */
+typedef struct mutex_state {
+    semaphore_state_t sem;   /*!< Semaphore holding lock and waiting tasks */
+    task_handle_t owner;     /*!< Task holding the mutex, or NULL if free */
+    uint32_t owner_priority; /*!< Priority of owner when it took the mutex */
+} mutex_state_t;
+
+_Static_assert(sizeof(semaphore_state_t) <= sizeof(semaphore_static_t),
+               "semaphore_static_t is too small to hold a semaphore");
+_Static_assert(sizeof(mutex_state_t) <= sizeof(mutex_static_t),
+               "mutex_static_t is too small to hold a mutex");
+
+/**
+ * Waiting task structure. Lives on the stack of the pending task, which cannot
+ * return from semaphore_pend while the entry is in the waiting list
+ */
 typedef struct waiting_task {
     task_handle_t task;      /*!< Task handle */
     int delay;               /*!< Delay task requested on semaphore pend */
-    list_state_t list_state; /*!< list state structure */
+    uint32_t priority;       /*!< Priority of task when it started waiting */
+    volatile bool granted;   /*!< Set when a post hands the task the token */
+    ilist_node_t list_node;  /*!< Wait list node */
 } waiting_task_t;
 
+/** Gets the waiting task entry holding a wait list node */
+#define WAITER_OF(node) ilist_entry(node, waiting_task_t, list_node)
+
 static const char *TAG = "semaphore.c";
 
 // Static functions
 static void get_semaphore_lock(semaphore_state_t *sem);
 static void drop_semaphore_lock(semaphore_state_t *sem);
+static syserr_t wait_for_post(semaphore_state_t *semaphore, int delay);
+static task_handle_t wake_waiting_task(semaphore_state_t *semaphore);
+static int compare_priority(ilist_node_t *a, ilist_node_t *b);
+static void init_semaphore(semaphore_state_t *sem, semaphore_type_t type,
+                           unsigned int start, bool allocated);
+static void init_mutex(mutex_state_t *mutex, bool allocated);
+static void mutex_drop_boost(mutex_state_t *mutex, uint32_t priority);
 
 /**
  * creates a new counting semaphore
@@ -48,15 +79,12 @@ static void drop_semaphore_lock(semaphore_state_t *sem);
  * @return handle to created semaphore, or null on error
  */
 semaphore_t semaphore_create_counting(unsigned int start) {
-    semaphore_state_t *sem = malloc(sizeof(semaphore_state_t));
+    semaphore_state_t *sem =
+        kmem_alloc(KMEM_SEMAPHORE, sizeof(semaphore_state_t));
     if (sem == NULL) {
         return NULL;
     }
-    // Initialize semaphore
-    sem->lock = SEMAPHORE_UNLOCKED;
-    sem->type = SEMAPHORE_COUNTING;
-    sem->value = start;
-    sem->waiting_tasks = NULL;
+    init_semaphore(sem, SEMAPHORE_COUNTING, start, true);
     return (semaphore_t)sem;
 }
 
@@ -65,31 +93,59 @@ semaphore_t semaphore_create_counting(unsigned int start) {
  * @return handle to created semaphore, or null on error
  */
 semaphore_t semaphore_create_binary() {
-    semaphore_state_t *sem = malloc(sizeof(semaphore_state_t));
+    semaphore_state_t *sem =
+        kmem_alloc(KMEM_SEMAPHORE, sizeof(semaphore_state_t));
     if (sem == NULL) {
         return NULL;
     }
-    // Initialize semaphore
-    sem->lock = SEMAPHORE_UNLOCKED;
-    sem->type = SEMAPHORE_BINARY;
-    sem->value = 0;
-    sem->waiting_tasks = NULL;
+    init_semaphore(sem, SEMAPHORE_BINARY, 0, true);
     return (semaphore_t)sem;
 }
 
 /**
- * pends on a semaphore (p). if other tasks are pending on semaphore, calling
- * task will be given lowest priority. blocks until semaphore value is nonzero
- * and all tasks that pended before caller have been unblocked.
+ * creates a new counting semaphore without allocating memory
+ * @param start: starting value for counting semaphore
+ * @param storage: storage for semaphore. Must remain valid until the
+ * semaphore is destroyed
+ * @return handle to created semaphore, or null on error
+ */
+semaphore_t semaphore_create_counting_static(unsigned int start,
+                                             semaphore_static_t *storage) {
+    if (storage == NULL) {
+        return NULL;
+    }
+    init_semaphore((semaphore_state_t *)storage, SEMAPHORE_COUNTING, start,
+                   false);
+    return (semaphore_t)storage;
+}
+
+/**
+ * creates a new binary semaphore without allocating memory. semaphore always
+ * starts at 0.
+ * @param storage: storage for semaphore. Must remain valid until the
+ * semaphore is destroyed
+ * @return handle to created semaphore, or null on error
+ */
+semaphore_t semaphore_create_binary_static(semaphore_static_t *storage) {
+    if (storage == NULL) {
+        return NULL;
+    }
+    init_semaphore((semaphore_state_t *)storage, SEMAPHORE_BINARY, 0, false);
+    return (semaphore_t)storage;
+}
+
+/**
+ * pends on a semaphore (p). Blocks until semaphore value is nonzero. Waiting
+ * tasks are woken in priority order, and tasks of equal priority are woken
+ * in the order they pended.
  * @param sem: semaphore to pend on
  * @param delay: max amount of time to pend on the semaphore before timeout (in
- * @return SYS_OK if pend succeeded, or ERR_TIMEOUT if pend timed out
  * ms). Use value SYS_TIMEOUT_INF for infinite timeout
+ * @return SYS_OK if pend succeeded, or ERR_TIMEOUT if pend timed out
  */
 syserr_t semaphore_pend(semaphore_t sem, int delay) {
-    syserr_t ret;
     semaphore_state_t *semaphore = (semaphore_state_t *)sem;
-    waiting_task_t *queue_entry;
+    trace_event(TRACE_SEM_PEND, (uintptr_t)semaphore, 0);
     // Get the semaphore lock
     get_semaphore_lock(semaphore);
     // Check semaphore value
@@ -99,73 +155,27 @@ syserr_t semaphore_pend(semaphore_t sem, int delay) {
         drop_semaphore_lock(semaphore);
         return SYS_OK;
     }
-    /**
-     * Semaphore value is 0. Wait for a post to the semaphore. Place this task
-     * into semaphore's queue
-     */
-    queue_entry = malloc(sizeof(waiting_task_t));
-    if (queue_entry == NULL) {
-        LOG_E(TAG, "Out of memory to allocate queue entry\n");
-        exit(ERR_NOMEM);
-    }
-    queue_entry->task = get_active_task();
-    queue_entry->delay = delay;
-    // Add queue entry to semaphore queue
-    semaphore->waiting_tasks = list_append(
-        semaphore->waiting_tasks, queue_entry, &(queue_entry->list_state));
-    // Drop semaphore lock
-    drop_semaphore_lock(semaphore);
-    if (delay == SYS_TIMEOUT_INF) {
-        // Block task without timeout, and try to get semaphore at every wakeup
-        while (1) {
-            block_active_task(BLOCK_SEMAPHORE);
-            get_semaphore_lock(semaphore);
-            if (semaphore->value > 0) {
-                semaphore->value--;
-                // We got a post to the semaphore. break out of loop.
-                ret = SYS_OK;
-                break;
-            } else {
-                drop_semaphore_lock(semaphore);
-            }
-        }
-    } else {
-        // Block task with timeout
-        task_delay((uint32_t)delay);
-        // Try to get semaphore (we may have unblocked due to a post)
-        get_semaphore_lock(semaphore);
-        if (semaphore->value > 0) {
-            semaphore->value--;
-            ret = SYS_OK;
-        } else {
-            ret = ERR_TIMEOUT;
-        }
-        // Timeout has expired. Continue even if we did not get semaphore post
-    }
-    /**
-     * At this point we either successfully pended on the semaphore or timed
-     * out. Remove the task from the waiting list.
-     */
-    semaphore->waiting_tasks =
-        list_remove(semaphore->waiting_tasks, &(queue_entry->list_state));
-    // Free queue entry
-    free(queue_entry);
-    // Drop semaphore lock
-    drop_semaphore_lock(semaphore);
-    return ret;
+    // Semaphore value is 0. Wait for a post to the semaphore.
+    return wait_for_post(semaphore, delay);
 }
 
 /**
  * posts to a semaphore (v), incrementing the value by one. does not block.
+ * If a task is waiting on the semaphore, the post is handed directly to the
+ * highest priority waiting task instead.
  * If the semaphore is a binary one and the value is already one, this call
  * has no effect.
  * @param sem: semaphore to post to
  */
 void semaphore_post(semaphore_t sem) {
     semaphore_state_t *semaphore = (semaphore_state_t *)sem;
-    waiting_task_t *runnable_queue_entry;
+    trace_event(TRACE_SEM_POST, (uintptr_t)semaphore, 0);
     // Get the semaphore lock
     get_semaphore_lock(semaphore);
+    // If tasks are waiting, hand the post to one. Drops the lock.
+    if (wake_waiting_task(semaphore) != NULL) {
+        return;
+    }
     if (semaphore->type == SEMAPHORE_BINARY && semaphore->value == 1) {
         // Drop lock and return
         drop_semaphore_lock(semaphore);
@@ -173,20 +183,6 @@ void semaphore_post(semaphore_t sem) {
     }
     // Increment the semaphore value
     semaphore->value++;
-    // If tasks are waiting, unblock one
-    if (semaphore->waiting_tasks != NULL) {
-        runnable_queue_entry = list_get_head(semaphore->waiting_tasks);
-        drop_semaphore_lock(semaphore);
-        // Mark the selected task as runnable
-        if (runnable_queue_entry->delay == SYS_TIMEOUT_INF) {
-            // Unblock the task normally.
-            unblock_task(runnable_queue_entry->task, BLOCK_SEMAPHORE);
-        } else {
-            // The task is in a delay block, clear the delay.
-            unblock_delayed_task(runnable_queue_entry->task);
-        }
-        return;
-    }
     // Drop the semaphore lock
     drop_semaphore_lock(semaphore);
 }
@@ -200,51 +196,341 @@ syserr_t semaphore_destroy(semaphore_t sem) {
     semaphore_state_t *semaphore = (semaphore_state_t *)sem;
     // Get the semaphore lock
     get_semaphore_lock(semaphore);
-    if (semaphore->waiting_tasks != NULL) {
+    if (!ilist_empty(&semaphore->waiting_tasks)) {
         LOG_D(TAG, "Cannot destroy semaphore, tasks are pending");
         // Drop semaphore
         drop_semaphore_lock(semaphore);
         return ERR_BADPARAM;
     } else {
+        // Drop the lock before freeing, it restores the interrupt mask
+        drop_semaphore_lock(semaphore);
         // Free semaphore resources
-        free(semaphore);
-        return SYS_OK; // No need to drop lock, we just freed it
+        if (semaphore->allocated) {
+            kmem_free(semaphore);
+        }
+        return SYS_OK;
+    }
+}
+
+/**
+ * Creates a new mutex. Mutexes may only be locked and unlocked by tasks, not
+ * from interrupt context.
+ * @return handle to created mutex, or NULL on error
+ */
+mutex_t mutex_create() {
+    mutex_state_t *mutex = kmem_alloc(KMEM_SEMAPHORE, sizeof(mutex_state_t));
+    if (mutex == NULL) {
+        return NULL;
+    }
+    init_mutex(mutex, true);
+    return (mutex_t)mutex;
+}
+
+/**
+ * Creates a new mutex without allocating memory. Mutexes may only be locked
+ * and unlocked by tasks, not from interrupt context.
+ * @param storage: storage for mutex. Must remain valid until the mutex is
+ * destroyed
+ * @return handle to created mutex, or NULL on error
+ */
+mutex_t mutex_create_static(mutex_static_t *storage) {
+    if (storage == NULL) {
+        return NULL;
+    }
+    init_mutex((mutex_state_t *)storage, false);
+    return (mutex_t)storage;
+}
+
+/**
+ * Locks a mutex. If the mutex is held by a lower priority task, that task
+ * inherits the priority of the caller until it unlocks the mutex, or until
+ * the caller times out and no other waiter needs the raised priority.
+ * Mutexes are not recursive. Priority inheritance is not transitive: if the
+ * owner is itself blocked on another mutex, that mutex's owner is not raised.
+ * A raised task also keeps its position in any wait list it is already in.
+ * @param mutex: mutex to lock
+ * @param delay: max amount of time to wait for the mutex before timeout (in
+ * ms). Use value SYS_TIMEOUT_INF for infinite timeout
+ * @return SYS_OK if the mutex was locked, ERR_TIMEOUT if the wait timed out,
+ * or ERR_INUSE if the calling task already holds the mutex
+ */
+syserr_t mutex_lock(mutex_t mutex, int delay) {
+    mutex_state_t *mtx = (mutex_state_t *)mutex;
+    task_handle_t self = get_active_task();
+    uint32_t priority;
+    syserr_t ret;
+    // Mutexes are traced as semaphores, so timeouts match their pends
+    trace_event(TRACE_SEM_PEND, (uintptr_t)&mtx->sem, 0);
+    get_semaphore_lock(&mtx->sem);
+    if (mtx->owner == NULL) {
+        // Mutex is free, take it
+        mtx->owner = self;
+        mtx->owner_priority = task_get_priority(self);
+        drop_semaphore_lock(&mtx->sem);
+        return SYS_OK;
+    }
+    if (mtx->owner == self) {
+        drop_semaphore_lock(&mtx->sem);
+        return ERR_INUSE;
+    }
+    /**
+     * Mutex is held. Raise the owner to our priority so that tasks of
+     * intermediate priority cannot hold us off by preempting the owner.
+     */
+    priority = task_get_priority(self);
+    if (priority > task_get_priority(mtx->owner)) {
+        task_set_priority(mtx->owner, priority);
     }
+    /**
+     * Wait for the owner to hand the mutex over. mutex_unlock sets the new
+     * owner before waking us, so there is nothing to do on success.
+     */
+    ret = wait_for_post(&mtx->sem, delay);
+    if (ret == ERR_TIMEOUT) {
+        mutex_drop_boost(mtx, priority);
+    }
+    return ret;
 }
 
+/**
+ * Unlocks a mutex. Restores the priority the caller had when it locked the
+ * mutex, and hands the mutex to the highest priority waiting task. Mutexes
+ * held at the same time should be unlocked in the reverse order they were
+ * locked, so that inherited priorities are restored correctly.
+ * @param mutex: mutex to unlock
+ * @return SYS_OK on success, or ERR_BADPARAM if caller does not hold mutex
+ */
+syserr_t mutex_unlock(mutex_t mutex) {
+    mutex_state_t *mtx = (mutex_state_t *)mutex;
+    task_handle_t self = get_active_task();
+    waiting_task_t *next;
+    uint32_t base_priority;
+    trace_event(TRACE_SEM_POST, (uintptr_t)&mtx->sem, 0);
+    get_semaphore_lock(&mtx->sem);
+    if (mtx->owner != self) {
+        drop_semaphore_lock(&mtx->sem);
+        return ERR_BADPARAM;
+    }
+    base_priority = mtx->owner_priority;
+    if (ilist_empty(&mtx->sem.waiting_tasks)) {
+        // No tasks waiting, mark mutex as free
+        mtx->owner = NULL;
+        drop_semaphore_lock(&mtx->sem);
+    } else {
+        // Make the highest priority waiter the owner, then wake it
+        next = WAITER_OF(ilist_head(&mtx->sem.waiting_tasks));
+        mtx->owner = next->task;
+        mtx->owner_priority = next->priority;
+        // Drops the semaphore lock
+        wake_waiting_task(&mtx->sem);
+    }
+    /**
+     * Drop any inherited priority. Done after handing off the mutex so that
+     * this task cannot be preempted while it still holds it.
+     */
+    if (task_get_priority(self) != base_priority) {
+        task_set_priority(self, base_priority);
+    }
+    return SYS_OK;
+}
+
+/**
+ * Destroys a mutex. Will fail if the mutex is held or tasks are waiting on it
+ * @param mutex: mutex to destroy
+ * @return SYS_OK on success, or ERR_BADPARAM if the mutex is in use
+ */
+syserr_t mutex_destroy(mutex_t mutex) {
+    mutex_state_t *mtx = (mutex_state_t *)mutex;
+    get_semaphore_lock(&mtx->sem);
+    if (mtx->owner != NULL || !ilist_empty(&mtx->sem.waiting_tasks)) {
+        LOG_D(TAG, "Cannot destroy mutex, it is in use");
+        drop_semaphore_lock(&mtx->sem);
+        return ERR_BADPARAM;
+    }
+    drop_semaphore_lock(&mtx->sem);
+    if (mtx->sem.allocated) {
+        kmem_free(mtx);
+    }
+    return SYS_OK;
+}
+
+/**
+ * Initializes semaphore state
+ * @param sem: semaphore to initialize
+ * @param type: semaphore type
+ * @param start: starting semaphore value
+ * @param allocated: was the semaphore allocated with kmem_alloc?
+ */
+static void init_semaphore(semaphore_state_t *sem, semaphore_type_t type,
+                           unsigned int start, bool allocated) {
+    sem->irq_state = 0;
+    sem->type = type;
+    sem->value = start;
+    ilist_init(&sem->waiting_tasks);
+    sem->allocated = allocated;
+}
+
+/**
+ * Initializes mutex state
+ * @param mutex: mutex to initialize
+ * @param allocated: was the mutex allocated with kmem_alloc?
+ */
+static void init_mutex(mutex_state_t *mutex, bool allocated) {
+    init_semaphore(&mutex->sem, SEMAPHORE_BINARY, 0, allocated);
+    mutex->owner = NULL;
+    mutex->owner_priority = 0;
+}
+
+/**
+ * Drops the priority a timed out waiter lent to the owner of a mutex. The
+ * owner is lowered to the highest priority still waiting on the mutex, or its
+ * own priority if none are waiting. Only waiters on this mutex are counted.
+ * @param mutex: mutex the waiter timed out on
+ * @param priority: priority of the timed out waiter
+ */
+static void mutex_drop_boost(mutex_state_t *mutex, uint32_t priority) {
+    waiting_task_t *head;
+    uint32_t target;
+    get_semaphore_lock(&mutex->sem);
+    // Leave the owner alone unless it is running at the lent priority
+    if (mutex->owner != NULL && task_get_priority(mutex->owner) == priority) {
+        target = mutex->owner_priority;
+        if (!ilist_empty(&mutex->sem.waiting_tasks)) {
+            head = WAITER_OF(ilist_head(&mutex->sem.waiting_tasks));
+            if (head->priority > target) {
+                target = head->priority;
+            }
+        }
+        if (target < priority) {
+            task_set_priority(mutex->owner, target);
+        }
+    }
+    drop_semaphore_lock(&mutex->sem);
+}
+
+/**
+ * Places the active task in the semaphore's waiting list, and blocks it until
+ * a post is handed to it or the delay expires. MUST be called with the
+ * semaphore lock held. Drops the semaphore lock.
+ * @param semaphore: semaphore to wait on
+ * @param delay: max time to wait in ms, or SYS_TIMEOUT_INF
+ * @return SYS_OK if a post was handed to the task, or ERR_TIMEOUT on timeout
+ */
+static syserr_t wait_for_post(semaphore_state_t *semaphore, int delay) {
+    syserr_t ret;
+    waiting_task_t queue_entry;
+    uint32_t state;
+    if (delay == SYS_TIMEOUT_NONE) {
+        drop_semaphore_lock(semaphore);
+        trace_event(TRACE_SEM_TIMEOUT, (uintptr_t)semaphore, 0);
+        return ERR_TIMEOUT;
+    }
+    /**
+     * Place this task into semaphore's queue, ordered by priority. The queue
+     * entry is stored on this task's stack, so blocking never needs to
+     * allocate memory.
+     */
+    queue_entry.task = get_active_task();
+    queue_entry.delay = delay;
+    queue_entry.priority = task_get_priority(queue_entry.task);
+    queue_entry.granted = false;
+    ilist_insert_sorted(&semaphore->waiting_tasks, &queue_entry.list_node,
+                        compare_priority);
+    // Drop semaphore lock
+    drop_semaphore_lock(semaphore);
+    /**
+     * A post may arrive between dropping the lock and blocking. Interrupts
+     * are masked while checking for one, so the post cannot be missed. The
+     * context switch occurs as soon as interrupts are unmasked.
+     */
+    state = mask_irq_save();
+    if (delay == SYS_TIMEOUT_INF) {
+        while (!queue_entry.granted) {
+            block_active_task(BLOCK_SEMAPHORE);
+            restore_irq_mask(state);
+            state = mask_irq_save();
+        }
+        restore_irq_mask(state);
+        // Poster removed our queue entry when granting the post
+        return SYS_OK;
+    }
+    if (!queue_entry.granted) {
+        task_delay((uint32_t)delay);
+    }
+    restore_irq_mask(state);
+    // We were woken by a post, or the delay expired
+    get_semaphore_lock(semaphore);
+    if (queue_entry.granted) {
+        // Poster removed our queue entry when granting the post
+        ret = SYS_OK;
+    } else {
+        ilist_remove(&queue_entry.list_node);
+        ret = ERR_TIMEOUT;
+    }
+    drop_semaphore_lock(semaphore);
+    if (ret == ERR_TIMEOUT) {
+        trace_event(TRACE_SEM_TIMEOUT, (uintptr_t)semaphore, 0);
+    }
+    return ret;
+}
+
+/**
+ * Hands a post directly to the highest priority task waiting on a semaphore,
+ * and wakes it. The semaphore value is not changed. MUST be called with the
+ * semaphore lock held. Drops the semaphore lock if a task was woken.
+ * @param semaphore: semaphore to wake a waiting task for
+ * @return woken task, or NULL if no tasks were waiting (lock is still held)
+ */
+static task_handle_t wake_waiting_task(semaphore_state_t *semaphore) {
+    waiting_task_t *entry;
+    task_handle_t task;
+    int delay;
+    if (ilist_empty(&semaphore->waiting_tasks)) {
+        return NULL;
+    }
+    entry = WAITER_OF(ilist_head(&semaphore->waiting_tasks));
+    ilist_remove(&entry->list_node);
+    /**
+     * Copy the entry out before granting the post. Once granted, the entry
+     * may leave scope as soon as the waiting task runs.
+     */
+    task = entry->task;
+    delay = entry->delay;
+    entry->granted = true;
+    drop_semaphore_lock(semaphore);
+    // Mark the selected task as runnable
+    if (delay == SYS_TIMEOUT_INF) {
+        // Unblock the task normally.
+        unblock_task(task, BLOCK_SEMAPHORE);
+    } else {
+        // The task is in a delay block, clear the delay.
+        unblock_delayed_task(task);
+    }
+    return task;
+}
+
+/**
+ * Compares the priorities of two waiting task entries. Used to keep wait
+ * lists sorted with the highest priority task first.
+ * @param a: list node of first waiting task entry
+ * @param b: list node of second waiting task entry
+ * @return negative value if entry a has higher priority than entry b
+ */
+static int compare_priority(ilist_node_t *a, ilist_node_t *b) {
+    waiting_task_t *entry_a = WAITER_OF(a);
+    waiting_task_t *entry_b = WAITER_OF(b);
+    return (int)entry_b->priority - (int)entry_a->priority;
+}
 /**
  * Gets semaphore lock. Returns when lock is acquired
+ * The lock is a critical section, so it may be taken from interrupt context
+ * and while other critical sections are held.
  * @param sem: Semaphore state to get lock for.
  */
 static void get_semaphore_lock(semaphore_state_t *sem) {
-    /**
-     * Load semaphore lock using LDREXB. Check if lock is 0x00, and if so
-     * acquire it. If not, drop memory access with a strexb instruction, and
-     * retry
-     */
-    asm volatile(
-        "cpsid i\n"             // This code is critical, cannot be interrupted
-        "mov r2, %[lock]\n"     // Save lock address. GCC likes to overwrite it
-        "try_lock_%=:\n"        // Entry point for reading the lock value
-        "ldrexb r0, [r2]\n"     // Get lock value
-        "cmp r0, %[UNLOCKED]\n" // Check if lock is open
-        "it eq\n"
-        "beq take_lock_%=\n"    // Lock is open, take it
-        "strexb r1, r0, [r2]\n" // Lock is closed. Release memory access.
-        "cmp r1, #0x0\n"        // Check to make sure strexb updated memory
-        "it ne\n"
-        "bne try_lock_%=\n"     // If strexb failed, try to get lock again
-        "take_lock_%=:\n"       // Section for taking the lock
-        "mov r0, %[LOCKED]\n"   // Set r0 to the locked value
-        "strexb r1, r0, [r2]\n" // Try to store new locked value
-        "cmp r1, #0x0\n"        // Check to ensure strexb succeeded
-        "it ne\n"
-        "bne try_lock_%=\n" // strexb failed. Try to get lock again.
-        "cpsie i\n"         // exit critical section
-        :
-        : [ lock ] "r"(&(sem->lock)), [ LOCKED ] "i"(SEMAPHORE_LOCKED),
-          [ UNLOCKED ] "i"(SEMAPHORE_UNLOCKED)
-        : "r0", "r1", "r2");
+    uint32_t state = mask_irq_save();
+    // No other context can touch the semaphore until the mask is restored
+    sem->irq_state = state;
 }
 
 /**
@@ -253,27 +539,5 @@ static void get_semaphore_lock(semaphore_state_t *sem) {
  * @param sem: Semaphore state to drop lock for.
  */
 static void drop_semaphore_lock(semaphore_state_t *sem) {
-    /**
-     * Load semaphore lock using LDREXB. Check if lock is 0xFF, and if so drop
-     * it. If not, spin the processor so user knowns there was an error
-     */
-    asm volatile("cpsid i\n" // This code is critical, cannot be interrupted
-                 "mov r2, %[lock]\n" // Save lock address. GCC likes to
-                                     // overwrite it with -O2
-                 "ldrexb r0, [r2]\n"
-                 "spin_%=:\n"            // Offset to spin processor from
-                 "cmp r0, %[UNLOCKED]\n" // Check if lock is unlocked
-                 "it eq\n"
-                 "beq spin_%=\n" // Spin here, lock is unlocked
-                 "mov r0, %[UNLOCKED]\n"
-                 "try_drop_%=:\n"
-                 "strexb r1, r0, [r2]\n" // Set lock as unlocked
-                 "cmp r1, #0x0\n"        // Check if strexb succeeded
-                 "it ne\n"
-                 "bne try_drop_%=\n" // strexb failed, retry lock drop
-                 "cpsie i\n"         // exit critical section
-                 :
-                 : [ lock ] "p"(&(sem->lock)), [ LOCKED ] "i"(SEMAPHORE_LOCKED),
-                   [ UNLOCKED ] "i"(SEMAPHORE_UNLOCKED)
-                 : "r0", "r1");
+    restore_irq_mask(sem->irq_state);
 }
@@ -7,9 +7,28 @@
 #include <sys/err.h>
 
 #define SYS_TIMEOUT_INF -1  /*!< Infinite timeout on semaphore pend */
+#define SYS_TIMEOUT_NONE 0  /*!< Do not block on semaphore pend */
 
 // typedef to obscure internal definition of semaphore
 typedef void *semaphore_t;
+// typedef to obscure internal definition of mutex
+typedef void *mutex_t;
+
+/**
+ * Storage for a statically allocated semaphore. Contents are private, this
+ * type only reserves memory of the correct size.
+ */
+typedef struct semaphore_static {
+    void *_reserved[6];
+} semaphore_static_t;
+
+/**
+ * Storage for a statically allocated mutex. Contents are private, this type
+ * only reserves memory of the correct size.
+ */
+typedef struct mutex_static {
+    void *_reserved[8];
+} mutex_static_t;
 
 /**
  * creates a new counting semaphore
@@ -25,18 +44,39 @@ semaphore_t semaphore_create_counting(unsigned int start);
 semaphore_t semaphore_create_binary();
 
 /**
- * pends on a semaphore (p). if other tasks are pending on semaphore, calling
- * task will be given lowest priority. blocks until semaphore value is nonzero
- * and all tasks that pended before caller have been unblocked.
+ * creates a new counting semaphore without allocating memory
+ * @param start: starting value for counting semaphore
+ * @param storage: storage for semaphore. Must remain valid until the
+ * semaphore is destroyed
+ * @return handle to created semaphore, or null on error
+ */
+semaphore_t semaphore_create_counting_static(unsigned int start,
+                                             semaphore_static_t *storage);
+
+/**
+ * creates a new binary semaphore without allocating memory. semaphore always
+ * starts at 0.
+ * @param storage: storage for semaphore. Must remain valid until the
+ * semaphore is destroyed
+ * @return handle to created semaphore, or null on error
+ */
+semaphore_t semaphore_create_binary_static(semaphore_static_t *storage);
+
+/**
+ * pends on a semaphore (p). Blocks until semaphore value is nonzero. Waiting
+ * tasks are woken in priority order, and tasks of equal priority are woken
+ * in the order they pended.
  * @param sem: semaphore to pend on
  * @param delay: max amount of time to pend on the semaphore before timeout (in
- * @return SYS_OK if pend succeeded, or ERR_TIMEOUT if pend timed out
  * ms). Use value SYS_TIMEOUT_INF for infinite timeout
+ * @return SYS_OK if pend succeeded, or ERR_TIMEOUT if pend timed out
  */
 syserr_t semaphore_pend(semaphore_t sem, int delay);
 
 /**
  * posts to a semaphore (v), incrementing the value by one. does not block.
+ * If a task is waiting on the semaphore, the post is handed directly to the
+ * highest priority waiting task instead.
  * If the semaphore is a binary one and the value is already one, this call
  * has no effect.
  * @param sem: semaphore to post to
@@ -50,4 +90,52 @@ void semaphore_post(semaphore_t sem);
  */
 syserr_t semaphore_destroy(semaphore_t sem);
 
+/**
+ * Creates a new mutex. Mutexes may only be locked and unlocked by tasks, not
+ * from interrupt context.
+ * @return handle to created mutex, or NULL on error
+ */
+mutex_t mutex_create();
+
+/**
+ * Creates a new mutex without allocating memory. Mutexes may only be locked
+ * and unlocked by tasks, not from interrupt context.
+ * @param storage: storage for mutex. Must remain valid until the mutex is
+ * destroyed
+ * @return handle to created mutex, or NULL on error
+ */
+mutex_t mutex_create_static(mutex_static_t *storage);
+
+/**
+ * Locks a mutex. If the mutex is held by a lower priority task, that task
+ * inherits the priority of the caller until it unlocks the mutex, or until
+ * the caller times out and no other waiter needs the raised priority.
+ * Mutexes are not recursive. Priority inheritance is not transitive: if the
+ * owner is itself blocked on another mutex, that mutex's owner is not raised.
+ * A raised task also keeps its position in any wait list it is already in.
+ * @param mutex: mutex to lock
+ * @param delay: max amount of time to wait for the mutex before timeout (in
+ * ms). Use value SYS_TIMEOUT_INF for infinite timeout
+ * @return SYS_OK if the mutex was locked, ERR_TIMEOUT if the wait timed out,
+ * or ERR_INUSE if the calling task already holds the mutex
+ */
+syserr_t mutex_lock(mutex_t mutex, int delay);
+
+/**
+ * Unlocks a mutex. Restores the priority the caller had when it locked the
+ * mutex, and hands the mutex to the highest priority waiting task. Mutexes
+ * held at the same time should be unlocked in the reverse order they were
+ * locked, so that inherited priorities are restored correctly.
+ * @param mutex: mutex to unlock
+ * @return SYS_OK on success, or ERR_BADPARAM if caller does not hold mutex
+ */
+syserr_t mutex_unlock(mutex_t mutex);
+
+/**
+ * Destroys a mutex. Will fail if the mutex is held or tasks are waiting on it
+ * @param mutex: mutex to destroy
+ * @return SYS_OK on success, or ERR_BADPARAM if the mutex is in use
+ */
+syserr_t mutex_destroy(mutex_t mutex);
+
 #endif
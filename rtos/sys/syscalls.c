@@ -11,8 +11,10 @@
 #undef errno
 extern int errno;
 
+#include <malloc.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/stat.h>
 #include <sys/times.h>
 #include <unistd.h>
@@ -23,9 +25,12 @@ extern int errno;
 #include <drivers/swo/swo.h>
 #include <drivers/uart/uart.h>
 #include <sys/err.h>
+#include <sys/isr/isr.h>
+#include <sys/semaphore/semaphore.h>
 #include <sys/task/task.h>
 
-extern char _ebss; // Defined by linker
+extern char _ebss;  // Defined by linker
+extern char _eheap; // Defined by linker, end of SRAM1
 
 /** Minimal environment implementation */
 char *__env[1] = {0};
@@ -36,13 +41,22 @@ static char *max_sbrk = &_ebss; // Updated in initializer to keep GCC happy
 #if SYSLOG == SYSLOG_LPUART1
 static UART_handle_t uart_logger = NULL;
 #endif
+/**
+ * Heap lock. newlib may take the lock again while holding it, so the owning
+ * task and lock depth are tracked here, since mutexes are not recursive.
+ */
+static mutex_static_t malloc_mutex_storage;
+static mutex_t malloc_mutex = NULL;
+static task_handle_t malloc_owner = NULL;
+static int malloc_depth = 0;
 
 /**
  * Exits the system.
  * @param status: Exit code
  */
 void _exit(int status) {
-    // Flush STDOUT log
+    // Flush STDOUT buffer and log
+    fflush(stdout);
     fsync(STDOUT_FILENO);
     if (SYSEXIT == SYSEXIT_MIN) {
         while (1)
@@ -69,11 +83,12 @@ void *_sbrk(int incr) {
     void *old_brk;
     if (SYS_HEAP_SIZE != 0) {
         old_brk = current_sbrk;
-        // Set the new break
-        current_sbrk += incr;
-        if (current_sbrk > max_sbrk) {
+        if (current_sbrk + incr > max_sbrk) {
+            // Leave the break unchanged, so smaller requests can still pass
             return (void *)-1;
         }
+        // Set the new break
+        current_sbrk += incr;
         return old_brk;
     } else {
         // No memory allocation
@@ -81,6 +96,52 @@ void *_sbrk(int incr) {
     }
 }
 
+/**
+ * Locks the heap. Called by newlib before it allocates or frees memory, so
+ * tasks may allocate concurrently. Interrupts stay unmasked, so tasks that do
+ * not use the heap are not delayed. The lock is skipped before the RTOS
+ * starts, since only one context runs. Memory MUST NOT be allocated or freed
+ * from interrupt context.
+ * @param r: reentrancy state of the caller. Unused.
+ */
+void __malloc_lock(struct _reent *r) {
+    task_handle_t self;
+    if (malloc_mutex == NULL || !rtos_started() || in_isr()) {
+        return;
+    }
+    self = get_active_task();
+    if (malloc_owner == self) {
+        // newlib is taking the lock again
+        malloc_depth++;
+        return;
+    }
+    if (task_is_idle(self)) {
+        // The idle task must never block, so it yields until the lock is free
+        while (mutex_lock(malloc_mutex, SYS_TIMEOUT_NONE) != SYS_OK) {
+            task_yield();
+        }
+    } else {
+        mutex_lock(malloc_mutex, SYS_TIMEOUT_INF);
+    }
+    malloc_owner = self;
+    malloc_depth = 1;
+}
+
+/**
+ * Unlocks the heap. Called by newlib once it has finished changing the heap.
+ * @param r: reentrancy state of the caller. Unused.
+ */
+void __malloc_unlock(struct _reent *r) {
+    if (malloc_mutex == NULL || !rtos_started() || in_isr()) {
+        return;
+    }
+    if (malloc_owner != get_active_task() || --malloc_depth != 0) {
+        return;
+    }
+    malloc_owner = NULL;
+    mutex_unlock(malloc_mutex);
+}
+
 /**
  * Writes to a system device. In this implementation, the only system device
  * available is the UART logger, or semihosting if it is enabled.
@@ -131,6 +192,12 @@ int fsync(int fd) {
     }
     // Flush semihost
     semihost_flush();
+#elif SYSLOG == SYSLOG_SWO
+    if (fd != STDOUT_FILENO) {
+        return -1;
+    }
+    // Send buffered SWO output
+    SWO_flush();
 #else
     // No need to flush
 #endif
@@ -167,7 +234,12 @@ static void lpuart_init(void) {
     }
     lpuart_config.UART_baud_rate = UART_baud_115200;
     lpuart_config.UART_wordlen = UART_word_8n1;
+#if SYSLOG_TOKENIZED == SYSLOG_TOKENIZED_ENABLED
+    // Text mode would alter binary log records
+    lpuart_config.UART_textmode = UART_txtmode_dis;
+#else
     lpuart_config.UART_textmode = UART_txtmode_en;
+#endif
     uart_logger = UART_open(LPUART_1, &lpuart_config, &ret);
     if (ret != SYS_OK || uart_logger == NULL) {
         while (1)
@@ -198,6 +270,11 @@ void _init(void) {
      * Setting max_sbrk to the correct value here is the workaround.
      */
     max_sbrk += SYS_HEAP_SIZE;
+    if (max_sbrk > &_eheap) {
+        // SRAM2 follows SRAM1, so the heap may not grow past it
+        max_sbrk = &_eheap;
+    }
+    malloc_mutex = mutex_create_static(&malloc_mutex_storage);
 }
 
 /**
@@ -250,13 +327,18 @@ int _fork(void) {
 }
 
 /**
- * Stats a file. Stub implementation
+ * Stats a file. All files are reported as character devices, with a block
+ * size of SYS_STDOUT_BUFSIZE. newlib sizes stdio buffers from the block
+ * size, and line buffers streams on terminals, so stdout is written to the
+ * system log one line at a time.
  * @param file file descriptor to stat
  * @param st stat structure
  * @return 0 on success, or -1 on error
  */
 int _fstat(int file, struct stat *st) {
+    memset(st, 0, sizeof(*st));
     st->st_mode = S_IFCHR;
+    st->st_blksize = SYS_STDOUT_BUFSIZE;
     return 0;
 }
 
@@ -5,6 +5,7 @@
 
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
@@ -12,16 +13,59 @@
 #include <config.h>
 #include <drivers/clock/clock.h>
 #include <drivers/device/device.h>
+#include <drivers/power/power.h>
+#include <drivers/semihost/semihost.h>
 #include <sys/err.h>
 #include <sys/isr/isr.h>
+#include <sys/kmem/kmem.h>
+#include <sys/sections.h>
+#include <sys/semaphore/semaphore.h>
+#include <sys/trace/trace.h>
 #include <util/bitmask.h>
-#include <util/list/list.h>
+#include <util/list/ilist.h>
 #include <util/logging/logging.h>
 
+#if SYS_PORT == PORT_HOST
+#include <host/port.h>
+#endif
+
 #include "task.h"
 
 #define reg_t volatile uint32_t
 
+/* Byte value task stacks are painted with */
+#define STACK_PAINT 0xDE
+/* MPU region used for the stack guard, and its size (2^(n+1) bytes) */
+#define STACK_GUARD_REGION 0
+#define STACK_GUARD_SIZE 32
+#define STACK_GUARD_RASR_SIZE 4
+
+#if SYS_STACK_MPU_GUARD == STACK_MPU_GUARD_ENABLED &&                          \
+    SYS_STACK_PROTECTION_SIZE < (2 * STACK_GUARD_SIZE)
+#error "MPU stack guard requires SYS_STACK_PROTECTION_SIZE of at least 64"
+#endif
+
+/**
+ * With hardware floating point, a task's EXEC_RETURN has bit 4 clear when it
+ * used the FPU, and the hardware then reserves space for s0-s15 in the
+ * exception frame. The context switch saves s16-s31 only for those tasks.
+ * Saving s16-s31 triggers the lazy save of s0-s15, so tasks that never use
+ * the FPU pay nothing.
+ */
+#ifdef __ARM_FP
+#define SAVE_FP_CONTEXT(reg)                                                    \
+    "tst lr, #0x10\n"                                                          \
+    "it eq\n"                                                                  \
+    "vstmdbeq " reg "!, {s16-s31}\n"
+#define RESTORE_FP_CONTEXT(reg)                                                 \
+    "tst lr, #0x10\n"                                                          \
+    "it eq\n"                                                                  \
+    "vldmiaeq " reg "!, {s16-s31}\n"
+#else
+#define SAVE_FP_CONTEXT(reg) ""
+#define RESTORE_FP_CONTEXT(reg) ""
+#endif
+
 /* Initial task register states */
 #define INITIAL_xPSR 0x01000000 // T bit is set in EPSR (thumb instructions)
 #define INITIAL_EXEC_RETURN 0xFFFFFFFD // Thread mode with process stack
@@ -50,39 +94,105 @@ typedef struct task_status {
     task_state_t state;    /*!< state of task */
     const char *name;      /*!< Task name */
     bool stack_allocated;  /*!< Was the stack allocated? */
-    int blockstate;        /*!< cause for task block (or delay value) */
+    bool tcb_allocated;    /*!< Was this control block allocated? */
+    int blockstate;        /*!< cause for task block */
+    uint32_t wake_tick;    /*!< System tick that a delayed task wakes at */
     uint32_t priority;     /*!< Task priority */
-    list_state_t list_state; /*!< Task list state */
+    uint32_t timeslice;    /*!< Time slice length in ticks, or 0 */
+    uint32_t slice_ticks;  /*!< Ticks left in current time slice */
+    uint32_t notify_value; /*!< Task notification word */
+    uint32_t notify_bits;  /*!< Notification bits the task is waiting for */
+    uint32_t notify_flags; /*!< Notification wait flags */
+    bool notify_waiting;   /*!< Is task waiting in task_notify_wait? */
+    bool stack_overflow;   /*!< Was task retired for overflowing its stack? */
+#if SYS_TASK_STATS == TASK_STATS_ENABLED
+    bool woken;            /*!< Was task woken since it last ran? */
+    uint32_t wake_cycle;   /*!< Cycle count when task was woken */
+    task_stats_t stats;    /*!< Scheduler statistics */
+#endif
+    ilist_node_t list_node; /*!< Task list node */
+#if SYS_TASK_REENT == TASK_REENT_ENABLED
+    struct _reent reent; /*!< newlib reentrancy state */
+#endif
 } task_status_t;
 
-// Task control block lists
-static task_status_t *active_task = NULL;                // Running task
-static list_t ready_tasks[RTOS_PRIORITY_COUNT] = {NULL}; // Tasks ready to run
-static list_t delayed_tasks = NULL; // Tasks delayed by task_delay
-static list_t blocked_tasks = NULL; // Tasks blocked by system
-static list_t exited_tasks = NULL;  // Exited tasks waiting to be reaped
+/** Gets the task control block holding a task list node */
+#define TASK_OF(node) ilist_entry(node, task_status_t, list_node)
+
+_Static_assert(sizeof(task_status_t) <= sizeof(task_static_t),
+               "task_static_t is too small to hold a task control block");
+
+// Task control block lists. The scheduler state is kept in SRAM2
+static task_status_t *active_task __fast_bss = NULL; // Running task
+// Tasks ready to run, and bit n set if ready_tasks[n] has tasks
+static ilist_t ready_tasks[RTOS_PRIORITY_COUNT] __fast_bss;
+static uint32_t ready_priorities __fast_bss = 0;
+static ilist_t delayed_tasks __fast_bss; // Tasks delayed (sorted)
+static ilist_t blocked_tasks;            // Tasks blocked by system
+static ilist_t exited_tasks;             // Exited tasks waiting to be reaped
+// Waiting task that overflowed its stack. The idle task halts if this is set
+static task_status_t *halted_task = NULL;
+// Task lists are initialized when the first task is created
+static bool task_lists_ready = false;
+// System tick count. Wraps after 2^32 ticks (~49 days at 1kHz)
+static volatile uint32_t system_ticks = 0;
+// Number of times system_ticks has wrapped, the upper word of the 64 bit time
+static volatile uint32_t system_ticks_high = 0;
+#if SYS_TASK_STATS == TASK_STATS_ENABLED
+// Cycle count when run time was last accounted, and system statistics
+static uint32_t stats_last_cycle = 0;
+static system_stats_t system_stats = {0};
+#endif
 
 // Logging tag
 static const char *TAG = "task.c";
 // Idle task name
 static const char *IDLE_TASK_NAME = "Idle Task";
+// Idle task control block and stack
+static task_static_t idle_task_storage;
+static char idle_task_stack[IDLE_TASK_STACK_SIZE] __attribute__((aligned(8)));
+#if SYS_PORT == PORT_CORTEX_M4
+// Recomputes the system tick reload value when the system clock changes
+static clock_notifier_t systick_notifier;
+#endif
 
 // Static functions
+static void init_task(task_status_t *task, void (*entry)(void *), void *arg,
+                      task_config_t *cfg);
 static inline void set_pendsv();
 static inline void trigger_svcall();
 static void idle_entry(void *arg);
+#if SYS_PORT == PORT_CORTEX_M4
 static uint32_t *init_task_stack(uint32_t *stack_ptr, void *return_pc,
                                  void *arg0);
-static inline list_return_t decrement_task_delay(void *taskptr);
-static inline void mark_task_ready(void *taskptr);
-static inline list_return_t delete_list(void *taskptr);
-static inline list_return_t check_stack(void *taskptr);
-static inline void free_task(void *task);
+static void systick_set_reload();
+static void systick_clock_change(clock_change_t event, void *arg);
+#endif
+static void init_task_lists();
+static int compare_wake_tick(ilist_node_t *a, ilist_node_t *b);
+static void idle_sleep();
+static inline void advance_ticks(uint32_t ticks);
+static inline void mark_task_ready(task_status_t *task);
+static inline void ready_list_remove(task_status_t *task);
+static inline int highest_ready_priority();
+static inline bool notify_satisfied(task_status_t *task);
+static void wake_task(task_status_t *task);
+static inline void stats_init();
+static inline void stats_account();
+static inline void stats_switch_in(task_status_t *task);
+static inline void retire_overflowed_task(task_status_t *task);
+static void reap_exited_tasks();
+static inline bool stack_overflowed(task_status_t *task);
+static void report_overflow(task_status_t *task);
+static inline void stack_guard_init();
+static inline void stack_guard_set(task_status_t *task);
+static inline void free_task(task_status_t *task);
 static void task_exithandler();
 
 /**
- * Creates a system task. Requires memory allocation to be enabled to succeed.
- * Task will be scheduled, but will not start immediately.
+ * Creates a system task. The task control block (and stack, if not provided)
+ * are allocated from the kernel object pools, or the heap if pools are
+ * exhausted. Task will be scheduled, but will not start immediately.
  * @param entry: task entry point. Must be a function taking a void* and
  * returning void
  * @param arg: task argument. May be NULL. Will be passed to the task entry
@@ -93,78 +203,66 @@ static void task_exithandler();
 task_handle_t task_create(void (*entry)(void *), void *arg,
                           task_config_t *cfg) {
     task_status_t *task;
+    task_config_t task_cfg = DEFAULT_TASK_CONFIG;
     // Check parameters
     if (entry == NULL) {
         return NULL;
     }
-    task = malloc(sizeof(task_status_t));
-    if (task == NULL) {
+    if (cfg != NULL) {
+        task_cfg = *cfg;
+    }
+    if (task_cfg.task_priority >= RTOS_PRIORITY_COUNT) {
         return NULL;
     }
     // Allocate task block
-    if (cfg == NULL) {
-        // Set default task parameters
-        task->priority = DEFAULT_PRIORITY;
-        task->name = "";
-        // Allocate one extra byte so that the stack start is word aligned
-        task->stack_end = malloc(DEFAULT_STACKSIZE + 1);
-        task->stack_allocated = true;
-        if (task->stack_end == NULL) {
-            free(task);
-            return NULL;
-        }
-        task->stack_start = task->stack_end + (DEFAULT_STACKSIZE);
+    task = kmem_alloc(KMEM_TASK, sizeof(task_status_t));
+    if (task == NULL) {
+        return NULL;
+    }
+    task->tcb_allocated = true;
+    // Check if a stack was provided
+    if (task_cfg.task_stack) {
+        task->stack_allocated = false;
     } else {
-        // Check priority
-        if (cfg->task_priority > RTOS_PRIORITY_COUNT) {
+        task_cfg.task_stack = kmem_alloc(KMEM_STACK, task_cfg.task_stacksize);
+        if (task_cfg.task_stack == NULL) {
+            kmem_free(task);
             return NULL;
         }
-        // Check if a stack was provided
-        if (cfg->task_stack) {
-            task->stack_end = cfg->task_stack;
-            // Calculate start of stack
-            task->stack_start = task->stack_end + (cfg->task_stacksize - 1);
-            task->stack_allocated = false;
-        } else {
-            // Allocate one extra byte so that the stack start is word aligned
-            task->stack_end = malloc(cfg->task_stacksize + 1);
-            // Calculate start of stack
-            task->stack_start = task->stack_end + (cfg->task_stacksize);
-            task->stack_allocated = true;
-            if (task->stack_end == NULL) {
-                free(task);
-                return NULL;
-            }
-        }
-        if (cfg->task_name) {
-            task->name = cfg->task_name;
-        } else {
-            // Default value
-            task->name = "";
-        }
-        task->priority = cfg->task_priority;
-    }
-    /**
-     * Setup stack padding. 'stack_softend' is the memory location where padding
-     * starts, and where we consider a stack to have overflowed.
-     */
-    for (task->stack_softend = task->stack_end;
-         task->stack_softend < (task->stack_end + SYS_STACK_PROTECTION_SIZE);
-         task->stack_softend++) {
-        *(task->stack_softend) = 0xDE; // Dummy value
+        task->stack_allocated = true;
     }
-    // Update task state and place in ready queue
-    task->entry = entry;
-    task->arg = arg;
-    // Initialize task stack
-    task->stack_ptr =
-        init_task_stack((uint32_t *)task->stack_start, task->entry, task->arg);
-    // Place this task into the ready queue (scheduler can select it)
-    mark_task_ready(task);
+    init_task(task, entry, arg, &task_cfg);
     // Return task handle
     return (task_handle_t)task;
 };
 
+/**
+ * Creates a system task without allocating memory. The task control block is
+ * stored in the provided storage, and the task stack must be provided in the
+ * task configuration. Task will be scheduled, but will not start immediately.
+ * @param entry: task entry point. Must be a function taking a void* and
+ * returning void
+ * @param arg: task argument. May be NULL. Will be passed to the task entry
+ * point function
+ * @param cfg: task configuration structure. task_stack must be set
+ * @param storage: storage for task control block. Must remain valid until the
+ * task is destroyed
+ * @return created task handle on success, or NULL on error
+ */
+task_handle_t task_create_static(void (*entry)(void *), void *arg,
+                                 task_config_t *cfg, task_static_t *storage) {
+    task_status_t *task = (task_status_t *)storage;
+    // Check parameters
+    if (entry == NULL || cfg == NULL || cfg->task_stack == NULL ||
+        storage == NULL || cfg->task_priority >= RTOS_PRIORITY_COUNT) {
+        return NULL;
+    }
+    task->tcb_allocated = false;
+    task->stack_allocated = false;
+    init_task(task, entry, arg, cfg);
+    return (task_handle_t)task;
+}
+
 /**
  * Starts the real time operating system. This function will not return.
  *
@@ -179,11 +277,30 @@ void rtos_start() {
     idle_task_cfg.task_name = IDLE_TASK_NAME;
     idle_task_cfg.task_priority = IDLE_TASK_PRIORITY;
     idle_task_cfg.task_stacksize = IDLE_TASK_STACK_SIZE;
-    idle_task = task_create(idle_entry, NULL, &idle_task_cfg);
+    idle_task_cfg.task_stack = idle_task_stack;
+    idle_task = task_create_static(idle_entry, NULL, &idle_task_cfg,
+                                   &idle_task_storage);
     if (!idle_task) {
         LOG_E(TAG, "Could not create idle task");
         exit(ERR_SCHEDULER);
     }
+    // Start the deferred log task, if enabled
+    LOG_deferred_init();
+    // Start the cycle counter, if task statistics are enabled
+    stats_init();
+    // Enable the MPU for stack guard regions, if enabled
+    stack_guard_init();
+    // Set up Stop mode wakeup, if low power idle is enabled
+    power_init();
+#if SYS_PORT == PORT_CORTEX_M4
+    /**
+     * Set the tick period once here. The SVCall handler enables the tick each
+     * time it runs, and must not restart the tick in progress.
+     */
+    systick_set_reload();
+    systick_notifier.callback = systick_clock_change;
+    clock_register_notifier(&systick_notifier);
+#endif
     // Trigger an SVCall to start the scheduler. Will not return.
     trigger_svcall();
     LOG_E(TAG, "Scheduler returned without starting RTOS");
@@ -198,8 +315,13 @@ void task_yield() {
     if (!active_task) {
         return;
     }
-    // Mark task as ready, not active
-    active_task->state = TASK_READY;
+    /**
+     * Mark task as ready, not active. A task that is already blocking or
+     * delaying keeps that state, so the context switch places it correctly.
+     */
+    if (active_task->state == TASK_ACTIVE) {
+        active_task->state = TASK_READY;
+    }
     // Trigger a system context switch switch by setting pendsv bit
     set_pendsv();
 }
@@ -214,26 +336,97 @@ void task_delay(uint32_t delay) {
     if (!active_task || delay == 0) {
         return;
     }
-    // Assign delay value to task blockstate field
-    active_task->blockstate = delay;
+    // Record the absolute tick the task should wake at
+    active_task->wake_tick = system_ticks + delay;
     active_task->state = TASK_DELAYED;
     // Trigger a context switch
     set_pendsv();
 }
 
+/**
+ * Gets scheduler statistics for a task. Requires SYS_TASK_STATS to be enabled
+ * @param task: task to get statistics for
+ * @param stats: filled with task statistics
+ * @return SYS_OK on success, ERR_BADPARAM on invalid parameters, or
+ * ERR_NOSUPPORT if task statistics are disabled
+ */
+syserr_t task_get_stats(task_handle_t task, task_stats_t *stats) {
+#if SYS_TASK_STATS == TASK_STATS_ENABLED
+    task_status_t *tsk = (task_status_t *)task;
+    uint32_t state;
+    if (tsk == NULL || stats == NULL) {
+        return ERR_BADPARAM;
+    }
+    state = mask_irq_save();
+    // Charge the running task for time since the last accounting point
+    stats_account();
+    *stats = tsk->stats;
+    restore_irq_mask(state);
+    return SYS_OK;
+#else
+    return ERR_NOSUPPORT;
+#endif
+}
+
+/**
+ * Gets system wide scheduler statistics. CPU load is
+ * 1 - idle_cycles / total_cycles. Requires SYS_TASK_STATS to be enabled
+ * @param stats: filled with system statistics
+ * @return SYS_OK on success, ERR_BADPARAM on invalid parameters, or
+ * ERR_NOSUPPORT if task statistics are disabled
+ */
+syserr_t task_get_system_stats(system_stats_t *stats) {
+#if SYS_TASK_STATS == TASK_STATS_ENABLED
+    uint32_t state;
+    if (stats == NULL) {
+        return ERR_BADPARAM;
+    }
+    state = mask_irq_save();
+    stats_account();
+    *stats = system_stats;
+    stats->idle_cycles =
+        ((task_status_t *)&idle_task_storage)->stats.run_cycles;
+    restore_irq_mask(state);
+    return SYS_OK;
+#else
+    return ERR_NOSUPPORT;
+#endif
+}
+
+/**
+ * Gets the stack high water mark of a task. Task stacks are painted when the
+ * task is created, so this is the number of stack bytes the task has never
+ * used. Scans the stack, so takes time proportional to the unused space.
+ * @param task: task to check
+ * @return bytes of stack never used, not counting stack protection padding
+ */
+uint32_t task_stack_highwater(task_handle_t task) {
+    task_status_t *tsk = (task_status_t *)task;
+    char *ptr;
+    if (tsk == NULL) {
+        return 0;
+    }
+    // The stack grows down, so unused bytes start just above the padding
+    for (ptr = tsk->stack_softend;
+         ptr < tsk->stack_start && *ptr == (char)STACK_PAINT; ptr++) {
+    }
+    return ptr - tsk->stack_softend;
+}
+
 /**
  * Destroys a task. Will stop task execution immediately.
  * @param task: Task handle to destroy
  */
 void task_destroy(task_handle_t task) {
     task_status_t *tsk = (task_status_t *)task;
+    trace_event(TRACE_TASK_DESTROY, (uintptr_t)tsk, 0);
     // Check if the task handle is the active one
     if (tsk == active_task) {
         /**
          * We cannot free this task. Instead, place it in exited task list.
          * idle task will reap resources.
          */
-        exited_tasks = list_append(exited_tasks, tsk, &(tsk->list_state));
+        ilist_append(&exited_tasks, &tsk->list_node);
         active_task = NULL;
         // Trigger an SVCall to switch to a new active task (not context switch)
         trigger_svcall();
@@ -241,14 +434,11 @@ void task_destroy(task_handle_t task) {
         // Remove task from list it is in
         switch (tsk->state) {
         case TASK_BLOCKED:
-            blocked_tasks = list_remove(blocked_tasks, &(tsk->list_state));
+        case TASK_DELAYED:
+            ilist_remove(&tsk->list_node);
             break;
         case TASK_READY:
-            ready_tasks[tsk->priority] =
-                list_remove(ready_tasks[tsk->priority], &(tsk->list_state));
-            break;
-        case TASK_DELAYED:
-            delayed_tasks = list_remove(delayed_tasks, &(tsk->list_state));
+            ready_list_remove(tsk);
             break;
         default:
             LOG_W(TAG,
@@ -259,12 +449,212 @@ void task_destroy(task_handle_t task) {
     }
 }
 
+/**
+ * Gets the number of system ticks elapsed since the RTOS started. The tick
+ * count wraps on overflow, so compare tick values by subtraction.
+ * @return current system tick count
+ */
+uint32_t task_get_ticks() { return system_ticks; }
+
+/**
+ * Gets the time elapsed since the RTOS started in microseconds, derived from
+ * the system tick. Monotonic and never wraps, and includes time spent in
+ * low power modes. Returns 0 before the RTOS starts. Safe to call from
+ * interrupt context.
+ * @return microseconds elapsed since the RTOS started
+ */
+uint64_t task_get_time_us() {
+#if SYS_PORT == PORT_HOST
+    // The host port counts whole simulated ticks only
+    return (((uint64_t)system_ticks_high << 32) | system_ticks) *
+           (1000000UL / SYSTICK_FREQ);
+#else
+    uint64_t ticks;
+    uint32_t state, load, val;
+    state = mask_irq_save();
+    ticks = ((uint64_t)system_ticks_high << 32) | system_ticks;
+    load = SysTick->LOAD;
+    val = SysTick->VAL;
+    if (READBITS(SysTick->CTRL, SysTick_CTRL_ENABLE_Msk) == 0) {
+        // SysTick is not running, so there is no partial tick
+        val = load;
+    } else if (SCB->ICSR & SCB_ICSR_PENDSTSET_Msk) {
+        // The counter reloaded, but its tick has not been counted yet
+        ticks++;
+        val = SysTick->VAL;
+    }
+    restore_irq_mask(state);
+    // SysTick counts down from LOAD, so add the part of the tick elapsed
+    return ticks * (1000000UL / SYSTICK_FREQ) +
+           ((uint64_t)(load - val) * (1000000UL / SYSTICK_FREQ)) / (load + 1);
+#endif
+}
+
+/**
+ * Gets the priority of a task
+ * @param task: task to get priority of
+ * @return task priority
+ */
+uint32_t task_get_priority(task_handle_t task) {
+    return ((task_status_t *)task)->priority;
+}
+
+/**
+ * Sets the priority of a task. If preemption is enabled and the change leaves
+ * a ready task with higher priority than the running one, it will run.
+ * @param task: task to change priority of
+ * @param priority: new task priority
+ * @return SYS_OK on success, or ERR_BADPARAM on invalid task or priority
+ */
+syserr_t task_set_priority(task_handle_t task, uint32_t priority) {
+    task_status_t *tsk = (task_status_t *)task;
+    uint32_t state;
+    // Check parameters
+    if (tsk == NULL || priority >= RTOS_PRIORITY_COUNT) {
+        return ERR_BADPARAM;
+    }
+    // May be called with interrupts already masked, such as by mutex_lock
+    state = mask_irq_save();
+    if (tsk->state == TASK_READY && tsk != active_task) {
+        // Move the task to the ready list for its new priority
+        ready_list_remove(tsk);
+        tsk->priority = priority;
+        mark_task_ready(tsk);
+    } else {
+        /**
+         * Task is not in a ready list. This includes the active task after it
+         * yields with the context switch held off, which the switch places.
+         */
+        tsk->priority = priority;
+    }
+#if SYS_USE_PREEMPTION == PREEMPTION_ENABLED
+    // Check to see if a ready task now has higher priority than the active one
+    if (active_task != NULL &&
+        highest_ready_priority() > (int)active_task->priority) {
+        // Force a context switch
+        task_yield();
+    }
+#endif
+    restore_irq_mask(state);
+    return SYS_OK;
+}
+
+/**
+ * Sets notification bits of a task. If the task is waiting in
+ * task_notify_wait and the new bits satisfy its wait, it is woken. Safe to
+ * call from interrupt context, and takes constant time.
+ * @param task: task to notify
+ * @param bits: bits to set in the task's notification word
+ * @return SYS_OK on success, or ERR_BADPARAM on invalid task
+ */
+syserr_t task_notify(task_handle_t task, uint32_t bits) {
+    task_status_t *tsk = (task_status_t *)task;
+    uint32_t state;
+    if (tsk == NULL) {
+        return ERR_BADPARAM;
+    }
+    state = mask_irq_save();
+    tsk->notify_value |= bits;
+    if (tsk->notify_waiting && notify_satisfied(tsk)) {
+        tsk->notify_waiting = false;
+        wake_task(tsk);
+    }
+    restore_irq_mask(state);
+    return SYS_OK;
+}
+
+/**
+ * Waits for bits to be set in the running task's notification word.
+ * @param bits: notification bits to wait for
+ * @param flags: NOTIFY_WAIT_ANY to wait for any of the bits, or
+ * NOTIFY_WAIT_ALL to wait for all of them. OR with NOTIFY_CLEAR to clear
+ * the waited for bits before returning
+ * @param value: set to the notification word when the wait completes. May be
+ * NULL
+ * @param delay: max amount of time to wait (in ms). Use SYS_TIMEOUT_INF for
+ * infinite timeout, or SYS_TIMEOUT_NONE to poll
+ * @return SYS_OK when the bits were set, or ERR_TIMEOUT on timeout
+ */
+syserr_t task_notify_wait(uint32_t bits, uint32_t flags, uint32_t *value,
+                          int delay) {
+    task_status_t *self = active_task;
+    syserr_t ret = SYS_OK;
+    uint32_t state;
+    // Only a task may wait for its own notifications
+    if (self == NULL || bits == 0 || in_isr()) {
+        return ERR_BADPARAM;
+    }
+    state = mask_irq_save();
+    self->notify_bits = bits;
+    self->notify_flags = flags;
+    if (!notify_satisfied(self)) {
+        if (delay == SYS_TIMEOUT_NONE) {
+            ret = ERR_TIMEOUT;
+        } else {
+            self->notify_waiting = true;
+            /**
+             * Interrupts stay masked until the task is blocked, so a
+             * notification cannot be missed. The context switch occurs once
+             * they are unmasked. Only the task clears its own bits, so once
+             * woken by a notification the wait stays satisfied.
+             */
+            if (delay == SYS_TIMEOUT_INF) {
+                block_active_task(BLOCK_NOTIFY);
+            } else {
+                task_delay((uint32_t)delay);
+            }
+            restore_irq_mask(state);
+            // Woken by a notification, or the delay expired
+            state = mask_irq_save();
+            self->notify_waiting = false;
+            if (!notify_satisfied(self)) {
+                ret = ERR_TIMEOUT;
+            }
+        }
+    }
+    if (value != NULL) {
+        *value = self->notify_value;
+    }
+    if (ret == SYS_OK && (flags & NOTIFY_CLEAR)) {
+        CLEARBITS(self->notify_value, bits);
+    }
+    restore_irq_mask(state);
+    return ret;
+}
+
+/**
+ * Clears bits in the running task's notification word
+ * @param bits: bits to clear
+ * @return notification word before bits were cleared
+ */
+uint32_t task_notify_clear(uint32_t bits) {
+    uint32_t old, state;
+    if (active_task == NULL) {
+        return 0;
+    }
+    state = mask_irq_save();
+    old = active_task->notify_value;
+    CLEARBITS(active_task->notify_value, bits);
+    restore_irq_mask(state);
+    return old;
+}
+
 /**
  * Gets the active task. Used by system drivers
  * @return handle to active task
  */
 task_handle_t get_active_task() { return (task_handle_t)active_task; }
 
+/**
+ * Checks if a task is the idle task. Used by system code that must never block
+ * the idle task.
+ * @param task: task to check
+ * @return true if task is the idle task
+ */
+bool task_is_idle(task_handle_t task) {
+    return task == (task_handle_t)&idle_task_storage;
+}
+
 /**
  * Returns if the RTOS has started.
  * @return boolean indicating RTOS status
@@ -293,25 +683,37 @@ void block_active_task(block_reason_t reason) {
  * Unblocks a task. Caller must give correct reason task was blocked. If
  * reason is incorrect, this call has no effect. Used by system drivers.
  * Task will not run immediately unless it has higher priority than running task
- * and preemption is enabled.
+ * and preemption is enabled. May be called with interrupts masked.
  * @param task: task to unblock
  * @param reason: reason task was blocked.
  */
 void unblock_task(task_handle_t task, block_reason_t reason) {
     task_status_t *tsk = (task_status_t *)task;
+    uint32_t state;
     // Check paramters
     if (task == NULL) {
         return;
     }
+    // Disable interrupts
+    state = mask_irq_save();
     /**
      * Ensure task block reason matches provided reason
      */
     if (tsk->state != TASK_BLOCKED || tsk->blockstate != reason) {
+        restore_irq_mask(state);
         return;
     }
-    // Disable interrupts
-    mask_irq();
-    blocked_tasks = list_remove(blocked_tasks, &(tsk->list_state));
+    if (tsk == active_task) {
+        /**
+         * Task blocked itself, but the context switch has not run yet. It is
+         * not in the blocked list, so just cancel the block.
+         */
+        tsk->state = TASK_ACTIVE;
+        tsk->blockstate = BLOCK_NONE;
+        restore_irq_mask(state);
+        return;
+    }
+    ilist_remove(&tsk->list_node);
     // Mark task as ready
     mark_task_ready(tsk);
 #if SYS_USE_PREEMPTION == PREEMPTION_ENABLED
@@ -322,24 +724,39 @@ void unblock_task(task_handle_t task, block_reason_t reason) {
     }
 #endif
     // Unmask interrupts
-    unmask_irq();
+    restore_irq_mask(state);
 }
 
 /**
  * Unblocks a delayed task, cancelling its delay. Used by system drivers.
  * Task will not run immediately unless it has higher priority than running task
- * and preemption is enabled.
+ * and preemption is enabled. May be called with interrupts masked.
  */
 void unblock_delayed_task(task_handle_t task) {
     task_status_t *tsk = (task_status_t *)task;
+    uint32_t state;
     // Check parameters
     if (tsk == NULL) {
         return;
     }
     // Mask interrupts here
-    mask_irq();
+    state = mask_irq_save();
+    if (tsk->state != TASK_DELAYED) {
+        // Delay already expired
+        restore_irq_mask(state);
+        return;
+    }
+    if (tsk == active_task) {
+        /**
+         * Task delayed itself, but the context switch has not run yet. It is
+         * not in the delayed list, so just cancel the delay.
+         */
+        tsk->state = TASK_ACTIVE;
+        restore_irq_mask(state);
+        return;
+    }
     // Remove list from delayed list
-    delayed_tasks = list_remove(delayed_tasks, &(tsk->list_state));
+    ilist_remove(&tsk->list_node);
     // Mark task as ready
     mark_task_ready(tsk);
 #if SYS_USE_PREEMPTION == PREEMPTION_ENABLED
@@ -350,9 +767,10 @@ void unblock_delayed_task(task_handle_t task) {
     }
 #endif
     // Unmask interrupts
-    unmask_irq();
+    restore_irq_mask(state);
 }
 
+#if SYS_PORT == PORT_CORTEX_M4
 /**
  * SVCall handler. Enables the system tick, switches the processor to the
  * process stack, and starts the RTOS scheduler.
@@ -368,37 +786,42 @@ __attribute__((naked)) void SVCallHandler() {
      */
     asm volatile(
         /* Reset the main stack pointer to initial value. */
-        "lsr r0, %[VTOR], #0x7\n" // get exception vector address from VTOR
-        "ldr r1, [r0]\n"          // load initial stack pointer from vectors
+        "ldr r1, [%[VTOR]]\n"     // load initial stack pointer from vectors
         "msr MSP, r1\n"           // set main stack pointer to initial value
         /* Select an active task to run, and enable systick */
-        "cpsid i\n"               // Set primask to 1 to disable interrupts
+        "mov r0, %[MASK]\n"       // Mask interrupts that may call the RTOS
+        "msr BASEPRI, r0\n"
+        "isb\n"
         "stmfd sp!, {r0-r3}\n"    // Save caller saved regs to main stack
         "bl select_active_task\n" // break to function to select new active task
         "bl enable_systick\n"  // break to function to enable systick interrupt
         "ldmfd sp!, {r0-r3}\n" // Restore registers after function calls
-        "cpsie i\n"            // Set primask to 0 to enable interrupts
+        "mov r0, #0\n"         // Set BASEPRI to 0 to enable interrupts
+        "msr BASEPRI, r0\n"
         /* Active task now set. Restore its register state and switch to it */
         "ldr r0, %[active_task]\n" // Load active task struct
         "ldr r1, [r0]\n" // Load address of top of stack for active task
         /* Restore register state for task */
         "ldmfd r1!, {r4-r11, lr}\n" // Restore calle-saved registers
+        RESTORE_FP_CONTEXT("r1")    // Restore s16-s31 if task used the FPU
         "msr PSP, r1\n" // Load new stack pointer after restoring register
         /* Task lr value will force return into thread mode with psp enabled */
         /* Loading EXEC_RETURN value in $lr reg will force exception to exit */
         "bx lr\n" // Load EXEC_RETURN value into PC. Core will intercept call
         :
-        : [ VTOR ] "r"(SCB->VTOR), [ active_task ] "m"(active_task));
+        : [ VTOR ] "r"(SCB->VTOR), [ active_task ] "m"(active_task),
+          [ MASK ] "i"(IRQ_MASK_BASEPRI));
 }
 
 /**
  * System context switch handler. Stores core registers for current
  * execution context, then selects the highest priority ready task to run.
+ * Runs from SRAM, so context switches do not wait on flash.
  *
  * This function SHOULD NOT BE CALLED BY THE USER. It is indended to run in
  * Handler mode, as the PendSV isr
  */
-__attribute__((naked)) void PendSVHandler() {
+__attribute__((naked)) __ramfunc void PendSVHandler() {
     /**
      * This is a naked function, so that GCC will not generate prologue and
      * epilogue code, which can leave the stack in an invalid state when
@@ -413,56 +836,98 @@ __attribute__((naked)) void PendSVHandler() {
         "mov r1, %[active_task]\n" // Store memory address of active task
         "ldr r3, [r1]\n"           // Load value of stack_ptr
 
+        SAVE_FP_CONTEXT("r0")       // Save s16-s31 if task used the FPU
         "stmfd r0!, {r4-r11, lr}\n" // Save calle-saved registers
         "str r0, [r3]\n"            // Store the new top of the stack
 
-        "cpsid i\n"               // Disable interrupts (set PRIMASK to 1)
+        "mov r2, %[MASK]\n"       // Mask interrupts that may call the RTOS
+        "msr BASEPRI, r2\n"
+        "isb\n"
         "stmfd sp!, {r0-r3}\n"    // Save caller saved regs to main stack
         "bl select_active_task\n" // Call function to select new active task
         "ldmfd sp!, {r0-r3}\n"    // Restore registers after function call
-        "cpsie i\n"               // Reenable interrupt
+        "mov r2, #0\n"            // Reenable interrupts (set BASEPRI to 0)
+        "msr BASEPRI, r2\n"
 
         "ldr r3, [r1]\n" // Reload address of active task
         "ldr r2, [r3]\n" // Reload stack_ptr from active_task
 
         "ldmfd r2!, {r4-r11, lr}\n" // Restore calle-saved registers for task
+        RESTORE_FP_CONTEXT("r2")    // Restore s16-s31 if task used the FPU
         "msr psp, r2\n"             // Load r2 as the stack pointer
 
         "bx lr\n" // Exception return. Core will intercept load of
                   // 0xFXXXXXXX to PC and return from exception
         :
-        : [ active_task ] "r"(&active_task));
+        : [ active_task ] "r"(&active_task), [ MASK ] "i"(IRQ_MASK_BASEPRI));
+}
+#else
+/**
+ * Gets the saved context of the active task. Used by the host port in place
+ * of the PendSV and SVCall handlers, which load the stack pointer directly.
+ * @return context set by host_init_stack, or NULL if no task is active
+ */
+void *host_active_context() {
+    return active_task ? (void *)active_task->stack_ptr : NULL;
 }
+#endif
 
 /**
  * System tick handler. Handles periodic RTOS tasks, such as checking to see
  * if blocked tasks are now unblocked, and preempting tasks if enabled.
+ * Runs from SRAM, since it runs every tick.
  *
  * This function SHOULD NOT BE CALLED BY THE USER. It is indended to run in
  * Handler mode, as the PendSV isr
  */
-void SysTickHandler() {
+__ramfunc void SysTickHandler() {
+    task_status_t *task;
+    uint32_t state;
+    /**
+     * SysTick runs at the lowest priority, so interrupts that wake tasks may
+     * preempt it. Mask them while the task lists are updated.
+     */
+    state = mask_irq_save();
+    advance_ticks(1);
     /**
-     * Use list filter to decrement task delay counts, and if task delay is
-     * zero, remove the delayed task from the delayed_task lists, and mark it
-     * as ready and move it to the ready list.
-     * We accomplish this by using the "destructor" function of list_filter
-     * to instead copy the task to the ready list
+     * Account run time every tick, so the 32 bit cycle counter cannot wrap
+     * between accounting points while one task runs.
      */
-    delayed_tasks =
-        list_filter(delayed_tasks, decrement_task_delay, mark_task_ready);
+    stats_account();
+    // Also keeps the cycle counter behind timestamp_us from wrapping unseen
+    timestamp_update();
+    /**
+     * The delayed list is sorted by wake tick, so only the head of the list
+     * needs to be checked. Move every task whose deadline has passed to the
+     * ready list. Ticks are compared by signed difference so that wraparound
+     * of the tick counter is handled.
+     */
+    while (!ilist_empty(&delayed_tasks)) {
+        task = TASK_OF(ilist_head(&delayed_tasks));
+        if ((int32_t)(task->wake_tick - system_ticks) > 0) {
+            // Head task is not due, so no other task is either
+            break;
+        }
+        ilist_remove(&task->list_node);
+        mark_task_ready(task);
+    }
 #if SYS_USE_PREEMPTION == PREEMPTION_ENABLED
     /** Check if preemption should occur **/
-    int i = RTOS_PRIORITY_COUNT - 1;
-    // Check to see if a higher priority task is ready
-    while (ready_tasks[i] == NULL && i > active_task->priority) {
-        i--;
-    }
-    if (i > active_task->priority) {
+    if (highest_ready_priority() > (int)active_task->priority) {
         // A higher priority task is ready. Run it.
         task_yield();
+    } else if (active_task->timeslice != 0 && --active_task->slice_ticks == 0) {
+        /**
+         * Time slice expired. If another task of equal priority is ready,
+         * yield so the active task moves to the back of its ready list.
+         */
+        active_task->slice_ticks = active_task->timeslice;
+        if (!ilist_empty(&ready_tasks[active_task->priority])) {
+            task_yield();
+        }
     }
 #endif
+    restore_irq_mask(state);
 }
 
 /**
@@ -471,20 +936,17 @@ void SysTickHandler() {
  * highest priority task available to run.
  * Does not update active task state, but will refer to task state when
  * placing it into blocked/delayed/ready list. Does update active task state.
+ * Runs from SRAM, since it is called on every context switch.
  */
-void select_active_task() {
+__ramfunc void select_active_task() {
     int i;
     task_status_t *new_active;
     /**
-     * Examine task lists to find the highest priority list with tasks ready
-     * to run
+     * The ready priority mask gives the highest priority list with tasks
+     * ready to run
      */
-    for (i = RTOS_PRIORITY_COUNT - 1; i > 0; i--) {
-        // If task list has tasks, break
-        if (ready_tasks[i] != NULL)
-            break;
-    }
-    if (ready_tasks[i] == NULL) {
+    i = highest_ready_priority();
+    if (i < 0) {
         /**
          * There is only one task (idle task). It should be active task, so just
          * leave it running
@@ -492,37 +954,60 @@ void select_active_task() {
         return;
     }
     // Select the head of this ready task list
-    new_active = list_get_head(ready_tasks[i]);
-    ready_tasks[i] = list_remove(ready_tasks[i], &(new_active->list_state));
+    new_active = TASK_OF(ilist_head(&ready_tasks[i]));
+    ready_list_remove(new_active);
+    // Charge the outgoing task for its run time
+    stats_account();
     if (active_task != NULL) { // active task will be null on scheduler start
+        trace_event(TRACE_TASK_SWITCH_OUT, (uintptr_t)active_task,
+                    active_task->state);
         /**
          * Based on the block state of the active task, store it in the blocked,
-         * delayed, or ready list
+         * delayed, or ready list. Its stack is checked here, since it can
+         * only overflow while it runs.
          */
-        if (active_task->state == TASK_BLOCKED) {
-            blocked_tasks = list_append(blocked_tasks, active_task,
-                                        &(active_task->list_state));
+        if (stack_overflowed(active_task)) {
+            retire_overflowed_task(active_task);
+        } else if (active_task->state == TASK_BLOCKED) {
+            ilist_append(&blocked_tasks, &active_task->list_node);
         } else if (active_task->state == TASK_DELAYED) {
-            // Append task to delayed list
-            delayed_tasks = list_append(delayed_tasks, active_task,
-                                        &(active_task->list_state));
+            // Insert task into delayed list, sorted by wake tick
+            ilist_insert_sorted(&delayed_tasks, &active_task->list_node,
+                                compare_wake_tick);
         } else {
             // Append active task to appropriate ready list
-            ready_tasks[active_task->priority] =
-                list_append(ready_tasks[active_task->priority], active_task,
-                            &(active_task->list_state));
+            mark_task_ready(active_task);
         }
     }
-    // Change the active task
+    // Change the active task, and start its time slice
     active_task = new_active;
     active_task->state = TASK_ACTIVE;
+    active_task->slice_ticks = active_task->timeslice;
+#if SYS_TASK_REENT == TASK_REENT_ENABLED
+    // newlib functions now use the reentrancy state of the new task
+    _impure_ptr = &active_task->reent;
+#endif
+    stats_switch_in(active_task);
+    stack_guard_set(active_task);
+    trace_event(TRACE_TASK_SWITCH_IN, (uintptr_t)active_task,
+                active_task->priority);
 }
 
+#if SYS_PORT == PORT_CORTEX_M4
 /**
  * This function should ONLY be called by internal routines.
  * Enables the system tick interrupt.
  */
 void enable_systick() {
+    // Enable the systick interrupt. The reload value is set by rtos_start
+    SETBITS(SysTick->CTRL, SysTick_CTRL_TICKINT_Msk | SysTick_CTRL_ENABLE_Msk);
+}
+
+/**
+ * Sets the system tick reload value for the current HCLK frequency, and
+ * restarts the current tick.
+ */
+static void systick_set_reload() {
     uint32_t reload_val;
     /**
      * The stm32l433 defaults to sourcing the systick clock as HCLK divided
@@ -536,10 +1021,91 @@ void enable_systick() {
     }
     // Set the reload value (interrupt fires when counting from 1 to 0)
     SysTick->LOAD = reload_val - 1;
-    // Enable the systick interrupt
-    SETBITS(SysTick->CTRL, SysTick_CTRL_TICKINT_Msk | SysTick_CTRL_ENABLE_Msk);
+    SysTick->VAL = 0;
+}
+
+/**
+ * Clock change notifier. Keeps the system tick rate constant across system
+ * clock profile changes. The partial tick in progress is dropped.
+ * @param event: clock change event
+ * @param arg: unused.
+ */
+static void systick_clock_change(clock_change_t event, void *arg) {
+    uint32_t state;
+    if (event == CLOCK_CHANGE_POST) {
+        state = mask_irq_save();
+        systick_set_reload();
+        restore_irq_mask(state);
+    }
 }
+#endif
 
+/**
+ * Initializes a task control block, and places the task in the ready list.
+ * @param task: task control block to initialize
+ * @param entry: task entry point
+ * @param arg: task argument
+ * @param cfg: task configuration structure
+ */
+static void init_task(task_status_t *task, void (*entry)(void *), void *arg,
+                      task_config_t *cfg) {
+    uint32_t state;
+    if (!task_lists_ready) {
+        init_task_lists();
+    }
+    task->stack_end = cfg->task_stack;
+    // Calculate start of stack
+    task->stack_start = task->stack_end + (cfg->task_stacksize - 1);
+    if (cfg->task_name) {
+        task->name = cfg->task_name;
+    } else {
+        // Default value
+        task->name = "";
+    }
+    task->priority = cfg->task_priority;
+#if SYS_TASK_STATS == TASK_STATS_ENABLED
+    task->woken = false;
+    memset(&task->stats, 0, sizeof(task->stats));
+#endif
+    task->timeslice = cfg->task_timeslice;
+    task->slice_ticks = task->timeslice;
+    task->notify_value = 0;
+    task->notify_waiting = false;
+    task->stack_overflow = false;
+#if SYS_TASK_REENT == TASK_REENT_ENABLED
+    // stdout and other newlib streams are created when the task first uses them
+    _REENT_INIT_PTR(&task->reent);
+#endif
+    /**
+     * Paint the stack, so task_stack_highwater can find the deepest point the
+     * task used. 'stack_softend' is the memory location where padding ends,
+     * and where we consider a stack to have overflowed. The padding keeps the
+     * paint value, so overwriting it is also detected as an overflow.
+     */
+    memset(task->stack_end, STACK_PAINT, cfg->task_stacksize);
+    task->stack_softend = task->stack_end + SYS_STACK_PROTECTION_SIZE;
+    // Update task state and place in ready queue. New tasks were not woken.
+    task->state = TASK_READY;
+    task->entry = entry;
+    task->arg = arg;
+    // Initialize task stack
+#if SYS_PORT == PORT_HOST
+    task->stack_ptr = host_init_stack(task->stack_end, task->stack_start,
+                                      task->entry, task->arg, task_exithandler);
+#else
+    task->stack_ptr =
+        init_task_stack((uint32_t *)task->stack_start, task->entry, task->arg);
+#endif
+    // Record the name, so the trace decoder can label this task
+    trace_event(TRACE_TASK_CREATE, (uintptr_t)task, task->priority);
+    trace_event(TRACE_TASK_NAME, (uintptr_t)task->name, 0);
+    // Place this task into the ready queue (scheduler can select it)
+    state = mask_irq_save();
+    mark_task_ready(task);
+    restore_irq_mask(state);
+}
+
+#if SYS_PORT == PORT_CORTEX_M4
 /**
  * Initializes a task stack for use with the scheduler
  * @param stack_ptr: pointer to start of stack to initialize
@@ -586,12 +1152,15 @@ static uint32_t *init_task_stack(uint32_t *stack_ptr, void *return_pc,
     *stack_ptr = 0x04040404UL;          // R4 (do not decrement)
     return stack_ptr;
 }
+#endif
 
 /**
  * Handles exit of task
  */
 static void task_exithandler() {
     LOG_I(TAG, "Task named '%s' exited", active_task->name);
+    // Write any partial line left in the task's stdout buffer
+    fflush(stdout);
     task_destroy((task_handle_t)active_task);
 }
 
@@ -600,92 +1169,490 @@ static void task_exithandler() {
  * @param arg: unused.
  */
 static void idle_entry(void *arg) {
-    int i;
     /* Idle task should never exit */
     while (1) {
         /**
-         * Reap resources of exited tasks
-         */
-        mask_irq();
-        exited_tasks = list_filter(exited_tasks, delete_list, free_task);
-        unmask_irq();
-        /**
-         * Check all task lists, and see if any are breaking stack boundaries
+         * Stacks are checked when each task is switched out, so the idle task
+         * only has work to do once a task exits or overflows its stack.
          */
-        for (i = 0; i < RTOS_PRIORITY_COUNT; i++) {
-            // Check each ready task list for overflowed tasks
-            mask_irq();
-            ready_tasks[i] =
-                list_filter(ready_tasks[i], check_stack, free_task);
-            unmask_irq();
+        if (halted_task != NULL) {
+            report_overflow(halted_task);
+            LOG_MIN(SYSLOG_LEVEL_ERROR, TAG,
+                    "Cannot reap waiting task, halting");
+            fsync(STDOUT_FILENO);
+            while (1)
+                ;
+        }
+        if (!ilist_empty(&exited_tasks)) {
+            reap_exited_tasks();
         }
         // Flush logging output
+#if SYSLOG == SYSLOG_SEMIHOST
+        // Semihosting halts the core, so only flush once enough is buffered
+        semihost_poll();
+#else
         fsync(STDOUT_FILENO);
-        // Wait for an interrupt to fire
-        asm volatile("wfi\n");
+#endif
+        trace_flush();
+        // Sleep until an interrupt fires
+        idle_sleep();
         // Yield to another task
         task_yield();
     }
 }
 
 /**
- * Used by the system tick handler to decrement task delay counts,
- * and remove any tasks that are ready to run
- * @param taskptr: pointer to the task
- * @return LST_REM if the task is ready, or LST_CONT otherwise
+ * Sleeps the idle task until an interrupt fires. When tickless idle is
+ * enabled and no task is ready, the periodic system tick is suppressed and
+ * SysTick is programmed to fire at the next delayed task deadline instead.
  */
-static inline list_return_t decrement_task_delay(void *taskptr) {
-    task_status_t *task = (task_status_t *)taskptr;
-    task->blockstate--;
-    return task->blockstate == 0 ? LST_REM : LST_CONT;
+static void idle_sleep() {
+#if SYS_PORT == PORT_HOST
+    // The host port has no interrupts to wait for, so simulated time advances
+    host_idle();
+#elif SYS_USE_TICKLESS == TICKLESS_ENABLED
+    uint32_t tick_reload, max_ticks, idle_ticks, reload, ctrl, elapsed;
+    task_status_t *next;
+#if SYS_LOW_POWER == LOW_POWER_ENABLED
+    power_mode_t mode;
+#endif
+    /**
+     * Interrupts masked by BASEPRI do not wake wfi, so PRIMASK is used here.
+     * This also briefly holds off interrupts above SYS_MAX_SYSCALL_PRIORITY.
+     */
+    asm volatile("cpsid i\n" : : : "memory");
+    if (ready_priorities != 0) {
+        // Another task is ready to run, so do not sleep
+        asm volatile("cpsie i\n" : : : "memory");
+        return;
+    }
+    tick_reload = SysTick->LOAD + 1;
+    max_ticks = SysTick_LOAD_RELOAD_Msk / tick_reload;
+    if (ilist_empty(&delayed_tasks)) {
+        // No deadline. Sleep as long as SysTick can count.
+        idle_ticks = max_ticks;
+    } else {
+        next = TASK_OF(ilist_head(&delayed_tasks));
+        idle_ticks = next->wake_tick - system_ticks;
+        if ((int32_t)idle_ticks <= 0) {
+            idle_ticks = 0;
+        }
+    }
+#if SYS_LOW_POWER == LOW_POWER_ENABLED
+    if (ilist_empty(&delayed_tasks)) {
+        // No deadline. Stop for as long as LPTIM1 can count.
+        idle_ticks = POWER_STOP_MAX_MS;
+    }
+    mode = power_select_mode(idle_ticks);
+    if (mode != POWER_SLEEP) {
+        // SysTick stops in Stop mode, so LPTIM1 times the idle period instead
+        CLEARBITS(SysTick->CTRL, SysTick_CTRL_ENABLE_Msk);
+        elapsed = power_stop(mode, idle_ticks);
+        if (elapsed >= idle_ticks) {
+            // Deadline was reached. Pend a tick to count the final tick.
+            advance_ticks(idle_ticks - 1);
+            SCB->ICSR = SCB_ICSR_PENDSTSET_Msk;
+        } else {
+            // Woken early. As below, the partial tick is dropped.
+            advance_ticks(elapsed);
+        }
+        SysTick->VAL = 0;
+        SETBITS(SysTick->CTRL, SysTick_CTRL_ENABLE_Msk);
+        asm volatile("cpsie i\n" : : : "memory");
+        return;
+    }
+#endif
+    if (idle_ticks > max_ticks) {
+        idle_ticks = max_ticks;
+    }
+    if (idle_ticks < TICKLESS_MIN_IDLE_TICKS) {
+        // Not worth stopping the tick. Sleep until the next tick fires.
+        asm volatile("cpsie i\n" : : : "memory");
+        asm volatile("wfi\n");
+        return;
+    }
+    /**
+     * Stop SysTick, and reload it with the remainder of the current tick plus
+     * the full ticks until the deadline. The expiring tick interrupt will
+     * count the final tick.
+     */
+    CLEARBITS(SysTick->CTRL, SysTick_CTRL_ENABLE_Msk);
+    reload = SysTick->VAL + (tick_reload * (idle_ticks - 1));
+    SysTick->LOAD = reload;
+    SysTick->VAL = 0;
+    SETBITS(SysTick->CTRL, SysTick_CTRL_ENABLE_Msk);
+    /**
+     * Interrupts are masked, but wfi will still wake the core when one is
+     * pending. The interrupt runs once interrupts are unmasked below.
+     */
+    asm volatile("dsb\n"
+                 "wfi\n"
+                 "isb\n");
+    // Stop SysTick. CTRL must only be read once, as reading clears COUNTFLAG
+    ctrl = SysTick->CTRL;
+    SysTick->CTRL = ctrl & ~SysTick_CTRL_ENABLE_Msk;
+    if (ctrl & SysTick_CTRL_COUNTFLAG_Msk) {
+        // Deadline was reached. Pending tick interrupt counts the final tick.
+        advance_ticks(idle_ticks - 1);
+    } else {
+        /**
+         * Another interrupt woke the core. Count the whole ticks that passed.
+         * The partial tick is dropped, so the tick may lag real time slightly
+         * after an early wakeup.
+         */
+        elapsed = reload - SysTick->VAL;
+        advance_ticks(elapsed / tick_reload);
+    }
+    // Restart the periodic system tick
+    SysTick->LOAD = tick_reload - 1;
+    SysTick->VAL = 0;
+    SETBITS(SysTick->CTRL, SysTick_CTRL_ENABLE_Msk);
+    asm volatile("cpsie i\n" : : : "memory");
+#else
+    // Wait for an interrupt to fire
+    asm volatile("wfi\n");
+#endif
 }
 
 /**
- * Checks stack boundaries of a task
- * @param taskptr: Task to check stack boundaries of
- * @return LST_REM if task overflowed stack, or LST_CONT if all is well
+ * Initializes the task lists as empty. The sentinel heads point to themselves,
+ * so they cannot be set up by a static initializer in the zeroed SRAM2 bss.
  */
-static inline list_return_t check_stack(void *taskptr) {
-    task_status_t *task = (task_status_t *)taskptr;
-    if (task->stack_ptr < (uint32_t*)task->stack_softend) {
-        // Log error to warn user that task overflowed stack.
-        LOG_MIN(SYSLOG_LEVEL_ERROR, TAG, "Task overflowed boundaries!!");
-        // Write task name to stdout
-        if (task->name != NULL) {
-            write(STDOUT_FILENO, "Task name: ", 11);
-            write(STDOUT_FILENO, task->name, strlen(task->name));
-            write(STDOUT_FILENO, "\n", 1);
-        }
-        return LST_REM;
+static void init_task_lists() {
+    int i;
+    for (i = 0; i < RTOS_PRIORITY_COUNT; i++) {
+        ilist_init(&ready_tasks[i]);
+    }
+    ilist_init(&delayed_tasks);
+    ilist_init(&blocked_tasks);
+    ilist_init(&exited_tasks);
+    task_lists_ready = true;
+}
+
+/**
+ * Compares the wake ticks of two delayed tasks. Used to keep the delayed
+ * list sorted by deadline.
+ * @param a: list node of first task
+ * @param b: list node of second task
+ * @return negative value if task a wakes before task b
+ */
+static int compare_wake_tick(ilist_node_t *a, ilist_node_t *b) {
+    task_status_t *task_a = TASK_OF(a);
+    task_status_t *task_b = TASK_OF(b);
+    // Signed difference handles wraparound of the tick counter
+    return (int32_t)(task_a->wake_tick - task_b->wake_tick);
+}
+
+/**
+ * Retires a task that overflowed its stack as it was switched out. The task
+ * never runs again. Blocked and delayed tasks may be referenced by the wait
+ * lists of other objects, so they cannot be reaped, and the idle task halts
+ * the system instead. MUST be called with interrupts masked.
+ * @param task: Task that overflowed its stack
+ */
+static inline void retire_overflowed_task(task_status_t *task) {
+    if (task->state == TASK_BLOCKED || task->state == TASK_DELAYED) {
+        halted_task = task;
     } else {
-        return LST_CONT; // All is well.
+        task->stack_overflow = true;
+        ilist_append(&exited_tasks, &task->list_node);
+    }
+    // Wakeups check the task state, so they now leave the task alone
+    task->state = TASK_EXITED;
+}
+
+/**
+ * Frees the resources of each exited task. Interrupts are only masked while
+ * a task is taken off the exited list, so the cost of freeing a task does
+ * not delay interrupts.
+ */
+static void reap_exited_tasks() {
+    task_status_t *task;
+    uint32_t state;
+    state = mask_irq_save();
+    while (!ilist_empty(&exited_tasks)) {
+        task = TASK_OF(ilist_head(&exited_tasks));
+        ilist_remove(&task->list_node);
+        restore_irq_mask(state);
+        if (task->stack_overflow) {
+            report_overflow(task);
+        }
+        free_task(task);
+        state = mask_irq_save();
+    }
+    restore_irq_mask(state);
+}
+
+/**
+ * Checks if a task overflowed its stack. The saved stack pointer must be above
+ * the padding, and the padding must still hold the paint value, so overflows
+ * that unwound before the check are caught as well. When the MPU stack guard
+ * is enabled, the guard region of the task is still armed here, so it is
+ * skipped. Any write to it would already have faulted.
+ * @param task: Task to check
+ * @return true if the task overflowed its stack
+ */
+static inline bool stack_overflowed(task_status_t *task) {
+    uint32_t *ptr;
+#if SYS_STACK_MPU_GUARD == STACK_MPU_GUARD_ENABLED
+    uint32_t *guard =
+        (uint32_t *)(((uint32_t)task->stack_end + (STACK_GUARD_SIZE - 1)) &
+                     ~(STACK_GUARD_SIZE - 1));
+#endif
+    if (task->stack_ptr < (uint32_t *)task->stack_softend) {
+        return true;
+    }
+    // Stacks may not be word aligned, so round the padding start up
+    ptr = (uint32_t *)(((uintptr_t)task->stack_end + 3) & ~(uintptr_t)3);
+    for (; ptr < (uint32_t *)task->stack_softend; ptr++) {
+#if SYS_STACK_MPU_GUARD == STACK_MPU_GUARD_ENABLED
+        if (ptr == guard) {
+            // Reading the guard region would take a memory management fault
+            ptr += (STACK_GUARD_SIZE / sizeof(uint32_t)) - 1;
+            continue;
+        }
+#endif
+        if (*ptr != (STACK_PAINT * 0x01010101UL)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * Reports a task stack overflow on the system log
+ * @param task: Task that overflowed its stack
+ */
+static void report_overflow(task_status_t *task) {
+    // Log error to warn user that task overflowed stack.
+    LOG_MIN(SYSLOG_LEVEL_ERROR, TAG, "Task overflowed boundaries!!");
+    // Write task name to stdout
+    if (task->name != NULL) {
+        write(STDOUT_FILENO, "Task name: ", 11);
+        write(STDOUT_FILENO, task->name, strlen(task->name));
+        write(STDOUT_FILENO, "\n", 1);
     }
 }
 
+/**
+ * Enables the MPU, so the stack guard region can be programmed on each
+ * context switch. Privileged code keeps the default memory map outside of
+ * the guard region. Does nothing unless the MPU stack guard is enabled.
+ */
+static inline void stack_guard_init() {
+#if SYS_STACK_MPU_GUARD == STACK_MPU_GUARD_ENABLED
+    MPU->RNR = STACK_GUARD_REGION;
+    MPU->RASR = 0;
+    MPU->CTRL = MPU_CTRL_PRIVDEFENA_Msk | MPU_CTRL_ENABLE_Msk;
+    // Report guard hits as memory management faults, not hard faults
+    SETBITS(SCB->SHCSR, SCB_SHCSR_MEMFAULTENA_Msk);
+    asm volatile("dsb\n"
+                 "isb\n");
+#endif
+}
+
+/**
+ * Moves the MPU stack guard region to the padding of a task stack. MUST be
+ * called with interrupts masked, the exception return that switches to the
+ * task makes the new region take effect. Does nothing unless the MPU stack
+ * guard is enabled.
+ * @param task: task being switched in
+ */
+static inline void stack_guard_set(task_status_t *task) {
+#if SYS_STACK_MPU_GUARD == STACK_MPU_GUARD_ENABLED
+    uint32_t guard = ((uint32_t)task->stack_end + (STACK_GUARD_SIZE - 1)) &
+                     ~(STACK_GUARD_SIZE - 1);
+    MPU->RNR = STACK_GUARD_REGION;
+    MPU->RBAR = guard;
+    // No access for privileged or unprivileged code, and never executable
+    MPU->RASR = MPU_RASR_XN_Msk |
+                (STACK_GUARD_RASR_SIZE << MPU_RASR_SIZE_Pos) |
+                MPU_RASR_ENABLE_Msk;
+#endif
+}
+
+/**
+ * Handles a memory management fault. If the MPU stack guard is enabled and
+ * the fault hit the running task's guard region, reports the overflowing
+ * task and halts. Used by the fault handler.
+ */
+void stack_guard_fault() {
+#if SYS_STACK_MPU_GUARD == STACK_MPU_GUARD_ENABLED
+    uint32_t cfsr = SCB->CFSR;
+    uint32_t guard;
+    if (active_task == NULL) {
+        return;
+    }
+    guard = ((uint32_t)active_task->stack_end + (STACK_GUARD_SIZE - 1)) &
+            ~(STACK_GUARD_SIZE - 1);
+    /**
+     * A stacking error means exception entry pushed onto the guard. Otherwise
+     * the faulting data address tells if the task touched its guard.
+     */
+    if ((cfsr & SCB_CFSR_MSTKERR_Msk) ||
+        ((cfsr & SCB_CFSR_MMARVALID_Msk) && SCB->MMFAR >= guard &&
+         SCB->MMFAR < guard + STACK_GUARD_SIZE)) {
+        // Disable the guard so logging can use the stack
+        MPU->RNR = STACK_GUARD_REGION;
+        MPU->RASR = 0;
+        report_overflow(active_task);
+        fsync(STDOUT_FILENO);
+        while (1)
+            ;
+    }
+#endif
+}
+
 /**
  * Marks a task as ready, and moves it to the correct ready list. Task MUST not
  * be in another list
- * @param taskptr: Pointer to the task
+ * @param task: Pointer to the task
  */
-static inline void mark_task_ready(void *taskptr) {
-    task_status_t *task = (task_status_t *)taskptr;
+static inline void mark_task_ready(task_status_t *task) {
+#if SYS_TASK_STATS == TASK_STATS_ENABLED
+    if (task->state == TASK_BLOCKED || task->state == TASK_DELAYED) {
+        // Task is being woken. Record when, to measure wake latency
+        task->woken = true;
+        task->wake_cycle = DWT->CYCCNT;
+    }
+#endif
     // Update task state
     task->state = TASK_READY;
     task->blockstate = BLOCK_NONE;
     // Add task to correct ready list
-    ready_tasks[task->priority] =
-        list_append(ready_tasks[task->priority], task, &(task->list_state));
+    ilist_append(&ready_tasks[task->priority], &task->list_node);
+    SETBITS(ready_priorities, 1UL << task->priority);
 }
 
 /**
- * Utility function to remove tasks from a list. Unconditionally returns
- * LST_REM
- * @param taskptr: unused
- * @return LST_REM
+ * Checks if the notification word of a task satisfies its wait
+ * @param task: task to check
+ * @return true if the bits the task waits for are set
  */
-static inline list_return_t delete_list(void *taskptr) {
-    (void)taskptr; // Prevent unused variable warnings
-    return LST_REM;
+static inline bool notify_satisfied(task_status_t *task) {
+    uint32_t set = task->notify_value & task->notify_bits;
+    if (task->notify_flags & NOTIFY_WAIT_ALL) {
+        return set == task->notify_bits;
+    }
+    return set != 0;
+}
+
+/**
+ * Wakes a blocked or delayed task. Both lists are doubly linked, so this
+ * takes constant time. MUST be called with interrupts masked.
+ * @param task: task to wake
+ */
+static void wake_task(task_status_t *task) {
+    if (task->state != TASK_BLOCKED && task->state != TASK_DELAYED) {
+        // Task delay already expired
+        return;
+    }
+    if (task == active_task) {
+        /**
+         * Task is waiting, but the context switch has not run yet. It is
+         * not in a list, so just cancel the wait.
+         */
+        task->state = TASK_ACTIVE;
+        task->blockstate = BLOCK_NONE;
+        return;
+    }
+    ilist_remove(&task->list_node);
+    mark_task_ready(task);
+#if SYS_USE_PREEMPTION == PREEMPTION_ENABLED
+    // Check to see if this task is higher priority than the active one.
+    if (task->priority > active_task->priority) {
+        // Force a context switch
+        task_yield();
+    }
+#endif
+}
+
+/**
+ * Advances the system tick count, carrying into the upper word of the 64 bit
+ * time when the count wraps. MUST be called with interrupts masked.
+ * @param ticks: number of ticks elapsed
+ */
+static inline void advance_ticks(uint32_t ticks) {
+    uint32_t old = system_ticks;
+    system_ticks = old + ticks;
+    if (system_ticks < old) {
+        system_ticks_high++;
+    }
+}
+
+/**
+ * Starts task statistics accounting. reset_clocks starts the DWT cycle
+ * counter at boot, and it is not reset here since timestamp_us also uses it.
+ * Does nothing unless task statistics are enabled.
+ */
+static inline void stats_init() {
+#if SYS_TASK_STATS == TASK_STATS_ENABLED
+    stats_last_cycle = clock_cycles();
+#endif
+}
+
+/**
+ * Charges the cycles elapsed since the last accounting point to the active
+ * task. MUST be called with interrupts masked. Does nothing unless task
+ * statistics are enabled.
+ */
+static inline void stats_account() {
+#if SYS_TASK_STATS == TASK_STATS_ENABLED
+    uint32_t now = DWT->CYCCNT;
+    uint32_t elapsed = now - stats_last_cycle;
+    stats_last_cycle = now;
+    system_stats.total_cycles += elapsed;
+    if (active_task != NULL) {
+        active_task->stats.run_cycles += elapsed;
+    }
+#endif
+}
+
+/**
+ * Records a task being switched in. MUST be called with interrupts masked.
+ * Does nothing unless task statistics are enabled.
+ * @param task: task that was switched in
+ */
+static inline void stats_switch_in(task_status_t *task) {
+#if SYS_TASK_STATS == TASK_STATS_ENABLED
+    uint32_t latency;
+    task->stats.switch_count++;
+    system_stats.switch_count++;
+    if (task->woken) {
+        task->woken = false;
+        latency = DWT->CYCCNT - task->wake_cycle;
+        if (latency > task->stats.max_wake_latency) {
+            task->stats.max_wake_latency = latency;
+        }
+        if (latency > system_stats.max_wake_latency) {
+            system_stats.max_wake_latency = latency;
+        }
+    }
+#endif
+}
+
+/**
+ * Removes a ready task from its ready list, clearing the ready priority bit
+ * if the list is left empty
+ * @param task: Task to remove. MUST be in its ready list
+ */
+static inline void ready_list_remove(task_status_t *task) {
+    ilist_remove(&task->list_node);
+    if (ilist_empty(&ready_tasks[task->priority])) {
+        CLEARBITS(ready_priorities, 1UL << task->priority);
+    }
+}
+
+/**
+ * Gets the highest priority with tasks in its ready list. Compiles to a
+ * single CLZ instruction, so cost does not depend on the priority count.
+ * @return highest ready priority, or -1 if no tasks are ready
+ */
+static inline int highest_ready_priority() {
+    if (ready_priorities == 0) {
+        return -1;
+    }
+    return 31 - __builtin_clz(ready_priorities);
 }
 
 /**
@@ -693,23 +1660,41 @@ static inline list_return_t delete_list(void *taskptr) {
  * from a list
  * @param task: Task to free
  */
-static inline void free_task(void *task) {
-    task_status_t *tsk = (task_status_t *)task;
+static inline void free_task(task_status_t *tsk) {
+#if SYS_TASK_REENT == TASK_REENT_ENABLED
+    // Close the task's newlib streams, and free the buffers they allocated
+    _reclaim_reent(&tsk->reent);
+#endif
     if (tsk->stack_allocated) {
-        free(tsk->stack_start);
+        // stack_end is the start of the stack allocation
+        kmem_free(tsk->stack_end);
     }
     LOG_MIN(SYSLOG_LEVEL_DEBUG, TAG, "Reaping dead task");
-    free(tsk);
+    if (tsk->tcb_allocated) {
+        kmem_free(tsk);
+    }
 }
 
 /**
  * Triggers a context switch via setting pendsv (will trigger pendsv
  * interrupt)
  */
-static inline void set_pendsv() { SETBITS(SCB->ICSR, SCB_ICSR_PENDSVSET_Msk); }
+static inline void set_pendsv() {
+#if SYS_PORT == PORT_HOST
+    host_set_pendsv();
+#else
+    SETBITS(SCB->ICSR, SCB_ICSR_PENDSVSET_Msk);
+#endif
+}
 
 /**
  * Triggers a task setup (essentially populating a task control block) via
  * an SVCall exception
  */
-static inline void trigger_svcall() { asm volatile("svc 0"); }
\ No newline at end of file
+static inline void trigger_svcall() {
+#if SYS_PORT == PORT_HOST
+    host_svcall();
+#else
+    asm volatile("svc 0");
+#endif
+}
\ No newline at end of file
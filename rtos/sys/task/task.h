@@ -9,17 +9,84 @@
 #include <limits.h>
 #include <stdbool.h>
 #include <stdint.h>
+
+#include <config.h>
 #include <sys/err.h>
 
+#if SYS_TASK_REENT == TASK_REENT_ENABLED
+#include <reent.h>
+#endif
+
+/**
+ * Default task stack size, in bytes.
+ * Set by passing -DDEFAULT_STACKSIZE=val
+ */
+#ifndef DEFAULT_STACKSIZE
 #define DEFAULT_STACKSIZE 2048
+#endif
 #define DEFAULT_PRIORITY 4
+/**
+ * Number of independent priority levels. Ready priorities are tracked in a
+ * 32 bit mask, so at most 32 levels are supported.
+ * Set by passing -DRTOS_PRIORITY_COUNT=val
+ */
+#ifndef RTOS_PRIORITY_COUNT
 #define RTOS_PRIORITY_COUNT 8 // 8 independent priority levels
+#endif
+#if RTOS_PRIORITY_COUNT > 32 || RTOS_PRIORITY_COUNT < 1
+#error "RTOS_PRIORITY_COUNT must be between 1 and 32"
+#endif
 #define IDLE_TASK_PRIORITY 0
+/**
+ * Idle task stack size, in bytes.
+ * Set by passing -DIDLE_TASK_STACK_SIZE=val
+ */
+#ifndef IDLE_TASK_STACK_SIZE
 #define IDLE_TASK_STACK_SIZE 1024
+#endif
 #define SYSTICK_FREQ 1000 // Every 1ms (1000Hz)
+// Minimum idle period (in ticks) before tickless idle stops the system tick
+#define TICKLESS_MIN_IDLE_TICKS 2
 
 typedef void *task_handle_t;
 
+/* Notification wait flags, see task_notify_wait */
+#define NOTIFY_WAIT_ANY 0x0 /*!< Wait for any of the requested bits */
+#define NOTIFY_WAIT_ALL 0x1 /*!< Wait for all of the requested bits */
+#define NOTIFY_CLEAR 0x2    /*!< Clear the requested bits on return */
+
+/**
+ * Storage for a statically allocated task control block. Contents are
+ * private, this type only reserves memory of the correct size.
+ */
+typedef struct task_static {
+    void *_reserved[32];
+#if SYS_TASK_REENT == TASK_REENT_ENABLED
+    struct _reent _reserved_reent;
+#endif
+} task_static_t;
+
+/**
+ * Task statistics, see task_get_stats. Times are in core clock cycles.
+ */
+typedef struct task_stats {
+    uint64_t run_cycles;   /*!< Cycles the task has spent running */
+    uint32_t switch_count; /*!< Number of times the task was switched in */
+    uint32_t max_wake_latency; /*!< Worst case cycles from a wake (by an
+                                  interrupt or another task) to running */
+} task_stats_t;
+
+/**
+ * System wide scheduler statistics, see task_get_system_stats. Times are in
+ * core clock cycles.
+ */
+typedef struct system_stats {
+    uint64_t total_cycles;     /*!< Cycles since the RTOS started */
+    uint64_t idle_cycles;      /*!< Cycles spent in the idle task */
+    uint32_t switch_count;     /*!< Number of context switches */
+    uint32_t max_wake_latency; /*!< Worst wake latency of any task */
+} system_stats_t;
+
 /**
  * Task configuration structure
  */
@@ -27,13 +94,16 @@ typedef struct task_config {
     char *task_stack;   /*!< Optional statically allocated task stack */
     int task_stacksize; /*!< Desired size of task stack. If stack is provided
                            set this to size of task stack*/
-    uint32_t task_priority; /*!< Task priority */
-    const char *task_name;  /*< Optional task name */
+    uint32_t task_priority;  /*!< Task priority */
+    const char *task_name;   /*< Optional task name */
+    uint32_t task_timeslice; /*!< Time slice in system ticks, 0 to disable.
+                                Only used when preemption is enabled */
 } task_config_t;
 
 /**
- * Creates a system task. Requires memory allocation to be enabled to succeed.
- * Task will be scheduled, but will not start immediately.
+ * Creates a system task. The task control block (and stack, if not provided)
+ * are allocated from the kernel object pools, or the heap if pools are
+ * exhausted. Task will be scheduled, but will not start immediately.
  * @param entry: task entry point. Must be a function taking a void* and
  * returning void
  * @param arg: task argument. May be NULL. Will be passed to the task entry
@@ -43,6 +113,22 @@ typedef struct task_config {
  */
 task_handle_t task_create(void (*entry)(void *), void *arg, task_config_t *cfg);
 
+/**
+ * Creates a system task without allocating memory. The task control block is
+ * stored in the provided storage, and the task stack must be provided in the
+ * task configuration. Task will be scheduled, but will not start immediately.
+ * @param entry: task entry point. Must be a function taking a void* and
+ * returning void
+ * @param arg: task argument. May be NULL. Will be passed to the task entry
+ * point function
+ * @param cfg: task configuration structure. task_stack must be set
+ * @param storage: storage for task control block. Must remain valid until the
+ * task is destroyed
+ * @return created task handle on success, or NULL on error
+ */
+task_handle_t task_create_static(void (*entry)(void *), void *arg,
+                                 task_config_t *cfg, task_static_t *storage);
+
 /**
  * Yields task execution. This function will stop execution of the current
  * task, and yield execution to the highest priority task able to run
@@ -57,6 +143,97 @@ void task_yield();
  */
 void task_delay(uint32_t delay);
 
+/**
+ * Gets the number of system ticks elapsed since the RTOS started. The tick
+ * count wraps on overflow, so compare tick values by subtraction.
+ * @return current system tick count
+ */
+uint32_t task_get_ticks();
+
+/**
+ * Gets the time elapsed since the RTOS started in microseconds, derived from
+ * the system tick. Monotonic and never wraps, and includes time spent in
+ * low power modes. Returns 0 before the RTOS starts. Safe to call from
+ * interrupt context.
+ * @return microseconds elapsed since the RTOS started
+ */
+uint64_t task_get_time_us();
+
+/**
+ * Gets the priority of a task
+ * @param task: task to get priority of
+ * @return task priority
+ */
+uint32_t task_get_priority(task_handle_t task);
+
+/**
+ * Sets the priority of a task. If preemption is enabled and the change leaves
+ * a ready task with higher priority than the running one, it will run.
+ * @param task: task to change priority of
+ * @param priority: new task priority
+ * @return SYS_OK on success, or ERR_BADPARAM on invalid task or priority
+ */
+syserr_t task_set_priority(task_handle_t task, uint32_t priority);
+
+/**
+ * Sets notification bits of a task. If the task is waiting in
+ * task_notify_wait and the new bits satisfy its wait, it is woken. Safe to
+ * call from interrupt context, and takes constant time.
+ * @param task: task to notify
+ * @param bits: bits to set in the task's notification word
+ * @return SYS_OK on success, or ERR_BADPARAM on invalid task
+ */
+syserr_t task_notify(task_handle_t task, uint32_t bits);
+
+/**
+ * Waits for bits to be set in the running task's notification word.
+ * @param bits: notification bits to wait for
+ * @param flags: NOTIFY_WAIT_ANY to wait for any of the bits, or
+ * NOTIFY_WAIT_ALL to wait for all of them. OR with NOTIFY_CLEAR to clear
+ * the waited for bits before returning
+ * @param value: set to the notification word when the wait completes. May be
+ * NULL
+ * @param delay: max amount of time to wait (in ms). Use SYS_TIMEOUT_INF for
+ * infinite timeout, or SYS_TIMEOUT_NONE to poll
+ * @return SYS_OK when the bits were set, or ERR_TIMEOUT on timeout
+ */
+syserr_t task_notify_wait(uint32_t bits, uint32_t flags, uint32_t *value,
+                          int delay);
+
+/**
+ * Clears bits in the running task's notification word
+ * @param bits: bits to clear
+ * @return notification word before bits were cleared
+ */
+uint32_t task_notify_clear(uint32_t bits);
+
+/**
+ * Gets scheduler statistics for a task. Requires SYS_TASK_STATS to be enabled
+ * @param task: task to get statistics for
+ * @param stats: filled with task statistics
+ * @return SYS_OK on success, ERR_BADPARAM on invalid parameters, or
+ * ERR_NOSUPPORT if task statistics are disabled
+ */
+syserr_t task_get_stats(task_handle_t task, task_stats_t *stats);
+
+/**
+ * Gets system wide scheduler statistics. CPU load is
+ * 1 - idle_cycles / total_cycles. Requires SYS_TASK_STATS to be enabled
+ * @param stats: filled with system statistics
+ * @return SYS_OK on success, ERR_BADPARAM on invalid parameters, or
+ * ERR_NOSUPPORT if task statistics are disabled
+ */
+syserr_t task_get_system_stats(system_stats_t *stats);
+
+/**
+ * Gets the stack high water mark of a task. Task stacks are painted when the
+ * task is created, so this is the number of stack bytes the task has never
+ * used. Scans the stack, so takes time proportional to the unused space.
+ * @param task: task to check
+ * @return bytes of stack never used, not counting stack protection padding
+ */
+uint32_t task_stack_highwater(task_handle_t task);
+
 /**
  * Destroys a task. Will stop task execution immediately.
  * @param task: Task handle to destroy
@@ -78,7 +255,8 @@ void rtos_start();
 #define DEFAULT_TASK_CONFIG                                                    \
     {                                                                          \
         .task_stack = NULL, .task_stacksize = DEFAULT_STACKSIZE,               \
-        .task_priority = DEFAULT_PRIORITY, .task_name = ""                     \
+        .task_priority = DEFAULT_PRIORITY, .task_name = "",                    \
+        .task_timeslice = SYS_TIMESLICE_TICKS                                  \
     }
 
 /** ------------------------ End user functions ---------------------------- */
@@ -88,8 +266,11 @@ void rtos_start();
  * Note that none of these enum values should be positive.
  */
 typedef enum block_reason {
-    BLOCK_SEMAPHORE = INT_MIN, /*!< Task is blocked due to sempahore pend */
-    BLOCK_NONE = 0,            /*!< Task is not blocked */
+    BLOCK_SEMAPHORE = INT_MIN,  /*!< Task is blocked due to sempahore pend */
+    BLOCK_QUEUE = INT_MIN + 1,  /*!< Task is blocked on a message queue */
+    BLOCK_NOTIFY = INT_MIN + 2, /*!< Task is waiting for a notification */
+    BLOCK_EVENT = INT_MIN + 3,  /*!< Task is waiting on an event group */
+    BLOCK_NONE = 0,             /*!< Task is not blocked */
 } block_reason_t;
 
 /**
@@ -98,6 +279,14 @@ typedef enum block_reason {
  */
 task_handle_t get_active_task();
 
+/**
+ * Checks if a task is the idle task. Used by system code that must never block
+ * the idle task.
+ * @param task: task to check
+ * @return true if task is the idle task
+ */
+bool task_is_idle(task_handle_t task);
+
 /**
  * Blocks the running task, and switches to a new runnable one. This function
  * does not return. Used by system drivers.
@@ -109,7 +298,7 @@ void block_active_task(block_reason_t reason);
  * Unblocks a task. Caller must give correct reason task was blocked. If
  * reason is incorrect, this call has no effect. Used by system drivers.
  * Task will not run immediately unless it has higher priority than running task
- * and preemption is enabled.
+ * and preemption is enabled. May be called with interrupts masked.
  * @param task: task to unblock
  * @param reason: reason task was blocked.
  */
@@ -118,10 +307,17 @@ void unblock_task(task_handle_t task, block_reason_t reason);
 /**
  * Unblocks a delayed task, cancelling its delay. Used by system drivers.
  * Task will not run immediately unless it has higher priority than running task
- * and preemption is enabled.
+ * and preemption is enabled. May be called with interrupts masked.
  */
 void unblock_delayed_task(task_handle_t task);
 
+/**
+ * Handles a memory management fault. If the MPU stack guard is enabled and
+ * the fault hit the running task's guard region, reports the overflowing
+ * task and halts. Used by the fault handler.
+ */
+void stack_guard_fault();
+
 /**
  * Returns if the RTOS has started.
  * @return boolean indicating RTOS status
@@ -0,0 +1,359 @@
+/**
+ * @file bench_test.c
+ * Kernel and driver microbenchmarks. Each benchmark is timed with the DWT
+ * cycle counter, and the results are written to the system log, so they can
+ * be compared between versions to catch performance regressions.
+ *
+ * The UART benchmark writes to LPUART1 (pins PA2 and PA3) at each baud rate.
+ * A terminal does not need to be open, but will show a stream of 'U'
+ * characters. Baud rates the device cannot generate from the current clock
+ * are reported as unsupported.
+ *
+ * Here is the expected output from the system log (cycle counts vary):
+ * task_yield round trip: ... cycles
+ * Semaphore ping-pong round trip: ... cycles
+ * EXTI to task wakeup: min ... avg ... max ... cycles
+ * task_create: ... cycles, task_destroy: ... cycles
+ * Ringbuf block copy: ....... bytes/cycle, single byte: ....... bytes/cycle
+ * UART 1200 baud: ... bytes/s (..% of line rate)
+ * .... (one line per baud rate) ......
+ * Benchmarks complete
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <drivers/clock/clock.h>
+#include <drivers/device/device.h>
+#include <drivers/gpio/gpio.h>
+#include <drivers/uart/uart.h>
+#include <sys/semaphore/semaphore.h>
+#include <sys/task/task.h>
+#include <util/logging/logging.h>
+#include <util/ringbuf/ringbuf.h>
+
+#define BENCH_ITERATIONS 1000
+#define EXTI_ITERATIONS 100
+#define RINGBUF_SIZE 256
+#define RINGBUF_BYTES (64 * 1024)
+#define UART_MIN_BYTES (4 * UART_DEFAULT_BUFSIZE)
+// UART data is sent with 8 data bits, a start bit, and a stop bit
+#define UART_BITS_PER_BYTE 10
+
+#define NOTIFY_EXTI 0x1
+#define NOTIFY_TRIGGER 0x1
+#define TRIGGER_PRIORITY (DEFAULT_PRIORITY - 1)
+
+static void bench_task(void *arg);
+static void yield_task(void *arg);
+static void pong_task(void *arg);
+static void trigger_task(void *arg);
+static void empty_task(void *arg);
+
+static const char *TAG = "Bench";
+static volatile bool yield_running;
+static semaphore_t ping_sem, pong_sem;
+static volatile uint32_t trigger_cycles;
+static uint8_t ringbuf_store[RINGBUF_SIZE];
+static uint8_t block[RINGBUF_SIZE];
+static uint8_t uart_data[UART_MIN_BYTES];
+
+static const UART_baud_rate_t baud_rates[] = {
+    UART_baud_1200,  UART_baud_2400,  UART_baud_4800,  UART_baud_9600,
+    UART_baud_19200, UART_baud_38400, UART_baud_57600, UART_baud_115200,
+};
+
+/**
+ * Initializes system
+ */
+static void system_init() {
+    clock_cfg_t clk_cfg = CLOCK_DEFAULT_CONFIG;
+    GPIO_config_t pin_cfg = GPIO_DEFAULT_CONFIG;
+    clock_init(&clk_cfg);
+    pin_cfg.mode = GPIO_mode_input;
+    GPIO_config(GPIO_PA0, &pin_cfg);
+    // LPUART1 pins, as used by the UART test
+    pin_cfg.alternate_func = GPIO_af8;
+    pin_cfg.mode = GPIO_mode_afunc;
+    pin_cfg.pullup_pulldown = GPIO_pullup;
+    pin_cfg.output_speed = GPIO_speed_vhigh;
+    GPIO_config(GPIO_PA2, &pin_cfg);
+    GPIO_config(GPIO_PA3, &pin_cfg);
+}
+
+/**
+ * Creates a benchmark helper task
+ * @param entry: task entry point
+ * @param priority: task priority
+ * @return handle to created task. Exits on failure
+ */
+static task_handle_t start_helper(void (*entry)(void *), uint32_t priority) {
+    task_config_t cfg = DEFAULT_TASK_CONFIG;
+    task_handle_t task;
+    cfg.task_name = "Helper";
+    cfg.task_priority = priority;
+    task = task_create(entry, NULL, &cfg);
+    if (task == NULL) {
+        LOG_E(TAG, "Benchmark failed, could not create helper task");
+        exit(ERR_FAIL);
+    }
+    return task;
+}
+
+/**
+ * Helper task for the yield benchmark. Yields back until stopped
+ * @param arg: unused.
+ */
+static void yield_task(void *arg) {
+    while (yield_running) {
+        task_yield();
+    }
+}
+
+/**
+ * Helper task for the semaphore benchmark. Answers each ping with a pong
+ * @param arg: unused.
+ */
+static void pong_task(void *arg) {
+    int i;
+    for (i = 0; i < BENCH_ITERATIONS; i++) {
+        semaphore_pend(ping_sem, SYS_TIMEOUT_INF);
+        semaphore_post(pong_sem);
+    }
+}
+
+/**
+ * Helper task for the EXTI benchmark. Raises EXTI line 0 in software each
+ * time the benchmark task asks for it. Runs below the benchmark task, so it
+ * only runs once the benchmark task waits for the interrupt.
+ * @param arg: unused.
+ */
+static void trigger_task(void *arg) {
+    while (1) {
+        task_notify_wait(NOTIFY_TRIGGER, NOTIFY_CLEAR, NULL, SYS_TIMEOUT_INF);
+        trigger_cycles = clock_cycles();
+        EXTI->SWIER1 = EXTI_SWIER1_SWI0;
+    }
+}
+
+/**
+ * Task used by the task_create benchmark. Never runs.
+ * @param arg: unused.
+ */
+static void empty_task(void *arg) {}
+
+/**
+ * Measures a task_yield round trip to another task of the same priority.
+ * Each round trip is two context switches.
+ */
+static void bench_yield() {
+    uint32_t start, cycles;
+    int i;
+    yield_running = true;
+    start_helper(yield_task, DEFAULT_PRIORITY);
+    task_yield();
+    start = clock_cycles();
+    for (i = 0; i < BENCH_ITERATIONS; i++) {
+        task_yield();
+    }
+    cycles = clock_cycles() - start;
+    yield_running = false;
+    task_yield();
+    LOG_I(TAG, "task_yield round trip: %lu cycles", cycles / BENCH_ITERATIONS);
+}
+
+/**
+ * Measures a semaphore post and pend round trip between two tasks
+ */
+static void bench_semaphore() {
+    uint32_t start, cycles;
+    int i;
+    ping_sem = semaphore_create_binary();
+    pong_sem = semaphore_create_binary();
+    if (ping_sem == NULL || pong_sem == NULL) {
+        LOG_E(TAG, "Benchmark failed, could not create semaphores");
+        exit(ERR_FAIL);
+    }
+    start_helper(pong_task, DEFAULT_PRIORITY);
+    start = clock_cycles();
+    for (i = 0; i < BENCH_ITERATIONS; i++) {
+        semaphore_post(ping_sem);
+        semaphore_pend(pong_sem, SYS_TIMEOUT_INF);
+    }
+    cycles = clock_cycles() - start;
+    LOG_I(TAG, "Semaphore ping-pong round trip: %lu cycles",
+          cycles / BENCH_ITERATIONS);
+}
+
+/**
+ * Measures the time from raising an EXTI interrupt until the task it
+ * notifies runs
+ */
+static void bench_exti() {
+    task_handle_t trigger;
+    uint32_t cycles, min = UINT32_MAX, max = 0, total = 0;
+    int i;
+    trigger = start_helper(trigger_task, TRIGGER_PRIORITY);
+    if (GPIO_interrupt_notify(GPIO_PA0, GPIO_trig_rising, get_active_task(),
+                              NOTIFY_EXTI) != SYS_OK) {
+        LOG_E(TAG, "Benchmark failed, could not bind EXTI line");
+        exit(ERR_FAIL);
+    }
+    for (i = 0; i < EXTI_ITERATIONS; i++) {
+        task_notify(trigger, NOTIFY_TRIGGER);
+        task_notify_wait(NOTIFY_EXTI, NOTIFY_CLEAR, NULL, SYS_TIMEOUT_INF);
+        cycles = clock_cycles() - trigger_cycles;
+        total += cycles;
+        min = cycles < min ? cycles : min;
+        max = cycles > max ? cycles : max;
+    }
+    task_destroy(trigger);
+    LOG_I(TAG, "EXTI to task wakeup: min %lu avg %lu max %lu cycles", min,
+          total / EXTI_ITERATIONS, max);
+}
+
+/**
+ * Measures the cost of creating and destroying a task. The created task has
+ * a lower priority, so it never runs.
+ */
+static void bench_task_create() {
+    task_config_t cfg = DEFAULT_TASK_CONFIG;
+    task_handle_t task;
+    uint32_t start, create = 0, destroy = 0;
+    int i;
+    cfg.task_priority = TRIGGER_PRIORITY;
+    for (i = 0; i < BENCH_ITERATIONS; i++) {
+        start = clock_cycles();
+        task = task_create(empty_task, NULL, &cfg);
+        create += clock_cycles() - start;
+        if (task == NULL) {
+            LOG_E(TAG, "Benchmark failed, could not create task");
+            exit(ERR_FAIL);
+        }
+        start = clock_cycles();
+        task_destroy(task);
+        destroy += clock_cycles() - start;
+    }
+    LOG_I(TAG, "task_create: %lu cycles, task_destroy: %lu cycles",
+          create / BENCH_ITERATIONS, destroy / BENCH_ITERATIONS);
+}
+
+/**
+ * Formats a byte rate as bytes per cycle, with three decimal places
+ * @param bytes: bytes moved
+ * @param cycles: cycles taken
+ * @param whole: set to whole bytes per cycle
+ * @param frac: set to thousandths of a byte per cycle
+ */
+static void bytes_per_cycle(uint32_t bytes, uint32_t cycles, uint32_t *whole,
+                            uint32_t *frac) {
+    uint32_t milli = (uint32_t)(((uint64_t)bytes * 1000) / cycles);
+    *whole = milli / 1000;
+    *frac = milli % 1000;
+}
+
+/**
+ * Measures ring buffer throughput, with block and single byte copies
+ */
+static void bench_ringbuf() {
+    RingBuf_t buf;
+    uint32_t start, block_cycles, byte_cycles, i, j;
+    uint32_t block_whole, block_frac, byte_whole, byte_frac;
+    char c;
+    buf_init(&buf, ringbuf_store, RINGBUF_SIZE);
+    memset(block, 'U', RINGBUF_SIZE);
+    start = clock_cycles();
+    for (i = 0; i < RINGBUF_BYTES; i += RINGBUF_SIZE) {
+        buf_writeblock(&buf, block, RINGBUF_SIZE);
+        buf_readblock(&buf, block, RINGBUF_SIZE);
+    }
+    block_cycles = clock_cycles() - start;
+    start = clock_cycles();
+    for (i = 0; i < RINGBUF_BYTES; i += RINGBUF_SIZE) {
+        for (j = 0; j < RINGBUF_SIZE; j++) {
+            buf_write(&buf, 'U');
+        }
+        for (j = 0; j < RINGBUF_SIZE; j++) {
+            buf_read(&buf, &c);
+        }
+    }
+    byte_cycles = clock_cycles() - start;
+    // Each byte is written and read once
+    bytes_per_cycle(RINGBUF_BYTES, block_cycles, &block_whole, &block_frac);
+    bytes_per_cycle(RINGBUF_BYTES, byte_cycles, &byte_whole, &byte_frac);
+    LOG_I(TAG,
+          "Ringbuf block copy: %lu.%03lu bytes/cycle, single byte: "
+          "%lu.%03lu bytes/cycle",
+          block_whole, block_frac, byte_whole, byte_frac);
+}
+
+/**
+ * Measures sustained UART write throughput at each baud rate. Roughly half a
+ * second of data is written at each rate, and at least several write buffers,
+ * and the time is taken up to the last byte leaving the device.
+ */
+static void bench_uart() {
+    UART_config_t cfg = UART_DEFAULT_CONFIG;
+    UART_handle_t uart;
+    syserr_t err;
+    uint32_t i, bytes, left, len, start, cycles, rate;
+    memset(uart_data, 'U', UART_MIN_BYTES);
+    for (i = 0; i < sizeof(baud_rates) / sizeof(baud_rates[0]); i++) {
+        cfg.UART_baud_rate = baud_rates[i];
+        uart = UART_open(LPUART_1, &cfg, &err);
+        if (uart == NULL) {
+            LOG_I(TAG, "UART %lu baud: unsupported", (uint32_t)baud_rates[i]);
+            continue;
+        }
+        bytes = baud_rates[i] / (2 * UART_BITS_PER_BYTE);
+        if (bytes < UART_MIN_BYTES) {
+            bytes = UART_MIN_BYTES;
+        }
+        start = clock_cycles();
+        for (left = bytes; left > 0; left -= len) {
+            len = left < UART_MIN_BYTES ? left : UART_MIN_BYTES;
+            if (UART_write(uart, uart_data, len, &err) != (int)len) {
+                LOG_E(TAG, "Benchmark failed, UART write error %d", err);
+                exit(ERR_FAIL);
+            }
+        }
+        // Closing waits for transmission to complete
+        UART_close(uart);
+        cycles = clock_cycles() - start;
+        rate = (uint32_t)(((uint64_t)bytes * sysclock_freq()) / cycles);
+        LOG_I(TAG, "UART %lu baud: %lu bytes/s (%lu%% of line rate)",
+              (uint32_t)baud_rates[i], rate,
+              (rate * UART_BITS_PER_BYTE * 100) / baud_rates[i]);
+    }
+}
+
+/**
+ * Benchmark task entry point. Runs each benchmark in turn
+ * @param arg: unused.
+ */
+static void bench_task(void *arg) {
+    bench_yield();
+    bench_semaphore();
+    bench_exti();
+    bench_task_create();
+    bench_ringbuf();
+    bench_uart();
+    LOG_I(TAG, "Benchmarks complete");
+}
+
+/**
+ * Testing entry point. Runs kernel and driver benchmarks
+ */
+int main() {
+    task_config_t cfg = DEFAULT_TASK_CONFIG;
+    /* Init system */
+    system_init();
+    cfg.task_name = "Bench Task";
+    if (task_create(bench_task, NULL, &cfg) == NULL) {
+        LOG_E(TAG, "Failed to create rtos task");
+        return ERR_FAIL;
+    }
+    LOG_I(TAG, "Starting RTOS");
+    rtos_start();
+    return SYS_OK;
+}
@@ -0,0 +1,158 @@
+/**
+ * @file event_test.c
+ * Test RTOS task notifications and event groups
+ * The signal task notifies the waiter task one bit at a time, so the
+ * waiter's wait for all bits only completes after both are set. Two tasks
+ * then wait on an event group, one for any of its bits and one for all of
+ * them, and are woken as the signal task sets bits.
+ *
+ * Here is the expected output from the system log:
+ * Notification wait timed out as expected
+ * Waiter received notification 0x3
+ * Any task received events 0x1
+ * All task received events 0x3
+ * Event test passed
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <drivers/clock/clock.h>
+#include <sys/event/event.h>
+#include <sys/task/task.h>
+#include <util/logging/logging.h>
+
+#define BIT_A 0x1
+#define BIT_B 0x2
+#define HIGH_PRIORITY (DEFAULT_PRIORITY + 1)
+
+static void waiter_task(void *arg);
+static void any_task(void *arg);
+static void all_task(void *arg);
+static void signal_task(void *arg);
+
+static task_handle_t waiter;
+static event_group_t events;
+
+/**
+ * Initializes system
+ */
+static void system_init() {
+    clock_cfg_t clk_cfg = CLOCK_DEFAULT_CONFIG;
+    clock_init(&clk_cfg);
+}
+
+/**
+ * Waiter task entry point. Waits for all notification bits
+ * @param arg: unused.
+ */
+static void waiter_task(void *arg) {
+    const char *TAG = "Waiter Task";
+    uint32_t value;
+    if (task_notify_wait(BIT_A, NOTIFY_WAIT_ALL, NULL, 10) != ERR_TIMEOUT) {
+        LOG_E(TAG, "Event test failed, notification wait did not time out");
+        exit(ERR_FAIL);
+    }
+    LOG_I(TAG, "Notification wait timed out as expected");
+    if (task_notify_wait(BIT_A | BIT_B, NOTIFY_WAIT_ALL | NOTIFY_CLEAR,
+                         &value, SYS_TIMEOUT_INF) != SYS_OK ||
+        value != (BIT_A | BIT_B)) {
+        LOG_E(TAG, "Event test failed, bad notification");
+        exit(ERR_FAIL);
+    }
+    LOG_I(TAG, "Waiter received notification 0x%lx", value);
+    if (task_notify_clear(0) != 0) {
+        LOG_E(TAG, "Event test failed, notification bits were not cleared");
+        exit(ERR_FAIL);
+    }
+}
+
+/**
+ * Any task entry point. Waits for any event bit
+ * @param arg: unused.
+ */
+static void any_task(void *arg) {
+    const char *TAG = "Any Task";
+    uint32_t value;
+    if (event_group_wait(events, BIT_A | BIT_B, EVENT_WAIT_ANY, &value,
+                         1000) != SYS_OK) {
+        LOG_E(TAG, "Event test failed, any wait timed out");
+        exit(ERR_FAIL);
+    }
+    LOG_I(TAG, "Any task received events 0x%lx", value);
+}
+
+/**
+ * All task entry point. Waits for all event bits, and clears them
+ * @param arg: unused.
+ */
+static void all_task(void *arg) {
+    const char *TAG = "All Task";
+    uint32_t value;
+    if (event_group_wait(events, BIT_A | BIT_B, EVENT_WAIT_ALL | EVENT_CLEAR,
+                         &value, SYS_TIMEOUT_INF) != SYS_OK) {
+        LOG_E(TAG, "Event test failed, all wait failed");
+        exit(ERR_FAIL);
+    }
+    LOG_I(TAG, "All task received events 0x%lx", value);
+    if (event_group_get(events) != 0) {
+        LOG_E(TAG, "Event test failed, event bits were not cleared");
+        exit(ERR_FAIL);
+    }
+    LOG_I(TAG, "Event test passed");
+}
+
+/**
+ * Signal task entry point. Sets notification and event bits one at a time
+ * @param arg: unused.
+ */
+static void signal_task(void *arg) {
+    task_delay(50);
+    task_notify(waiter, BIT_A);
+    task_delay(10);
+    task_notify(waiter, BIT_B);
+    task_delay(10);
+    event_group_set(events, BIT_A);
+    task_delay(10);
+    event_group_set(events, BIT_B);
+}
+
+/**
+ * Testing entry point. Tests task notifications and event groups
+ */
+int main() {
+    const char *TAG = "main";
+    task_config_t cfg = DEFAULT_TASK_CONFIG;
+    task_config_t signal_cfg = DEFAULT_TASK_CONFIG;
+    /* Init system */
+    system_init();
+    events = event_group_create();
+    if (events == NULL) {
+        LOG_E(TAG, "Could not create event group");
+        return ERR_FAIL;
+    }
+    // Waiting tasks run at higher priority, so they are woken immediately
+    cfg.task_priority = HIGH_PRIORITY;
+    cfg.task_name = "Waiter Task";
+    waiter = task_create(waiter_task, NULL, &cfg);
+    cfg.task_name = "Any Task";
+    if (waiter == NULL || task_create(any_task, NULL, &cfg) == NULL) {
+        LOG_E(TAG, "Failed to create rtos task");
+        return ERR_FAIL;
+    }
+    cfg.task_name = "All Task";
+    if (task_create(all_task, NULL, &cfg) == NULL) {
+        LOG_E(TAG, "Failed to create rtos task");
+        return ERR_FAIL;
+    }
+    signal_cfg.task_name = "Signal Task";
+    if (task_create(signal_task, NULL, &signal_cfg) == NULL) {
+        LOG_E(TAG, "Failed to create rtos task");
+        return ERR_FAIL;
+    }
+    LOG_I(TAG, "Starting RTOS");
+    rtos_start();
+    return SYS_OK;
+}
@@ -0,0 +1,142 @@
+/**
+ * @file mutex_test.c
+ * Test RTOS mutex priority inheritance
+ * The low priority task locks the mutex, then starts the high and medium
+ * priority tasks. The high priority task blocks on the mutex, which should
+ * raise the low priority task to high priority. The medium priority task
+ * spins for long periods without yielding, so without priority inheritance
+ * it would starve the low priority task and the high priority task would
+ * never run.
+ *
+ * Here is the expected output from the system log:
+ * Low task locked mutex
+ * High task waiting for mutex
+ * Low task running at priority 6
+ * Low task unlocking mutex
+ * High task locked mutex
+ * Medium task running
+ * Low task priority restored
+ * Medium task running
+ * .... (medium task continues to print) ......
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <drivers/clock/clock.h>
+#include <sys/semaphore/semaphore.h>
+#include <sys/task/task.h>
+#include <util/logging/logging.h>
+
+#define LOW_PRIORITY (DEFAULT_PRIORITY - 1)
+#define MEDIUM_PRIORITY DEFAULT_PRIORITY
+#define HIGH_PRIORITY (DEFAULT_PRIORITY + 2)
+
+static void low_task(void *arg);
+static void medium_task(void *arg);
+static void high_task(void *arg);
+
+static mutex_t mutex;
+
+/**
+ * Initializes system
+ */
+static void system_init() {
+    clock_cfg_t clk_cfg = CLOCK_DEFAULT_CONFIG;
+    clock_init(&clk_cfg);
+}
+
+/**
+ * Low priority task entry point. Holds the mutex while the other tasks start
+ * @param arg: unused.
+ */
+static void low_task(void *arg) {
+    task_config_t medium_cfg = DEFAULT_TASK_CONFIG;
+    task_config_t high_cfg = DEFAULT_TASK_CONFIG;
+    const char *TAG = "Low Task";
+    if (mutex_lock(mutex, SYS_TIMEOUT_INF) != SYS_OK) {
+        LOG_E(TAG, "Could not lock mutex");
+        exit(ERR_FAIL);
+    }
+    LOG_I(TAG, "Low task locked mutex");
+    // High priority task will run immediately, and block on the mutex
+    high_cfg.task_priority = HIGH_PRIORITY;
+    high_cfg.task_name = "High Task";
+    if (task_create(high_task, NULL, &high_cfg) == NULL) {
+        LOG_E(TAG, "Could not create high priority task");
+    }
+    // Medium priority task should not run until the mutex is unlocked
+    medium_cfg.task_priority = MEDIUM_PRIORITY;
+    medium_cfg.task_name = "Medium Task";
+    if (task_create(medium_task, NULL, &medium_cfg) == NULL) {
+        LOG_E(TAG, "Could not create medium priority task");
+    }
+    task_yield();
+    LOG_I(TAG, "Low task running at priority %lu",
+          task_get_priority(get_active_task()));
+    if (task_get_priority(get_active_task()) != HIGH_PRIORITY) {
+        LOG_E(TAG, "Mutex test failed, low task did not inherit priority");
+    }
+    LOG_I(TAG, "Low task unlocking mutex");
+    mutex_unlock(mutex);
+    if (task_get_priority(get_active_task()) != LOW_PRIORITY) {
+        LOG_E(TAG, "Mutex test failed, low task priority was not restored");
+    } else {
+        LOG_I(TAG, "Low task priority restored");
+    }
+}
+
+/**
+ * Medium priority task entry point. Spins without yielding, then sleeps.
+ * @param arg: unused.
+ */
+static void medium_task(void *arg) {
+    const char *TAG = "Medium Task";
+    while (1) {
+        LOG_I(TAG, "Medium task running");
+        blocking_delay_ms(1000);
+        task_delay(1000);
+    }
+}
+
+/**
+ * High priority task entry point. Blocks on the mutex held by the low task.
+ * @param arg: unused.
+ */
+static void high_task(void *arg) {
+    const char *TAG = "High Task";
+    LOG_I(TAG, "High task waiting for mutex");
+    if (mutex_lock(mutex, SYS_TIMEOUT_INF) != SYS_OK) {
+        LOG_E(TAG, "Could not lock mutex");
+        exit(ERR_FAIL);
+    }
+    LOG_I(TAG, "High task locked mutex");
+    mutex_unlock(mutex);
+    mutex_destroy(mutex);
+}
+
+/**
+ * Testing entry point. Tests mutex priority inheritance
+ */
+int main() {
+    const char *TAG = "main";
+    task_config_t low_cfg = DEFAULT_TASK_CONFIG;
+    /* Init system */
+    system_init();
+    mutex = mutex_create();
+    if (mutex == NULL) {
+        LOG_E(TAG, "Could not create mutex");
+        return ERR_FAIL;
+    }
+    low_cfg.task_priority = LOW_PRIORITY;
+    low_cfg.task_name = "Low Task";
+    if (task_create(low_task, NULL, &low_cfg) == NULL) {
+        LOG_E(TAG, "Failed to create rtos task");
+        return ERR_FAIL;
+    }
+    LOG_I(TAG, "Starting RTOS");
+    rtos_start();
+    return SYS_OK;
+}
@@ -0,0 +1,142 @@
+/**
+ * @file queue_test.c
+ * Test RTOS message queues
+ * The producer task sends numbered items to a short queue faster than the
+ * consumer task receives them, so the producer blocks on a full queue and
+ * items are handed over directly as the consumer frees space. The producer
+ * then passes buffers to the consumer by pointer, without copying them.
+ *
+ * Here is the expected output from the system log:
+ * Producer sending items
+ * Consumer received 16 items in order
+ * Queue full, send timed out as expected
+ * Consumer received frame "frame 0"
+ * Consumer received frame "frame 1"
+ * Consumer received frame "frame 2"
+ * Queue test passed
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <drivers/clock/clock.h>
+#include <sys/queue/queue.h>
+#include <sys/task/task.h>
+#include <util/logging/logging.h>
+
+#define QUEUE_LEN 4
+#define NUM_ITEMS 16
+#define NUM_FRAMES 3
+#define FRAME_SIZE 16
+
+static void producer_task(void *arg);
+static void consumer_task(void *arg);
+
+static queue_t item_queue;
+static queue_t frame_queue;
+static queue_t done_queue;
+
+static char frames[NUM_FRAMES][FRAME_SIZE];
+
+/**
+ * Initializes system
+ */
+static void system_init() {
+    clock_cfg_t clk_cfg = CLOCK_DEFAULT_CONFIG;
+    clock_init(&clk_cfg);
+}
+
+/**
+ * Producer task entry point. Sends items, then frames by pointer
+ * @param arg: unused.
+ */
+static void producer_task(void *arg) {
+    const char *TAG = "Producer";
+    uint32_t item;
+    uint32_t result;
+    LOG_I(TAG, "Producer sending items");
+    for (item = 0; item < NUM_ITEMS; item++) {
+        if (queue_send(item_queue, &item, SYS_TIMEOUT_INF) != SYS_OK) {
+            LOG_E(TAG, "Queue test failed, could not send item %lu", item);
+            exit(ERR_FAIL);
+        }
+    }
+    // Wait for consumer to finish, then fill the queue and check timeouts
+    queue_receive(done_queue, &result, SYS_TIMEOUT_INF);
+    for (item = 0; item < QUEUE_LEN; item++) {
+        queue_send(item_queue, &item, SYS_TIMEOUT_NONE);
+    }
+    if (queue_send(item_queue, &item, 10) != ERR_TIMEOUT) {
+        LOG_E(TAG, "Queue test failed, send to full queue did not time out");
+        exit(ERR_FAIL);
+    }
+    LOG_I(TAG, "Queue full, send timed out as expected");
+    for (item = 0; item < NUM_FRAMES; item++) {
+        snprintf(frames[item], FRAME_SIZE, "frame %d", (int)item);
+        if (queue_send_ptr(frame_queue, frames[item], SYS_TIMEOUT_INF) !=
+            SYS_OK) {
+            LOG_E(TAG, "Queue test failed, could not send frame");
+            exit(ERR_FAIL);
+        }
+    }
+}
+
+/**
+ * Consumer task entry point. Receives items slowly, then frames by pointer
+ * @param arg: unused.
+ */
+static void consumer_task(void *arg) {
+    const char *TAG = "Consumer";
+    uint32_t item, expected;
+    char *frame;
+    for (expected = 0; expected < NUM_ITEMS; expected++) {
+        if (queue_receive(item_queue, &item, SYS_TIMEOUT_INF) != SYS_OK ||
+            item != expected) {
+            LOG_E(TAG, "Queue test failed, expected item %lu", expected);
+            exit(ERR_FAIL);
+        }
+        task_delay(5);
+    }
+    LOG_I(TAG, "Consumer received %d items in order", NUM_ITEMS);
+    queue_send(done_queue, &expected, SYS_TIMEOUT_INF);
+    for (expected = 0; expected < NUM_FRAMES; expected++) {
+        if (queue_receive_ptr(frame_queue, (void **)&frame, SYS_TIMEOUT_INF) !=
+                SYS_OK ||
+            frame != frames[expected]) {
+            LOG_E(TAG, "Queue test failed, frame was not passed by pointer");
+            exit(ERR_FAIL);
+        }
+        LOG_I(TAG, "Consumer received frame \"%s\"", frame);
+    }
+    LOG_I(TAG, "Queue test passed");
+}
+
+/**
+ * Testing entry point. Tests message queues
+ */
+int main() {
+    const char *TAG = "main";
+    task_config_t producer_cfg = DEFAULT_TASK_CONFIG;
+    task_config_t consumer_cfg = DEFAULT_TASK_CONFIG;
+    /* Init system */
+    system_init();
+    item_queue = queue_create(sizeof(uint32_t), QUEUE_LEN);
+    frame_queue = queue_create(QUEUE_PTR_ITEM_SIZE, 1);
+    done_queue = queue_create(sizeof(uint32_t), 1);
+    if (item_queue == NULL || frame_queue == NULL || done_queue == NULL) {
+        LOG_E(TAG, "Could not create queues");
+        return ERR_FAIL;
+    }
+    producer_cfg.task_name = "Producer";
+    consumer_cfg.task_name = "Consumer";
+    if (task_create(producer_task, NULL, &producer_cfg) == NULL ||
+        task_create(consumer_task, NULL, &consumer_cfg) == NULL) {
+        LOG_E(TAG, "Failed to create rtos task");
+        return ERR_FAIL;
+    }
+    LOG_I(TAG, "Starting RTOS");
+    rtos_start();
+    return SYS_OK;
+}
@@ -0,0 +1,114 @@
+/**
+ * @file reent_test.c
+ * Tests per task newlib reentrancy and heap locking
+ * Two tasks of equal priority run the same loop, and yield between every
+ * step. Each task sets errno and checks that it survives the other task
+ * setting errno, allocates and frees heap blocks that the other task must not
+ * touch, and prints each line in several fragments. Since each task has its
+ * own line buffered stdout, the fragments of one line are never split by
+ * output from the other task.
+ *
+ * Here is the expected output from the system log, with lines from the two
+ * tasks in any order:
+ * Task A: line 0 of 8
+ * Task B: line 0 of 8
+ * .... (each task prints 8 lines) ......
+ * Task A: line 7 of 8
+ * Task B: line 7 of 8
+ * Reent test passed
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <drivers/clock/clock.h>
+#include <sys/task/task.h>
+#include <util/logging/logging.h>
+
+#define LINES 8
+#define ALLOCS 4
+#define ALLOC_SIZE 48
+
+static void test_task(void *arg);
+
+static const char *TAG = "Reent Test";
+static int finished = 0;
+
+/**
+ * Initializes system
+ */
+static void system_init() {
+    clock_cfg_t clk_cfg = CLOCK_DEFAULT_CONFIG;
+    clock_init(&clk_cfg);
+}
+
+/**
+ * Test task entry point. Checks errno, heap blocks, and stdout lines while
+ * yielding to the other test task
+ * @param arg: character naming the task, also used as the fill byte
+ */
+static void test_task(void *arg) {
+    char name = (char)(uintptr_t)arg;
+    char *blocks[ALLOCS];
+    int line, i, j;
+    for (line = 0; line < LINES; line++) {
+        // errno is part of the task's reentrancy state
+        errno = name + line;
+        task_yield();
+        if (errno != name + line) {
+            LOG_E(TAG, "Task %c errno changed to %d", name, errno);
+            exit(ERR_FAIL);
+        }
+        // Heap blocks must not be handed out to both tasks
+        for (i = 0; i < ALLOCS; i++) {
+            blocks[i] = malloc(ALLOC_SIZE);
+            if (blocks[i] == NULL) {
+                LOG_E(TAG, "Task %c could not allocate memory", name);
+                exit(ERR_FAIL);
+            }
+            memset(blocks[i], name, ALLOC_SIZE);
+            task_yield();
+        }
+        for (i = 0; i < ALLOCS; i++) {
+            for (j = 0; j < ALLOC_SIZE; j++) {
+                if (blocks[i][j] != name) {
+                    LOG_E(TAG, "Task %c heap block was overwritten", name);
+                    exit(ERR_FAIL);
+                }
+            }
+            free(blocks[i]);
+        }
+        // Each fragment stays in the task's stdout buffer until the newline
+        printf("Task %c: ", name);
+        task_yield();
+        printf("line %d ", line);
+        task_yield();
+        printf("of %d\n", LINES);
+    }
+    if (++finished == 2) {
+        LOG_I(TAG, "Reent test passed");
+    }
+}
+
+/**
+ * Testing entry point. Starts both test tasks
+ */
+int main() {
+    task_config_t cfg = DEFAULT_TASK_CONFIG;
+    /* Init system */
+    system_init();
+    cfg.task_name = "Task A";
+    if (task_create(test_task, (void *)'A', &cfg) == NULL) {
+        LOG_E(TAG, "Failed to create rtos task");
+        return ERR_FAIL;
+    }
+    cfg.task_name = "Task B";
+    if (task_create(test_task, (void *)'B', &cfg) == NULL) {
+        LOG_E(TAG, "Failed to create rtos task");
+        return ERR_FAIL;
+    }
+    rtos_start();
+    return SYS_OK;
+}
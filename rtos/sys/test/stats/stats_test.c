@@ -0,0 +1,99 @@
+/**
+ * @file stats_test.c
+ * Test RTOS scheduler statistics
+ * The busy task spins for half of each 100ms period and sleeps for the other
+ * half, so the system should report roughly 50% cpu load. The monitor task
+ * prints system and per task statistics every second.
+ *
+ * Here is the expected output from the system log:
+ * CPU load 50%, ... switches, worst wake latency ... cycles
+ * Busy task ran ... cycles in 10 switches
+ * .... (monitor continues to print) ......
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <drivers/clock/clock.h>
+#include <sys/task/task.h>
+#include <util/logging/logging.h>
+
+#define MONITOR_PRIORITY (DEFAULT_PRIORITY + 1)
+
+static void busy_task(void *arg);
+static void monitor_task(void *arg);
+
+static task_handle_t busy;
+
+/**
+ * Initializes system
+ */
+static void system_init() {
+    clock_cfg_t clk_cfg = CLOCK_DEFAULT_CONFIG;
+    clock_init(&clk_cfg);
+}
+
+/**
+ * Busy task entry point. Runs at 50% duty cycle
+ * @param arg: unused.
+ */
+static void busy_task(void *arg) {
+    while (1) {
+        blocking_delay_ms(50);
+        task_delay(50);
+    }
+}
+
+/**
+ * Monitor task entry point. Prints statistics once a second
+ * @param arg: unused.
+ */
+static void monitor_task(void *arg) {
+    const char *TAG = "Monitor Task";
+    system_stats_t sys_stats, last_sys = {0};
+    task_stats_t busy_stats, last_busy = {0};
+    uint64_t total, idle;
+    while (1) {
+        task_delay(1000);
+        if (task_get_system_stats(&sys_stats) != SYS_OK ||
+            task_get_stats(busy, &busy_stats) != SYS_OK) {
+            LOG_E(TAG, "Stats test failed, could not read statistics");
+            exit(ERR_FAIL);
+        }
+        total = sys_stats.total_cycles - last_sys.total_cycles;
+        idle = sys_stats.idle_cycles - last_sys.idle_cycles;
+        LOG_I(TAG, "CPU load %lu%%, %lu switches, worst wake latency %lu cycles",
+              (uint32_t)(100 - (idle * 100) / total),
+              sys_stats.switch_count - last_sys.switch_count,
+              sys_stats.max_wake_latency);
+        LOG_I(TAG, "Busy task ran %lu cycles in %lu switches",
+              (uint32_t)(busy_stats.run_cycles - last_busy.run_cycles),
+              busy_stats.switch_count - last_busy.switch_count);
+        last_sys = sys_stats;
+        last_busy = busy_stats;
+    }
+}
+
+/**
+ * Testing entry point. Tests scheduler statistics
+ */
+int main() {
+    const char *TAG = "main";
+    task_config_t busy_cfg = DEFAULT_TASK_CONFIG;
+    task_config_t monitor_cfg = DEFAULT_TASK_CONFIG;
+    /* Init system */
+    system_init();
+    busy_cfg.task_name = "Busy Task";
+    busy = task_create(busy_task, NULL, &busy_cfg);
+    monitor_cfg.task_priority = MONITOR_PRIORITY;
+    monitor_cfg.task_name = "Monitor Task";
+    if (busy == NULL || task_create(monitor_task, NULL, &monitor_cfg) == NULL) {
+        LOG_E(TAG, "Failed to create rtos task");
+        return ERR_FAIL;
+    }
+    LOG_I(TAG, "Starting RTOS");
+    rtos_start();
+    return SYS_OK;
+}
@@ -104,6 +104,11 @@ static void rtos_task4(void *arg) {
     const char *TAG = "Rtos_Task4";
     LOG_D(TAG, "Task 4 starting. Dropping into delay, then killing task 3");
     task_delay(2000);
+    LOG_D(TAG, "Task 3 has %lu bytes of stack never used",
+          task_stack_highwater((task_handle_t)arg));
+    if (task_stack_highwater((task_handle_t)arg) == 0) {
+        LOG_E(TAG, "Task 3 stack high water mark was not found");
+    }
     LOG_D(TAG, "Task 4 destroying task 3");
     task_destroy((task_handle_t)arg);
     LOG_D(TAG, "Task 4 exiting");
@@ -0,0 +1,137 @@
+/**
+ * @file timer_test.c
+ * Test RTOS software timers
+ * A periodic timer and a one shot timer are started together. The periodic
+ * timer should expire once every period, and the one shot timer only once.
+ * Once the periodic timer is stopped its callback should not run again. A
+ * third timer destroys itself from its own callback.
+ *
+ * Here is the expected output from the system log:
+ * Periodic timer expired 10 times
+ * One shot timer expired once
+ * Stopped timer did not expire
+ * Timer destroyed itself
+ * Timer test passed
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <drivers/clock/clock.h>
+#include <sys/task/task.h>
+#include <sys/timer/timer.h>
+#include <util/logging/logging.h>
+
+#define PERIOD_MS 10
+#define PERIOD_COUNT 10
+
+static void test_task(void *arg);
+static void count_callback(soft_timer_t timer, void *arg);
+static void destroy_callback(soft_timer_t timer, void *arg);
+
+static volatile int periodic_count = 0;
+static volatile int oneshot_count = 0;
+static volatile bool destroyed = false;
+static soft_timer_static_t oneshot_storage;
+
+/**
+ * Initializes system
+ */
+static void system_init() {
+    clock_cfg_t clk_cfg = CLOCK_DEFAULT_CONFIG;
+    clock_init(&clk_cfg);
+}
+
+/**
+ * Timer callback. Increments the counter passed as its argument
+ * @param timer: expired timer
+ * @param arg: counter to increment
+ */
+static void count_callback(soft_timer_t timer, void *arg) {
+    (*(volatile int *)arg)++;
+}
+
+/**
+ * Timer callback. Destroys the expired timer
+ * @param timer: expired timer
+ * @param arg: unused.
+ */
+static void destroy_callback(soft_timer_t timer, void *arg) {
+    soft_timer_destroy(timer);
+    destroyed = true;
+}
+
+/**
+ * Test task entry point. Starts timers and checks their callbacks ran
+ * @param arg: unused.
+ */
+static void test_task(void *arg) {
+    const char *TAG = "Test Task";
+    soft_timer_t periodic, oneshot, self_destroy;
+    int count;
+    periodic = soft_timer_create(count_callback, (void *)&periodic_count,
+                                 PERIOD_MS, SOFT_TIMER_PERIODIC);
+    oneshot = soft_timer_create_static(count_callback, (void *)&oneshot_count,
+                                       PERIOD_MS * 2, SOFT_TIMER_ONESHOT,
+                                       &oneshot_storage);
+    self_destroy = soft_timer_create(destroy_callback, NULL, PERIOD_MS,
+                                     SOFT_TIMER_PERIODIC);
+    if (periodic == NULL || oneshot == NULL || self_destroy == NULL) {
+        LOG_E(TAG, "Timer test failed, could not create timers");
+        exit(ERR_FAIL);
+    }
+    soft_timer_start(periodic);
+    soft_timer_start(oneshot);
+    // Wait for half a period past the last expected expiry
+    task_delay(PERIOD_MS * PERIOD_COUNT + PERIOD_MS / 2);
+    soft_timer_stop(periodic);
+    count = periodic_count;
+    if (count != PERIOD_COUNT) {
+        LOG_E(TAG, "Timer test failed, periodic timer expired %d times",
+              count);
+        exit(ERR_FAIL);
+    }
+    LOG_I(TAG, "Periodic timer expired %d times", count);
+    if (oneshot_count != 1 || soft_timer_active(oneshot)) {
+        LOG_E(TAG, "Timer test failed, one shot timer expired %d times",
+              oneshot_count);
+        exit(ERR_FAIL);
+    }
+    LOG_I(TAG, "One shot timer expired once");
+    task_delay(PERIOD_MS * 3);
+    if (periodic_count != count || soft_timer_active(periodic)) {
+        LOG_E(TAG, "Timer test failed, stopped timer expired");
+        exit(ERR_FAIL);
+    }
+    LOG_I(TAG, "Stopped timer did not expire");
+    soft_timer_start(self_destroy);
+    task_delay(PERIOD_MS * 2);
+    if (!destroyed) {
+        LOG_E(TAG, "Timer test failed, timer did not destroy itself");
+        exit(ERR_FAIL);
+    }
+    LOG_I(TAG, "Timer destroyed itself");
+    soft_timer_destroy(periodic);
+    soft_timer_destroy(oneshot);
+    LOG_I(TAG, "Timer test passed");
+}
+
+/**
+ * Testing entry point. Tests software timers
+ */
+int main() {
+    const char *TAG = "main";
+    task_config_t cfg = DEFAULT_TASK_CONFIG;
+    /* Init system */
+    system_init();
+    cfg.task_name = "Test Task";
+    if (task_create(test_task, NULL, &cfg) == NULL) {
+        LOG_E(TAG, "Failed to create rtos task");
+        return ERR_FAIL;
+    }
+    LOG_I(TAG, "Starting RTOS");
+    rtos_start();
+    return SYS_OK;
+}
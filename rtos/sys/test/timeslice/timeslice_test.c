@@ -0,0 +1,102 @@
+/**
+ * @file timeslice_test.c
+ * Test RTOS time slice scheduling
+ * Two worker tasks of equal priority spin without ever yielding. With a time
+ * slice set, the scheduler rotates between them, so both make progress. A
+ * higher priority monitor task periodically checks that both counters
+ * advanced.
+ *
+ * Here is the expected output from the system log:
+ * Both workers ran: ...
+ * Both workers ran: ...
+ * .... (monitor continues to print) ......
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <drivers/clock/clock.h>
+#include <sys/task/task.h>
+#include <util/logging/logging.h>
+
+#define WORKER_PRIORITY DEFAULT_PRIORITY
+#define MONITOR_PRIORITY (DEFAULT_PRIORITY + 1)
+#define WORKER_TIMESLICE 5
+
+static void worker_task(void *arg);
+static void monitor_task(void *arg);
+
+static volatile uint32_t counters[2];
+
+/**
+ * Initializes system
+ */
+static void system_init() {
+    clock_cfg_t clk_cfg = CLOCK_DEFAULT_CONFIG;
+    clock_init(&clk_cfg);
+}
+
+/**
+ * Worker task entry point. Increments its counter forever without yielding
+ * @param arg: pointer to counter to increment
+ */
+static void worker_task(void *arg) {
+    volatile uint32_t *counter = (volatile uint32_t *)arg;
+    while (1) {
+        (*counter)++;
+    }
+}
+
+/**
+ * Monitor task entry point. Checks that both workers make progress
+ * @param arg: unused.
+ */
+static void monitor_task(void *arg) {
+    const char *TAG = "Monitor Task";
+    uint32_t last[2] = {0, 0};
+    while (1) {
+        task_delay(100);
+        if (counters[0] == last[0] || counters[1] == last[1]) {
+            LOG_E(TAG, "Timeslice test failed, a worker was starved");
+            exit(ERR_FAIL);
+        }
+        LOG_I(TAG, "Both workers ran: %lu, %lu", counters[0] - last[0],
+              counters[1] - last[1]);
+        last[0] = counters[0];
+        last[1] = counters[1];
+    }
+}
+
+/**
+ * Testing entry point. Tests time slice scheduling
+ */
+int main() {
+    const char *TAG = "main";
+    task_config_t worker_cfg = DEFAULT_TASK_CONFIG;
+    task_config_t monitor_cfg = DEFAULT_TASK_CONFIG;
+    /* Init system */
+    system_init();
+    worker_cfg.task_priority = WORKER_PRIORITY;
+    worker_cfg.task_timeslice = WORKER_TIMESLICE;
+    worker_cfg.task_name = "Worker 0";
+    if (task_create(worker_task, (void *)&counters[0], &worker_cfg) == NULL) {
+        LOG_E(TAG, "Failed to create rtos task");
+        return ERR_FAIL;
+    }
+    worker_cfg.task_name = "Worker 1";
+    if (task_create(worker_task, (void *)&counters[1], &worker_cfg) == NULL) {
+        LOG_E(TAG, "Failed to create rtos task");
+        return ERR_FAIL;
+    }
+    monitor_cfg.task_priority = MONITOR_PRIORITY;
+    monitor_cfg.task_name = "Monitor Task";
+    if (task_create(monitor_task, NULL, &monitor_cfg) == NULL) {
+        LOG_E(TAG, "Failed to create rtos task");
+        return ERR_FAIL;
+    }
+    LOG_I(TAG, "Starting RTOS");
+    rtos_start();
+    return SYS_OK;
+}
@@ -0,0 +1,129 @@
+/**
+ * @file trace_test.c
+ * Test RTOS kernel trace
+ * A worker task pends on a semaphore that is posted from an EXTI interrupt,
+ * raised in software by the test task. The test task then pends on a
+ * semaphore that is never posted, so the pend times out, and destroys the
+ * worker. Every step is recorded in the kernel trace and sent on SWO port 1.
+ *
+ * Here is the expected output from the system log:
+ * Worker woken 5 times by interrupt
+ * Pend timed out
+ * Trace test passed
+ *
+ * Decoding the captured trace with "make decode-trace" should show, for each
+ * wakeup:
+ * ISR_ENTER    IRQ 6
+ * SEM_POST     semaphore 0x...
+ * ISR_EXIT     IRQ 6
+ * SWITCH_OUT   Test Task preempted
+ * SWITCH_IN    Worker priority ...
+ * .... (ending with a SEM_TIMEOUT and TASK_DESTROY of Worker) ......
+ */
+
+#include <stdlib.h>
+
+#include <drivers/clock/clock.h>
+#include <drivers/device/device.h>
+#include <drivers/gpio/gpio.h>
+#include <sys/semaphore/semaphore.h>
+#include <sys/task/task.h>
+#include <util/logging/logging.h>
+
+#define WAKEUPS 5
+#define PEND_TIMEOUT 10
+#define WORKER_PRIORITY (DEFAULT_PRIORITY + 1)
+
+static void test_task(void *arg);
+static void worker_task(void *arg);
+static void post_callback(void *arg);
+
+static semaphore_t wake_sem;
+static volatile int wake_count = 0;
+
+/**
+ * Initializes system
+ */
+static void system_init() {
+    clock_cfg_t clk_cfg = CLOCK_DEFAULT_CONFIG;
+    GPIO_config_t in_cfg = GPIO_DEFAULT_CONFIG;
+    clock_init(&clk_cfg);
+    in_cfg.mode = GPIO_mode_input;
+    GPIO_config(GPIO_PA0, &in_cfg);
+}
+
+/**
+ * GPIO callback. Posts to the semaphore passed as its argument
+ * @param arg: semaphore to post
+ */
+static void post_callback(void *arg) { semaphore_post((semaphore_t)arg); }
+
+/**
+ * Worker task entry point. Counts posts to the wake semaphore
+ * @param arg: unused.
+ */
+static void worker_task(void *arg) {
+    while (1) {
+        semaphore_pend(wake_sem, SYS_TIMEOUT_INF);
+        wake_count++;
+    }
+}
+
+/**
+ * Test task entry point. Wakes the worker from interrupt context, then times
+ * out on a semaphore
+ * @param arg: unused.
+ */
+static void test_task(void *arg) {
+    const char *TAG = "Test Task";
+    task_config_t cfg = DEFAULT_TASK_CONFIG;
+    task_handle_t worker;
+    semaphore_t idle_sem;
+    int i;
+    wake_sem = semaphore_create_binary();
+    idle_sem = semaphore_create_binary();
+    cfg.task_name = "Worker";
+    cfg.task_priority = WORKER_PRIORITY;
+    worker = task_create(worker_task, NULL, &cfg);
+    if (wake_sem == NULL || idle_sem == NULL || worker == NULL ||
+        GPIO_interrupt_enable(GPIO_PA0, GPIO_trig_rising, post_callback,
+                              wake_sem) != SYS_OK) {
+        LOG_E(TAG, "Trace test failed, could not create test objects");
+        exit(ERR_FAIL);
+    }
+    for (i = 0; i < WAKEUPS; i++) {
+        // The worker preempts this task as soon as the interrupt returns
+        EXTI->SWIER1 = EXTI_SWIER1_SWI0;
+        task_delay(1);
+    }
+    if (wake_count != WAKEUPS) {
+        LOG_E(TAG, "Trace test failed, worker woken %d times", wake_count);
+        exit(ERR_FAIL);
+    }
+    LOG_I(TAG, "Worker woken %d times by interrupt", wake_count);
+    if (semaphore_pend(idle_sem, PEND_TIMEOUT) != ERR_TIMEOUT) {
+        LOG_E(TAG, "Trace test failed, pend did not time out");
+        exit(ERR_FAIL);
+    }
+    LOG_I(TAG, "Pend timed out");
+    task_destroy(worker);
+    LOG_I(TAG, "Trace test passed");
+}
+
+/**
+ * Testing entry point. Tests kernel trace
+ */
+int main() {
+    const char *TAG = "main";
+    task_config_t cfg = DEFAULT_TASK_CONFIG;
+    /* Init system */
+    system_init();
+    cfg.task_name = "Test Task";
+    if (task_create(test_task, NULL, &cfg) == NULL) {
+        LOG_E(TAG, "Failed to create rtos task");
+        return ERR_FAIL;
+    }
+    LOG_I(TAG, "Starting RTOS");
+    rtos_start();
+    return SYS_OK;
+}
@@ -0,0 +1,130 @@
+/**
+ * @file workqueue_test.c
+ * Tests the work queue. A work item submitted by the test task should run in
+ * a work queue task, at the work queue priority. Submitting an item twice
+ * before it runs should only run it once, and a cancelled item should not
+ * run. Finally a work item is bound to PA1 with GPIO_interrupt_defer, and the
+ * EXTI line is raised in software. The item should run outside interrupt
+ * context.
+ *
+ * Here is the expected output from the system log:
+ * Work item ran in work queue task
+ * Repeated submission ran once
+ * Cancelled work item did not run
+ * Deferred GPIO interrupt ran in task context
+ * Workqueue test passed
+ */
+
+#include <stdlib.h>
+
+#include <drivers/clock/clock.h>
+#include <drivers/device/device.h>
+#include <drivers/gpio/gpio.h>
+#include <sys/isr/isr.h>
+#include <sys/task/task.h>
+#include <sys/workqueue/workqueue.h>
+#include <util/logging/logging.h>
+
+static void test_task(void *arg);
+static void record_work(void *arg);
+
+static volatile int work_count = 0;
+static volatile bool ran_in_isr = false;
+static task_handle_t work_task = NULL;
+static work_t work;
+
+/**
+ * Initializes system
+ */
+static void system_init() {
+    clock_cfg_t clk_cfg = CLOCK_DEFAULT_CONFIG;
+    GPIO_config_t in_cfg = GPIO_DEFAULT_CONFIG;
+    clock_init(&clk_cfg);
+    in_cfg.mode = GPIO_mode_input;
+    GPIO_config(GPIO_PA1, &in_cfg);
+}
+
+/**
+ * Work function. Records the task and context the work item ran in
+ * @param arg: unused.
+ */
+static void record_work(void *arg) {
+    work_count++;
+    work_task = get_active_task();
+    if (in_isr()) {
+        ran_in_isr = true;
+    }
+}
+
+/**
+ * Test task entry point. Submits and cancels work items
+ * @param arg: unused.
+ */
+static void test_task(void *arg) {
+    const char *TAG = "Test Task";
+    uint32_t state;
+    bool first, second;
+    if (work_init(&work, record_work, NULL) != SYS_OK) {
+        LOG_E(TAG, "Workqueue test failed, could not init work item");
+        exit(ERR_FAIL);
+    }
+    // The work queue task has a higher priority, so the item runs at once
+    work_submit(&work);
+    if (work_count != 1 || work_task == get_active_task() ||
+        task_get_priority(work_task) != WORKQUEUE_TASK_PRIORITY) {
+        LOG_E(TAG, "Workqueue test failed, work item did not run in worker");
+        exit(ERR_FAIL);
+    }
+    LOG_I(TAG, "Work item ran in work queue task");
+    // With interrupts masked, the work queue task cannot run in between
+    state = mask_irq_save();
+    first = work_submit(&work);
+    second = work_submit(&work);
+    restore_irq_mask(state);
+    if (!first || second || work_count != 2) {
+        LOG_E(TAG, "Workqueue test failed, repeated submission ran %d times",
+              work_count - 1);
+        exit(ERR_FAIL);
+    }
+    LOG_I(TAG, "Repeated submission ran once");
+    state = mask_irq_save();
+    work_submit(&work);
+    first = work_cancel(&work);
+    second = work_pending(&work);
+    restore_irq_mask(state);
+    if (!first || second || work_count != 2 || work_cancel(&work)) {
+        LOG_E(TAG, "Workqueue test failed, cancelled work item ran");
+        exit(ERR_FAIL);
+    }
+    LOG_I(TAG, "Cancelled work item did not run");
+    if (GPIO_interrupt_defer(GPIO_PA1, GPIO_trig_rising, &work) != SYS_OK) {
+        LOG_E(TAG, "Workqueue test failed, could not bind work item");
+        exit(ERR_FAIL);
+    }
+    EXTI->SWIER1 = EXTI_SWIER1_SWI1;
+    task_delay(1);
+    if (work_count != 3 || ran_in_isr) {
+        LOG_E(TAG, "Workqueue test failed, deferred interrupt did not run");
+        exit(ERR_FAIL);
+    }
+    LOG_I(TAG, "Deferred GPIO interrupt ran in task context");
+    LOG_I(TAG, "Workqueue test passed");
+}
+
+/**
+ * Testing entry point. Tests the work queue
+ */
+int main() {
+    const char *TAG = "main";
+    task_config_t cfg = DEFAULT_TASK_CONFIG;
+    /* Init system */
+    system_init();
+    cfg.task_name = "Test Task";
+    if (task_create(test_task, NULL, &cfg) == NULL) {
+        LOG_E(TAG, "Failed to create rtos task");
+        return ERR_FAIL;
+    }
+    LOG_I(TAG, "Starting RTOS");
+    rtos_start();
+    return SYS_OK;
+}
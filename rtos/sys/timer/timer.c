@@ -0,0 +1,290 @@
+/**
+ * @file timer.c
+ * Implements one shot and auto reload software timers
+ *
+ * Running timers are kept in a list sorted by expiry tick. A single timer
+ * task sleeps until the head timer expires, using the same delayed task list
+ * as task_delay, then runs the callbacks of every expired timer in one batch.
+ * Starting a timer that expires before the current head notifies the timer
+ * task, so it can sleep for the shorter time.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <sys/err.h>
+#include <sys/isr/isr.h>
+#include <sys/kmem/kmem.h>
+#include <sys/semaphore/semaphore.h>
+#include <sys/task/task.h>
+#include <util/list/ilist.h>
+#include <util/logging/logging.h>
+
+#include "timer.h"
+
+/** Notification bit used to wake the timer task */
+#define TIMER_NOTIFY_RESCHEDULE 0x1
+
+/** Internal definition of software timer structure */
+typedef struct soft_timer_state {
+    soft_timer_callback_t callback; /*!< Expiry callback */
+    void *arg;                      /*!< Callback argument */
+    uint32_t period;                /*!< Timer period, in ticks */
+    uint32_t expiry;                /*!< Tick the timer expires at */
+    uint32_t flags;                 /*!< Timer flags */
+    bool active;                    /*!< Is the timer in the active list? */
+    bool allocated;                 /*!< Was this timer allocated? */
+    ilist_node_t list_node;         /*!< Active list node */
+} soft_timer_state_t;
+
+/** Gets the timer holding an active list node */
+#define TIMER_OF(node) ilist_entry(node, soft_timer_state_t, list_node)
+
+_Static_assert(sizeof(soft_timer_state_t) <= sizeof(soft_timer_static_t),
+               "soft_timer_static_t is too small to hold a timer");
+
+static const char *TAG = "timer.c";
+/**
+ * Running timers, sorted by expiry. Only modified with interrupts masked, and
+ * initialized with the timer task.
+ */
+static ilist_t active_timers;
+static task_handle_t timer_task = NULL;
+
+// Static functions
+static soft_timer_state_t *init_timer(soft_timer_state_t *tmr,
+                                      soft_timer_callback_t callback,
+                                      void *arg, uint32_t period,
+                                      uint32_t flags, bool allocated);
+static syserr_t start_timer_task();
+static void timer_task_entry(void *arg);
+static void insert_timer(soft_timer_state_t *tmr);
+static int compare_expiry(ilist_node_t *a, ilist_node_t *b);
+
+/**
+ * Creates a new software timer. The timer is created stopped. The timer task
+ * is started when the first timer is created.
+ * @param callback: function to run when the timer expires
+ * @param arg: argument for callback. May be NULL
+ * @param period: timer period (in ms). Must be nonzero
+ * @param flags: SOFT_TIMER_ONESHOT or SOFT_TIMER_PERIODIC
+ * @return handle to created timer, or NULL on error
+ */
+soft_timer_t soft_timer_create(soft_timer_callback_t callback, void *arg,
+                               uint32_t period, uint32_t flags) {
+    soft_timer_state_t *tmr;
+    if (callback == NULL || period == 0 || start_timer_task() != SYS_OK) {
+        return NULL;
+    }
+    tmr = kmem_alloc(KMEM_SEMAPHORE, sizeof(soft_timer_state_t));
+    if (tmr == NULL) {
+        return NULL;
+    }
+    return (soft_timer_t)init_timer(tmr, callback, arg, period, flags, true);
+}
+
+/**
+ * Creates a new software timer without allocating memory.
+ * @param callback: function to run when the timer expires
+ * @param arg: argument for callback. May be NULL
+ * @param period: timer period (in ms). Must be nonzero
+ * @param flags: SOFT_TIMER_ONESHOT or SOFT_TIMER_PERIODIC
+ * @param storage: storage for timer. Must remain valid until the timer is
+ * destroyed
+ * @return handle to created timer, or NULL on error
+ */
+soft_timer_t soft_timer_create_static(soft_timer_callback_t callback,
+                                      void *arg, uint32_t period,
+                                      uint32_t flags,
+                                      soft_timer_static_t *storage) {
+    if (storage == NULL || callback == NULL || period == 0 ||
+        start_timer_task() != SYS_OK) {
+        return NULL;
+    }
+    return (soft_timer_t)init_timer((soft_timer_state_t *)storage, callback,
+                                    arg, period, flags, false);
+}
+
+/**
+ * Starts a software timer, so it expires one period from now. Restarts the
+ * timer if it is already running. Safe to call from interrupt context.
+ * @param timer: timer to start
+ */
+void soft_timer_start(soft_timer_t timer) {
+    soft_timer_state_t *tmr = (soft_timer_state_t *)timer;
+    uint32_t state = mask_irq_save();
+    if (tmr->active) {
+        ilist_remove(&tmr->list_node);
+    }
+    tmr->expiry = task_get_ticks() + tmr->period;
+    insert_timer(tmr);
+    if (ilist_head(&active_timers) == &tmr->list_node) {
+        // Timer expires first, so the timer task must wake sooner
+        task_notify(timer_task, TIMER_NOTIFY_RESCHEDULE);
+    }
+    restore_irq_mask(state);
+}
+
+/**
+ * Stops a software timer. Has no effect if the timer is stopped. Safe to call
+ * from interrupt context.
+ * @param timer: timer to stop
+ */
+void soft_timer_stop(soft_timer_t timer) {
+    soft_timer_state_t *tmr = (soft_timer_state_t *)timer;
+    uint32_t state = mask_irq_save();
+    if (tmr->active) {
+        /**
+         * The timer task is not woken. If this was the head timer, it wakes
+         * at the old expiry, finds nothing due, and sleeps again.
+         */
+        ilist_remove(&tmr->list_node);
+        tmr->active = false;
+    }
+    restore_irq_mask(state);
+}
+
+/**
+ * Checks if a software timer is running
+ * @param timer: timer to check
+ * @return true if the timer is running
+ */
+bool soft_timer_active(soft_timer_t timer) {
+    return ((soft_timer_state_t *)timer)->active;
+}
+
+/**
+ * Destroys a software timer, stopping it if it is running. May be called from
+ * the timer's own callback.
+ * @param timer: timer to destroy
+ */
+void soft_timer_destroy(soft_timer_t timer) {
+    soft_timer_state_t *tmr = (soft_timer_state_t *)timer;
+    soft_timer_stop(timer);
+    if (tmr->allocated) {
+        kmem_free(tmr);
+    }
+}
+
+/**
+ * Initializes software timer state
+ * @param tmr: timer to initialize
+ * @param callback: expiry callback
+ * @param arg: callback argument
+ * @param period: timer period, in ms
+ * @param flags: timer flags
+ * @param allocated: was the timer allocated with kmem_alloc?
+ * @return initialized timer
+ */
+static soft_timer_state_t *init_timer(soft_timer_state_t *tmr,
+                                      soft_timer_callback_t callback,
+                                      void *arg, uint32_t period,
+                                      uint32_t flags, bool allocated) {
+    tmr->callback = callback;
+    tmr->arg = arg;
+    tmr->period = period;
+    tmr->expiry = 0;
+    tmr->flags = flags;
+    tmr->active = false;
+    tmr->allocated = allocated;
+    return tmr;
+}
+
+/**
+ * Starts the timer task, if it is not running. MUST be called from a task,
+ * or before the RTOS starts.
+ * @return SYS_OK if the timer task is running, or ERR_NOMEM on failure
+ */
+static syserr_t start_timer_task() {
+    task_config_t cfg = DEFAULT_TASK_CONFIG;
+    if (timer_task != NULL) {
+        return SYS_OK;
+    }
+    // No timer exists without the timer task, so the list is empty
+    ilist_init(&active_timers);
+    cfg.task_stacksize = TIMER_TASK_STACKSIZE;
+    cfg.task_priority = TIMER_TASK_PRIORITY;
+    cfg.task_name = "timer";
+    timer_task = task_create(timer_task_entry, NULL, &cfg);
+    if (timer_task == NULL) {
+        LOG_E(TAG, "Could not create timer task");
+        return ERR_NOMEM;
+    }
+    return SYS_OK;
+}
+
+/**
+ * Timer task entry point. Runs the callbacks of expired timers, then sleeps
+ * until the next timer expires or a sooner timer is started.
+ * @param arg: unused
+ */
+static void timer_task_entry(void *arg) {
+    soft_timer_state_t *tmr;
+    soft_timer_callback_t callback;
+    void *callback_arg;
+    uint32_t state, now;
+    int delay;
+    while (1) {
+        state = mask_irq_save();
+        now = task_get_ticks();
+        while (!ilist_empty(&active_timers)) {
+            tmr = TIMER_OF(ilist_head(&active_timers));
+            if ((int32_t)(tmr->expiry - now) > 0) {
+                // Head timer is not due, so no other timer is either
+                break;
+            }
+            ilist_remove(&tmr->list_node);
+            tmr->active = false;
+            if (tmr->flags & SOFT_TIMER_PERIODIC) {
+                // Reload from the expiry tick, so the period does not drift
+                tmr->expiry += tmr->period;
+                insert_timer(tmr);
+            }
+            /**
+             * The callback may stop, restart, or destroy the timer, so it is
+             * not referenced again once the callback runs.
+             */
+            callback = tmr->callback;
+            callback_arg = tmr->arg;
+            restore_irq_mask(state);
+            callback((soft_timer_t)tmr, callback_arg);
+            state = mask_irq_save();
+            now = task_get_ticks();
+        }
+        if (ilist_empty(&active_timers)) {
+            delay = SYS_TIMEOUT_INF;
+        } else {
+            tmr = TIMER_OF(ilist_head(&active_timers));
+            delay = (int)(tmr->expiry - now);
+        }
+        restore_irq_mask(state);
+        /**
+         * A timer started after the mask is restored sets the notification,
+         * so this wait returns immediately and the list is checked again.
+         */
+        task_notify_wait(TIMER_NOTIFY_RESCHEDULE, NOTIFY_CLEAR, NULL, delay);
+    }
+}
+
+/**
+ * Inserts a timer into the active list by expiry. MUST be called with
+ * interrupts masked.
+ * @param tmr: timer to insert
+ */
+static void insert_timer(soft_timer_state_t *tmr) {
+    ilist_insert_sorted(&active_timers, &tmr->list_node, compare_expiry);
+    tmr->active = true;
+}
+
+/**
+ * Compares the expiry ticks of two timers. Used to keep the active list
+ * sorted by expiry, with timers of equal expiry kept in start order.
+ * @param a: first timer
+ * @param b: second timer
+ * @return negative value if timer a expires before timer b
+ */
+static int compare_expiry(ilist_node_t *a, ilist_node_t *b) {
+    soft_timer_state_t *tmr_a = TIMER_OF(a);
+    soft_timer_state_t *tmr_b = TIMER_OF(b);
+    return (int32_t)(tmr_a->expiry - tmr_b->expiry);
+}
@@ -0,0 +1,108 @@
+/**
+ * @file timer.h
+ * Implements one shot and auto reload software timers
+ */
+#ifndef TIMER_H
+#define TIMER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <sys/err.h>
+#include <sys/task/task.h>
+
+/**
+ * Priority of the timer task, which runs all timer callbacks. Defaults to the
+ * highest priority, so callbacks run as soon as their timer expires.
+ * Set by passing -DTIMER_TASK_PRIORITY=val
+ */
+#ifndef TIMER_TASK_PRIORITY
+#define TIMER_TASK_PRIORITY (RTOS_PRIORITY_COUNT - 1)
+#endif
+/**
+ * Stack size of the timer task. Every timer callback runs on this stack.
+ * Set by passing -DTIMER_TASK_STACKSIZE=val
+ */
+#ifndef TIMER_TASK_STACKSIZE
+#define TIMER_TASK_STACKSIZE 1024
+#endif
+
+// typedef to obscure internal definition of software timer
+typedef void *soft_timer_t;
+
+/**
+ * Storage for a statically allocated software timer. Contents are private,
+ * this type only reserves memory of the correct size.
+ */
+typedef struct soft_timer_static {
+    void *_reserved[9];
+} soft_timer_static_t;
+
+/* Software timer flags, see soft_timer_create */
+#define SOFT_TIMER_ONESHOT 0x0  /*!< Timer stops after it expires once */
+#define SOFT_TIMER_PERIODIC 0x1 /*!< Timer restarts each time it expires */
+
+/**
+ * Timer callback. Runs in the timer task, which is shared by every timer, so
+ * callbacks should be short and MUST NOT block.
+ * @param timer: timer that expired
+ * @param arg: argument passed when the timer was created
+ */
+typedef void (*soft_timer_callback_t)(soft_timer_t timer, void *arg);
+
+/**
+ * Creates a new software timer. The timer is created stopped. The timer task
+ * is started when the first timer is created.
+ * @param callback: function to run when the timer expires
+ * @param arg: argument for callback. May be NULL
+ * @param period: timer period (in ms). Must be nonzero
+ * @param flags: SOFT_TIMER_ONESHOT or SOFT_TIMER_PERIODIC
+ * @return handle to created timer, or NULL on error
+ */
+soft_timer_t soft_timer_create(soft_timer_callback_t callback, void *arg,
+                               uint32_t period, uint32_t flags);
+
+/**
+ * Creates a new software timer without allocating memory.
+ * @param callback: function to run when the timer expires
+ * @param arg: argument for callback. May be NULL
+ * @param period: timer period (in ms). Must be nonzero
+ * @param flags: SOFT_TIMER_ONESHOT or SOFT_TIMER_PERIODIC
+ * @param storage: storage for timer. Must remain valid until the timer is
+ * destroyed
+ * @return handle to created timer, or NULL on error
+ */
+soft_timer_t soft_timer_create_static(soft_timer_callback_t callback,
+                                      void *arg, uint32_t period,
+                                      uint32_t flags,
+                                      soft_timer_static_t *storage);
+
+/**
+ * Starts a software timer, so it expires one period from now. Restarts the
+ * timer if it is already running. Safe to call from interrupt context.
+ * @param timer: timer to start
+ */
+void soft_timer_start(soft_timer_t timer);
+
+/**
+ * Stops a software timer. Has no effect if the timer is stopped. Safe to call
+ * from interrupt context.
+ * @param timer: timer to stop
+ */
+void soft_timer_stop(soft_timer_t timer);
+
+/**
+ * Checks if a software timer is running
+ * @param timer: timer to check
+ * @return true if the timer is running
+ */
+bool soft_timer_active(soft_timer_t timer);
+
+/**
+ * Destroys a software timer, stopping it if it is running. May be called from
+ * the timer's own callback.
+ * @param timer: timer to destroy
+ */
+void soft_timer_destroy(soft_timer_t timer);
+
+#endif
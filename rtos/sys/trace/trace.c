@@ -0,0 +1,109 @@
+/**
+ * @file trace.c
+ * Implements a kernel event trace recorder, streamed over SWO
+ *
+ * The scheduler, semaphores, and interrupt dispatch record events into a RAM
+ * ring buffer, stamped with the DWT cycle counter. The idle task sends the
+ * buffered records to the SWO trace port, where tools/tracedecode.py turns
+ * them back into a timeline.
+ */
+#include <stdint.h>
+
+#include <config.h>
+#include <drivers/device/device.h>
+#include <drivers/swo/swo.h>
+
+#include "trace.h"
+
+#if SYS_TRACE == TRACE_ENABLED
+
+#if (SYS_TRACE_RECORDS & (SYS_TRACE_RECORDS - 1)) != 0
+#error "SYS_TRACE_RECORDS must be a power of two"
+#endif
+
+/**
+ * Records are written at trace_head with PRIMASK set, so interrupts of any
+ * priority may record events. The idle task is the only consumer, and frees
+ * records in order by advancing trace_tail.
+ */
+static trace_record_t trace_records[SYS_TRACE_RECORDS];
+static volatile uint32_t trace_head = 0;
+static volatile uint32_t trace_tail = 0;
+static uint32_t trace_drops = 0;
+static uint16_t trace_seq = 0;
+
+// Static functions
+static inline uint32_t trace_free();
+static inline void trace_put(trace_event_t event, uintptr_t object,
+                             uint8_t arg);
+
+/**
+ * Records a trace event in the trace buffer. If the buffer is full, the
+ * record is dropped. Safe to call from interrupt context.
+ * @param event: event type
+ * @param object: address of object the event applies to
+ * @param arg: event argument
+ */
+void trace_event(trace_event_t event, uintptr_t object, uint8_t arg) {
+    uint32_t primask;
+    asm volatile("mrs %0, primask\n"
+                 "cpsid i\n"
+                 : "=r"(primask)
+                 :
+                 : "memory");
+    if (trace_drops != 0 && trace_free() >= 2) {
+        // Report dropped records before the first record that fits
+        trace_put(TRACE_DROPPED, trace_drops, 0);
+        trace_drops = 0;
+    }
+    if (trace_drops == 0 && trace_free() != 0) {
+        trace_put(event, object, arg);
+    } else {
+        // Sequence numbers still advance, so the gap is visible when decoded
+        trace_drops++;
+        trace_seq++;
+    }
+    asm volatile("msr primask, %0\n" : : "r"(primask) : "memory");
+}
+
+/**
+ * Sends all records in the trace buffer to the SWO trace port. Called by the
+ * idle task, so trace data is sent when no other task needs to run.
+ */
+void trace_flush() {
+    trace_record_t *record;
+    while (trace_tail != trace_head) {
+        record = &trace_records[trace_tail & (SYS_TRACE_RECORDS - 1)];
+        SWO_writeport(SWO_PORT_TRACE, record, sizeof(trace_record_t));
+        __atomic_store_n(&trace_tail, trace_tail + 1, __ATOMIC_RELEASE);
+    }
+}
+
+/**
+ * Gets the number of free records in the trace buffer
+ * @return free record count
+ */
+static inline uint32_t trace_free() {
+    return SYS_TRACE_RECORDS - (trace_head - trace_tail);
+}
+
+/**
+ * Writes a record at the head of the trace buffer. MUST be called with
+ * interrupts disabled, and at least one record free.
+ * @param event: event type
+ * @param object: address of object the event applies to
+ * @param arg: event argument
+ */
+static inline void trace_put(trace_event_t event, uintptr_t object,
+                             uint8_t arg) {
+    trace_record_t *record;
+    record = &trace_records[trace_head & (SYS_TRACE_RECORDS - 1)];
+    record->event = (uint8_t)event;
+    record->arg = arg;
+    record->seq = trace_seq++;
+    record->cycles = DWT->CYCCNT;
+    record->object = (uint32_t)object;
+    __atomic_store_n(&trace_head, trace_head + 1, __ATOMIC_RELEASE);
+}
+
+#endif
@@ -0,0 +1,77 @@
+/**
+ * @file trace.h
+ * Implements a kernel event trace recorder, streamed over SWO
+ */
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#include <config.h>
+
+/**
+ * Trace event types. Each record carries an object address, and a one byte
+ * argument whose meaning depends on the event.
+ */
+typedef enum {
+    TRACE_TASK_SWITCH_IN = 1, /*!< Task runs. Arg is task priority */
+    TRACE_TASK_SWITCH_OUT,    /*!< Task stops running. Arg is task state */
+    TRACE_ISR_ENTER,          /*!< Object is IRQ number */
+    TRACE_ISR_EXIT,           /*!< Object is IRQ number */
+    TRACE_SEM_PEND,           /*!< Task pends on semaphore */
+    TRACE_SEM_POST,           /*!< Semaphore is posted */
+    TRACE_SEM_TIMEOUT,        /*!< Semaphore pend timed out */
+    TRACE_TASK_CREATE,        /*!< Task created. Arg is task priority */
+    TRACE_TASK_NAME,          /*!< Name of last created task. Object is name */
+    TRACE_TASK_DESTROY,       /*!< Task destroyed */
+    TRACE_DROPPED, /*!< Records were dropped. Object is count dropped */
+} trace_event_t;
+
+/**
+ * Trace record, as written to the SWO trace port. Records are sent in
+ * little endian byte order, and decoded by tools/tracedecode.py.
+ */
+typedef struct trace_record {
+    uint8_t event;   /*!< Event type (trace_event_t) */
+    uint8_t arg;     /*!< Event argument */
+    uint16_t seq;    /*!< Sequence number, counts dropped records as well */
+    uint32_t cycles; /*!< DWT cycle count when event was recorded */
+    uint32_t object; /*!< Address of the task or semaphore, or IRQ number */
+} trace_record_t;
+
+_Static_assert(sizeof(trace_record_t) == 12,
+               "tracedecode.py expects 12 byte trace records");
+
+#if SYS_TRACE == TRACE_ENABLED
+
+/**
+ * Records a trace event in the trace buffer. If the buffer is full, the
+ * record is dropped. Safe to call from interrupt context.
+ * @param event: event type
+ * @param object: address of object the event applies to
+ * @param arg: event argument
+ */
+void trace_event(trace_event_t event, uintptr_t object, uint8_t arg);
+
+/**
+ * Sends all records in the trace buffer to the SWO trace port. Called by the
+ * idle task, so trace data is sent when no other task needs to run.
+ */
+void trace_flush();
+
+#else
+
+/**
+ * Records a trace event. Has no effect unless SYS_TRACE is enabled.
+ */
+static inline void trace_event(trace_event_t event, uintptr_t object,
+                               uint8_t arg) {}
+
+/**
+ * Sends buffered trace records. Has no effect unless SYS_TRACE is enabled.
+ */
+static inline void trace_flush() {}
+
+#endif
+
+#endif
@@ -0,0 +1,161 @@
+/**
+ * @file workqueue.c
+ * Implements a work queue, for deferring interrupt work to task context
+ *
+ * Queued work items are kept in a FIFO list, and a counting semaphore counts
+ * them. Each work queue task pends on the semaphore, then takes the item at
+ * the head of the list and runs it. Interrupts only mask for the list update
+ * and semaphore post, so the work itself runs with all interrupts enabled.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <sys/err.h>
+#include <sys/isr/isr.h>
+#include <sys/semaphore/semaphore.h>
+#include <sys/task/task.h>
+#include <util/list/ilist.h>
+#include <util/logging/logging.h>
+
+#include "workqueue.h"
+
+/** Gets the work item holding a work queue list node */
+#define WORK_OF(node) ilist_entry(node, work_t, _node)
+
+static const char *TAG = "workqueue.c";
+// Queued work items, in submission order. Only modified with interrupts masked
+static ilist_t work_items;
+// Counts queued items. May count cancelled items, which workers skip
+static semaphore_t work_sem = NULL;
+static semaphore_static_t work_sem_storage;
+static task_handle_t work_tasks[WORKQUEUE_TASKS];
+
+// Static functions
+static syserr_t start_work_tasks();
+static void work_task_entry(void *arg);
+
+/**
+ * Initializes a work item. The work queue tasks are started when the first
+ * work item is initialized. MUST be called from a task, or before the RTOS
+ * starts.
+ * @param work: work item to initialize
+ * @param fn: function to run when the work item is processed
+ * @param arg: argument for fn. May be NULL
+ * @return SYS_OK on success, ERR_BADPARAM if fn is NULL, or ERR_NOMEM if the
+ * work queue tasks could not be created
+ */
+syserr_t work_init(work_t *work, work_fn_t fn, void *arg) {
+    if (work == NULL || fn == NULL) {
+        return ERR_BADPARAM;
+    }
+    work->fn = fn;
+    work->arg = arg;
+    work->_pending = false;
+    return start_work_tasks();
+}
+
+/**
+ * Queues a work item, to run in a work queue task. Only masks interrupts
+ * for a few instructions, so it is cheap to call from interrupt context.
+ * Submitting an item that is already queued has no effect, so repeated
+ * submissions before the item runs only run it once. An item may be
+ * submitted again while it runs, including from its own function.
+ * @param work: work item to queue
+ * @return true if the item was queued, or false if it was already queued
+ */
+bool work_submit(work_t *work) {
+    uint32_t state = mask_irq_save();
+    if (work->_pending) {
+        restore_irq_mask(state);
+        return false;
+    }
+    work->_pending = true;
+    ilist_append(&work_items, &work->_node);
+    semaphore_post(work_sem);
+    restore_irq_mask(state);
+    return true;
+}
+
+/**
+ * Removes a queued work item, so it does not run. Has no effect on an item
+ * that is running. Safe to call from interrupt context.
+ * @param work: work item to cancel
+ * @return true if the item was removed, or false if it was not queued
+ */
+bool work_cancel(work_t *work) {
+    uint32_t state = mask_irq_save();
+    if (!work->_pending) {
+        restore_irq_mask(state);
+        return false;
+    }
+    /**
+     * The semaphore is not decremented. The worker it wakes finds one less
+     * item in the list, and pends again.
+     */
+    ilist_remove(&work->_node);
+    work->_pending = false;
+    restore_irq_mask(state);
+    return true;
+}
+
+/**
+ * Starts the work queue tasks, if they are not running. MUST be called from
+ * a task, or before the RTOS starts.
+ * @return SYS_OK if the work queue tasks are running, or ERR_NOMEM on failure
+ */
+static syserr_t start_work_tasks() {
+    task_config_t cfg = DEFAULT_TASK_CONFIG;
+    int i;
+    if (work_sem == NULL) {
+        ilist_init(&work_items);
+        work_sem = semaphore_create_counting_static(0, &work_sem_storage);
+    }
+    cfg.task_stacksize = WORKQUEUE_TASK_STACKSIZE;
+    cfg.task_priority = WORKQUEUE_TASK_PRIORITY;
+    cfg.task_name = "workqueue";
+    for (i = 0; i < WORKQUEUE_TASKS; i++) {
+        if (work_tasks[i] != NULL) {
+            continue;
+        }
+        work_tasks[i] = task_create(work_task_entry, NULL, &cfg);
+        if (work_tasks[i] == NULL) {
+            LOG_E(TAG, "Could not create work queue task");
+            return ERR_NOMEM;
+        }
+    }
+    return SYS_OK;
+}
+
+/**
+ * Work queue task entry point. Runs queued work items in submission order
+ * @param arg: unused
+ */
+static void work_task_entry(void *arg) {
+    work_t *work;
+    ilist_node_t *node;
+    work_fn_t fn;
+    void *fn_arg;
+    uint32_t state;
+    while (1) {
+        semaphore_pend(work_sem, SYS_TIMEOUT_INF);
+        state = mask_irq_save();
+        node = ilist_head(&work_items);
+        if (node == NULL) {
+            // The item this post counted was cancelled
+            restore_irq_mask(state);
+            continue;
+        }
+        ilist_remove(node);
+        work = WORK_OF(node);
+        /**
+         * The item is no longer queued, so it may be submitted again (or
+         * freed) while its function runs. It is not referenced once the
+         * function runs.
+         */
+        work->_pending = false;
+        fn = work->fn;
+        fn_arg = work->arg;
+        restore_irq_mask(state);
+        fn(fn_arg);
+    }
+}
@@ -0,0 +1,100 @@
+/**
+ * @file workqueue.h
+ * Implements a work queue, for deferring interrupt work to task context
+ */
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include <stdbool.h>
+
+#include <sys/err.h>
+#include <sys/task/task.h>
+#include <util/list/ilist.h>
+
+/**
+ * Priority of the work queue tasks, which run all work items. Defaults to the
+ * highest priority, so deferred interrupt work runs as soon as the interrupt
+ * returns.
+ * Set by passing -DWORKQUEUE_TASK_PRIORITY=val
+ */
+#ifndef WORKQUEUE_TASK_PRIORITY
+#define WORKQUEUE_TASK_PRIORITY (RTOS_PRIORITY_COUNT - 1)
+#endif
+/**
+ * Stack size of each work queue task. Every work item runs on one of these
+ * stacks.
+ * Set by passing -DWORKQUEUE_TASK_STACKSIZE=val
+ */
+#ifndef WORKQUEUE_TASK_STACKSIZE
+#define WORKQUEUE_TASK_STACKSIZE 1024
+#endif
+/**
+ * Number of work queue tasks. Each task takes the next queued work item, so
+ * with more than one task a work item that blocks does not delay the others.
+ * Set by passing -DWORKQUEUE_TASKS=val
+ */
+#ifndef WORKQUEUE_TASKS
+#define WORKQUEUE_TASKS 1
+#endif
+#if WORKQUEUE_TASKS < 1
+#error "WORKQUEUE_TASKS must be at least 1"
+#endif
+
+/**
+ * Work function. Runs in a work queue task, so it may call any RTOS function,
+ * but should not block for long if WORKQUEUE_TASKS is 1.
+ * @param arg: argument given to work_init
+ */
+typedef void (*work_fn_t)(void *arg);
+
+/**
+ * Work item. Owned by the caller, and MUST remain valid while it is queued.
+ * Initialize it with work_init. Fields starting with an underscore are
+ * private.
+ */
+typedef struct work {
+    work_fn_t fn;       /*!< Function to run */
+    void *arg;          /*!< Argument for fn */
+    bool _pending;      /*!< Is the item queued? */
+    ilist_node_t _node; /*!< Work queue list node */
+} work_t;
+
+/**
+ * Initializes a work item. The work queue tasks are started when the first
+ * work item is initialized. MUST be called from a task, or before the RTOS
+ * starts.
+ * @param work: work item to initialize
+ * @param fn: function to run when the work item is processed
+ * @param arg: argument for fn. May be NULL
+ * @return SYS_OK on success, ERR_BADPARAM if fn is NULL, or ERR_NOMEM if the
+ * work queue tasks could not be created
+ */
+syserr_t work_init(work_t *work, work_fn_t fn, void *arg);
+
+/**
+ * Queues a work item, to run in a work queue task. Only masks interrupts
+ * for a few instructions, so it is cheap to call from interrupt context.
+ * Submitting an item that is already queued has no effect, so repeated
+ * submissions before the item runs only run it once. An item may be
+ * submitted again while it runs, including from its own function.
+ * @param work: work item to queue
+ * @return true if the item was queued, or false if it was already queued
+ */
+bool work_submit(work_t *work);
+
+/**
+ * Removes a queued work item, so it does not run. Has no effect on an item
+ * that is running. Safe to call from interrupt context.
+ * @param work: work item to cancel
+ * @return true if the item was removed, or false if it was not queued
+ */
+bool work_cancel(work_t *work);
+
+/**
+ * Checks if a work item is queued
+ * @param work: work item to check
+ * @return true if the item is queued and has not started running
+ */
+static inline bool work_pending(work_t *work) { return work->_pending; }
+
+#endif
@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+"""
+Decodes tokenized RTOS log output (built with -DSYSLOG_TOKENIZED=1).
+
+Log output is a mix of plain text and binary records. Each record is:
+    0xFF, nargs (1 byte), token (u32), tag address (u32), nargs * u32 args
+with all words little endian. The token is the offset of the format string in
+the .logstr section of the program ELF file. The first character of each
+format string is the log level.
+
+Usage: logdecode.py <program.elf> [captured log file]
+Reads log output from stdin if no log file is given.
+"""
+
+import re
+import struct
+import sys
+
+SYNC = 0xFF
+SHF_ALLOC = 0x2
+SHT_NOBITS = 8
+LEVELS = {"0": "DEBUG", "1": "INFO", "2": "WARNING", "3": "ERROR"}
+# printf conversion: flags, width, precision, length, conversion
+CONVERSION = re.compile(
+    r"%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d+))?(hh|h|l|z|t)?([diouxXcsp%])")
+
+
+class Elf:
+    """Minimal 32 bit little endian ELF reader"""
+
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.data = f.read()
+        if self.data[:4] != b"\x7fELF" or self.data[4] != 1:
+            raise ValueError("%s is not a 32 bit ELF file" % path)
+        shoff, = struct.unpack_from("<I", self.data, 0x20)
+        shentsize, shnum, shstrndx = struct.unpack_from("<HHH", self.data,
+                                                        0x2E)
+        headers = [
+            struct.unpack_from("<IIIIIIIIII", self.data, shoff + i * shentsize)
+            for i in range(shnum)
+        ]
+        names = headers[shstrndx][4]
+        self.sections = []
+        for hdr in headers:
+            name = self.cstring(names + hdr[0])
+            self.sections.append({
+                "name": name,
+                "type": hdr[1],
+                "flags": hdr[2],
+                "addr": hdr[3],
+                "offset": hdr[4],
+                "size": hdr[5],
+            })
+
+    def cstring(self, offset):
+        end = self.data.index(b"\0", offset)
+        return self.data[offset:end].decode("utf-8", "replace")
+
+    def section(self, name):
+        for sec in self.sections:
+            if sec["name"] == name:
+                return sec
+        raise ValueError("ELF file has no %s section. Was it built with "
+                         "-DSYSLOG_TOKENIZED=1?" % name)
+
+    def string_at(self, addr):
+        """Reads a string from a loaded section, or returns None"""
+        for sec in self.sections:
+            if (sec["flags"] & SHF_ALLOC and sec["type"] != SHT_NOBITS and
+                    sec["addr"] <= addr < sec["addr"] + sec["size"]):
+                return self.cstring(sec["offset"] + addr - sec["addr"])
+        return None
+
+
+def format_args(elf, fmt, args):
+    """Formats a printf style string with raw 32 bit arguments"""
+    args = list(args)
+    out = []
+    pos = 0
+
+    def next_arg():
+        return args.pop(0) if args else 0
+
+    for match in CONVERSION.finditer(fmt):
+        out.append(fmt[pos:match.start()])
+        pos = match.end()
+        flags, width, prec, length, conv = match.groups()
+        if conv == "%":
+            out.append("%")
+            continue
+        if width == "*":
+            width = str(struct.unpack("<i", struct.pack("<I", next_arg()))[0])
+        if prec == "*":
+            prec = str(next_arg())
+        spec = "%" + flags + (width or "") + ("." + prec if prec else "")
+        value = next_arg()
+        if length == "hh":
+            value &= 0xFF
+        elif length == "h":
+            value &= 0xFFFF
+        if conv in "di":
+            bits = 8 if length == "hh" else 16 if length == "h" else 32
+            if value & (1 << (bits - 1)):
+                value -= 1 << bits
+            out.append((spec + "d") % value)
+        elif conv == "u":
+            out.append((spec + "d") % value)
+        elif conv in "oxX":
+            out.append((spec + conv) % value)
+        elif conv == "c":
+            out.append((spec + "c") % chr(value & 0xFF))
+        elif conv == "p":
+            out.append((spec + "s") % ("0x%08x" % value))
+        elif conv == "s":
+            string = elf.string_at(value)
+            if string is None:
+                string = "<0x%08x>" % value
+            out.append((spec + "s") % string)
+    out.append(fmt[pos:])
+    return "".join(out)
+
+
+def decode(elf, stream, output):
+    logstr = elf.section(".logstr")
+    buf = b""
+    while True:
+        chunk = stream.read1(1024) if hasattr(stream, "read1") else \
+            stream.read(1024)
+        if not chunk:
+            break
+        buf += chunk
+        while buf:
+            if buf[0] != SYNC:
+                # Plain text, up to the next record
+                end = buf.find(bytes([SYNC]))
+                if end < 0:
+                    end = len(buf)
+                output.write(buf[:end].decode("utf-8", "replace"))
+                buf = buf[end:]
+                continue
+            if len(buf) < 2:
+                break
+            nargs = buf[1]
+            size = 10 + 4 * nargs
+            if len(buf) < size:
+                break
+            token, tag = struct.unpack_from("<II", buf, 2)
+            args = struct.unpack_from("<%dI" % nargs, buf, 10)
+            buf = buf[size:]
+            if token >= logstr["size"]:
+                output.write("<bad log token 0x%x>\n" % token)
+                continue
+            fmt = elf.cstring(logstr["offset"] + token)
+            tag_str = elf.string_at(tag) or "<0x%08x>" % tag
+            output.write("%s [%s]: %s\n" % (tag_str, LEVELS.get(
+                fmt[:1], "LOG"), format_args(elf, fmt[1:], args)))
+        output.flush()
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        sys.stderr.write(__doc__)
+        return 1
+    elf = Elf(sys.argv[1])
+    if len(sys.argv) == 3:
+        with open(sys.argv[2], "rb") as stream:
+            decode(elf, stream, sys.stdout)
+    else:
+        decode(elf, sys.stdin.buffer, sys.stdout)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,127 @@
+#!/usr/bin/env python3
+"""
+Decodes RTOS kernel trace output (built with -DSYS_TRACE=1).
+
+Trace output is the data sent on SWO stimulus port 1, as a stream of 12 byte
+records:
+    event (u8), arg (u8), sequence number (u16), cycle count (u32), object (u32)
+with all fields little endian. Task names are read from the program ELF file,
+using the name address recorded when each task is created.
+
+Usage: tracedecode.py [-f core_hz] <program.elf> [captured trace file]
+Reads trace output from stdin if no trace file is given. Timestamps are shown
+in microseconds, assuming the core runs at core_hz (80 MHz by default).
+"""
+
+import argparse
+import struct
+import sys
+
+from logdecode import Elf
+
+RECORD = struct.Struct("<BBHII")
+EVENTS = {
+    1: "SWITCH_IN",
+    2: "SWITCH_OUT",
+    3: "ISR_ENTER",
+    4: "ISR_EXIT",
+    5: "SEM_PEND",
+    6: "SEM_POST",
+    7: "SEM_TIMEOUT",
+    8: "TASK_CREATE",
+    9: "TASK_NAME",
+    10: "TASK_DESTROY",
+    11: "DROPPED",
+}
+# Task states, from task_state_t in task.c. Active tasks were preempted
+STATES = {0: "exited", 1: "delayed", 2: "blocked", 3: "ready", 4: "preempted"}
+
+
+class Decoder:
+    """Turns trace records into timeline lines"""
+
+    def __init__(self, elf, freq, output):
+        self.elf = elf
+        self.freq = freq
+        self.output = output
+        self.names = {}
+        self.last_created = None
+        self.last_cycles = None
+        self.last_seq = None
+        self.elapsed = 0
+
+    def task(self, addr):
+        return self.names.get(addr, "task@0x%08x" % addr)
+
+    def record(self, event, arg, seq, cycles, obj):
+        # The cycle counter wraps every 2^32 cycles, so only deltas are used
+        if self.last_cycles is not None:
+            self.elapsed += (cycles - self.last_cycles) & 0xFFFFFFFF
+        self.last_cycles = cycles
+        # Dropped records also advance the sequence, and are reported below
+        if (self.last_seq is not None and event != 11 and
+                seq != (self.last_seq + 1) & 0xFFFF):
+            self.output.write("<%d records lost>\n" %
+                              ((seq - self.last_seq - 1) & 0xFFFF))
+        self.last_seq = seq
+        name = EVENTS[event]
+        if event == 9:
+            # Name record follows the create record of the same task
+            string = self.elf.string_at(obj)
+            if self.last_created is not None and string is not None:
+                self.names[self.last_created] = string or "<unnamed>"
+            return
+        if event in (1, 2, 8, 10):
+            detail = self.task(obj)
+            if event == 1 or event == 8:
+                detail += " priority %d" % arg
+            elif event == 2:
+                detail += " %s" % STATES.get(arg, "state %d" % arg)
+            if event == 8:
+                self.last_created = obj
+            elif event == 10:
+                self.names.pop(obj, None)
+        elif event in (3, 4):
+            detail = "IRQ %d" % obj
+        elif event == 11:
+            detail = "%d records dropped" % obj
+        else:
+            detail = "semaphore 0x%08x" % obj
+        self.output.write("%14.3f us  %-12s %s\n" %
+                          (self.elapsed * 1e6 / self.freq, name, detail))
+
+    def decode(self, stream):
+        buf = b""
+        while True:
+            chunk = stream.read1(1024) if hasattr(stream, "read1") else \
+                stream.read(1024)
+            if not chunk:
+                break
+            buf += chunk
+            while len(buf) >= RECORD.size:
+                if buf[0] not in EVENTS:
+                    # Capture started mid record, skip to the next event
+                    buf = buf[1:]
+                    continue
+                self.record(*RECORD.unpack_from(buf))
+                buf = buf[RECORD.size:]
+            self.output.flush()
+
+
+def main():
+    parser = argparse.ArgumentParser(usage=__doc__)
+    parser.add_argument("-f", "--freq", type=float, default=80e6)
+    parser.add_argument("elf")
+    parser.add_argument("trace", nargs="?")
+    args = parser.parse_args()
+    decoder = Decoder(Elf(args.elf), args.freq, sys.stdout)
+    if args.trace:
+        with open(args.trace, "rb") as stream:
+            decoder.decode(stream)
+    else:
+        decoder.decode(sys.stdin.buffer)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
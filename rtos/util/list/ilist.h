@@ -0,0 +1,180 @@
+/**
+ * @file ilist.h
+ * Implements an inline intrusive doubly linked list
+ * Each list has a sentinel head node, so no operation needs to handle an empty
+ * list or an end of list specially. Each element embeds an ilist_node_t, and
+ * ilist_entry recovers the element from its node. Every operation is inline
+ * and takes constant time, except ilist_insert_sorted.
+ *
+ * For example, this structure would store well in the list:
+ * struct example {
+ *      void *data;
+ *      ilist_node_t node;
+ * };
+ *
+ * These calls would create a list with "ex" as the only member, then visit
+ * each element of the list:
+ * ilist_t alist;
+ * ilist_node_t *pos;
+ * struct example ex;
+ * ilist_init(&alist);
+ * ilist_append(&alist, &ex.node);
+ * ilist_for_each(pos, &alist) {
+ *      struct example *elem = ilist_entry(pos, struct example, node);
+ * }
+ */
+
+#ifndef ILIST_H
+#define ILIST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+ * Gets a pointer to the structure containing a member
+ * @param ptr: pointer to the member
+ * @param type: type of the containing structure
+ * @param member: name of the member within the structure
+ */
+#define container_of(ptr, type, member)                                        \
+    ((type *)((char *)(ptr)-offsetof(type, member)))
+
+/**
+ * List node, embedded in each list element. Do NOT manipulate these fields.
+ */
+typedef struct ilist_node {
+    struct ilist_node *next;
+    struct ilist_node *prev;
+} ilist_node_t;
+
+/**
+ * List head. The sentinel node links to the first and last elements, and
+ * points to itself when the list is empty.
+ */
+typedef struct ilist {
+    ilist_node_t head;
+} ilist_t;
+
+/**
+ * Gets the list element containing a node
+ * @param node: list node
+ * @param type: type of the list element
+ * @param member: name of the ilist_node_t member within the element
+ */
+#define ilist_entry(node, type, member) container_of(node, type, member)
+
+/**
+ * Iterates over each node in a list. The current node MUST NOT be removed
+ * @param pos: ilist_node_t pointer, set to each node in turn
+ * @param list: list to iterate over
+ */
+#define ilist_for_each(pos, list)                                              \
+    for ((pos) = (list)->head.next; (pos) != &(list)->head; (pos) = (pos)->next)
+
+/**
+ * Iterates over each node in a list. The current node may be removed
+ * @param pos: ilist_node_t pointer, set to each node in turn
+ * @param tmp: ilist_node_t pointer, used to hold the next node
+ * @param list: list to iterate over
+ */
+#define ilist_for_each_safe(pos, tmp, list)                                    \
+    for ((pos) = (list)->head.next, (tmp) = (pos)->next;                       \
+         (pos) != &(list)->head; (pos) = (tmp), (tmp) = (pos)->next)
+
+/**
+ * Initializes a list as empty
+ * @param list: list to initialize
+ */
+static inline void ilist_init(ilist_t *list) {
+    list->head.next = &list->head;
+    list->head.prev = &list->head;
+}
+
+/**
+ * Checks if a list is empty
+ * @param list: list to check
+ * @return true if the list has no elements
+ */
+static inline bool ilist_empty(const ilist_t *list) {
+    return list->head.next == &list->head;
+}
+
+/**
+ * Inserts a node before another node in a list
+ * @param pos: node to insert before. May be the list sentinel
+ * @param node: node to insert. MUST not be in a list
+ */
+static inline void ilist_insert_before(ilist_node_t *pos, ilist_node_t *node) {
+    node->next = pos;
+    node->prev = pos->prev;
+    pos->prev->next = node;
+    pos->prev = node;
+}
+
+/**
+ * Appends a node to a list
+ * @param list: list to append to
+ * @param node: node to append. MUST not be in a list
+ */
+static inline void ilist_append(ilist_t *list, ilist_node_t *node) {
+    ilist_insert_before(&list->head, node);
+}
+
+/**
+ * Prepends a node to a list
+ * @param list: list to prepend to
+ * @param node: node to prepend. MUST not be in a list
+ */
+static inline void ilist_prepend(ilist_t *list, ilist_node_t *node) {
+    ilist_insert_before(list->head.next, node);
+}
+
+/**
+ * Removes a node from the list it is in. The list itself is not needed.
+ * @param node: node to remove. MUST be in a list
+ */
+static inline void ilist_remove(ilist_node_t *node) {
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+}
+
+/**
+ * Gets the first node of a list without removing it
+ * @param list: list to get head of
+ * @return first node, or NULL if the list is empty
+ */
+static inline ilist_node_t *ilist_head(const ilist_t *list) {
+    return ilist_empty(list) ? NULL : list->head.next;
+}
+
+/**
+ * Gets the last node of a list without removing it
+ * @param list: list to get tail of
+ * @return last node, or NULL if the list is empty
+ */
+static inline ilist_node_t *ilist_tail(const ilist_t *list) {
+    return ilist_empty(list) ? NULL : list->head.prev;
+}
+
+/**
+ * Inserts a node into a sorted list. The node is placed before the first
+ * node that sorts after it, so nodes that compare equal keep insertion
+ * order. The tail is checked first, so appending in order costs O(1). The
+ * comparison is inlined when "cmp" is a known function.
+ * @param list: sorted list to insert into
+ * @param node: node to insert. MUST not be in a list
+ * @param cmp: comparison function. Should return a negative value if its
+ * first argument sorts before its second, or zero/positive otherwise
+ */
+static inline void ilist_insert_sorted(ilist_t *list, ilist_node_t *node,
+                                       int (*cmp)(ilist_node_t *,
+                                                  ilist_node_t *)) {
+    ilist_node_t *pos = list->head.prev;
+    // Walk back from the tail to the last node that does not sort after node
+    while (pos != &list->head && cmp(node, pos) < 0) {
+        pos = pos->prev;
+    }
+    ilist_insert_before(pos->next, node);
+}
+
+#endif
@@ -35,6 +35,48 @@ list_t list_append(list_t list, void *elem, list_state_t *state) {
 list_t list_prepend(list_t list, void *elem, list_state_t *state) {
     return list_add(list, elem, state, true);
 }
+
+/**
+ * Inserts element into a sorted list. The element is placed before the first
+ * entry that sorts after it, so entries that compare equal keep insertion
+ * order. The tail is checked first, so appending in order costs O(1).
+ * @param list: Sorted list to insert into (if NULL, new list is created)
+ * @param elem: element to insert into list
+ * @param state: list element state. Should be associated with elem.
+ * @param cmp: comparison function. Should return a negative value if its
+ * first argument sorts before its second, or zero/positive otherwise
+ * @return new list on success, or NULL on error
+ */
+list_t list_insert_sorted(list_t list, void *elem, list_state_t *state,
+                          int (*cmp)(void *, void *)) {
+    list_state_t *head, *current;
+    // Check parameters
+    if (state == NULL || elem == NULL || cmp == NULL) {
+        return NULL;
+    }
+    if (list == NULL) {
+        return list_add(list, elem, state, false);
+    }
+    head = (list_state_t *)list;
+    // If element does not sort before the tail, it belongs at the end
+    if (cmp(elem, head->_prev->_container) >= 0) {
+        return list_add(list, elem, state, false);
+    }
+    // Find the first entry that sorts after the element
+    current = head;
+    while (cmp(elem, current->_container) >= 0) {
+        current = current->_next;
+    }
+    // Insert the element before current
+    state->_container = elem;
+    state->_next = current;
+    state->_prev = current->_prev;
+    current->_prev->_next = state;
+    current->_prev = state;
+    // If the element was inserted before the head, it is the new head
+    return current == head ? state : head;
+}
+
 /**
  * Iterates through linked list. If iterator function returns LST_BRK,
  * iteration will cease at that list element
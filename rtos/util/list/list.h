@@ -61,6 +61,20 @@ list_t list_append(list_t list, void *elem, list_state_t *state);
  */
 list_t list_prepend(list_t list, void *elem, list_state_t *state);
 
+/**
+ * Inserts element into a sorted list. The element is placed before the first
+ * entry that sorts after it, so entries that compare equal keep insertion
+ * order. The tail is checked first, so appending in order costs O(1).
+ * @param list: Sorted list to insert into (if NULL, new list is created)
+ * @param elem: element to insert into list
+ * @param state: list element state. Should be associated with elem.
+ * @param cmp: comparison function. Should return a negative value if its
+ * first argument sorts before its second, or zero/positive otherwise
+ * @return new list on success, or NULL on error
+ */
+list_t list_insert_sorted(list_t list, void *elem, list_state_t *state,
+                          int (*cmp)(void *, void *));
+
 /**
  * Iterates through linked list. If iterator function returns LST_BRK,
  * iteration will cease at that list element
@@ -1,172 +1,484 @@
-
 /**
  * @file logging.c
  * Implements system logging facilities
  */
 #include <stdarg.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 
 #include <config.h>
+#include <sys/isr/isr.h>
+#include <sys/semaphore/semaphore.h>
+#include <sys/task/task.h>
 
 #include "logging.h"
 
 #if SYSLOG == SYSLOG_DISABLED
-/** Define all functions as stubs to minimize code size */
-void LOG_D(const char *tag, char *format, ...) {
+/**
+ * Define all functions as stubs to minimize code size. Log calls are removed
+ * at compile time, so these are never called.
+ */
+void log_printf(int log_level, const char *tag, const char *format, ...) {
+    (void)log_level;
     (void)tag;
     (void)format;
 }
 
-void LOG_I(const char *tag, char *format, ...) {
+void log_min(int log_level, const char *tag, const char *logstr) {
+    (void)log_level;
     (void)tag;
-    (void)format;
+    (void)logstr;
 }
 
-void LOG_W(const char *tag, char *format, ...) {
+void log_token(const char *token, const char *tag, int nargs, ...) {
+    (void)token;
     (void)tag;
-    (void)format;
+    (void)nargs;
 }
 
-void LOG_E(const char *tag, char *format, ...) {
-    (void)tag;
-    (void)format;
-}
+void LOG_flush() {}
+
+uint32_t LOG_dropped() { return 0; }
+
+void LOG_deferred_init() {}
+
+#else
+
+#define LOG_RECORD_ARGS 4 // Maximum number of arguments stored in a record
 
 /**
- * Minimal system log. Useful for tasks with small stacks, or other low memory
- * environments. Does not implement printf style formatting.
- * @param log_level: logging level to use
- * @param tag: Tag to log (NULL terminated)
- * @param logstr: NULL terminated log string
+ * Tokenized log record header. Marks the start of a binary record in the log
+ * output. Never occurs in UTF-8 text.
  */
-void LOG_MIN(int log_level, const char *tag, const char *logstr) {
-    (void)log_level;
-    (void)tag;
-    (void)logstr;
-}
+#define LOG_TOKEN_SYNC 0xFF
 
-#else
+static void log_header(int log_level, const char *tag);
+static void log_write_token(const char *token, const char *tag, int nargs,
+                            uint32_t *args);
+
+#if SYSLOG_DEFERRED == SYSLOG_DEFERRED_ENABLED
 
-static void syslog(int log_level, const char *tag, char *format, va_list ap);
+#if (SYSLOG_DEFERRED_RECORDS & (SYSLOG_DEFERRED_RECORDS - 1)) != 0
+#error "SYSLOG_DEFERRED_RECORDS must be a power of two"
+#endif
+
+#define LOG_TASK_PRIORITY (IDLE_TASK_PRIORITY + 1)
+
+/**
+ * Deferred log record types
+ */
+typedef enum {
+    LOG_RECORD_FORMAT, /*!< Format string is printed with arguments */
+    LOG_RECORD_RAW,    /*!< Format string is printed verbatim */
+    LOG_RECORD_TOKEN,  /*!< Format string is a token, written as binary */
+} log_record_type_t;
+
+/**
+ * Deferred log record. Holds everything needed to format a log call later.
+ */
+typedef struct log_record {
+    const char *tag;                /*!< Log tag */
+    const char *format;             /*!< printf style format string */
+    uint32_t args[LOG_RECORD_ARGS]; /*!< Raw format arguments */
+    uint32_t timestamp;             /*!< System tick of log call */
+    uint8_t level;                  /*!< Log level */
+    uint8_t type;                   /*!< Record type (log_record_type_t) */
+    uint8_t nargs;                  /*!< Number of format arguments */
+    volatile uint8_t ready;         /*!< Record is complete */
+} log_record_t;
 
 /**
- * System debugging log. Uses same format as printf
+ * Records are claimed by advancing log_head with a compare and swap, so any
+ * task or interrupt may log without masking interrupts. Each record is marked
+ * ready once written. The log task is the only consumer, and frees records in
+ * order by advancing log_tail.
+ */
+static log_record_t log_records[SYSLOG_DEFERRED_RECORDS];
+static volatile uint32_t log_head = 0;
+static volatile uint32_t log_tail = 0;
+static volatile uint32_t log_drops = 0;
+static uint32_t log_drops_reported = 0;
+
+static semaphore_t log_sem = NULL;
+static semaphore_static_t log_sem_storage;
+static task_handle_t log_task = NULL;
+static task_static_t log_task_storage;
+static char log_task_stack[SYSLOG_DEFERRED_STACKSIZE]
+    __attribute__((aligned(8)));
+
+static bool log_defer(int log_level, const char *tag, const char *format,
+                      log_record_type_t type, int nargs, uint32_t *args);
+static int log_capture_args(const char *format, va_list *ap, uint32_t *args);
+static void log_print_record(log_record_t *record);
+static void log_drain();
+static void log_task_entry(void *arg);
+
+#endif
+
+/**
+ * Writes a formatted log message. Use the LOG_* macros instead of calling
+ * this directly.
+ * @param log_level: logging level of message
  * @param tag: logging tag
  * @param format: printf style formatting string
  */
-void LOG_D(const char *tag, char *format, ...) {
+void log_printf(int log_level, const char *tag, const char *format, ...) {
     va_list valist;
+#if SYSLOG_DEFERRED == SYSLOG_DEFERRED_ENABLED
+    uint32_t args[LOG_RECORD_ARGS];
+    int nargs;
+    if (rtos_started()) {
+        va_start(valist, format);
+        nargs = log_capture_args(format, &valist, args);
+        va_end(valist);
+        if (nargs >= 0 && log_defer(log_level, tag, format, LOG_RECORD_FORMAT,
+                                    nargs, args)) {
+            return;
+        }
+    }
+#endif
+    log_header(log_level, tag);
     // Start valist with format as last argument
     va_start(valist, format);
-    syslog(SYSLOG_LEVEL_DEBUG, tag, format, valist);
+    // Log message
+    vprintf(format, valist);
     // Free valist
     va_end(valist);
+    // Print newline
+    printf("\n");
 }
 
 /**
- * System info log. Uses same format as printf
- * @param tag: logging tag
- * @param format: printf style formatting string
+ * Writes a log message without formatting. Use LOG_MIN instead of calling
+ * this directly.
+ * @param log_level: logging level of message
+ * @param tag: Tag to log (NULL terminated)
+ * @param logstr: NULL terminated log string
  */
-void LOG_I(const char *tag, char *format, ...) {
-    va_list valist;
-    // Start valist with format as last argument
-    va_start(valist, format);
-    syslog(SYSLOG_LEVEL_INFO, tag, format, valist);
-    // Free valist
-    va_end(valist);
+void log_min(int log_level, const char *tag, const char *logstr) {
+#if SYSLOG_DEFERRED == SYSLOG_DEFERRED_ENABLED
+    if (rtos_started() &&
+        log_defer(log_level, tag, logstr, LOG_RECORD_RAW, 0, NULL)) {
+        return;
+    }
+#endif
+    // Log tag and level
+    write(STDOUT_FILENO, tag, strlen(tag));
+    switch (log_level) {
+    case SYSLOG_LEVEL_DEBUG:
+        write(STDOUT_FILENO, " [DEBUG]: ", 10);
+        break;
+    case SYSLOG_LEVEL_INFO:
+        write(STDOUT_FILENO, " [INFO]: ", 9);
+        break;
+    case SYSLOG_LEVEL_WARNING:
+        write(STDOUT_FILENO, " [WARNING]: ", 12);
+        break;
+    case SYSLOG_LEVEL_ERROR:
+        write(STDOUT_FILENO, " [ERROR]: ", 10);
+        break;
+    default:
+        write(STDOUT_FILENO, " [LOG]: ", 8);
+        break;
+    }
+    // Log logging string
+    write(STDOUT_FILENO, logstr, strlen(logstr));
+    // Write newline
+    write(STDOUT_FILENO, "\n", 1);
 }
 
 /**
- * System warning log. Uses same format as printf
+ * Writes a tokenized log record. Use the LOG_* macros instead of calling this
+ * directly.
+ * @param token: format string, stored in the .logstr section
  * @param tag: logging tag
- * @param format: printf style formatting string
+ * @param nargs: number of format arguments. Each must be 32 bits
  */
-void LOG_W(const char *tag, char *format, ...) {
+void log_token(const char *token, const char *tag, int nargs, ...) {
     va_list valist;
-    // Start valist with format as last argument
-    va_start(valist, format);
-    syslog(SYSLOG_LEVEL_WARNING, tag, format, valist);
-    // Free valist
+    uint32_t args[LOG_MAX_ARGS];
+    int i;
+    va_start(valist, nargs);
+    for (i = 0; i < nargs; i++) {
+        args[i] = va_arg(valist, uint32_t);
+    }
     va_end(valist);
+#if SYSLOG_DEFERRED == SYSLOG_DEFERRED_ENABLED
+    if (rtos_started() && nargs <= LOG_RECORD_ARGS &&
+        log_defer(0, tag, token, LOG_RECORD_TOKEN, nargs, args)) {
+        return;
+    }
+#endif
+    log_write_token(token, tag, nargs, args);
+}
+
+/**
+ * Prints the tag and level prefix of a log message
+ * @param log_level: logging level of message
+ * @param tag: logging tag of message
+ */
+static void log_header(int log_level, const char *tag) {
+    switch (log_level) {
+    case SYSLOG_LEVEL_DEBUG:
+        printf("%s [DEBUG]: ", tag);
+        break;
+    case SYSLOG_LEVEL_INFO:
+        printf("%s [INFO]: ", tag);
+        break;
+    case SYSLOG_LEVEL_WARNING:
+        printf("%s [WARNING]: ", tag);
+        break;
+    case SYSLOG_LEVEL_ERROR:
+        printf("%s [ERROR]: ", tag);
+        break;
+    default:
+        printf("%s [LOG]: ", tag);
+        break;
+    }
 }
 
 /**
- * System error log. Uses same format as printf
+ * Writes a binary tokenized log record. The record is the sync byte, the
+ * argument count, the token (offset of the format string in .logstr), the
+ * tag address, then each argument. All words are little endian.
+ * @param token: format string, stored in the .logstr section
  * @param tag: logging tag
- * @param format: printf style formatting string
+ * @param nargs: number of format arguments
+ * @param args: format arguments
  */
-void LOG_E(const char *tag, char *format, ...) {
-    va_list valist;
-    // Start valist with format as last argument
-    va_start(valist, format);
-    syslog(SYSLOG_LEVEL_ERROR, tag, format, valist);
-    // Free valist
-    va_end(valist);
+static void log_write_token(const char *token, const char *tag, int nargs,
+                            uint32_t *args) {
+    uint8_t record[2 + 4 * (2 + LOG_MAX_ARGS)];
+    uint32_t words[2] = {(uint32_t)(uintptr_t)token, (uint32_t)(uintptr_t)tag};
+    record[0] = LOG_TOKEN_SYNC;
+    record[1] = nargs;
+    // Cortex-M is little endian, so words are copied directly
+    memcpy(&record[2], words, sizeof(words));
+    memcpy(&record[2 + sizeof(words)], args, nargs * sizeof(uint32_t));
+    // Flush text output first, so records stay in order
+    fflush(stdout);
+    write(STDOUT_FILENO, record, 2 + sizeof(words) + nargs * sizeof(uint32_t));
 }
 
+#if SYSLOG_DEFERRED == SYSLOG_DEFERRED_ENABLED
+
 /**
- * Minimal system log. Useful for tasks with small stacks, or other low memory
- * environments. Does not implement printf style formatting.
- * @param log_level: logging level to use
- * @param tag: Tag to log (NULL terminated)
- * @param logstr: NULL terminated log string
+ * Waits for all pending deferred log records to be written. From a task, the
+ * log task is signalled to write them, since it is their only consumer.
+ * Before the RTOS starts or from interrupt context, such as a fault handler,
+ * the records are written directly.
  */
-void LOG_MIN(int log_level, const char *tag, const char *logstr) {
-    if (log_level >= SYSLOG_LEVEL) {
-        // Log tag and level
-        write(STDOUT_FILENO, tag, strlen(tag));
-        switch (log_level) {
-        case SYSLOG_LEVEL_DEBUG:
-            write(STDOUT_FILENO, " [DEBUG]: ", 10);
-            break;
-        case SYSLOG_LEVEL_INFO:
-            write(STDOUT_FILENO, " [INFO]: ", 9);
-            break;
-        case SYSLOG_LEVEL_WARNING:
-            write(STDOUT_FILENO, " [WARNING]: ", 12);
-            break;
-        case SYSLOG_LEVEL_ERROR:
-            write(STDOUT_FILENO, " [ERROR]: ", 10);
-            break;
-        default:
-            write(STDOUT_FILENO, " [LOG]: ", 8);
+void LOG_flush() {
+    uint32_t head;
+    if (log_sem == NULL || !rtos_started() || in_isr() ||
+        get_active_task() == log_task) {
+        // The log task cannot run, so write the records here
+        log_drain();
+        return;
+    }
+    // Have the log task write every record claimed so far
+    head = __atomic_load_n(&log_head, __ATOMIC_ACQUIRE);
+    semaphore_post(log_sem);
+    while ((int32_t)(__atomic_load_n(&log_tail, __ATOMIC_ACQUIRE) - head) < 0) {
+        // Delay rather than yield, so the low priority log task can run
+        task_delay(1);
+    }
+}
+
+/**
+ * Formats and writes all pending deferred log records. Only called by the
+ * log task, or where the log task cannot run.
+ */
+static void log_drain() {
+    log_record_t *record;
+    while (1) {
+        record = &log_records[log_tail & (SYSLOG_DEFERRED_RECORDS - 1)];
+        if (log_tail == log_head || !record->ready) {
+            // No record, or the oldest record is still being written
             break;
         }
-        // Log logging string
-        write(STDOUT_FILENO, logstr, strlen(logstr));
-        // Write newline
-        write(STDOUT_FILENO, "\n", 1);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        log_print_record(record);
+        record->ready = 0;
+        // Release the record to producers
+        __atomic_store_n(&log_tail, log_tail + 1, __ATOMIC_RELEASE);
     }
 }
 
-static void syslog(int log_level, const char *tag, char *format, va_list ap) {
-    if (log_level >= SYSLOG_LEVEL) {
-        // Log message level
-        switch (log_level) {
-        case SYSLOG_LEVEL_DEBUG:
-            printf("%s [DEBUG]: ", tag);
-            break;
-        case SYSLOG_LEVEL_INFO:
-            printf("%s [INFO]: ", tag);
-            break;
-        case SYSLOG_LEVEL_WARNING:
-            printf("%s [WARNING]: ", tag);
-            break;
-        case SYSLOG_LEVEL_ERROR:
-            printf("%s [ERROR]: ", tag);
+/**
+ * Gets the number of deferred log records dropped because the record buffer
+ * was full.
+ * @return number of dropped log records
+ */
+uint32_t LOG_dropped() { return log_drops; }
+
+/**
+ * Starts the deferred log task. Called by the system when the RTOS starts.
+ */
+void LOG_deferred_init() {
+    task_config_t cfg = DEFAULT_TASK_CONFIG;
+    cfg.task_stack = log_task_stack;
+    cfg.task_stacksize = SYSLOG_DEFERRED_STACKSIZE;
+    cfg.task_priority = LOG_TASK_PRIORITY;
+    cfg.task_name = "log";
+    log_sem = semaphore_create_binary_static(&log_sem_storage);
+    log_task =
+        task_create_static(log_task_entry, NULL, &cfg, &log_task_storage);
+    if (log_task == NULL) {
+        // Without a log task, log calls are written immediately
+        log_sem = NULL;
+    }
+}
+
+/**
+ * Stores a log call as a deferred record. Safe to call from any task or
+ * interrupt.
+ * @param log_level: logging level of message
+ * @param tag: logging tag of message
+ * @param format: format string, verbatim message or token, per type
+ * @param type: type of record
+ * @param nargs: number of format arguments, at most LOG_RECORD_ARGS
+ * @param args: format arguments
+ * @return true if the call was deferred (or dropped), false if the caller
+ * should write it immediately
+ */
+static bool log_defer(int log_level, const char *tag, const char *format,
+                      log_record_type_t type, int nargs, uint32_t *args) {
+    uint32_t head;
+    log_record_t *record;
+    if (log_sem == NULL) {
+        // Log task is not running
+        return false;
+    }
+    // Claim a record
+    head = __atomic_load_n(&log_head, __ATOMIC_RELAXED);
+    do {
+        if (head - __atomic_load_n(&log_tail, __ATOMIC_ACQUIRE) >=
+            SYSLOG_DEFERRED_RECORDS) {
+            // Buffer is full, drop the record
+            __atomic_fetch_add(&log_drops, 1, __ATOMIC_RELAXED);
+            return true;
+        }
+    } while (!__atomic_compare_exchange_n(&log_head, &head, head + 1, true,
+                                          __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+    record = &log_records[head & (SYSLOG_DEFERRED_RECORDS - 1)];
+    record->tag = tag;
+    record->format = format;
+    memcpy(record->args, args, nargs * sizeof(uint32_t));
+    record->timestamp = task_get_ticks();
+    record->level = log_level;
+    record->type = type;
+    record->nargs = nargs;
+    // Publish the record to the log task
+    __atomic_store_n(&record->ready, 1, __ATOMIC_RELEASE);
+    semaphore_post(log_sem);
+    return true;
+}
+
+/**
+ * Copies the arguments of a printf style format string. Each argument is
+ * stored as a 32 bit word.
+ * @param format: printf style format string
+ * @param ap: format arguments
+ * @param args: array of LOG_RECORD_ARGS words to store arguments in
+ * @return number of arguments stored, or -1 if the arguments cannot be
+ * stored (floating point, 64 bit, "%n", or too many arguments)
+ */
+static int log_capture_args(const char *format, va_list *ap, uint32_t *args) {
+    int count = 0;
+    while (*format) {
+        if (*format++ != '%') {
+            continue;
+        }
+        if (*format == '%') {
+            format++;
+            continue;
+        }
+        // Skip flags, width, precision and length. '*' takes an int argument.
+        while (*format && strchr("-+ #0123456789.*hlzt", *format)) {
+            if (*format == '*') {
+                if (count == LOG_RECORD_ARGS) {
+                    count = -1;
+                    break;
+                }
+                args[count++] = va_arg(*ap, int);
+            } else if (*format == 'l' && format[1] == 'l') {
+                // 64 bit arguments are not supported
+                count = -1;
+                break;
+            }
+            format++;
+        }
+        if (count < 0 || *format == '\0') {
             break;
-        default:
-            printf("%s [LOG]: ", tag);
+        }
+        if (count == LOG_RECORD_ARGS || !strchr("diouxXcsp", *format)) {
+            // Too many arguments, or unsupported conversion
+            count = -1;
             break;
         }
-        // Log message
-        vprintf(format, ap);
-        // Print newline
-        printf("\n");
+        if (*format == 's' || *format == 'p') {
+            args[count++] = (uint32_t)va_arg(*ap, void *);
+        } else {
+            args[count++] = va_arg(*ap, unsigned int);
+        }
+        format++;
+    }
+    return count;
+}
+
+/**
+ * Formats and writes a deferred log record
+ * @param record: record to write
+ */
+static void log_print_record(log_record_t *record) {
+    if (record->type == LOG_RECORD_TOKEN) {
+        log_write_token(record->format, record->tag, record->nargs,
+                        record->args);
+        return;
+    }
+    printf("%lu ", (unsigned long)record->timestamp);
+    log_header(record->level, record->tag);
+    if (record->type == LOG_RECORD_RAW) {
+        fputs(record->format, stdout);
+    } else {
+        // printf ignores arguments the format does not use
+        printf(record->format, record->args[0], record->args[1],
+               record->args[2], record->args[3]);
+    }
+    printf("\n");
+}
+
+/**
+ * Log task. Writes deferred log records as they arrive, and reports records
+ * dropped since the last report.
+ * @param arg: unused
+ */
+static void log_task_entry(void *arg) {
+    uint32_t drops;
+    (void)arg;
+    while (1) {
+        semaphore_pend(log_sem, SYS_TIMEOUT_INF);
+        log_drain();
+        drops = log_drops;
+        if (drops != log_drops_reported) {
+            printf("log [WARNING]: %lu log records dropped\n",
+                   (unsigned long)(drops - log_drops_reported));
+            log_drops_reported = drops;
+        }
     }
 }
 
-#endif
\ No newline at end of file
+#else
+
+void LOG_flush() {}
+
+uint32_t LOG_dropped() { return 0; }
+
+void LOG_deferred_init() {}
+
+#endif
+
+#endif
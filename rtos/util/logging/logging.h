@@ -5,33 +5,99 @@
 
 #ifndef LOGGING_H
 #define LOGGING_H
+
+#include <stdint.h>
+
+#include <config.h>
+
+/**
+ * Log calls below SYSLOG_LEVEL (or all log calls, if SYSLOG is
+ * SYSLOG_DISABLED) are removed at compile time. Their arguments are not
+ * evaluated, and their format strings are not stored in flash.
+ *
+ * When deferred logging is enabled (see SYSLOG_DEFERRED in config.h), log
+ * calls store their arguments, and are formatted later by the log task.
+ * Strings passed for "%s" must therefore remain valid after the call, such as
+ * string literals. Calls with more than 4 arguments, or floating point or 64
+ * bit arguments, are formatted immediately instead.
+ *
+ * When tokenized logging is enabled (see SYSLOG_TOKENIZED in config.h), format
+ * strings must be string literals, and calls take at most LOG_MAX_ARGS 32 bit
+ * arguments. Format strings are placed in the .logstr section,
+ * which is not loaded to the device, and log calls write a binary record of
+ * the format string token and raw arguments. tools/logdecode.py formats the
+ * records on the host using the program ELF file.
+ */
+
+#if SYSLOG == SYSLOG_DISABLED
+#define LOG_ENABLED(level) 0
+#else
+#define LOG_ENABLED(level) ((level) >= SYSLOG_LEVEL)
+#endif
+
+/** Maximum number of arguments to a log call in tokenized mode */
+#define LOG_MAX_ARGS 8
+
+/** Counts variadic macro arguments, up to LOG_MAX_ARGS */
+#define LOG_NARGS(...) LOG_NARGS_(_, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, n, ...) n
+
+#if SYSLOG_TOKENIZED == SYSLOG_TOKENIZED_ENABLED
+#define LOG_STR(x) LOG_STR_(x)
+#define LOG_STR_(x) #x
+
+/**
+ * Log call in tokenized mode. The log level is stored as the first character
+ * of the format string, so the decoder can recover it.
+ */
+#define LOG_CALL(level, tag, format, ...)                                      \
+    do {                                                                       \
+        if (LOG_ENABLED(level)) {                                              \
+            static const char _log_fmt[] __attribute__((                      \
+                section(".logstr"))) = LOG_STR(level) format;                  \
+            log_token(_log_fmt, tag, LOG_NARGS(__VA_ARGS__), ##__VA_ARGS__);   \
+        }                                                                      \
+    } while (0)
+#else
+#define LOG_CALL(level, tag, format, ...)                                      \
+    do {                                                                       \
+        if (LOG_ENABLED(level)) {                                              \
+            log_printf(level, tag, format, ##__VA_ARGS__);                     \
+        }                                                                      \
+    } while (0)
+#endif
+
 /**
  * System debugging log. Uses same format as printf
  * @param tag: logging tag
  * @param format: printf style formatting string
  */
-void LOG_D(const char *tag, char *format, ...);
+#define LOG_D(tag, format, ...)                                                \
+    LOG_CALL(SYSLOG_LEVEL_DEBUG, tag, format, ##__VA_ARGS__)
 
 /**
  * System info log. Uses same format as printf
  * @param tag: logging tag
  * @param format: printf style formatting string
  */
-void LOG_I(const char *tag, char *format, ...);
+#define LOG_I(tag, format, ...)                                                \
+    LOG_CALL(SYSLOG_LEVEL_INFO, tag, format, ##__VA_ARGS__)
 
 /**
  * System warning log. Uses same format as printf
  * @param tag: logging tag
  * @param format: printf style formatting string
  */
-void LOG_W(const char *tag, char *format, ...);
+#define LOG_W(tag, format, ...)                                                \
+    LOG_CALL(SYSLOG_LEVEL_WARNING, tag, format, ##__VA_ARGS__)
 
 /**
  * System error log. Uses same format as printf
  * @param tag: logging tag
  * @param format: printf style formatting string
  */
-void LOG_E(const char *tag, char *format, ...);
+#define LOG_E(tag, format, ...)                                                \
+    LOG_CALL(SYSLOG_LEVEL_ERROR, tag, format, ##__VA_ARGS__)
 
 /**
  * Minimal system log. Useful for tasks with small stacks, or other low memory
@@ -40,6 +106,58 @@ void LOG_E(const char *tag, char *format, ...);
  * @param tag: Tag to log (NULL terminated)
  * @param logstr: NULL terminated log string
  */
-void LOG_MIN(int log_level, const char *tag, const char *logstr);
+#define LOG_MIN(log_level, tag, logstr)                                        \
+    do {                                                                       \
+        if (LOG_ENABLED(log_level)) {                                          \
+            log_min(log_level, tag, logstr);                                   \
+        }                                                                      \
+    } while (0)
+
+/**
+ * Waits for all pending deferred log records to be written. Must not be called
+ * from a task with interrupts masked. Has no effect unless deferred logging
+ * is enabled.
+ */
+void LOG_flush();
+
+/**
+ * Gets the number of deferred log records dropped because the record buffer
+ * was full.
+ * @return number of dropped log records
+ */
+uint32_t LOG_dropped();
+
+/**
+ * Starts the deferred log task. Called by the system when the RTOS starts,
+ * has no effect unless deferred logging is enabled.
+ */
+void LOG_deferred_init();
+
+/**
+ * Writes a formatted log message. Use the LOG_* macros instead of calling
+ * this directly.
+ * @param log_level: logging level of message
+ * @param tag: logging tag
+ * @param format: printf style formatting string
+ */
+void log_printf(int log_level, const char *tag, const char *format, ...);
+
+/**
+ * Writes a log message without formatting. Use LOG_MIN instead of calling
+ * this directly.
+ * @param log_level: logging level of message
+ * @param tag: Tag to log (NULL terminated)
+ * @param logstr: NULL terminated log string
+ */
+void log_min(int log_level, const char *tag, const char *logstr);
+
+/**
+ * Writes a tokenized log record. Use the LOG_* macros instead of calling this
+ * directly.
+ * @param token: format string, stored in the .logstr section
+ * @param tag: logging tag
+ * @param nargs: number of format arguments. Each must be 32 bits
+ */
+void log_token(const char *token, const char *tag, int nargs, ...);
 
-#endif
\ No newline at end of file
+#endif
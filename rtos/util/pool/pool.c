@@ -0,0 +1,110 @@
+/**
+ * @file pool.c
+ * Implements fixed block size memory pools
+ *
+ * A pool splits a caller provided memory region into equally sized blocks,
+ * and keeps unused blocks in a free list. Allocation and free are O(1), do
+ * not fragment, and are safe to call from interrupt context.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sys/err.h>
+#include <sys/isr/isr.h>
+
+#include "pool.h"
+
+/**
+ * Initializes a memory pool.
+ * @param pool: Pool structure to initialize
+ * @param mem: Memory to back the pool. Must be POOL_ALIGN aligned, and hold
+ * at least count blocks of POOL_BLOCK_SIZE(block_size) bytes
+ * @param block_size: size of each block, in bytes
+ * @param count: Number of blocks in pool. May be 0.
+ * @return SYS_OK on success, or ERR_BADPARAM on invalid parameters
+ */
+syserr_t pool_init(pool_t *pool, void *mem, size_t block_size, size_t count) {
+    size_t i;
+    char *block;
+    // Check parameters
+    if (pool == NULL || block_size == 0 || (mem == NULL && count != 0) ||
+        (((uintptr_t)mem) % POOL_ALIGN) != 0) {
+        return ERR_BADPARAM;
+    }
+    pool->block_size = POOL_BLOCK_SIZE(block_size);
+    pool->start = mem;
+    pool->end = pool->start + (pool->block_size * count);
+    pool->num_free = count;
+    pool->free_list = NULL;
+    /**
+     * Thread every block into the free list. The first word of a free block
+     * points to the next free block. Link in reverse so that the lowest
+     * address block is allocated first.
+     */
+    for (i = count; i > 0; i--) {
+        block = pool->start + (pool->block_size * (i - 1));
+        *((void **)block) = pool->free_list;
+        pool->free_list = block;
+    }
+    return SYS_OK;
+}
+
+/**
+ * Allocates a block from a pool.
+ * @param pool: pool to allocate from
+ * @return allocated block, or NULL if the pool is empty
+ */
+void *pool_alloc(pool_t *pool) {
+    void *block;
+    uint32_t irq_state;
+    irq_state = mask_irq_save();
+    block = pool->free_list;
+    if (block != NULL) {
+        // Pop block from head of free list
+        pool->free_list = *((void **)block);
+        pool->num_free--;
+    }
+    restore_irq_mask(irq_state);
+    return block;
+}
+
+/**
+ * Returns a block to a pool.
+ * @param pool: pool block was allocated from
+ * @param block: block to free
+ * @return SYS_OK on success, or ERR_BADPARAM if the block is not from pool
+ */
+syserr_t pool_free(pool_t *pool, void *block) {
+    uint32_t irq_state;
+    // Make sure this is the start of a block within the pool
+    if (!pool_contains(pool, block) ||
+        (((char *)block - pool->start) % pool->block_size) != 0) {
+        return ERR_BADPARAM;
+    }
+    irq_state = mask_irq_save();
+    // Push block onto head of free list
+    *((void **)block) = pool->free_list;
+    pool->free_list = block;
+    pool->num_free++;
+    restore_irq_mask(irq_state);
+    return SYS_OK;
+}
+
+/**
+ * Checks if a pointer lies within a pool's memory
+ * @param pool: pool to check
+ * @param ptr: pointer to check
+ * @return true if pointer is within pool memory
+ */
+bool pool_contains(pool_t *pool, void *ptr) {
+    return (char *)ptr >= pool->start && (char *)ptr < pool->end;
+}
+
+/**
+ * Gets the number of free blocks in a pool
+ * @param pool: pool to check
+ * @return number of free blocks
+ */
+size_t pool_available(pool_t *pool) { return pool->num_free; }
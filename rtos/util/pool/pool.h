@@ -0,0 +1,87 @@
+/**
+ * @file pool.h
+ * Implements fixed block size memory pools
+ *
+ * A pool splits a caller provided memory region into equally sized blocks,
+ * and keeps unused blocks in a free list. Allocation and free are O(1), do
+ * not fragment, and are safe to call from interrupt context.
+ */
+
+#ifndef POOL_H
+#define POOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sys/err.h>
+
+/** Alignment of every pool block, in bytes. Suitable for task stacks */
+#define POOL_ALIGN 8
+
+/** Rounds a requested block size up to the block size a pool will use */
+#define POOL_BLOCK_SIZE(size)                                                  \
+    ((((size) < sizeof(void *) ? sizeof(void *) : (size)) + POOL_ALIGN - 1) &  \
+     ~(POOL_ALIGN - 1))
+
+/**
+ * Number of uint64_t words needed to back a pool of count blocks. Use to
+ * declare pool storage, such as:
+ * static uint64_t mem[POOL_STORAGE_WORDS(sizeof(obj_t), 8)];
+ */
+#define POOL_STORAGE_WORDS(size, count)                                        \
+    ((POOL_BLOCK_SIZE(size) * (count)) / sizeof(uint64_t))
+
+/**
+ * Memory pool structure
+ */
+typedef struct pool {
+    void *free_list;   /*!< Linked list of free blocks */
+    char *start;       /*!< Start of pool memory */
+    char *end;         /*!< End of pool memory */
+    size_t block_size; /*!< Size of each block in pool */
+    size_t num_free;   /*!< Number of free blocks in pool */
+} pool_t;
+
+/**
+ * Initializes a memory pool.
+ * @param pool: Pool structure to initialize
+ * @param mem: Memory to back the pool. Must be POOL_ALIGN aligned, and hold
+ * at least count blocks of POOL_BLOCK_SIZE(block_size) bytes
+ * @param block_size: size of each block, in bytes
+ * @param count: Number of blocks in pool. May be 0.
+ * @return SYS_OK on success, or ERR_BADPARAM on invalid parameters
+ */
+syserr_t pool_init(pool_t *pool, void *mem, size_t block_size, size_t count);
+
+/**
+ * Allocates a block from a pool.
+ * @param pool: pool to allocate from
+ * @return allocated block, or NULL if the pool is empty
+ */
+void *pool_alloc(pool_t *pool);
+
+/**
+ * Returns a block to a pool.
+ * @param pool: pool block was allocated from
+ * @param block: block to free
+ * @return SYS_OK on success, or ERR_BADPARAM if the block is not from pool
+ */
+syserr_t pool_free(pool_t *pool, void *block);
+
+/**
+ * Checks if a pointer lies within a pool's memory
+ * @param pool: pool to check
+ * @param ptr: pointer to check
+ * @return true if pointer is within pool memory
+ */
+bool pool_contains(pool_t *pool, void *ptr);
+
+/**
+ * Gets the number of free blocks in a pool
+ * @param pool: pool to check
+ * @return number of free blocks
+ */
+size_t pool_available(pool_t *pool);
+
+#endif
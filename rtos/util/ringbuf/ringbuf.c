@@ -1,23 +1,50 @@
 /**
  * @file ringbuf.c
  * Implements a simple ring buffer with no dynamic allocation
+ *
+ * The read and write positions are stored as indices that run from 0 to twice
+ * the buffer length, so a full buffer can be told apart from an empty one
+ * without a separate size count. If the buffer length is a power of two,
+ * the indices instead run freely and wrap on overflow, and are masked to
+ * find a position in the backing store.
+ *
+ * Each index is only written by one side, so one producer and one consumer
+ * (such as an interrupt and a task) may use a buffer concurrently without
+ * masking interrupts. Memory barriers order data accesses against index
+ * updates.
  */
 
+#include <string.h>
+
 #include "ringbuf.h"
 
+// Static functions
+static inline uint32_t buf_offset(RingBuf_t *buf, uint32_t idx);
+static inline uint32_t buf_advance(RingBuf_t *buf, uint32_t idx, uint32_t n);
+static inline void buf_barrier();
+
 /**
  * Initializes a ring buffer configuration.
- * This function is required to set the buffer to back the ringbuffer
+ * This function is required to set the buffer to back the ringbuffer. If
+ * storelen is a power of two, index wrapping uses a mask instead of a compare.
  * @param buf: Ringbuffer configuration to init
  * @param store: Ringbuffer storage to utilize (may be alloced or static)
  * @param storelen: length of storage buffer
  */
 syserr_t buf_init(RingBuf_t *buf, uint8_t *store, uint32_t storelen) {
+    if (store == NULL || storelen == 0 || storelen > (UINT32_MAX / 2)) {
+        return ERR_BADPARAM;
+    }
     buf->buff = store;
     buf->len = storelen;
-    buf->read_offset = store;
-    buf->write_offset = store;
-    buf->buf_end = (uint8_t *)(store + storelen);
+    // A length of one is a power of two, but needs no mask
+    if ((storelen & (storelen - 1)) == 0) {
+        buf->mask = storelen - 1;
+    } else {
+        buf->mask = 0;
+    }
+    buf->read_idx = 0;
+    buf->write_idx = 0;
     return SYS_OK;
 }
 
@@ -29,11 +56,13 @@ syserr_t buf_init(RingBuf_t *buf, uint8_t *store, uint32_t storelen) {
  */
 syserr_t buf_peek(RingBuf_t *buf, char *data) {
     // Check if a character is present
-    if (buf->size == 0) {
+    if (buf_getsize(buf) == 0) {
         return ERR_NOMEM;
     }
+    // Do not read data before seeing the write index that covers it
+    buf_barrier();
     // If character is present, copy it to output
-    *data = *((char *)buf->read_offset);
+    *data = (char)buf->buff[buf_offset(buf, buf->read_idx)];
     return SYS_OK;
 }
 
@@ -44,10 +73,15 @@ syserr_t buf_peek(RingBuf_t *buf, char *data) {
  * @return SYS_OK, ERR_NOMEM if buffer is empty
  */
 syserr_t buf_read(RingBuf_t *buf, char *data) {
-    if (buf_readblock(buf, (uint8_t *)data, 1) == 0) {
+    if (buf_getsize(buf) == 0) {
         // No data in buffer to return;
         return ERR_NOMEM;
     }
+    buf_barrier();
+    *data = (char)buf->buff[buf_offset(buf, buf->read_idx)];
+    // Finish reading data before releasing its space to the producer
+    buf_barrier();
+    buf->read_idx = buf_advance(buf, buf->read_idx, 1);
     // Read succeeded, return success
     return SYS_OK;
 }
@@ -59,10 +93,16 @@ syserr_t buf_read(RingBuf_t *buf, char *data) {
  * @return SYS_OK, ERR_NOMEM if buffer is full
  */
 syserr_t buf_write(RingBuf_t *buf, char data) {
-    if (buf_writeblock(buf, (uint8_t *)&data, 1) == 0) {
+    if (buf_getspace(buf) == 0) {
         // No space in buffer to write to
         return ERR_NOMEM;
     }
+    // Do not write data before seeing the read index that frees its space
+    buf_barrier();
+    buf->buff[buf_offset(buf, buf->write_idx)] = (uint8_t)data;
+    // Finish writing data before publishing it to the consumer
+    buf_barrier();
+    buf->write_idx = buf_advance(buf, buf->write_idx, 1);
     // Write succeeded, return success
     return SYS_OK;
 }
@@ -75,20 +115,26 @@ syserr_t buf_write(RingBuf_t *buf, char data) {
  * @return number of characters read into buffer
  */
 uint32_t buf_readblock(RingBuf_t *buf, uint8_t *data, uint32_t rlen) {
-    uint32_t rdoffset = 0;
-    // While output buffer has space and ring buffer has data, copy it
-    while (buf->size > 0 && rdoffset < rlen) {
-        data[rdoffset] = *(buf->read_offset);
-        // Move read offset forwards
-        buf->read_offset++;
-        // Check if we need to wrap read offset around
-        if (buf->read_offset == buf->buf_end) {
-            buf->read_offset = buf->buff;
-        }
-        buf->size--;
-        rdoffset++;
+    uint32_t offset, span, size;
+    size = buf_getsize(buf);
+    if (rlen > size) {
+        rlen = size;
+    }
+    /**
+     * Data may wrap around the end of the backing store. Copy it as at most
+     * two contiguous spans.
+     */
+    offset = buf_offset(buf, buf->read_idx);
+    span = buf->len - offset;
+    if (span > rlen) {
+        span = rlen;
     }
-    return rdoffset;
+    buf_barrier();
+    memcpy(data, buf->buff + offset, span);
+    memcpy(data + span, buf->buff, rlen - span);
+    buf_barrier();
+    buf->read_idx = buf_advance(buf, buf->read_idx, rlen);
+    return rlen;
 }
 
 /**
@@ -99,20 +145,93 @@ uint32_t buf_readblock(RingBuf_t *buf, uint8_t *data, uint32_t rlen) {
  * @return number of characters written into buffer
  */
 uint32_t buf_writeblock(RingBuf_t *buf, uint8_t *data, uint32_t wlen) {
-    uint32_t wroffset = 0;
-    // While output buffer has space and ring buffer has data, copy it
-    while (buf->size < buf->len && wroffset < wlen) {
-        *(buf->write_offset) = data[wroffset];
-        // Move write offset forwards
-        buf->write_offset++;
-        // Check if we need to wrap write offset around
-        if (buf->write_offset == buf->buf_end) {
-            buf->write_offset = buf->buff;
-        }
-        buf->size++;
-        wroffset++;
+    uint32_t offset, span, space;
+    space = buf_getspace(buf);
+    if (wlen > space) {
+        wlen = space;
+    }
+    /**
+     * Free space may wrap around the end of the backing store. Copy data as
+     * at most two contiguous spans.
+     */
+    offset = buf_offset(buf, buf->write_idx);
+    span = buf->len - offset;
+    if (span > wlen) {
+        span = wlen;
     }
-    return wroffset;
+    buf_barrier();
+    memcpy(buf->buff + offset, data, span);
+    memcpy(buf->buff, data + span, wlen - span);
+    buf_barrier();
+    buf->write_idx = buf_advance(buf, buf->write_idx, wlen);
+    return wlen;
+}
+
+/**
+ * Get the contiguous region of data at the read position of the buffer,
+ * without removing it. Used to consume data in place, such as by DMA.
+ * @param buf: Ringbuffer configuration
+ * @param region: set to the start of the readable region
+ * @return number of bytes readable at region
+ */
+uint32_t buf_read_region(RingBuf_t *buf, uint8_t **region) {
+    uint32_t offset, contiguous, size;
+    size = buf_getsize(buf);
+    offset = buf_offset(buf, buf->read_idx);
+    contiguous = buf->len - offset;
+    *region = buf->buff + offset;
+    buf_barrier();
+    return size < contiguous ? size : contiguous;
+}
+
+/**
+ * Remove data that was consumed in place from the buffer
+ * @param buf: Ringbuffer configuration
+ * @param len: number of bytes to remove
+ * @return number of bytes removed
+ */
+uint32_t buf_read_commit(RingBuf_t *buf, uint32_t len) {
+    uint32_t size = buf_getsize(buf);
+    if (len > size) {
+        len = size;
+    }
+    buf_barrier();
+    buf->read_idx = buf_advance(buf, buf->read_idx, len);
+    return len;
+}
+
+/**
+ * Get the contiguous region of free space at the write position of the
+ * buffer. Used to produce data in place, such as by DMA.
+ * @param buf: Ringbuffer configuration
+ * @param region: set to the start of the writable region
+ * @return number of bytes writable at region
+ */
+uint32_t buf_write_region(RingBuf_t *buf, uint8_t **region) {
+    uint32_t offset, contiguous, space;
+    space = buf_getspace(buf);
+    offset = buf_offset(buf, buf->write_idx);
+    contiguous = buf->len - offset;
+    *region = buf->buff + offset;
+    buf_barrier();
+    return space < contiguous ? space : contiguous;
+}
+
+/**
+ * Add data that was written directly into the buffer's backing store at the
+ * write position, such as by DMA.
+ * @param buf: Ringbuffer configuration
+ * @param len: number of bytes written
+ * @return number of bytes added
+ */
+uint32_t buf_write_commit(RingBuf_t *buf, uint32_t len) {
+    uint32_t space = buf_getspace(buf);
+    if (len > space) {
+        len = space;
+    }
+    buf_barrier();
+    buf->write_idx = buf_advance(buf, buf->write_idx, len);
+    return len;
 }
 
 /**
@@ -120,11 +239,53 @@ uint32_t buf_writeblock(RingBuf_t *buf, uint8_t *data, uint32_t wlen) {
  * @param buf: Ringbuffer configuration
  * @return number of bytes in buffer
  */
-uint32_t buf_getsize(RingBuf_t *buf) { return buf->size; }
+uint32_t buf_getsize(RingBuf_t *buf) {
+    uint32_t read_idx = buf->read_idx;
+    uint32_t write_idx = buf->write_idx;
+    if (buf->mask != 0 || write_idx >= read_idx) {
+        // Free running indices wrap on overflow, so subtraction still works
+        return write_idx - read_idx;
+    }
+    return write_idx + (2 * buf->len) - read_idx;
+}
 
 /**
  * Get the number of bytes of remaining space available in the ring buffer
  * @param buf: Ringbuffer configuration
  * @return number of bytes still possible to write to buffer
  */
-uint32_t buf_getspace(RingBuf_t *buf) { return buf->len - buf->size; }
+uint32_t buf_getspace(RingBuf_t *buf) { return buf->len - buf_getsize(buf); }
+
+/**
+ * Converts a buffer index to an offset within the backing store
+ * @param buf: Ringbuffer configuration
+ * @param idx: read or write index
+ * @return offset of index in backing store
+ */
+static inline uint32_t buf_offset(RingBuf_t *buf, uint32_t idx) {
+    if (buf->mask != 0) {
+        return idx & buf->mask;
+    }
+    return idx < buf->len ? idx : idx - buf->len;
+}
+
+/**
+ * Advances a buffer index
+ * @param buf: Ringbuffer configuration
+ * @param idx: read or write index
+ * @param n: number of bytes to advance by. Must not exceed buffer length.
+ * @return advanced index
+ */
+static inline uint32_t buf_advance(RingBuf_t *buf, uint32_t idx, uint32_t n) {
+    idx += n;
+    if (buf->mask == 0 && idx >= (2 * buf->len)) {
+        idx -= 2 * buf->len;
+    }
+    return idx;
+}
+
+/**
+ * Memory barrier. Orders data accesses against index updates, so the other
+ * side of the buffer never sees an index before the data it covers.
+ */
+static inline void buf_barrier() { __sync_synchronize(); }
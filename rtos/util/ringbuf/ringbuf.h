@@ -1,6 +1,18 @@
 /**
  * @file ringbuf.h
  * Implements a simple ring buffer with no dynamic allocation
+ *
+ * The read and write positions are stored as indices that run from 0 to twice
+ * the buffer length, so a full buffer can be told apart from an empty one
+ * without a separate size count. If the buffer length is a power of two,
+ * the indices instead run freely and wrap on overflow, and are masked to
+ * find a position in the backing store.
+ *
+ * One producer and one consumer (such as an interrupt and a task) may use a
+ * buffer concurrently without masking interrupts. The producer may call
+ * buf_write, buf_writeblock, buf_write_region and buf_write_commit. The
+ * consumer may call buf_peek, buf_read, buf_readblock, buf_read_region and
+ * buf_read_commit. Multiple producers or consumers must serialize access.
  */
 
 #ifndef RINGBUF_H
@@ -11,17 +23,17 @@
 #include <sys/err.h>
 
 typedef struct {
-    uint8_t *read_offset; /*!< Address to read next byte from */
-    uint8_t *write_offset; /*!< Address to write next byte to */
-    uint8_t *buf_end; /*!< Pointer to first memory location after buffer */
-    uint32_t len; /*!< Length of buffer's backing store */
-    uint32_t size; /*!< Current number of bytes in buffer */
-    uint8_t *buff; /*!< Pointer to buffer's backing store */
+    uint8_t *buff;                /*!< Pointer to buffer's backing store */
+    uint32_t len;                 /*!< Length of buffer's backing store */
+    uint32_t mask;                /*!< len - 1 if len is a power of two, or 0 */
+    volatile uint32_t read_idx;   /*!< Index to read next byte from */
+    volatile uint32_t write_idx;  /*!< Index to write next byte to */
 } RingBuf_t;
 
 /**
  * Initializes a ring buffer configuration.
- * This function is required to set the buffer to back the ringbuffer
+ * This function is required to set the buffer to back the ringbuffer. If
+ * storelen is a power of two, index wrapping uses a mask instead of a compare.
  * @param buf: Ringbuffer configuration to init
  * @param store: Ringbuffer storage to utilize (may be alloced or static)
  * @param storelen: length of storage buffer
@@ -70,6 +82,41 @@ uint32_t buf_readblock(RingBuf_t *buf, uint8_t *data, uint32_t rlen);
  */
 uint32_t buf_writeblock(RingBuf_t *buf, uint8_t *data, uint32_t wlen);
 
+/**
+ * Get the contiguous region of data at the read position of the buffer,
+ * without removing it. Used to consume data in place, such as by DMA.
+ * @param buf: Ringbuffer configuration
+ * @param region: set to the start of the readable region
+ * @return number of bytes readable at region
+ */
+uint32_t buf_read_region(RingBuf_t *buf, uint8_t **region);
+
+/**
+ * Remove data that was consumed in place from the buffer
+ * @param buf: Ringbuffer configuration
+ * @param len: number of bytes to remove
+ * @return number of bytes removed
+ */
+uint32_t buf_read_commit(RingBuf_t *buf, uint32_t len);
+
+/**
+ * Get the contiguous region of free space at the write position of the
+ * buffer. Used to produce data in place, such as by DMA.
+ * @param buf: Ringbuffer configuration
+ * @param region: set to the start of the writable region
+ * @return number of bytes writable at region
+ */
+uint32_t buf_write_region(RingBuf_t *buf, uint8_t **region);
+
+/**
+ * Add data that was written directly into the buffer's backing store at the
+ * write position, such as by DMA.
+ * @param buf: Ringbuffer configuration
+ * @param len: number of bytes written
+ * @return number of bytes added
+ */
+uint32_t buf_write_commit(RingBuf_t *buf, uint32_t len);
+
 /**
  * Get the length of data present in the buffer
  * @param buf: Ringbuffer configuration
@@ -84,4 +131,4 @@ uint32_t buf_getsize(RingBuf_t *buf);
  */
 uint32_t buf_getspace(RingBuf_t *buf);
 
-#endif
\ No newline at end of file
+#endif
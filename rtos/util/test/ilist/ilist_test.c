@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <drivers/clock/clock.h>
+#include <util/list/ilist.h>
+#include <util/logging/logging.h>
+
+/**
+ * @file ilist_test.c
+ * This file verifies the implementation of intrusive lists within the RTOS
+ * It does so by building a list, then checking the order of its elements
+ * after appends, prepends, removals and sorted inserts
+ *
+ * Here is the expected output:
+ * Test 1: append and iterate: "Test Data"
+ * Test 2: prepend: ">Test Data"
+ * Test 3: remove every 't': ">es Daa"
+ * Test 4: sorted insert: " >Daaes"
+ * Test 5: empty list
+ * All tests passed
+ */
+
+struct ilist_entry {
+    char data;
+    ilist_node_t node;
+};
+
+static char *TAG = "ilist_test";
+static char data[] = "Test Data";
+static struct ilist_entry elements[sizeof(data) + 1];
+
+/**
+ * Initializes system
+ */
+static void system_init() {
+    clock_cfg_t clk_cfg = CLOCK_DEFAULT_CONFIG;
+    clock_init(&clk_cfg);
+}
+
+/**
+ * Checks the list contents match a string, in both directions
+ * @param test: test name, printed with the list contents
+ * @param list: list to check
+ * @param expected: expected list contents
+ */
+static void check_list(const char *test, ilist_t *list, const char *expected) {
+    char forward[sizeof(elements) + 1] = {0};
+    char reverse[sizeof(elements) + 1] = {0};
+    ilist_node_t *node;
+    int len = strlen(expected);
+    int i = 0;
+    ilist_for_each(node, list) {
+        forward[i++] = ilist_entry(node, struct ilist_entry, node)->data;
+    }
+    // Walk backwards from the tail, to check the prev links as well
+    for (node = list->head.prev; node != &list->head; node = node->prev) {
+        reverse[--i] = ilist_entry(node, struct ilist_entry, node)->data;
+    }
+    printf("%s: \"%s\"\n", test, forward);
+    if (strcmp(forward, expected) != 0 || i != 0 ||
+        strncmp(reverse, expected, len) != 0) {
+        LOG_E(TAG, "%s failed, expected \"%s\"", test, expected);
+        exit(ERR_FAIL);
+    }
+}
+
+/**
+ * Compares the characters of two list entries
+ * @param a: first list node
+ * @param b: second list node
+ * @return negative value if entry a sorts before entry b
+ */
+static int compare_data(ilist_node_t *a, ilist_node_t *b) {
+    return ilist_entry(a, struct ilist_entry, node)->data -
+           ilist_entry(b, struct ilist_entry, node)->data;
+}
+
+/**
+ * Intrusive list test function
+ */
+int main() {
+    ilist_t list, sorted;
+    ilist_node_t *node, *next;
+    struct ilist_entry *entry;
+    int i;
+    system_init();
+    ilist_init(&list);
+    if (!ilist_empty(&list) || ilist_head(&list) != NULL ||
+        ilist_tail(&list) != NULL) {
+        LOG_E(TAG, "New list is not empty");
+        exit(ERR_FAIL);
+    }
+    for (i = 0; i < sizeof(data) - 1; i++) {
+        elements[i].data = data[i];
+        ilist_append(&list, &elements[i].node);
+    }
+    check_list("Test 1: append and iterate", &list, "Test Data");
+    // Prepend an element, and check head and tail
+    elements[sizeof(data)].data = '>';
+    ilist_prepend(&list, &elements[sizeof(data)].node);
+    check_list("Test 2: prepend", &list, ">Test Data");
+    if (ilist_head(&list) != &elements[sizeof(data)].node ||
+        ilist_tail(&list) != &elements[sizeof(data) - 2].node) {
+        LOG_E(TAG, "Test 2 failed, bad list head or tail");
+        exit(ERR_FAIL);
+    }
+    // Remove elements while iterating
+    ilist_for_each_safe(node, next, &list) {
+        entry = ilist_entry(node, struct ilist_entry, node);
+        if (entry->data == 'T' || entry->data == 't') {
+            ilist_remove(node);
+        }
+    }
+    check_list("Test 3: remove every 't'", &list, ">es Daa");
+    // Move the remaining elements to a sorted list. Equal entries keep order
+    ilist_init(&sorted);
+    ilist_for_each_safe(node, next, &list) {
+        ilist_remove(node);
+        ilist_insert_sorted(&sorted, node, compare_data);
+    }
+    check_list("Test 4: sorted insert", &sorted, " >Daaes");
+    if (&elements[6].node != sorted.head.next->next->next->next) {
+        LOG_E(TAG, "Test 4 failed, equal entries were reordered");
+        exit(ERR_FAIL);
+    }
+    if (!ilist_empty(&list)) {
+        LOG_E(TAG, "Test 5 failed, list is not empty");
+        exit(ERR_FAIL);
+    }
+    printf("Test 5: empty list\n");
+    printf("All tests passed\n");
+    return SYS_OK;
+}
@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <util/logging/logging.h>
+#include <util/ringbuf/ringbuf.h>
+
+/**
+ * @file ringbuf_test.c
+ * This file verifies the ring buffer implementation. It builds natively with
+ * the host port, so run it with "make run".
+ * Buffers with a power of two length (masked, free running indices), a length
+ * that is not a power of two (indices run to twice the length), and a length
+ * of one are each tested. Every test streams a byte sequence through the
+ * buffer, so any byte lost, repeated or reordered at the wrap is caught.
+ *
+ * Here is the expected output:
+ * Test 1: length 1 buffer
+ * Test 2: full and empty detection
+ * Test 3: block wrap-around
+ * Test 4: region contiguity at the wrap
+ * Test 5: oversized commits
+ * All tests passed
+ */
+
+#define POW2_LEN 8
+#define ODD_LEN 7
+#define ROUNDS 100
+
+static char *TAG = "ringbuf_test";
+static uint8_t store[POW2_LEN];
+
+/**
+ * Fails the test with a message
+ * @param test: test name
+ * @param msg: failure message
+ */
+static void fail(const char *test, const char *msg) {
+    LOG_E(TAG, "%s failed, %s", test, msg);
+    exit(ERR_FAIL);
+}
+
+/**
+ * Checks the size and space reported by a buffer
+ * @param test: test name
+ * @param buf: buffer to check
+ * @param size: expected number of bytes in the buffer
+ */
+static void check_size(const char *test, RingBuf_t *buf, uint32_t size) {
+    if (buf_getsize(buf) != size || buf_getspace(buf) != buf->len - size) {
+        fail(test, "bad size or space");
+    }
+}
+
+/**
+ * Initializes a buffer, exiting on failure. Power of two buffers start with
+ * indices just below their overflow point, so the free running indices wrap
+ * during the test.
+ * @param buf: buffer to initialize
+ * @param len: length of buffer
+ */
+static void init_buf(RingBuf_t *buf, uint32_t len) {
+    if (buf_init(buf, store, len) != SYS_OK) {
+        fail("buf_init", "buffer not initialized");
+    }
+    if (buf->mask != 0) {
+        buf->read_idx = buf->write_idx = UINT32_MAX - 2;
+    }
+}
+
+/**
+ * Writes and reads single bytes through a length 1 buffer
+ */
+static void test_single() {
+    const char *test = "Test 1";
+    RingBuf_t buf;
+    char c;
+    int i;
+    init_buf(&buf, 1);
+    for (i = 0; i < ROUNDS; i++) {
+        if (buf_read(&buf, &c) != ERR_NOMEM) {
+            fail(test, "read from empty buffer");
+        }
+        if (buf_write(&buf, (char)i) != SYS_OK) {
+            fail(test, "write to empty buffer");
+        }
+        check_size(test, &buf, 1);
+        if (buf_write(&buf, 'x') != ERR_NOMEM) {
+            fail(test, "write to full buffer");
+        }
+        if (buf_peek(&buf, &c) != SYS_OK || c != (char)i ||
+            buf_read(&buf, &c) != SYS_OK || c != (char)i) {
+            fail(test, "wrong byte read");
+        }
+        check_size(test, &buf, 0);
+    }
+    printf("Test 1: length 1 buffer\n");
+}
+
+/**
+ * Fills and drains a buffer, checking it reports full and empty
+ * @param len: length of buffer
+ */
+static void test_full_empty(uint32_t len) {
+    const char *test = "Test 2";
+    uint8_t data[POW2_LEN + 4], out[POW2_LEN + 4];
+    RingBuf_t buf;
+    char c;
+    uint32_t i;
+    init_buf(&buf, len);
+    for (i = 0; i < sizeof(data); i++) {
+        data[i] = (uint8_t)i;
+    }
+    // Offset the read position, so the full buffer wraps
+    buf_writeblock(&buf, data, 3);
+    buf_readblock(&buf, out, 3);
+    check_size(test, &buf, 0);
+    if (buf_peek(&buf, &c) != ERR_NOMEM) {
+        fail(test, "peek into empty buffer");
+    }
+    if (buf_writeblock(&buf, data, sizeof(data)) != len) {
+        fail(test, "wrote more than buffer length");
+    }
+    check_size(test, &buf, len);
+    if (buf_write(&buf, 'x') != ERR_NOMEM ||
+        buf_writeblock(&buf, data, 1) != 0) {
+        fail(test, "write to full buffer");
+    }
+    if (buf_readblock(&buf, out, sizeof(out)) != len ||
+        memcmp(out, data, len) != 0) {
+        fail(test, "wrong data read from full buffer");
+    }
+    check_size(test, &buf, 0);
+    if (buf_readblock(&buf, out, 1) != 0) {
+        fail(test, "read from empty buffer");
+    }
+}
+
+/**
+ * Streams a byte sequence through a buffer in blocks of varying length, so
+ * the read and write positions wrap at every offset
+ * @param len: length of buffer
+ */
+static void test_wrap(uint32_t len) {
+    const char *test = "Test 3";
+    uint8_t data[POW2_LEN], out[POW2_LEN];
+    uint8_t next_write = 0, next_read = 0;
+    RingBuf_t buf;
+    uint32_t i, j, n;
+    init_buf(&buf, len);
+    for (i = 0; i < ROUNDS; i++) {
+        // Write lengths cycle up to the free space, reads leave one byte
+        n = 1 + i % buf_getspace(&buf);
+        for (j = 0; j < n; j++) {
+            data[j] = next_write++;
+        }
+        if (buf_writeblock(&buf, data, n) != n) {
+            fail(test, "block not written");
+        }
+        n = buf_getsize(&buf) > 1 ? buf_getsize(&buf) - 1 : 1;
+        if (buf_readblock(&buf, out, n) != n) {
+            fail(test, "block not read");
+        }
+        for (j = 0; j < n; j++) {
+            if (out[j] != next_read++) {
+                fail(test, "byte lost or reordered at wrap");
+            }
+        }
+    }
+}
+
+/**
+ * Checks that regions stop at the end of the backing store, and continue at
+ * its start once committed
+ * @param len: length of buffer
+ */
+static void test_regions(uint32_t len) {
+    const char *test = "Test 4";
+    uint8_t *region;
+    uint8_t data[POW2_LEN], out[POW2_LEN];
+    RingBuf_t buf;
+    uint32_t i, n;
+    init_buf(&buf, len);
+    for (i = 0; i < len; i++) {
+        data[i] = (uint8_t)(i + 0x40);
+    }
+    // Move both positions two bytes before the end of the backing store
+    buf_write_region(&buf, &region);
+    n = (2 * len - 2 - (region - store)) % len;
+    buf_writeblock(&buf, data, n);
+    buf_read_commit(&buf, n);
+    // Regions of free space and data both stop at the end of the store
+    if (buf_write_region(&buf, &region) != 2 || region != store + len - 2) {
+        fail(test, "write region does not stop at the wrap");
+    }
+    memcpy(region, data, 2);
+    buf_write_commit(&buf, 2);
+    if (buf_write_region(&buf, &region) != len - 2 || region != store) {
+        fail(test, "write region does not continue at the store start");
+    }
+    memcpy(region, data + 2, len - 2);
+    if (buf_write_commit(&buf, len - 2) != len - 2) {
+        fail(test, "write region not committed");
+    }
+    check_size(test, &buf, len);
+    if (buf_write_region(&buf, &region) != 0) {
+        fail(test, "write region in full buffer");
+    }
+    if (buf_read_region(&buf, &region) != 2 || region != store + len - 2) {
+        fail(test, "read region does not stop at the wrap");
+    }
+    memcpy(out, region, 2);
+    buf_read_commit(&buf, 2);
+    n = buf_read_region(&buf, &region);
+    if (n != len - 2 || region != store) {
+        fail(test, "read region does not continue at the store start");
+    }
+    memcpy(out + 2, region, n);
+    buf_read_commit(&buf, n);
+    if (memcmp(out, data, len) != 0) {
+        fail(test, "wrong data read from regions");
+    }
+    if (buf_read_region(&buf, &region) != 0) {
+        fail(test, "read region in empty buffer");
+    }
+}
+
+/**
+ * Checks that commits are limited to the space or data available
+ * @param len: length of buffer
+ */
+static void test_commits(uint32_t len) {
+    const char *test = "Test 5";
+    uint8_t data[POW2_LEN] = {0};
+    RingBuf_t buf;
+    uint32_t n = len / 2;
+    init_buf(&buf, len);
+    buf_writeblock(&buf, data, n);
+    if (buf_write_commit(&buf, len + 5) != len - n) {
+        fail(test, "write commit exceeds free space");
+    }
+    check_size(test, &buf, len);
+    if (buf_write_commit(&buf, 1) != 0) {
+        fail(test, "write commit into full buffer");
+    }
+    if (buf_read_commit(&buf, 1) != 1 ||
+        buf_read_commit(&buf, len + 5) != len - 1) {
+        fail(test, "read commit exceeds data present");
+    }
+    check_size(test, &buf, 0);
+    if (buf_read_commit(&buf, 1) != 0) {
+        fail(test, "read commit from empty buffer");
+    }
+    // The buffer must still work after the oversized commits
+    test_wrap(len);
+}
+
+/**
+ * Ring buffer test function
+ */
+int main() {
+    uint32_t lens[] = {POW2_LEN, ODD_LEN, 1};
+    uint32_t i;
+    test_single();
+    for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        test_full_empty(lens[i]);
+    }
+    printf("Test 2: full and empty detection\n");
+    for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        test_wrap(lens[i]);
+    }
+    printf("Test 3: block wrap-around\n");
+    // Regions need room for a split, so the length 1 buffer is skipped
+    test_regions(POW2_LEN);
+    test_regions(ODD_LEN);
+    printf("Test 4: region contiguity at the wrap\n");
+    for (i = 0; i < sizeof(lens) / sizeof(lens[0]); i++) {
+        test_commits(lens[i]);
+    }
+    printf("Test 5: oversized commits\n");
+    printf("All tests passed\n");
+    return SYS_OK;
+}